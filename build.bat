@@ -44,7 +44,7 @@ exit /b 1
 :build
 echo.
 echo Building with GCC...
-gcc -o ott_server.exe src/main.c src/utils.c src/data.c src/ffmpeg_helper.c src/http_handler.c -lws2_32 -Wall -O2
+gcc -o ott_server.exe src/main.c src/utils.c src/data.c src/ffmpeg_helper.c src/http_handler.c src/mp4_faststart.c src/stream_tune.c src/chunk_cache.c src/pacing.c src/disk_io.c src/storage.c src/tier.c src/prefetch.c src/warmup.c src/rendition.c src/live.c src/upload.c src/token.c src/auth.c src/backend.c -lws2_32 -Wall -O2
 if %errorlevel%==0 (
     echo.
     echo [SUCCESS] Build complete: ott_server.exe
@@ -59,7 +59,7 @@ goto :end
 :build_msvc
 echo.
 echo Building with MSVC...
-cl /Fe:ott_server.exe src/main.c src/utils.c src/data.c src/ffmpeg_helper.c src/http_handler.c ws2_32.lib /O2 /W3
+cl /Fe:ott_server.exe src/main.c src/utils.c src/data.c src/ffmpeg_helper.c src/http_handler.c src/mp4_faststart.c src/stream_tune.c src/chunk_cache.c src/pacing.c src/disk_io.c src/storage.c src/tier.c src/prefetch.c src/warmup.c src/rendition.c src/live.c src/upload.c src/token.c src/auth.c src/backend.c ws2_32.lib /O2 /W3
 if %errorlevel%==0 (
     echo.
     echo [SUCCESS] Build complete: ott_server.exe
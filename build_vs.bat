@@ -22,7 +22,7 @@ echo ========================================
 echo Compiling OTT Server with PostgreSQL...
 echo ========================================
 
-cl /c /O2 /W3 /I"src" /D_CRT_SECURE_NO_WARNINGS src\main.c src\utils.c src\ffmpeg_helper.c src\http_handler.c src\db.c
+cl /c /O2 /W3 /I"src" /D_CRT_SECURE_NO_WARNINGS /DHAVE_POSTGRES src\main.c src\utils.c src\data.c src\ffmpeg_helper.c src\http_handler.c src\mp4_faststart.c src\stream_tune.c src\chunk_cache.c src\pacing.c src\disk_io.c src\storage.c src\tier.c src\prefetch.c src\warmup.c src\rendition.c src\live.c src\upload.c src\token.c src\auth.c src\backend.c src\db.c
 
 if errorlevel 1 (
     echo Compilation failed!
@@ -35,7 +35,7 @@ echo ========================================
 echo Linking with libpq...
 echo ========================================
 
-link /OUT:ott_server.exe main.obj utils.obj ffmpeg_helper.obj http_handler.obj db.obj ws2_32.lib libpq.lib
+link /OUT:ott_server.exe main.obj utils.obj data.obj ffmpeg_helper.obj http_handler.obj mp4_faststart.obj stream_tune.obj chunk_cache.obj pacing.obj disk_io.obj storage.obj tier.obj prefetch.obj warmup.obj rendition.obj live.obj upload.obj token.obj auth.obj backend.obj db.obj ws2_32.lib libpq.lib
 
 if errorlevel 1 (
     echo Linking failed!
@@ -42,6 +42,7 @@ CREATE TABLE IF NOT EXISTS watch_history (
 -- Create indexes
 CREATE INDEX IF NOT EXISTS idx_sessions_token ON sessions(token);
 CREATE INDEX IF NOT EXISTS idx_sessions_user_id ON sessions(user_id);
+CREATE INDEX IF NOT EXISTS idx_sessions_expires_at ON sessions(expires_at);
 CREATE INDEX IF NOT EXISTS idx_history_user_video ON watch_history(user_id, video_id);
 
 -- Insert default users (password hashes for: admin123, password, test)
@@ -0,0 +1,382 @@
+/*
+ * OTT Video Streaming Server - Password Hashing and Auth Workers
+ * Passwords are stored as scrypt hashes, which take tens of milliseconds
+ * and AUTH_SCRYPT_LOG_N-sized memory to compute. So that a burst of logins
+ * can't occupy the network workers that keep streams going, login and
+ * registration requests are handed to a small pool of auth threads with
+ * a bounded queue; when the queue is full the caller answers 429.
+ *
+ * Hashes from before scrypt (decimal DJB2) still verify, and are replaced
+ * by the storage layer on the next successful login.
+ */
+
+#include "common.h"
+#include <stdint.h>
+
+#define SCRYPT_R 8
+#define SCRYPT_P 1
+#define SCRYPT_SALT_BYTES 16
+#define SCRYPT_HASH_BYTES 32
+
+/* Largest stored parameters honoured when verifying, 1 GiB of scratch */
+#define SCRYPT_MAX_LOG_N 20
+#define SCRYPT_MAX_MEMORY (1024L * 1024 * 1024)
+
+typedef void (*AuthTask)(SOCKET client, const char* username, const char* password);
+
+typedef struct {
+    SOCKET client;
+    AuthTask task;
+    char username[64];
+    char password[MAX_PASSWORD_LEN + 1];
+} AuthJob;
+
+static AuthJob* g_jobs = NULL;      /* ring of g_depth queued jobs */
+static int g_depth = 0;
+static int g_head = 0;
+static int g_count = 0;
+static int g_threads = 0;
+static pthread_mutex_t g_auth_mutex;
+static pthread_cond_t g_auth_cond;
+static long long g_completed = 0;
+static long long g_rejected = 0;
+static double g_task_seconds = 0;
+
+/* Hash checked for unknown users, so they cost as much as known ones */
+static char g_dummy_hash[256];
+
+extern void pbkdf2_sha256(const void* password, size_t password_len, const void* salt,
+                          size_t salt_len, unsigned int iterations, unsigned char* out,
+                          size_t out_len);
+
+/* Clear a buffer in a way the compiler won't drop */
+static void wipe(void* buf, size_t len) {
+    volatile unsigned char* p = buf;
+    while (len--) *p++ = 0;
+}
+
+#define ROTL(a, b) (((a) << (b)) | ((a) >> (32 - (b))))
+
+/* Salsa20/8 core, applied in place */
+static void salsa20_8(uint32_t b[16]) {
+    uint32_t x[16];
+    memcpy(x, b, sizeof(x));
+
+    for (int i = 0; i < 8; i += 2) {
+        /* Columns */
+        x[4] ^= ROTL(x[0] + x[12], 7);   x[8] ^= ROTL(x[4] + x[0], 9);
+        x[12] ^= ROTL(x[8] + x[4], 13);  x[0] ^= ROTL(x[12] + x[8], 18);
+        x[9] ^= ROTL(x[5] + x[1], 7);    x[13] ^= ROTL(x[9] + x[5], 9);
+        x[1] ^= ROTL(x[13] + x[9], 13);  x[5] ^= ROTL(x[1] + x[13], 18);
+        x[14] ^= ROTL(x[10] + x[6], 7);  x[2] ^= ROTL(x[14] + x[10], 9);
+        x[6] ^= ROTL(x[2] + x[14], 13);  x[10] ^= ROTL(x[6] + x[2], 18);
+        x[3] ^= ROTL(x[15] + x[11], 7);  x[7] ^= ROTL(x[3] + x[15], 9);
+        x[11] ^= ROTL(x[7] + x[3], 13);  x[15] ^= ROTL(x[11] + x[7], 18);
+
+        /* Rows */
+        x[1] ^= ROTL(x[0] + x[3], 7);    x[2] ^= ROTL(x[1] + x[0], 9);
+        x[3] ^= ROTL(x[2] + x[1], 13);   x[0] ^= ROTL(x[3] + x[2], 18);
+        x[6] ^= ROTL(x[5] + x[4], 7);    x[7] ^= ROTL(x[6] + x[5], 9);
+        x[4] ^= ROTL(x[7] + x[6], 13);   x[5] ^= ROTL(x[4] + x[7], 18);
+        x[11] ^= ROTL(x[10] + x[9], 7);  x[8] ^= ROTL(x[11] + x[10], 9);
+        x[9] ^= ROTL(x[8] + x[11], 13);  x[10] ^= ROTL(x[9] + x[8], 18);
+        x[12] ^= ROTL(x[15] + x[14], 7); x[13] ^= ROTL(x[12] + x[15], 9);
+        x[14] ^= ROTL(x[13] + x[12], 13); x[15] ^= ROTL(x[14] + x[13], 18);
+    }
+
+    for (int i = 0; i < 16; i++) b[i] += x[i];
+}
+
+/* scrypt BlockMix: 2r 64-byte blocks from in to out, even blocks first */
+static void block_mix(const uint32_t* in, uint32_t* out, int r) {
+    uint32_t x[16];
+    memcpy(x, in + (2 * r - 1) * 16, sizeof(x));
+
+    for (int i = 0; i < 2 * r; i++) {
+        for (int j = 0; j < 16; j++) x[j] ^= in[i * 16 + j];
+        salsa20_8(x);
+        memcpy(out + ((i & 1) * r + i / 2) * 16, x, sizeof(x));
+    }
+}
+
+/* scrypt ROMix over one 128r-byte block; v holds n blocks of scratch, x two */
+static void ro_mix(unsigned char* block, int r, uint32_t n, uint32_t* v, uint32_t* x) {
+    int words = 32 * r;
+    uint32_t* y = x + words;
+
+    for (int i = 0; i < words; i++) {
+        const unsigned char* p = block + i * 4;
+        x[i] = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        memcpy(v + (size_t)i * words, x, sizeof(uint32_t) * words);
+        block_mix(x, y, r);
+        memcpy(x, y, sizeof(uint32_t) * words);
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        const uint32_t* vj = v + (size_t)(x[(2 * r - 1) * 16] & (n - 1)) * words;
+        for (int k = 0; k < words; k++) x[k] ^= vj[k];
+        block_mix(x, y, r);
+        memcpy(x, y, sizeof(uint32_t) * words);
+    }
+
+    for (int i = 0; i < words; i++) {
+        unsigned char* p = block + i * 4;
+        p[0] = (unsigned char)x[i];
+        p[1] = (unsigned char)(x[i] >> 8);
+        p[2] = (unsigned char)(x[i] >> 16);
+        p[3] = (unsigned char)(x[i] >> 24);
+    }
+}
+
+/* scrypt (RFC 7914) with N = 2^log_n. Returns -1 if scratch memory is unavailable. */
+static int scrypt(const char* password, const unsigned char* salt, size_t salt_len,
+                  int log_n, int r, int p, unsigned char* out, size_t out_len) {
+    uint32_t n = (uint32_t)1 << log_n;
+    size_t block_bytes = (size_t)128 * r;
+    unsigned char* b = malloc(block_bytes * p);
+    uint32_t* v = malloc(block_bytes * n);
+    uint32_t* x = malloc(block_bytes * 2);
+    if (!b || !v || !x) {
+        free(b);
+        free(v);
+        free(x);
+        return -1;
+    }
+
+    size_t password_len = strlen(password);
+    pbkdf2_sha256(password, password_len, salt, salt_len, 1, b, block_bytes * p);
+    for (int i = 0; i < p; i++) {
+        ro_mix(b + block_bytes * i, r, n, v, x);
+    }
+    pbkdf2_sha256(password, password_len, b, block_bytes * p, 1, out, out_len);
+
+    wipe(b, block_bytes * p);
+    wipe(x, block_bytes * 2);
+    free(b);
+    free(v);
+    free(x);
+    return 0;
+}
+
+static void hex_encode(const unsigned char* data, size_t len, char* out) {
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < len; i++) {
+        *out++ = digits[data[i] >> 4];
+        *out++ = digits[data[i] & 15];
+    }
+    *out = '\0';
+}
+
+static int hex_decode(const char* hex, unsigned char* out, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        int value = 0;
+        for (int k = 0; k < 2; k++) {
+            char c = hex[i * 2 + k];
+            int d = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+            if (d < 0) return -1;
+            value = value * 16 + d;
+        }
+        out[i] = (unsigned char)value;
+    }
+    return hex[len * 2] == '\0' ? 0 : -1;
+}
+
+static int equal_bytes(const unsigned char* a, const unsigned char* b, size_t len) {
+    unsigned char diff = 0;
+    for (size_t i = 0; i < len; i++) diff |= a[i] ^ b[i];
+    return diff == 0;
+}
+
+/*
+ * Hash a password with a fresh salt as
+ * "$scrypt$ln=<log2 N>,r=<r>,p=<p>$<salt hex>$<hash hex>".
+ * Returns 0, or -1 if no salt or scratch memory could be had.
+ */
+int password_hash(const char* password, char* out, size_t size) {
+    unsigned char salt[SCRYPT_SALT_BYTES];
+    unsigned char hash[SCRYPT_HASH_BYTES];
+    char salt_hex[SCRYPT_SALT_BYTES * 2 + 1];
+    char hash_hex[SCRYPT_HASH_BYTES * 2 + 1];
+
+    if (size > 0) out[0] = '\0';
+    if (random_bytes(salt, sizeof(salt)) < 0) return -1;
+    if (scrypt(password, salt, sizeof(salt), AUTH_SCRYPT_LOG_N, SCRYPT_R, SCRYPT_P,
+               hash, sizeof(hash)) < 0) {
+        log_message(LOG_ERROR, "Password hashing failed: out of memory");
+        return -1;
+    }
+
+    hex_encode(salt, sizeof(salt), salt_hex);
+    hex_encode(hash, sizeof(hash), hash_hex);
+    wipe(hash, sizeof(hash));
+
+    int len = snprintf(out, size, "$scrypt$ln=%d,r=%d,p=%d$%s$%s",
+                       AUTH_SCRYPT_LOG_N, SCRYPT_R, SCRYPT_P, salt_hex, hash_hex);
+    return len > 0 && (size_t)len < size ? 0 : -1;
+}
+
+/* A hash stored before scrypt: the decimal DJB2 value */
+int password_is_legacy(const char* stored) {
+    if (!stored || !*stored) return 0;
+    for (const char* c = stored; *c; c++) {
+        if (*c < '0' || *c > '9') return 0;
+    }
+    return 1;
+}
+
+/*
+ * Check a password against a stored hash, scrypt or legacy. A NULL hash
+ * is checked against a dummy one and fails. Returns 1 on a match.
+ */
+int password_verify(const char* password, const char* stored) {
+    if (!stored) stored = g_dummy_hash;
+
+    if (password_is_legacy(stored)) {
+        char hash_str[32];
+        snprintf(hash_str, sizeof(hash_str), "%lu", simple_hash(password));
+        size_t len = strlen(stored);
+        return len == strlen(hash_str) &&
+               equal_bytes((const unsigned char*)stored, (const unsigned char*)hash_str, len);
+    }
+
+    int log_n, r, p;
+    char salt_hex[SCRYPT_SALT_BYTES * 2 + 2];
+    char hash_hex[SCRYPT_HASH_BYTES * 2 + 2];
+    unsigned char salt[SCRYPT_SALT_BYTES];
+    unsigned char expected[SCRYPT_HASH_BYTES];
+    unsigned char hash[SCRYPT_HASH_BYTES];
+
+    if (sscanf(stored, "$scrypt$ln=%d,r=%d,p=%d$%33[0-9a-f]$%65[0-9a-f]",
+               &log_n, &r, &p, salt_hex, hash_hex) != 5) {
+        return 0;
+    }
+    if (log_n < 1 || log_n > SCRYPT_MAX_LOG_N || r < 1 || p < 1 || p > 16 ||
+        (long)r * 128 > SCRYPT_MAX_MEMORY >> log_n ||
+        hex_decode(salt_hex, salt, sizeof(salt)) < 0 ||
+        hex_decode(hash_hex, expected, sizeof(expected)) < 0) {
+        log_message(LOG_WARN, "Unrecognised password hash parameters");
+        return 0;
+    }
+
+    if (scrypt(password, salt, sizeof(salt), log_n, r, p, hash, sizeof(hash)) < 0) return 0;
+    int match = equal_bytes(hash, expected, sizeof(hash)) && stored != g_dummy_hash;
+    wipe(hash, sizeof(hash));
+    return match;
+}
+
+#if defined(_WIN32)
+static unsigned __stdcall auth_worker(void* arg) {
+#else
+static void* auth_worker(void* arg) {
+#endif
+    (void)arg;
+
+    for (;;) {
+        pthread_mutex_lock(&g_auth_mutex);
+        while (g_count == 0) {
+            pthread_cond_wait(&g_auth_cond, &g_auth_mutex);
+        }
+        AuthJob job = g_jobs[g_head];
+        wipe(g_jobs[g_head].password, sizeof(g_jobs[g_head].password));
+        g_head = (g_head + 1) % g_depth;
+        g_count--;
+        pthread_mutex_unlock(&g_auth_mutex);
+
+        double start = monotonic_seconds();
+        job.task(job.client, job.username, job.password);
+        CLOSESOCKET(job.client);
+        wipe(job.password, sizeof(job.password));
+        double elapsed = monotonic_seconds() - start;
+
+        pthread_mutex_lock(&g_auth_mutex);
+        g_completed++;
+        g_task_seconds += elapsed;
+        pthread_mutex_unlock(&g_auth_mutex);
+    }
+
+#if defined(_WIN32)
+    return 0;
+#else
+    return NULL;
+#endif
+}
+
+/* Start the auth threads */
+void auth_init(int threads, int queue_depth) {
+    pthread_mutex_init(&g_auth_mutex, NULL);
+    pthread_cond_init(&g_auth_cond, NULL);
+
+    g_depth = queue_depth > 0 ? queue_depth : 1;
+    g_jobs = calloc(g_depth, sizeof(AuthJob));
+    if (!g_jobs) {
+        log_message(LOG_ERROR, "Failed to allocate the auth queue");
+        g_depth = 0;
+        return;
+    }
+
+    char password[17];
+    if (generate_session_token(password, sizeof(password)) < 0 ||
+        password_hash(password, g_dummy_hash, sizeof(g_dummy_hash)) < 0) {
+        snprintf(g_dummy_hash, sizeof(g_dummy_hash), "$scrypt$ln=%d,r=%d,p=%d$%032d$%064d",
+                 AUTH_SCRYPT_LOG_N, SCRYPT_R, SCRYPT_P, 0, 0);
+    }
+
+    for (int i = 0; i < threads; i++) {
+#if defined(_WIN32)
+        HANDLE h = (HANDLE)_beginthreadex(NULL, 0, auth_worker, NULL, 0, NULL);
+        if (h) {
+            CloseHandle(h);
+            g_threads++;
+        }
+#else
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, auth_worker, NULL) == 0) {
+            pthread_detach(thread);
+            g_threads++;
+        }
+#endif
+    }
+
+    log_message(LOG_INFO, "Auth: %d threads, queue depth %d, scrypt N=2^%d r=%d",
+                g_threads, g_depth, AUTH_SCRYPT_LOG_N, SCRYPT_R);
+}
+
+/*
+ * Queue a task to run on an auth thread. On success the task owns the
+ * client socket, which is closed after it returns. Returns -1 without
+ * taking the socket when the queue is full, -2 if the password is longer
+ * than MAX_PASSWORD_LEN.
+ */
+int auth_submit(SOCKET client, AuthTask task, const char* username, const char* password) {
+    if (strlen(password) > MAX_PASSWORD_LEN) return -2;
+
+    pthread_mutex_lock(&g_auth_mutex);
+    if (g_threads == 0 || g_count >= g_depth) {
+        g_rejected++;
+        pthread_mutex_unlock(&g_auth_mutex);
+        return -1;
+    }
+
+    AuthJob* job = &g_jobs[(g_head + g_count) % g_depth];
+    job->client = client;
+    job->task = task;
+    snprintf(job->username, sizeof(job->username), "%s", username);
+    snprintf(job->password, sizeof(job->password), "%s", password);
+    g_count++;
+    pthread_cond_signal(&g_auth_cond);
+    pthread_mutex_unlock(&g_auth_mutex);
+    return 0;
+}
+
+/* Write auth pool counters as a JSON object */
+int auth_stats_json(char* buf, size_t size) {
+    pthread_mutex_lock(&g_auth_mutex);
+    int written = snprintf(buf, size,
+        "{\"threads\":%d,\"queued\":%d,\"completed\":%lld,\"rejected\":%lld,\"avg_ms\":%.1f}",
+        g_threads, g_count, g_completed, g_rejected,
+        g_completed > 0 ? g_task_seconds * 1000 / g_completed : 0.0);
+    pthread_mutex_unlock(&g_auth_mutex);
+    return written;
+}
@@ -0,0 +1,159 @@
+/*
+ * OTT Video Streaming Server - Storage Backend Selection
+ * Users, sessions, videos and watch history live in one of the backends
+ * compiled in: the embedded file store (data.c) or PostgreSQL (db.c,
+ * built with HAVE_POSTGRES). The OTT_DATA_BACKEND environment variable,
+ * else DATA_BACKEND, names the one used; by default PostgreSQL when it is
+ * built in. The functions below forward to it, and own the password
+ * policy so backends only store hashes.
+ */
+
+#include "common.h"
+
+extern const StorageBackend file_backend;
+#if defined(HAVE_POSTGRES)
+extern const StorageBackend postgres_backend;
+#endif
+
+/* Compiled-in backends, the default last */
+const StorageBackend* const data_backends[] = {
+    &file_backend,
+#if defined(HAVE_POSTGRES)
+    &postgres_backend,
+#endif
+    NULL
+};
+
+static const StorageBackend* g_backend = NULL;
+
+extern int password_hash(const char* password, char* out, size_t size);
+extern int password_verify(const char* password, const char* stored);
+extern int password_is_legacy(const char* stored);
+
+/* Find a compiled-in backend by name; NULL or "" picks the configured one */
+const StorageBackend* data_backend_find(const char* name) {
+    if (!name || !name[0]) name = getenv("OTT_DATA_BACKEND");
+    if (!name || !name[0]) name = DATA_BACKEND;
+
+    int count = 0;
+    while (data_backends[count]) count++;
+    if (!name[0]) return data_backends[count - 1];
+
+    for (int i = 0; i < count; i++) {
+        if (strcmp(data_backends[i]->name, name) == 0) return data_backends[i];
+    }
+    return NULL;
+}
+
+/* Select and start the storage backend. Returns -1 if it is unknown or fails. */
+int data_init(void) {
+    g_backend = data_backend_find(NULL);
+    if (!g_backend) {
+        const char* name = getenv("OTT_DATA_BACKEND");
+        log_message(LOG_ERROR, "Unknown data backend: %s", name && name[0] ? name : DATA_BACKEND);
+        return -1;
+    }
+
+    log_message(LOG_INFO, "Data backend: %s", g_backend->name);
+    return g_backend->init();
+}
+
+void data_load(void) {
+    g_backend->load();
+}
+
+void data_save(void) {
+    g_backend->save();
+}
+
+/* User functions */
+int user_find_by_username(const char* username, User* user) {
+    return g_backend->user_find_by_username(username, user);
+}
+
+int user_find_by_id(int id, User* user) {
+    return g_backend->user_find_by_id(id, user);
+}
+
+/* Check a password; a legacy hash is replaced once the password is known. Returns 1 on a match. */
+int user_verify_password(const User* user, const char* password) {
+    if (!password_verify(password, user->password_hash)) return 0;
+    if (!password_is_legacy(user->password_hash)) return 1;
+
+    char hash[256];
+    if (password_hash(password, hash, sizeof(hash)) == 0 &&
+        g_backend->user_set_password_hash(user->id, user->password_hash, hash) == 0) {
+        log_message(LOG_INFO, "Upgraded password hash for user: %s", user->username);
+    }
+    return 1;
+}
+
+int user_create(const char* username, const char* password) {
+    char hash[256];
+    if (password_hash(password, hash, sizeof(hash)) < 0) return -1;
+    return g_backend->user_create(username, hash);
+}
+
+/* Session functions */
+int session_create(int user_id, Session* session) {
+    return g_backend->session_create(user_id, session);
+}
+
+int session_find(const char* token, Session* session) {
+    if (!token || !*token) return -1;
+    return g_backend->session_find(token, session);
+}
+
+void session_destroy(const char* token) {
+    g_backend->session_destroy(token);
+}
+
+/* Video functions */
+int video_add(const char* title, const char* filename, const char* thumbnail, int duration,
+              const char* description) {
+    return g_backend->video_add(title, filename, thumbnail, duration, description);
+}
+
+int video_find_by_id(int id, Video* video) {
+    return g_backend->video_find_by_id(id, video);
+}
+
+/* Look up several videos at once; missing ones get id 0. Returns how many were found. */
+int videos_find(const int* ids, int count, Video* videos) {
+    return count > 0 ? g_backend->videos_find(ids, count, videos) : 0;
+}
+
+int video_set_duration(int id, int duration) {
+    return g_backend->video_set_duration(id, duration);
+}
+
+/* All videos in a malloc'd array the caller frees; *videos is NULL when there are none */
+int video_get_all(Video** videos) {
+    return g_backend->video_get_all(videos);
+}
+
+int video_count(void) {
+    return g_backend->video_count();
+}
+
+/* Watch history functions */
+int history_find(int user_id, int video_id, WatchHistory* history) {
+    return g_backend->history_find(user_id, video_id, history);
+}
+
+int history_update(int user_id, int video_id, int position) {
+    return g_backend->history_update(user_id, video_id, position);
+}
+
+/* Store several positions at once; updated_at 0 means now. Returns rows stored or -1. */
+int history_update_batch(const WatchHistory* rows, int count) {
+    return count > 0 ? g_backend->history_update_batch(rows, count) : 0;
+}
+
+int history_get_user_history(int user_id, WatchHistory* history, int max_count) {
+    return g_backend->history_get_user_history(user_id, history, max_count);
+}
+
+int history_top_videos(int days, int* video_ids, int max_count) {
+    return g_backend->history_top_videos(days, video_ids, max_count);
+}
@@ -0,0 +1,449 @@
+/*
+ * OTT Video Streaming Server - Chunk Cache
+ * Shared, size-bounded cache of aligned video chunks keyed by
+ * (video_id, chunk index). Eviction follows S3-FIFO: new chunks enter a
+ * small probationary queue, chunks hit again are promoted to the main
+ * queue, and keys evicted from probation are remembered in a ghost queue.
+ *
+ * Hits are lock-free: readers probe the index and pin a slot with an
+ * atomic reference count. Misses take the cache mutex and only one
+ * request fills a given chunk; concurrent requesters wait for it.
+ */
+
+#include "common.h"
+
+extern long disk_io_read(int fd, long long dev, char* buf, long length, long long offset);
+
+#define SLOT_EMPTY 0
+#define SLOT_FILLING 1
+#define SLOT_READY 2
+
+#define FREQ_MAX 3
+
+typedef struct {
+    volatile long long key;      /* 0 when unused */
+    volatile int refs;           /* pinning readers; -1 while being recycled */
+    volatile int state;
+    volatile int freq;           /* S3-FIFO access counter */
+    volatile long length;        /* valid bytes in data */
+    char* data;
+} CacheSlot;
+
+/* FIFO of slot indices */
+typedef struct {
+    int* items;
+    int head;
+    int count;
+    int capacity;
+} SlotQueue;
+
+static CacheSlot* g_slots = NULL;
+static int g_slot_count = 0;
+
+/* Linear-probing index of slot + 1; 0 marks an empty bucket */
+static volatile int* g_index = NULL;
+static int g_index_mask = 0;
+
+static SlotQueue g_small;
+static SlotQueue g_main;
+static SlotQueue g_free;
+static int g_small_target = 0;
+
+/* Ghost queue of keys recently evicted from the small queue */
+static long long* g_ghost = NULL;
+static int g_ghost_size = 0;
+static int g_ghost_next = 0;
+
+static pthread_mutex_t g_cache_mutex;
+static pthread_cond_t g_fill_cond;
+
+/* Metrics */
+static volatile long long g_hits = 0;
+static volatile long long g_misses = 0;
+static volatile long long g_bytes_memory = 0;
+static volatile long long g_bytes_disk = 0;
+static volatile long long g_evictions = 0;
+
+/* 32 bits of video id, 4 of rendition, 28 of chunk index (64 TB files) */
+static long long make_key(int video_id, int rendition, long chunk) {
+    return ((long long)video_id << 32) | ((long long)(rendition & 0xF) << 28) |
+           ((long long)chunk & 0xFFFFFFFLL);
+}
+
+static unsigned int hash_key(long long key) {
+    unsigned long long x = (unsigned long long)key;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (unsigned int)x;
+}
+
+static void queue_push(SlotQueue* q, int idx) {
+    q->items[(q->head + q->count) % q->capacity] = idx;
+    q->count++;
+}
+
+static int queue_pop(SlotQueue* q) {
+    int idx = q->items[q->head];
+    q->head = (q->head + 1) % q->capacity;
+    q->count--;
+    return idx;
+}
+
+static int queue_alloc(SlotQueue* q, int capacity) {
+    q->items = malloc(sizeof(int) * capacity);
+    q->head = 0;
+    q->count = 0;
+    q->capacity = capacity;
+    return q->items ? 0 : -1;
+}
+
+/* Initialize the cache with a memory budget in megabytes */
+void chunk_cache_init(int size_mb) {
+    g_slot_count = (int)((long long)size_mb * 1024 * 1024 / CACHE_CHUNK_SIZE);
+    if (g_slot_count < 16) g_slot_count = 16;
+
+    int index_size = 1;
+    while (index_size < g_slot_count * 2) index_size <<= 1;
+    g_index_mask = index_size - 1;
+
+    g_slots = calloc(g_slot_count, sizeof(CacheSlot));
+    g_index = calloc(index_size, sizeof(int));
+    g_ghost_size = g_slot_count;
+    g_ghost = calloc(g_ghost_size, sizeof(long long));
+
+    if (!g_slots || !g_index || !g_ghost ||
+        queue_alloc(&g_small, g_slot_count) != 0 ||
+        queue_alloc(&g_main, g_slot_count) != 0 ||
+        queue_alloc(&g_free, g_slot_count) != 0) {
+        log_message(LOG_ERROR, "Chunk cache allocation failed");
+        g_slot_count = 0;
+        return;
+    }
+
+    for (int i = 0; i < g_slot_count; i++) {
+        queue_push(&g_free, i);
+    }
+
+    g_small_target = g_slot_count / 10;
+    if (g_small_target < 1) g_small_target = 1;
+
+    pthread_mutex_init(&g_cache_mutex, NULL);
+    pthread_cond_init(&g_fill_cond, NULL);
+
+    log_message(LOG_INFO, "Chunk cache initialized: %d MB, %d chunks of %d KB",
+                size_mb, g_slot_count, CACHE_CHUNK_SIZE / 1024);
+}
+
+/* Find the slot holding key; safe without the lock, may miss during updates */
+static int index_find(long long key) {
+    unsigned int pos = hash_key(key) & g_index_mask;
+
+    for (;;) {
+        int entry = ATOMIC_LOAD(&g_index[pos]);
+        if (entry == 0) return -1;
+        if (g_slots[entry - 1].key == key) return entry - 1;
+        pos = (pos + 1) & g_index_mask;
+    }
+}
+
+/* Add a slot to the index (caller holds g_cache_mutex) */
+static void index_insert(long long key, int idx) {
+    unsigned int pos = hash_key(key) & g_index_mask;
+    while (g_index[pos] != 0) {
+        pos = (pos + 1) & g_index_mask;
+    }
+    ATOMIC_STORE(&g_index[pos], idx + 1);
+}
+
+/* Remove a slot from the index with backward-shift deletion (caller holds g_cache_mutex) */
+static void index_remove(long long key, int idx) {
+    unsigned int pos = hash_key(key) & g_index_mask;
+    while (g_index[pos] != idx + 1) {
+        if (g_index[pos] == 0) return;
+        pos = (pos + 1) & g_index_mask;
+    }
+
+    unsigned int hole = pos;
+    for (;;) {
+        pos = (pos + 1) & g_index_mask;
+        int entry = g_index[pos];
+        if (entry == 0) break;
+
+        unsigned int home = hash_key(g_slots[entry - 1].key) & g_index_mask;
+        /* Move the entry back if its home is not in (hole, pos] */
+        if (((pos - home) & g_index_mask) >= ((pos - hole) & g_index_mask)) {
+            ATOMIC_STORE(&g_index[hole], entry);
+            hole = pos;
+        }
+    }
+    ATOMIC_STORE(&g_index[hole], 0);
+}
+
+/* Pin a slot for reading; fails while it is being recycled */
+static int slot_pin(CacheSlot* s) {
+    for (;;) {
+        int refs = ATOMIC_LOAD(&s->refs);
+        if (refs < 0) return 0;
+        if (ATOMIC_CAS(&s->refs, refs, refs + 1)) return 1;
+    }
+}
+
+static void slot_unpin(CacheSlot* s) {
+    ATOMIC_ADD(&s->refs, -1);
+}
+
+static void slot_touch(CacheSlot* s) {
+    int freq = ATOMIC_LOAD(&s->freq);
+    if (freq < FREQ_MAX) {
+        ATOMIC_CAS(&s->freq, freq, freq + 1);
+    }
+}
+
+static int ghost_take(long long key) {
+    for (int i = 0; i < g_ghost_size; i++) {
+        if (g_ghost[i] == key) {
+            g_ghost[i] = 0;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void ghost_add(long long key) {
+    g_ghost[g_ghost_next] = key;
+    g_ghost_next = (g_ghost_next + 1) % g_ghost_size;
+}
+
+/* Take exclusive ownership of an unpinned slot and drop its contents (caller holds g_cache_mutex) */
+static int slot_claim(int idx) {
+    CacheSlot* s = &g_slots[idx];
+    if (!ATOMIC_CAS(&s->refs, 0, -1)) return 0;
+
+    if (s->key != 0) {
+        index_remove(s->key, idx);
+        s->key = 0;
+    }
+    ATOMIC_STORE(&s->state, SLOT_EMPTY);
+    return 1;
+}
+
+/* Pick a slot to fill, evicting per S3-FIFO if needed (caller holds g_cache_mutex) */
+static int slot_allocate(void) {
+    int attempts = g_free.count;
+    while (attempts-- > 0) {
+        int idx = queue_pop(&g_free);
+        if (slot_claim(idx)) return idx;
+        queue_push(&g_free, idx);
+    }
+
+    /* Bounded so a cache full of pinned chunks cannot spin forever */
+    for (attempts = 0; attempts < 4 * g_slot_count; attempts++) {
+        int from_small = g_small.count > 0 &&
+                         (g_small.count >= g_small_target || g_main.count == 0);
+
+        if (from_small) {
+            int idx = queue_pop(&g_small);
+            CacheSlot* s = &g_slots[idx];
+
+            if (ATOMIC_LOAD(&s->freq) > 1) {
+                ATOMIC_STORE(&s->freq, 0);
+                queue_push(&g_main, idx);
+                continue;
+            }
+
+            long long key = s->key;
+            if (!slot_claim(idx)) {
+                queue_push(&g_small, idx);
+                continue;
+            }
+
+            ghost_add(key);
+            ATOMIC_ADD64(&g_evictions, 1);
+            return idx;
+        }
+
+        if (g_main.count == 0) break;
+
+        int idx = queue_pop(&g_main);
+        CacheSlot* s = &g_slots[idx];
+
+        int freq = ATOMIC_LOAD(&s->freq);
+        if (freq > 0) {
+            ATOMIC_STORE(&s->freq, freq - 1);
+            queue_push(&g_main, idx);
+            continue;
+        }
+
+        if (!slot_claim(idx)) {
+            queue_push(&g_main, idx);
+            continue;
+        }
+
+        ATOMIC_ADD64(&g_evictions, 1);
+        return idx;
+    }
+
+    return -1;
+}
+
+/* Read a chunk from disk into a filling slot */
+static long fill_slot(CacheSlot* s, int fd, long long dev, long chunk, long file_size) {
+    long start = chunk * CACHE_CHUNK_SIZE;
+    long want = file_size - start;
+    if (want > CACHE_CHUNK_SIZE) want = CACHE_CHUNK_SIZE;
+    if (want <= 0) return 0;
+
+    if (!s->data) {
+        s->data = malloc(CACHE_CHUNK_SIZE);
+        if (!s->data) return 0;
+    }
+
+    long n = disk_io_read(fd, dev, s->data, want, start);
+    return n > 0 ? n : 0;
+}
+
+/* Lock-free lookup of a ready chunk; returns a pinned slot index or -1 */
+static int lookup_ready(long long key) {
+    int idx = index_find(key);
+    if (idx < 0) return -1;
+
+    CacheSlot* s = &g_slots[idx];
+    if (!slot_pin(s)) return -1;
+
+    if (s->key != key || ATOMIC_LOAD(&s->state) != SLOT_READY) {
+        slot_unpin(s);
+        return -1;
+    }
+
+    return idx;
+}
+
+/*
+ * Get the cached bytes at offset of a video file (rendition 0 for the
+ * original), filling the chunk from fd
+ * through the device I/O pool on a miss. On success *data points at offset, *len is the number of bytes
+ * available (at most max_len, never past the chunk end), and a handle for
+ * chunk_cache_release is returned. Returns -1 if the chunk can't be cached;
+ * the caller then reads from the file directly. With fd < 0 only chunks
+ * already resident are returned.
+ */
+int chunk_cache_get(int video_id, int rendition, int fd, long long dev, long file_size,
+                    long offset, long max_len, const char** data, long* len) {
+    if (g_slot_count == 0 || offset < 0 || offset >= file_size) return -1;
+
+    long chunk = offset / CACHE_CHUNK_SIZE;
+    long chunk_offset = offset - chunk * CACHE_CHUNK_SIZE;
+    long long key = make_key(video_id, rendition, chunk);
+    int from_memory = 1;
+
+    int idx = lookup_ready(key);
+    if (idx < 0 && fd < 0) return -1;
+
+    if (idx < 0) {
+        pthread_mutex_lock(&g_cache_mutex);
+
+        idx = index_find(key);
+        if (idx >= 0) {
+            /* Another request is filling or has just filled this chunk */
+            CacheSlot* s = &g_slots[idx];
+            ATOMIC_ADD(&s->refs, 1);
+            while (ATOMIC_LOAD(&s->state) == SLOT_FILLING) {
+                pthread_cond_wait(&g_fill_cond, &g_cache_mutex);
+            }
+            if (ATOMIC_LOAD(&s->state) != SLOT_READY || s->key != key) {
+                slot_unpin(s);
+                idx = -1;
+            }
+            pthread_mutex_unlock(&g_cache_mutex);
+        } else {
+            idx = slot_allocate();
+            if (idx < 0) {
+                pthread_mutex_unlock(&g_cache_mutex);
+                ATOMIC_ADD64(&g_misses, 1);
+                return -1;
+            }
+
+            /* Publish the filling slot so concurrent misses wait for it */
+            CacheSlot* s = &g_slots[idx];
+            s->key = key;
+            s->length = 0;
+            ATOMIC_STORE(&s->freq, 0);
+            ATOMIC_STORE(&s->state, SLOT_FILLING);
+            ATOMIC_STORE(&s->refs, 1);
+            index_insert(key, idx);
+            int promote = ghost_take(key);
+            pthread_mutex_unlock(&g_cache_mutex);
+
+            long length = fill_slot(s, fd, dev, chunk, file_size);
+
+            pthread_mutex_lock(&g_cache_mutex);
+            if (length > chunk_offset) {
+                s->length = length;
+                ATOMIC_STORE(&s->state, SLOT_READY);
+                queue_push(promote ? &g_main : &g_small, idx);
+            } else {
+                index_remove(key, idx);
+                s->key = 0;
+                ATOMIC_STORE(&s->state, SLOT_EMPTY);
+                slot_unpin(s);
+                queue_push(&g_free, idx);
+                idx = -1;
+            }
+            pthread_cond_broadcast(&g_fill_cond);
+            pthread_mutex_unlock(&g_cache_mutex);
+
+            from_memory = 0;
+        }
+    }
+
+    if (idx < 0) {
+        ATOMIC_ADD64(&g_misses, 1);
+        return -1;
+    }
+
+    CacheSlot* s = &g_slots[idx];
+    if (s->length <= chunk_offset) {
+        slot_unpin(s);
+        return -1;
+    }
+
+    slot_touch(s);
+
+    long available = s->length - chunk_offset;
+    if (available > max_len) available = max_len;
+
+    *data = s->data + chunk_offset;
+    *len = available;
+
+    if (from_memory) {
+        ATOMIC_ADD64(&g_hits, 1);
+        ATOMIC_ADD64(&g_bytes_memory, available);
+    } else {
+        ATOMIC_ADD64(&g_misses, 1);
+        ATOMIC_ADD64(&g_bytes_disk, available);
+    }
+
+    return idx;
+}
+
+/* Release a chunk returned by chunk_cache_get */
+void chunk_cache_release(int handle) {
+    if (handle < 0 || handle >= g_slot_count) return;
+    slot_unpin(&g_slots[handle]);
+}
+
+/* Write cache metrics as a JSON object */
+int chunk_cache_stats_json(char* buf, size_t size) {
+    long long hits = ATOMIC_LOAD64(&g_hits);
+    long long misses = ATOMIC_LOAD64(&g_misses);
+    long long lookups = hits + misses;
+
+    return snprintf(buf, size,
+        "{\"capacity_bytes\":%lld,\"hits\":%lld,\"misses\":%lld,\"hit_rate\":%.4f,"
+        "\"bytes_from_memory\":%lld,\"bytes_from_disk\":%lld,\"evictions\":%lld}",
+        (long long)g_slot_count * CACHE_CHUNK_SIZE, hits, misses,
+        lookups > 0 ? (double)hits / lookups : 0.0,
+        ATOMIC_LOAD64(&g_bytes_memory), ATOMIC_LOAD64(&g_bytes_disk),
+        ATOMIC_LOAD64(&g_evictions));
+}
@@ -30,6 +30,14 @@
     #define pthread_mutex_unlock(m) LeaveCriticalSection(m)
     #define pthread_mutex_destroy(m) DeleteCriticalSection(m)
     
+    typedef CONDITION_VARIABLE pthread_cond_t;
+    
+    #define pthread_cond_init(c, attr) InitializeConditionVariable(c)
+    #define pthread_cond_wait(c, m) SleepConditionVariableCS((c), (m), INFINITE)
+    #define pthread_cond_signal(c) WakeConditionVariable(c)
+    #define pthread_cond_broadcast(c) WakeAllConditionVariable(c)
+    #define pthread_cond_destroy(c) ((void)0)
+    
     #define sleep(s) Sleep((s) * 1000)
     #define usleep(us) Sleep((us) / 1000)
 #else
@@ -60,21 +68,111 @@
 #include <stdarg.h>
 #include <ctype.h>
 
+/* Atomic operations on int and long long values */
+#if defined(_MSC_VER)
+    #define ATOMIC_LOAD(p) InterlockedCompareExchange((volatile LONG*)(p), 0, 0)
+    #define ATOMIC_STORE(p, v) InterlockedExchange((volatile LONG*)(p), (v))
+    #define ATOMIC_ADD(p, v) InterlockedExchangeAdd((volatile LONG*)(p), (v))
+    #define ATOMIC_CAS(p, expected, desired) \
+        (InterlockedCompareExchange((volatile LONG*)(p), (desired), (expected)) == (expected))
+    #define ATOMIC_LOAD64(p) InterlockedCompareExchange64((volatile LONGLONG*)(p), 0, 0)
+    #define ATOMIC_ADD64(p, v) InterlockedExchangeAdd64((volatile LONGLONG*)(p), (v))
+#else
+    #define ATOMIC_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+    #define ATOMIC_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+    #define ATOMIC_ADD(p, v) __atomic_fetch_add((p), (v), __ATOMIC_ACQ_REL)
+    #define ATOMIC_CAS(p, expected, desired) __sync_bool_compare_and_swap((p), (expected), (desired))
+    #define ATOMIC_LOAD64(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+    #define ATOMIC_ADD64(p, v) __atomic_fetch_add((p), (v), __ATOMIC_ACQ_REL)
+#endif
+
+/* Thread-local storage */
+#if defined(_WIN32)
+    #define THREAD_LOCAL __declspec(thread)
+#else
+    #define THREAD_LOCAL __thread
+#endif
+
+/* Reader-writer locks */
+#if defined(_WIN32)
+    typedef SRWLOCK RWLOCK;
+    #define RWLOCK_INIT(l) InitializeSRWLock(l)
+    #define READ_LOCK(l) AcquireSRWLockShared(l)
+    #define READ_UNLOCK(l) ReleaseSRWLockShared(l)
+    #define WRITE_LOCK(l) AcquireSRWLockExclusive(l)
+    #define WRITE_UNLOCK(l) ReleaseSRWLockExclusive(l)
+#else
+    typedef pthread_rwlock_t RWLOCK;
+    #define RWLOCK_INIT(l) pthread_rwlock_init((l), NULL)
+    #define READ_LOCK(l) pthread_rwlock_rdlock(l)
+    #define READ_UNLOCK(l) pthread_rwlock_unlock(l)
+    #define WRITE_LOCK(l) pthread_rwlock_wrlock(l)
+    #define WRITE_UNLOCK(l) pthread_rwlock_unlock(l)
+#endif
+
 /* Server Configuration */
 #define SERVER_PORT "8080"
 #define MAX_CLIENTS 100
 #define MAX_REQUEST_SIZE 8192
 #define BUFFER_SIZE 65536
 #define MAX_PATH_LEN 512
-#define MAX_SESSIONS 100
 #define SESSION_TIMEOUT 3600  /* 1 hour */
-#define MAX_VIDEOS 100
-#define MAX_USERS 50
+#define SESSION_PURGE_BATCH 4096  /* expired sessions removed per background pass */
+#define SESSION_PURGE_SECONDS 60  /* interval of the database session purge */
+#define SESSION_SIGNED_TOKENS 1   /* stateless HMAC-signed session cookies, 0 = server-side sessions */
+#define SESSION_KEY_ROTATE_SECONDS 86400 /* how long a token signing key is used for new tokens */
+#define AUTH_THREADS 2            /* password hashing threads, apart from the network workers */
+#define AUTH_QUEUE_DEPTH 32       /* logins waiting for an auth thread before answering 429 */
+#define AUTH_SCRYPT_LOG_N 15      /* scrypt cost, 2^N rounds and 2^N KB of memory per hash */
+#define MAX_PASSWORD_LEN 63       /* longer passwords are refused, never truncated */
+#define CACHE_CHUNK_SIZE (256 * 1024)
+#define CHUNK_CACHE_MB 256
+#define EGRESS_LIMIT_MBPS 0       /* shared by all streams, 0 = unlimited */
+#define PACING_BURST_FACTOR 2.0   /* stream rate as a multiple of the title bitrate */
+#define DISK_IO_THREADS 4         /* reader threads per storage device */
+#define DISK_IO_QUEUE_DEPTH 64    /* queued reads per storage device */
+#define DISK_IO_TIMEOUT_MS 500    /* longest a request waits for one read */
+#define DISK_IO_BODY_TIMEOUT_MS 30000 /* same, once a response body is under way */
+#define DISK_IO_WORKER_SHARE 50   /* percent of worker threads one device may hold waiting */
+#define DISK_IO_BLOCK_SIZE (256 * 1024)
+#define DIRECT_IO_COLD_TITLES 1   /* stream cold titles around the page cache */
+#define STORAGE_REPLICAS 2        /* copies kept of popular titles across roots */
+#define STORAGE_REPLICATE_HEAT 10.0 /* title heat at which replicas are added */
+#define STORAGE_COPY_MBPS 50      /* replica copy rate limit */
+#define FAST_TIER_DIR ""          /* SSD/NVMe cache directory, "" = no fast tier */
+#define FAST_TIER_CAPACITY_MB 102400
+#define TIER_PROMOTE_HEAT 5.0     /* title heat at which titles move to the fast tier */
+#define TIER_COPY_MBPS 100        /* promotion copy rate limit */
+#define PREFETCH_SECONDS 10       /* playback time loaded ahead of each viewer, 0 = off */
+#define PREFETCH_THREADS 2
+#define WARMUP_TITLES 20          /* most-watched titles warmed at startup, 0 = off */
+#define WARMUP_SECONDS 120        /* playback time warmed from the start of each title */
+#define WARMUP_BUDGET_MB 2048     /* total bytes read by the startup warmup */
+#define WARMUP_HISTORY_DAYS 7     /* watch history window used for ranking */
+#define RENDITION_HEADROOM 1.5    /* link throughput needed per unit of rendition bitrate */
+#define TRICKPLAY_INTERVAL 10     /* seconds between scrubbing preview frames */
+#define TRICKPLAY_TILE_WIDTH 160
+#define TRICKPLAY_TILE_HEIGHT 90
+#define TRICKPLAY_COLUMNS 10      /* tiles per sprite sheet row */
+#define TRICKPLAY_ROWS 10
+#define STATIC_MAX_AGE 86400      /* Cache-Control max-age for generated images */
+#define LIVE_SEGMENTS 32          /* media files kept in memory per live channel */
+#define LIVE_MAX_FILE_MB 32       /* largest segment accepted from the encoder */
+#define LIVE_BLOCK_TIMEOUT_MS 6000 /* longest wait for a blocking playlist or hinted part */
+#define LIVE_BLOCK_WORKER_SHARE 25 /* percent of worker threads live requests may hold waiting */
+#define LIVE_INGEST_WORKER_SHARE 25 /* percent of worker threads encoder uploads may hold */
+#define UPLOAD_CHUNK_MB 8         /* resume granularity of uploads */
+#define DATA_SYNC_MS 1000         /* group commit interval of the data log, 0 = sync every change */
+#define DATA_WAL_COMPACT_MB 4     /* data log size that triggers a snapshot */
+#define DATA_BACKEND ""           /* "file" or "postgres", "" = postgres when built with it */
+#define DATA_SLAB_KB 64           /* allocation unit of the in-memory data tables */
 
 /* Directories */
 #define STATIC_DIR "static"
 #define VIDEO_DIR "videos"
+#define VIDEO_ROOTS VIDEO_DIR      /* ';'-separated storage roots, e.g. "videos;/mnt/disk2/videos" */
 #define THUMBNAIL_DIR "static/thumbnails"
+#define TRICKPLAY_DIR "static/trickplay"
 #define DATA_DIR "data"
 
 /* Log levels */
@@ -119,6 +217,41 @@ typedef struct {
     int active;
 } Session;
 
+/*
+ * Storage backend (backend.c picks one at startup). Lookups fill a
+ * caller-owned struct and return 0, or -1 if there is no such row.
+ * Passwords arrive already hashed.
+ */
+typedef struct {
+    const char* name;
+    int (*init)(void);
+    void (*load)(void);
+    void (*save)(void);
+
+    int (*user_find_by_username)(const char* username, User* user);
+    int (*user_find_by_id)(int id, User* user);
+    int (*user_create)(const char* username, const char* password_hash);
+    int (*user_set_password_hash)(int id, const char* old_hash, const char* new_hash);
+
+    int (*session_create)(int user_id, Session* session);
+    int (*session_find)(const char* token, Session* session);
+    void (*session_destroy)(const char* token);
+
+    int (*video_add)(const char* title, const char* filename, const char* thumbnail,
+                     int duration, const char* description);
+    int (*video_find_by_id)(int id, Video* video);
+    int (*videos_find)(const int* ids, int count, Video* videos);
+    int (*video_set_duration)(int id, int duration);
+    int (*video_get_all)(Video** videos);
+    int (*video_count)(void);
+
+    int (*history_find)(int user_id, int video_id, WatchHistory* history);
+    int (*history_update)(int user_id, int video_id, int position);
+    int (*history_update_batch)(const WatchHistory* rows, int count);
+    int (*history_get_user_history)(int user_id, WatchHistory* history, int max_count);
+    int (*history_top_videos)(int days, int* video_ids, int max_count);
+} StorageBackend;
+
 /* HTTP Request structure */
 typedef struct {
     char method[16];
@@ -128,30 +261,39 @@ typedef struct {
     char host[256];
     char cookie[512];
     char content_type[128];
-    int content_length;
+    long long content_length;
     long range_start;
     long range_end;
     int has_range;
+    int chunked;          /* Transfer-Encoding: chunked */
+    long long upload_length;  /* tus Upload-Length, -1 if absent */
+    long long upload_offset;  /* tus Upload-Offset, -1 if absent */
     char body[4096];
 } HttpRequest;
 
 /* HTTP Response helpers */
 #define HTTP_200 "HTTP/1.1 200 OK\r\n"
+#define HTTP_201 "HTTP/1.1 201 Created\r\n"
+#define HTTP_204 "HTTP/1.1 204 No Content\r\n"
 #define HTTP_206 "HTTP/1.1 206 Partial Content\r\n"
 #define HTTP_302 "HTTP/1.1 302 Found\r\n"
 #define HTTP_400 "HTTP/1.1 400 Bad Request\r\n"
 #define HTTP_401 "HTTP/1.1 401 Unauthorized\r\n"
 #define HTTP_403 "HTTP/1.1 403 Forbidden\r\n"
 #define HTTP_404 "HTTP/1.1 404 Not Found\r\n"
+#define HTTP_409 "HTTP/1.1 409 Conflict\r\n"
+#define HTTP_429 "HTTP/1.1 429 Too Many Requests\r\n"
 #define HTTP_500 "HTTP/1.1 500 Internal Server Error\r\n"
+#define HTTP_503 "HTTP/1.1 503 Service Unavailable\r\n"
 
 /* Function declarations */
 void log_message(LogLevel level, const char* format, ...);
+double monotonic_seconds(void);
 const char* get_content_type(const char* path);
 void url_decode(char* dst, const char* src);
 char* get_query_param(const char* query, const char* name, char* value, size_t value_size);
-void generate_session_token(char* token, size_t len);
+int random_bytes(void* buf, size_t len);
+int generate_session_token(char* token, size_t len);
 unsigned long simple_hash(const char* str);
-int user_create(const char* username, const char* password);
 
 #endif /* COMMON_H */
@@ -1,320 +1,1822 @@
 /*
  * OTT Video Streaming Server - Data Storage Module
- * File-based storage for users, videos, sessions, and watch history
+ * The "file" storage backend: users, videos, sessions, and watch history
+ * kept in memory and persisted by this process alone.
+ * Each change is appended to a write-ahead log, flushed to disk in
+ * batches every DATA_SYNC_MS. The log is compacted into a snapshot file
+ * (store.dat) in the background once it passes DATA_WAL_COMPACT_MB.
+ * Startup maps the snapshot, uses its rows and indexes in place, and
+ * replays the log.
  */
 
 #include "common.h"
+#include <stdint.h>
+
+#if defined(_WIN32)
+    #include <io.h>
+    #define PATH_SEP "\\"
+#else
+    #include <sys/mman.h>
+    #define PATH_SEP "/"
+#endif
+
+#define STORE_FILE DATA_DIR PATH_SEP "store.dat"
+#define WAL_FILE DATA_DIR PATH_SEP "data.wal"
+#define WAL_OLD_FILE DATA_DIR PATH_SEP "data.wal.old"   /* log being compacted */
+#define WAL_FOLD_FILE DATA_DIR PATH_SEP "data.wal.fold" /* old and current logs being joined */
+
+/* Snapshot files written before store.dat, imported once */
+#define LEGACY_USERS_FILE DATA_DIR PATH_SEP "users.dat"
+#define LEGACY_VIDEOS_FILE DATA_DIR PATH_SEP "videos.dat"
+#define LEGACY_HISTORY_FILE DATA_DIR PATH_SEP "history.dat"
+
+/*
+ * Rows as stored on disk and in memory: fixed-width little-endian fields,
+ * naturally aligned with no implicit padding, so the layout is the same
+ * for every compiler. The public structs are filled from these.
+ */
+typedef struct {
+    int32_t id;
+    int32_t active;
+    char username[64];
+    char password_hash[256];
+} UserRecord;
+
+typedef struct {
+    int32_t id;
+    int32_t duration_sec;
+    char title[256];
+    char filename[256];
+    char thumbnail[256];
+    char description[512];
+} VideoRecord;
+
+typedef struct {
+    int32_t user_id;
+    int32_t video_id;
+    int32_t last_pos_sec;
+    int32_t reserved;
+    int64_t updated_at;
+} HistoryRecord;
+
+typedef char user_record_layout[sizeof(UserRecord) == 328 ? 1 : -1];
+typedef char video_record_layout[sizeof(VideoRecord) == 1288 ? 1 : -1];
+/* One title in a viewer's history */
+typedef struct {
+    int32_t video_id;
+    int32_t last_pos_sec;
+    int64_t updated_at;
+} HistoryEntry;
+
+/* A viewer's entries within a shard's entry section */
+typedef struct {
+    int32_t user_id;
+    uint32_t count;
+    uint64_t first;
+} HistoryUserRecord;
+
+typedef char history_record_layout[sizeof(HistoryRecord) == 24 ? 1 : -1];
+typedef char history_entry_layout[sizeof(HistoryEntry) == 16 ? 1 : -1];
+typedef char history_user_layout[sizeof(HistoryUserRecord) == 16 ? 1 : -1];
+
+/*
+ * Snapshot layout: a header, a table of sections, then the sections at
+ * 8-byte aligned offsets. Each section is a table's rows or an index's
+ * buckets, with its own checksum.
+ */
+#define STORE_MAGIC "OTTSTORE"
+#define STORE_VERSION 1
+
+enum {
+    SECTION_USERS = 1,
+    SECTION_USER_NAME_INDEX = 2,
+    SECTION_USER_ID_INDEX = 3,
+    SECTION_VIDEOS = 4,
+    SECTION_VIDEO_ID_INDEX = 5,
+    SECTION_HISTORY_USERS = 6,    /* one per shard */
+    SECTION_HISTORY_ENTRIES = 7,
+    SECTION_HISTORY_USER_INDEX = 8
+};
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t section_count;
+    int64_t created_at;
+    uint64_t checksum;            /* of the section table */
+} StoreHeader;
+
+typedef struct {
+    uint32_t type;
+    uint32_t part;                /* history shard */
+    uint32_t row_size;            /* bytes per row or bucket */
+    uint32_t reserved;
+    uint64_t count;               /* rows or buckets */
+    uint64_t offset;              /* from the start of the file */
+    uint64_t checksum;
+} StoreSection;
+
+/* Log file header and record types; each record carries the full new state of one row */
+#define WAL_MAGIC "OTTWAL\0\0"
+#define WAL_VERSION 1
+
+enum { WAL_USER = 1, WAL_VIDEO = 2, WAL_HISTORY = 3 };
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+} WalFileHeader;
+
+typedef struct {
+    unsigned int type;
+    unsigned int length;
+    unsigned int checksum;   /* FNV-1a of the payload, detects torn writes */
+} WalHeader;
+
+/*
+ * Growable table of fixed-size rows. Rows loaded from the snapshot stay
+ * in its mapping (copy-on-write, so they can be updated in place); new
+ * rows go into slabs of DATA_SLAB_KB allocated as the table grows. Rows
+ * never move, so a row's handle (its index) and address stay valid.
+ */
+typedef struct {
+    char* base;           /* rows mapped from the snapshot */
+    int base_count;
+    char** slabs;
+    int slab_count;
+    int count;            /* rows in use */
+    int rows_per_slab;
+    size_t row_size;
+} Table;
+
+/*
+ * Open-addressing hash index over a table, with linear probing. Each
+ * bucket holds a row handle + 1, 0 when empty. The bucket array (a power
+ * of two) doubles once half full; deletion shifts entries back instead
+ * of leaving tombstones.
+ */
+typedef struct {
+    int32_t* buckets;
+    int size;
+    int count;
+    int owned;            /* buckets were allocated here, not mapped */
+    Table* table;
+    unsigned int (*hash)(const void* row);
+} Index;
+
+/*
+ * Watch history is kept per viewer as one vector of entries ordered by
+ * update time, oldest first. Progress updates hit the title at the end,
+ * and all of a viewer's positions are read in one pass. Viewers are
+ * split into shards so updates from different viewers don't contend.
+ */
+#define HISTORY_SHARDS 16
+
+typedef struct {
+    int32_t user_id;
+    int32_t count;
+    int32_t size;         /* allocated entries, 0 while in the snapshot mapping */
+    HistoryEntry* entries;
+} UserHistory;
+
+typedef struct {
+    Table users;          /* UserHistory rows */
+    Index by_user;
+    int entry_count;
+    RWLOCK lock;
+} HistoryShard;
 
 /* Global storage */
-static User g_users[MAX_USERS];
-static int g_user_count = 0;
+static Table g_users;
+static Index g_user_by_name;
+static Index g_user_by_id;
+
+static Table g_videos;
+static Index g_video_by_id;
+
+static Table g_sessions;
+static Index g_session_by_token;
+static int* g_session_free = NULL;   /* stack of unused session handles */
+static int g_session_free_count = 0;
+static int g_session_free_size = 0;
 
-static Video g_videos[MAX_VIDEOS];
-static int g_video_count = 0;
+/*
+ * Session expiry times in a min-heap, drained in bounded batches by the
+ * background thread. Destroyed sessions keep their entry until it comes
+ * due and is skipped.
+ */
+typedef struct {
+    time_t expires_at;
+    int handle;
+} SessionExpiry;
 
-static Session g_sessions[MAX_SESSIONS];
-static int g_session_count = 0;
+static SessionExpiry* g_session_heap = NULL;
+static int g_session_heap_count = 0;
+static int g_session_heap_size = 0;
 
-static WatchHistory g_history[MAX_USERS * MAX_VIDEOS];
-static int g_history_count = 0;
+static HistoryShard g_history[HISTORY_SHARDS];
 
-/* Mutex for thread safety */
-static pthread_mutex_t g_data_mutex;
+/*
+ * One reader-writer lock per table, one per history shard. Lookups copy
+ * the row into a struct the caller owns while the lock is held, so callers
+ * never read rows that another thread is changing.
+ */
+static RWLOCK g_user_lock;
+static RWLOCK g_video_lock;
+static RWLOCK g_session_lock;
 static int g_mutex_initialized = 0;
 
-/* Initialize data storage */
-void data_init(void) {
-    if (!g_mutex_initialized) {
-        pthread_mutex_init(&g_data_mutex, NULL);
-        g_mutex_initialized = 1;
+/* Write-ahead log; appended after the change, under the table's write lock */
+static FILE* g_wal = NULL;
+static long long g_wal_bytes = 0;
+static int g_wal_dirty = 0;
+static pthread_mutex_t g_wal_mutex;
+static pthread_mutex_t g_compact_mutex;    /* keeps the open log in place while it is synced or swapped */
+static pthread_mutex_t g_snapshot_mutex;   /* one compaction at a time */
+static pthread_cond_t g_compact_cond;      /* wakes the compaction thread, with g_wal_mutex */
+static int g_compact_wanted = 0;
+
+static void table_init(Table* t, size_t row_size) {
+    memset(t, 0, sizeof(Table));
+    t->row_size = row_size;
+    t->rows_per_slab = (int)(DATA_SLAB_KB * 1024 / row_size);
+    if (t->rows_per_slab < 1) t->rows_per_slab = 1;
+}
+
+static void* table_row(const Table* t, int handle) {
+    if (handle < t->base_count) return t->base + (size_t)handle * t->row_size;
+    handle -= t->base_count;
+    return t->slabs[handle / t->rows_per_slab] + (size_t)(handle % t->rows_per_slab) * t->row_size;
+}
+
+/* Append a zeroed row; returns its handle, -1 when out of memory */
+static int table_add(Table* t) {
+    if (t->count - t->base_count == t->slab_count * t->rows_per_slab) {
+        char** slabs = realloc(t->slabs, sizeof(char*) * (t->slab_count + 1));
+        if (!slabs) return -1;
+        t->slabs = slabs;
+        t->slabs[t->slab_count] = malloc(t->row_size * t->rows_per_slab);
+        if (!t->slabs[t->slab_count]) return -1;
+        t->slab_count++;
+    }
+    memset(table_row(t, t->count), 0, t->row_size);
+    return t->count++;
+}
+
+/* Copy all rows into one array for writing out (caller frees) */
+static void* table_copy(const Table* t) {
+    char* out = malloc(t->row_size * (t->count > 0 ? t->count : 1));
+    if (!out) return NULL;
+    memcpy(out, t->base, t->row_size * t->base_count);
+    for (int done = t->base_count; done < t->count; done += t->rows_per_slab) {
+        int n = t->count - done < t->rows_per_slab ? t->count - done : t->rows_per_slab;
+        memcpy(out + (size_t)done * t->row_size, table_row(t, done), t->row_size * n);
+    }
+    return out;
+}
+
+static void index_init(Index* ix, Table* table, unsigned int (*hash)(const void* row)) {
+    memset(ix, 0, sizeof(Index));
+    ix->table = table;
+    ix->hash = hash;
+}
+
+static void index_place(int32_t* buckets, int size, unsigned int hash, int handle) {
+    unsigned int i = hash & (size - 1);
+    while (buckets[i]) i = (i + 1) & (size - 1);
+    buckets[i] = handle + 1;
+}
+
+static int index_insert(Index* ix, int handle) {
+    if ((ix->count + 1) * 2 > ix->size) {
+        int size = ix->size > 0 ? ix->size * 2 : 64;
+        int32_t* buckets = calloc(size, sizeof(int32_t));
+        if (!buckets) return -1;
+        for (int i = 0; i < ix->size; i++) {
+            if (ix->buckets[i]) {
+                index_place(buckets, size, ix->hash(table_row(ix->table, ix->buckets[i] - 1)),
+                            ix->buckets[i] - 1);
+            }
+        }
+        if (ix->owned) free(ix->buckets);
+        ix->buckets = buckets;
+        ix->size = size;
+        ix->owned = 1;
+    }
+    index_place(ix->buckets, ix->size, ix->hash(table_row(ix->table, handle)), handle);
+    ix->count++;
+    return 0;
+}
+
+/* Index every row of the table, when the snapshot had no usable index */
+static int index_build(Index* ix) {
+    for (int i = 0; i < ix->table->count; i++) {
+        if (index_insert(ix, i) < 0) return -1;
+    }
+    return 0;
+}
+
+/* Remove a handle, shifting later entries of the probe run back */
+static void index_remove(Index* ix, int handle) {
+    if (ix->size == 0) return;
+
+    unsigned int mask = ix->size - 1;
+    unsigned int i = ix->hash(table_row(ix->table, handle)) & mask;
+    while (ix->buckets[i] && ix->buckets[i] != handle + 1) i = (i + 1) & mask;
+    if (!ix->buckets[i]) return;
+
+    unsigned int j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (!ix->buckets[j]) break;
+
+        /* An entry may move into the hole only if its home bucket isn't in (i, j] */
+        unsigned int home = ix->hash(table_row(ix->table, ix->buckets[j] - 1)) & mask;
+        if (i <= j ? (i < home && home <= j) : (i < home || home <= j)) continue;
+
+        ix->buckets[i] = ix->buckets[j];
+        i = j;
+    }
+    ix->buckets[i] = 0;
+    ix->count--;
+}
+
+/* Walk the probe run for a hash: returns candidate handles in turn, -1 at the end */
+static int index_probe(const Index* ix, unsigned int hash, unsigned int* step) {
+    if (ix->size == 0) return -1;
+    unsigned int i = (hash + *step) & (ix->size - 1);
+    if (!ix->buckets[i]) return -1;
+    (*step)++;
+    return ix->buckets[i] - 1;
+}
+
+/* FNV-1a; the indexes are saved with the snapshot, so the hashes must not vary by build */
+static unsigned int hash_bytes(const void* data, size_t len) {
+    const unsigned char* p = data;
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static unsigned int hash_string(const char* s) {
+    return hash_bytes(s, strlen(s));
+}
+
+static unsigned int hash_id(int id) {
+    return (unsigned int)id * 2654435761u;
+}
+
+static unsigned int user_name_hash(const void* row) { return hash_string(((const UserRecord*)row)->username); }
+static unsigned int user_id_hash(const void* row) { return hash_id(((const UserRecord*)row)->id); }
+static unsigned int video_id_hash(const void* row) { return hash_id(((const VideoRecord*)row)->id); }
+static unsigned int session_hash(const void* row) { return hash_string(((const Session*)row)->token); }
+static unsigned int user_history_hash(const void* row) { return hash_id(((const UserHistory*)row)->user_id); }
+
+static HistoryShard* history_shard(int user_id) {
+    return &g_history[(unsigned int)user_id % HISTORY_SHARDS];
+}
+
+/* Conversions between records and the public structs */
+static void copy_string(char* dst, size_t size, const char* src) {
+    size_t len = strnlen(src, size - 1);
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+static void user_from_record(User* u, const UserRecord* r) {
+    memset(u, 0, sizeof(User));
+    u->id = r->id;
+    u->active = r->active;
+    copy_string(u->username, sizeof(u->username), r->username);
+    copy_string(u->password_hash, sizeof(u->password_hash), r->password_hash);
+}
+
+static void user_to_record(UserRecord* r, const User* u) {
+    memset(r, 0, sizeof(UserRecord));
+    r->id = u->id;
+    r->active = u->active;
+    copy_string(r->username, sizeof(r->username), u->username);
+    copy_string(r->password_hash, sizeof(r->password_hash), u->password_hash);
+}
+
+static void video_from_record(Video* v, const VideoRecord* r) {
+    memset(v, 0, sizeof(Video));
+    v->id = r->id;
+    v->duration_sec = r->duration_sec;
+    copy_string(v->title, sizeof(v->title), r->title);
+    copy_string(v->filename, sizeof(v->filename), r->filename);
+    copy_string(v->thumbnail, sizeof(v->thumbnail), r->thumbnail);
+    copy_string(v->description, sizeof(v->description), r->description);
+}
+
+static void video_to_record(VideoRecord* r, const Video* v) {
+    memset(r, 0, sizeof(VideoRecord));
+    r->id = v->id;
+    r->duration_sec = v->duration_sec;
+    copy_string(r->title, sizeof(r->title), v->title);
+    copy_string(r->filename, sizeof(r->filename), v->filename);
+    copy_string(r->thumbnail, sizeof(r->thumbnail), v->thumbnail);
+    copy_string(r->description, sizeof(r->description), v->description);
+}
+
+static void history_from_entry(WatchHistory* h, int user_id, const HistoryEntry* e) {
+    memset(h, 0, sizeof(WatchHistory));
+    h->user_id = user_id;
+    h->video_id = e->video_id;
+    h->last_pos_sec = e->last_pos_sec;
+    h->updated_at = (time_t)e->updated_at;
+}
+
+static void history_to_record(HistoryRecord* r, const WatchHistory* h) {
+    memset(r, 0, sizeof(HistoryRecord));
+    r->user_id = h->user_id;
+    r->video_id = h->video_id;
+    r->last_pos_sec = h->last_pos_sec;
+    r->updated_at = (int64_t)h->updated_at;
+}
+
+/* Row lookups by key; callers hold the table's lock */
+static UserRecord* find_user_by_name(const char* username) {
+    unsigned int step = 0;
+    int handle;
+    while ((handle = index_probe(&g_user_by_name, hash_string(username), &step)) >= 0) {
+        UserRecord* u = table_row(&g_users, handle);
+        if (strcmp(u->username, username) == 0) return u;
     }
-    
-    /* Initialize counters - data will be loaded from PostgreSQL */
-    g_user_count = 0;
-    g_video_count = 0;
-    g_session_count = 0;
-    g_history_count = 0;
-    
-    log_message(LOG_INFO, "Data storage initialized (using PostgreSQL database)");
+    return NULL;
 }
 
-/* Save data to file */
-void data_save(void) {
-    FILE* fp;
-    
+static UserRecord* find_user_by_id(int id) {
+    unsigned int step = 0;
+    int handle;
+    while ((handle = index_probe(&g_user_by_id, hash_id(id), &step)) >= 0) {
+        UserRecord* u = table_row(&g_users, handle);
+        if (u->id == id) return u;
+    }
+    return NULL;
+}
+
+static VideoRecord* find_video(int id) {
+    unsigned int step = 0;
+    int handle;
+    while ((handle = index_probe(&g_video_by_id, hash_id(id), &step)) >= 0) {
+        VideoRecord* v = table_row(&g_videos, handle);
+        if (v->id == id) return v;
+    }
+    return NULL;
+}
+
+static UserHistory* find_user_history(HistoryShard* shard, int user_id) {
+    unsigned int step = 0;
+    int handle;
+    while ((handle = index_probe(&shard->by_user, hash_id(user_id), &step)) >= 0) {
+        UserHistory* uh = table_row(&shard->users, handle);
+        if (uh->user_id == user_id) return uh;
+    }
+    return NULL;
+}
+
+/* Position of a title in a viewer's history, searching from the most recent */
+static int find_entry(const UserHistory* uh, int video_id) {
+    for (int i = uh->count - 1; i >= 0; i--) {
+        if (uh->entries[i].video_id == video_id) return i;
+    }
+    return -1;
+}
+
+static void sync_file(FILE* fp) {
 #if defined(_WIN32)
-    #define PATH_SEP "\\"
+    _commit(_fileno(fp));
 #else
-    #define PATH_SEP "/"
+    fsync(fileno(fp));
 #endif
-    
-    /* Save users */
-    fp = fopen(DATA_DIR PATH_SEP "users.dat", "wb");
-    if (fp) {
-        fwrite(&g_user_count, sizeof(int), 1, fp);
-        fwrite(g_users, sizeof(User), g_user_count, fp);
-        fclose(fp);
-        log_message(LOG_DEBUG, "Saved %d users", g_user_count);
-    } else {
-        log_message(LOG_ERROR, "Failed to save users.dat");
-    }
-    
-    /* Save videos */
-    fp = fopen(DATA_DIR PATH_SEP "videos.dat", "wb");
-    if (fp) {
-        fwrite(&g_video_count, sizeof(int), 1, fp);
-        fwrite(g_videos, sizeof(Video), g_video_count, fp);
-        fclose(fp);
-        log_message(LOG_DEBUG, "Saved %d videos", g_video_count);
-    } else {
-        log_message(LOG_ERROR, "Failed to save videos.dat");
-    }
-    
-    /* Save history */
-    fp = fopen(DATA_DIR PATH_SEP "history.dat", "wb");
-    if (fp) {
-        fwrite(&g_history_count, sizeof(int), 1, fp);
-        fwrite(g_history, sizeof(WatchHistory), g_history_count, fp);
+}
+
+static int wal_write_header(FILE* fp) {
+    WalFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, WAL_MAGIC, sizeof(header.magic));
+    header.version = WAL_VERSION;
+    return fwrite(&header, sizeof(header), 1, fp) == 1 ? 0 : -1;
+}
+
+/* Open a log for appending, writing its header when new (caller holds g_wal_mutex) */
+static FILE* wal_open(void) {
+    FILE* fp = fopen(WAL_FILE, "ab");
+    if (fp) fseek(fp, 0, SEEK_END);
+    if (fp && ftell(fp) == 0) wal_write_header(fp);
+    return fp;
+}
+
+/*
+ * Copy the intact records of a log onto out, stopping at a torn one. A
+ * missing log, or one too short for its header, copies nothing. Returns
+ * -1 if the log is in another format or out can't be written.
+ */
+static int wal_copy_records(const char* path, FILE* out) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) return 0;
+
+    WalFileHeader file_header;
+    if (fread(&file_header, sizeof(file_header), 1, fp) != 1) {
         fclose(fp);
+        return 0;
     }
+    int ok = memcmp(file_header.magic, WAL_MAGIC, sizeof(file_header.magic)) == 0 &&
+             file_header.version == WAL_VERSION;
+
+    union {
+        UserRecord user;
+        VideoRecord video;
+        HistoryRecord history;
+    } row;
+    WalHeader header;
+
+    while (ok && fread(&header, sizeof(header), 1, fp) == 1) {
+        if (header.length > sizeof(row) || fread(&row, 1, header.length, fp) != header.length ||
+            hash_bytes(&row, header.length) != header.checksum) {
+            break;
+        }
+        ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+             fwrite(&row, 1, header.length, out) == header.length;
+    }
+
+    fclose(fp);
+    return ok ? 0 : -1;
 }
 
-/* Load data from file */
-void data_load(void) {
-    FILE* fp;
-    
-    /* Load users */
-    fp = fopen(DATA_DIR PATH_SEP "users.dat", "rb");
-    if (fp) {
-        fread(&g_user_count, sizeof(int), 1, fp);
-        if (g_user_count > MAX_USERS) g_user_count = MAX_USERS;
-        fread(g_users, sizeof(User), g_user_count, fp);
-        fclose(fp);
-        log_message(LOG_INFO, "Loaded %d users from file", g_user_count);
-    }
-    
-    /* Load videos */
-    fp = fopen(DATA_DIR PATH_SEP "videos.dat", "rb");
-    if (fp) {
-        fread(&g_video_count, sizeof(int), 1, fp);
-        if (g_video_count > MAX_VIDEOS) g_video_count = MAX_VIDEOS;
-        fread(g_videos, sizeof(Video), g_video_count, fp);
-        fclose(fp);
-        log_message(LOG_INFO, "Loaded %d videos from file", g_video_count);
-    }
-    
-    /* Load history */
-    fp = fopen(DATA_DIR PATH_SEP "history.dat", "rb");
-    if (fp) {
-        fread(&g_history_count, sizeof(int), 1, fp);
-        if (g_history_count > MAX_USERS * MAX_VIDEOS) g_history_count = MAX_USERS * MAX_VIDEOS;
-        fread(g_history, sizeof(WatchHistory), g_history_count, fp);
-        fclose(fp);
-        log_message(LOG_INFO, "Loaded %d watch history records from file", g_history_count);
+/*
+ * Append the current log to the old one left by a failed compaction, so
+ * setting the current log aside doesn't overwrite changes the snapshot
+ * lacks. The joined log replaces the old one and the current log is
+ * removed. Returns -1, leaving both logs alone, if they can't be joined.
+ * Caller holds g_wal_mutex with g_wal closed.
+ */
+static int wal_fold_into_old(void) {
+    FILE* fp = fopen(WAL_FOLD_FILE, "wb");
+    if (!fp) return -1;
+
+    int ok = wal_write_header(fp) == 0 &&
+             wal_copy_records(WAL_OLD_FILE, fp) == 0 &&
+             wal_copy_records(WAL_FILE, fp) == 0 &&
+             fflush(fp) == 0;
+    if (ok) sync_file(fp);
+    if (fclose(fp) != 0) ok = 0;
+
+#if defined(_WIN32)
+    if (ok && !MoveFileExA(WAL_FOLD_FILE, WAL_OLD_FILE, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) ok = 0;
+#else
+    if (ok && rename(WAL_FOLD_FILE, WAL_OLD_FILE) != 0) ok = 0;
+#endif
+    if (!ok) {
+        remove(WAL_FOLD_FILE);
+        return -1;
     }
+
+    remove(WAL_FILE);
+    return 0;
 }
 
-/* User functions */
-User* user_find_by_username(const char* username) {
-    pthread_mutex_lock(&g_data_mutex);
-    for (int i = 0; i < g_user_count; i++) {
-        if (strcmp(g_users[i].username, username) == 0 && g_users[i].active) {
-            pthread_mutex_unlock(&g_data_mutex);
-            return &g_users[i];
+/* Append count rows of one type; durable after the next group commit */
+static void wal_append_rows(unsigned int type, const void* rows, size_t len, int count) {
+    pthread_mutex_lock(&g_wal_mutex);
+    if (g_wal) {
+        for (int i = 0; i < count; i++) {
+            const char* row = (const char*)rows + len * i;
+            WalHeader header;
+            header.type = type;
+            header.length = (unsigned int)len;
+            header.checksum = hash_bytes(row, len);
+
+            fwrite(&header, sizeof(header), 1, g_wal);
+            fwrite(row, 1, len, g_wal);
+            g_wal_bytes += sizeof(header) + len;
+        }
+        g_wal_dirty = 1;
+
+        if (DATA_SYNC_MS <= 0) {
+            fflush(g_wal);
+            sync_file(g_wal);
+            g_wal_dirty = 0;
         }
     }
-    pthread_mutex_unlock(&g_data_mutex);
-    return NULL;
+    pthread_mutex_unlock(&g_wal_mutex);
+}
+
+/* Append one record */
+static void wal_append(unsigned int type, const void* row, size_t len) {
+    wal_append_rows(type, row, len, 1);
 }
 
-User* user_find_by_id(int id) {
-    pthread_mutex_lock(&g_data_mutex);
-    for (int i = 0; i < g_user_count; i++) {
-        if (g_users[i].id == id && g_users[i].active) {
-            pthread_mutex_unlock(&g_data_mutex);
-            return &g_users[i];
+/* Insert rows, or replace them by key (caller holds the table's write lock) */
+static UserRecord* put_user(const UserRecord* row) {
+    UserRecord* u = find_user_by_id(row->id);
+    if (u) {
+        *u = *row;
+        return u;
+    }
+
+    int handle = table_add(&g_users);
+    if (handle < 0) return NULL;
+    u = table_row(&g_users, handle);
+    *u = *row;
+    if (index_insert(&g_user_by_name, handle) < 0 || index_insert(&g_user_by_id, handle) < 0) {
+        return NULL;
+    }
+    return u;
+}
+
+static VideoRecord* put_video(const VideoRecord* row) {
+    VideoRecord* v = find_video(row->id);
+    if (v) {
+        *v = *row;
+        return v;
+    }
+
+    int handle = table_add(&g_videos);
+    if (handle < 0) return NULL;
+    v = table_row(&g_videos, handle);
+    *v = *row;
+    if (index_insert(&g_video_by_id, handle) < 0) return NULL;
+    return v;
+}
+
+static int put_history(HistoryShard* shard, const HistoryRecord* row) {
+    UserHistory* uh = find_user_history(shard, row->user_id);
+    if (!uh) {
+        int handle = table_add(&shard->users);
+        if (handle < 0) return -1;
+        uh = table_row(&shard->users, handle);
+        uh->user_id = row->user_id;
+        if (index_insert(&shard->by_user, handle) < 0) return -1;
+    }
+
+    int pos = find_entry(uh, row->video_id);
+    if (pos < 0) {
+        /* Vectors still in the mapping are copied out the first time they grow */
+        if (uh->count >= uh->size) {
+            int size = uh->count >= 4 ? uh->count * 2 : 4;
+            HistoryEntry* entries = malloc(sizeof(HistoryEntry) * size);
+            if (!entries) return -1;
+            memcpy(entries, uh->entries, sizeof(HistoryEntry) * uh->count);
+            if (uh->size > 0) free(uh->entries);
+            uh->entries = entries;
+            uh->size = size;
         }
+        pos = uh->count++;
+        shard->entry_count++;
     }
-    pthread_mutex_unlock(&g_data_mutex);
-    return NULL;
+
+    /* Slide the entry to its place by update time; a live update ends up last */
+    HistoryEntry entry;
+    entry.video_id = row->video_id;
+    entry.last_pos_sec = row->last_pos_sec;
+    entry.updated_at = row->updated_at;
+    while (pos + 1 < uh->count && uh->entries[pos + 1].updated_at <= entry.updated_at) {
+        uh->entries[pos] = uh->entries[pos + 1];
+        pos++;
+    }
+    while (pos > 0 && uh->entries[pos - 1].updated_at > entry.updated_at) {
+        uh->entries[pos] = uh->entries[pos - 1];
+        pos--;
+    }
+    uh->entries[pos] = entry;
+    return 0;
 }
 
-int user_verify_password(User* user, const char* password) {
-    char hash_str[256];
-    snprintf(hash_str, sizeof(hash_str), "%lu", simple_hash(password));
-    return strcmp(user->password_hash, hash_str) == 0;
+/* Loaders, used before other threads start */
+static void load_user(const void* row) { put_user(row); }
+static void load_video(const void* row) { put_video(row); }
+
+static void load_history(const void* row) {
+    put_history(history_shard(((const HistoryRecord*)row)->user_id), row);
 }
 
-/* Session functions */
-Session* session_create(int user_id) {
-    pthread_mutex_lock(&g_data_mutex);
-    
-    /* Find empty slot or reuse expired */
-    int slot = -1;
-    time_t now = time(NULL);
-    
-    for (int i = 0; i < MAX_SESSIONS; i++) {
-        if (!g_sessions[i].active || g_sessions[i].expires_at < now) {
-            slot = i;
+/* The tables of builds before the log and snapshot hold the public structs */
+static void load_legacy_user(const void* row) {
+    UserRecord r;
+    user_to_record(&r, row);
+    load_user(&r);
+}
+
+static void load_legacy_video(const void* row) {
+    VideoRecord r;
+    video_to_record(&r, row);
+    load_video(&r);
+}
+
+static void load_legacy_history(const void* row) {
+    HistoryRecord r;
+    history_to_record(&r, row);
+    load_history(&r);
+}
+
+/*
+ * Replay a log file into memory; returns the number of records applied.
+ * Sets *rewrite when the log can't be appended to: its header or last
+ * record is torn.
+ */
+static int wal_replay(const char* path, int* rewrite) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) return 0;
+
+    /* A crash can leave a log shorter than its header; it holds no records */
+    WalFileHeader file_header;
+    if (fread(&file_header, sizeof(file_header), 1, fp) != 1) {
+        fseek(fp, 0, SEEK_END);
+        if (ftell(fp) > 0) *rewrite = 1;
+        fclose(fp);
+        return 0;
+    }
+    if (memcmp(file_header.magic, WAL_MAGIC, sizeof(file_header.magic)) != 0 ||
+        file_header.version != WAL_VERSION) {
+        log_message(LOG_ERROR, "Unsupported data log format in %s", path);
+        fclose(fp);
+        return 0;
+    }
+
+    union {
+        UserRecord user;
+        VideoRecord video;
+        HistoryRecord history;
+    } row;
+    WalHeader header;
+    int applied = 0;
+
+    while (fread(&header, sizeof(header), 1, fp) == 1) {
+        if (header.length > sizeof(row) || fread(&row, 1, header.length, fp) != header.length ||
+            hash_bytes(&row, header.length) != header.checksum) {
+            log_message(LOG_WARN, "Ignoring torn record at the end of %s", path);
+            *rewrite = 1;
             break;
         }
+
+        if (header.type == WAL_USER && header.length == sizeof(UserRecord)) {
+            load_user(&row);
+        } else if (header.type == WAL_VIDEO && header.length == sizeof(VideoRecord)) {
+            load_video(&row);
+        } else if (header.type == WAL_HISTORY && header.length == sizeof(HistoryRecord)) {
+            load_history(&row);
+        } else {
+            continue;
+        }
+        applied++;
+    }
+
+    fclose(fp);
+    return applied;
+}
+
+/* Read a legacy snapshot table row by row; returns the number of rows */
+static int read_legacy_table(const char* path, size_t row_size, void (*load)(const void* row)) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) return 0;
+
+    union {
+        User user;
+        Video video;
+        WatchHistory history;
+    } row;
+    int count = 0;
+    int loaded = 0;
+
+    if (row_size <= sizeof(row) && fread(&count, sizeof(int), 1, fp) == 1) {
+        while (loaded < count && fread(&row, row_size, 1, fp) == 1) {
+            load(&row);
+            loaded++;
+        }
+    }
+
+    fclose(fp);
+    return loaded;
+}
+
+/* FNV-1a over 64-bit words, fast enough to check large sections at startup */
+static uint64_t store_checksum(const void* data, size_t len) {
+    const unsigned char* p = data;
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, p + i, 8);
+        hash = (hash ^ word) * 1099511628211ULL;
+    }
+    for (; i < len; i++) {
+        hash = (hash ^ p[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/* Map the snapshot copy-on-write where mmap exists, else read it into memory */
+static char* store_map(const char* path, size_t* size) {
+#if defined(_WIN32)
+    FILE* fp = fopen(path, "rb");
+    if (!fp) return NULL;
+
+    _fseeki64(fp, 0, SEEK_END);
+    long long length = _ftelli64(fp);
+    _fseeki64(fp, 0, SEEK_SET);
+
+    char* data = length > 0 ? malloc((size_t)length) : NULL;
+    if (data && fread(data, 1, (size_t)length, fp) != (size_t)length) {
+        free(data);
+        data = NULL;
+    }
+    fclose(fp);
+    *size = (size_t)length;
+    return data;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    void* data = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return NULL;
+
+    *size = (size_t)st.st_size;
+    return data;
+#endif
+}
+
+static void store_unmap(char* data, size_t size) {
+#if defined(_WIN32)
+    (void)size;
+    free(data);
+#else
+    munmap(data, size);
+#endif
+}
+
+/* Row or bucket size of each section type, 0 if unknown */
+static uint32_t section_row_size(uint32_t type) {
+    switch (type) {
+    case SECTION_USERS: return sizeof(UserRecord);
+    case SECTION_VIDEOS: return sizeof(VideoRecord);
+    case SECTION_HISTORY_USERS: return sizeof(HistoryUserRecord);
+    case SECTION_HISTORY_ENTRIES: return sizeof(HistoryEntry);
+    case SECTION_USER_NAME_INDEX:
+    case SECTION_USER_ID_INDEX:
+    case SECTION_VIDEO_ID_INDEX:
+    case SECTION_HISTORY_USER_INDEX:
+        return sizeof(int32_t);
+    default: return 0;
     }
-    
-    if (slot < 0) {
-        /* Overwrite oldest */
-        slot = 0;
-        for (int i = 1; i < MAX_SESSIONS; i++) {
-            if (g_sessions[i].expires_at < g_sessions[slot].expires_at) {
-                slot = i;
+}
+
+/* Use a table's rows in place */
+static void attach_table(Table* t, const StoreSection* section, char* data) {
+    if (!section) return;
+    t->base = data + section->offset;
+    t->base_count = (int)section->count;
+    t->count = (int)section->count;
+}
+
+/* Use a mapped index if it fits its table, else build one */
+static void attach_index(Index* ix, const StoreSection* section, char* data) {
+    int size = section ? (int)section->count : 0;
+    if (size >= 64 && (size & (size - 1)) == 0 && size >= ix->table->count * 2) {
+        ix->buckets = (int32_t*)(data + section->offset);
+        ix->size = size;
+        ix->count = ix->table->count;
+        ix->owned = 0;
+    } else {
+        index_build(ix);
+    }
+}
+
+/*
+ * Map the snapshot and use its rows and indexes in place. Returns 1 if
+ * loaded, 0 if there is none, -1 if it is damaged.
+ */
+static int store_load(void) {
+    size_t size = 0;
+    char* data = store_map(STORE_FILE, &size);
+    if (!data) return 0;
+
+    StoreHeader* header = (StoreHeader*)data;
+    StoreSection* sections = (StoreSection*)(data + sizeof(StoreHeader));
+
+    int ok = size >= sizeof(StoreHeader) &&
+             memcmp(header->magic, STORE_MAGIC, sizeof(header->magic)) == 0 &&
+             header->version == STORE_VERSION &&
+             header->section_count <= (size - sizeof(StoreHeader)) / sizeof(StoreSection) &&
+             store_checksum(sections, sizeof(StoreSection) * header->section_count) == header->checksum;
+
+    for (uint32_t i = 0; ok && i < header->section_count; i++) {
+        StoreSection* s = &sections[i];
+        uint64_t length = s->count * s->row_size;
+        ok = s->offset % 8 == 0 && s->offset <= size && length <= size - s->offset &&
+             s->count <= INT32_MAX && s->part < HISTORY_SHARDS &&
+             store_checksum(data + s->offset, (size_t)length) == s->checksum;
+    }
+
+    if (!ok) {
+        store_unmap(data, size);
+        return -1;
+    }
+
+    /* Find each section by type and shard; sections from newer builds are skipped */
+    StoreSection* found[SECTION_HISTORY_USER_INDEX + 1][HISTORY_SHARDS];
+    memset(found, 0, sizeof(found));
+    for (uint32_t i = 0; i < header->section_count; i++) {
+        StoreSection* s = &sections[i];
+        if (s->type <= SECTION_HISTORY_USER_INDEX && s->row_size == section_row_size(s->type)) {
+            found[s->type][s->part] = s;
+        }
+    }
+
+    /* Each viewer's entries must lie within the shard's entry section */
+    for (int i = 0; ok && i < HISTORY_SHARDS; i++) {
+        StoreSection* users = found[SECTION_HISTORY_USERS][i];
+        StoreSection* entries = found[SECTION_HISTORY_ENTRIES][i];
+        uint64_t total = entries ? entries->count : 0;
+        HistoryUserRecord* rows = users ? (HistoryUserRecord*)(data + users->offset) : NULL;
+        for (uint64_t j = 0; ok && users && j < users->count; j++) {
+            ok = rows[j].first <= total && rows[j].count <= total - rows[j].first;
+        }
+    }
+
+    if (!ok) {
+        store_unmap(data, size);
+        return -1;
+    }
+
+    /* Tables first, then the indexes over them */
+    attach_table(&g_users, found[SECTION_USERS][0], data);
+    attach_index(&g_user_by_name, found[SECTION_USER_NAME_INDEX][0], data);
+    attach_index(&g_user_by_id, found[SECTION_USER_ID_INDEX][0], data);
+    attach_table(&g_videos, found[SECTION_VIDEOS][0], data);
+    attach_index(&g_video_by_id, found[SECTION_VIDEO_ID_INDEX][0], data);
+
+    for (int i = 0; i < HISTORY_SHARDS; i++) {
+        HistoryShard* shard = &g_history[i];
+        StoreSection* users = found[SECTION_HISTORY_USERS][i];
+        StoreSection* entries = found[SECTION_HISTORY_ENTRIES][i];
+
+        if (users) {
+            /* Viewers' vectors point into the entry section until they grow */
+            HistoryUserRecord* records = (HistoryUserRecord*)(data + users->offset);
+            HistoryEntry* base = entries ? (HistoryEntry*)(data + entries->offset) : NULL;
+            for (uint64_t j = 0; j < users->count; j++) {
+                int handle = table_add(&shard->users);
+                if (handle < 0) break;
+                UserHistory* uh = table_row(&shard->users, handle);
+                uh->user_id = records[j].user_id;
+                uh->count = (int32_t)records[j].count;
+                uh->entries = base + records[j].first;
+                shard->entry_count += uh->count;
             }
+            attach_index(&shard->by_user, found[SECTION_HISTORY_USER_INDEX][i], data);
         }
     }
-    
-    Session* session = &g_sessions[slot];
-    generate_session_token(session->token, sizeof(session->token));
-    session->user_id = user_id;
-    session->expires_at = now + SESSION_TIMEOUT;
-    session->active = 1;
-    
-    if (slot >= g_session_count) {
-        g_session_count = slot + 1;
+
+    /* The mapping stays for the life of the process */
+    return 1;
+}
+
+/* Snapshot contents gathered under the table locks */
+typedef struct {
+    uint32_t type;
+    uint32_t part;
+    uint32_t row_size;
+    uint64_t count;
+    void* data;
+} SectionData;
+
+static int add_table_section(SectionData* out, int* n, uint32_t type, uint32_t part, const Table* t) {
+    SectionData* s = &out[(*n)++];
+    s->type = type;
+    s->part = part;
+    s->row_size = (uint32_t)t->row_size;
+    s->count = (uint64_t)t->count;
+    s->data = table_copy(t);
+    return s->data ? 0 : -1;
+}
+
+static int add_index_section(SectionData* out, int* n, uint32_t type, uint32_t part, const Index* ix) {
+    SectionData* s = &out[(*n)++];
+    s->type = type;
+    s->part = part;
+    s->row_size = sizeof(int32_t);
+    s->count = (uint64_t)ix->size;
+    s->data = malloc(sizeof(int32_t) * (ix->size > 0 ? ix->size : 1));
+    if (!s->data) return -1;
+    memcpy(s->data, ix->buckets, sizeof(int32_t) * ix->size);
+    return 0;
+}
+
+/* A shard's viewers, and all their entries laid end to end */
+static int add_history_sections(SectionData* out, int* n, uint32_t part, const HistoryShard* shard) {
+    SectionData* users = &out[(*n)++];
+    SectionData* entries = &out[(*n)++];
+    int user_count = shard->users.count;
+
+    users->type = SECTION_HISTORY_USERS;
+    users->part = part;
+    users->row_size = sizeof(HistoryUserRecord);
+    users->count = (uint64_t)user_count;
+    users->data = malloc(sizeof(HistoryUserRecord) * (user_count > 0 ? user_count : 1));
+
+    entries->type = SECTION_HISTORY_ENTRIES;
+    entries->part = part;
+    entries->row_size = sizeof(HistoryEntry);
+    entries->count = (uint64_t)shard->entry_count;
+    entries->data = malloc(sizeof(HistoryEntry) * (shard->entry_count > 0 ? shard->entry_count : 1));
+
+    if (!users->data || !entries->data) return -1;
+
+    HistoryUserRecord* records = users->data;
+    HistoryEntry* dst = entries->data;
+    uint64_t first = 0;
+    for (int i = 0; i < user_count; i++) {
+        const UserHistory* uh = table_row(&shard->users, i);
+        records[i].user_id = uh->user_id;
+        records[i].count = (uint32_t)uh->count;
+        records[i].first = first;
+        memcpy(dst + first, uh->entries, sizeof(HistoryEntry) * uh->count);
+        first += uh->count;
     }
-    
-    pthread_mutex_unlock(&g_data_mutex);
-    return session;
+    return 0;
 }
 
-Session* session_find(const char* token) {
-    if (!token || !*token) return NULL;
-    
-    pthread_mutex_lock(&g_data_mutex);
-    time_t now = time(NULL);
-    
-    for (int i = 0; i < g_session_count; i++) {
-        if (g_sessions[i].active && 
-            strcmp(g_sessions[i].token, token) == 0 &&
-            g_sessions[i].expires_at > now) {
-            pthread_mutex_unlock(&g_data_mutex);
-            return &g_sessions[i];
+/* Write the snapshot through a temporary file and rename it into place */
+static int store_write(const SectionData* sections, int count) {
+    char tmp[MAX_PATH_LEN];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", STORE_FILE);
+
+    StoreSection* table = calloc(count, sizeof(StoreSection));
+    if (!table) return -1;
+
+    uint64_t offset = sizeof(StoreHeader) + sizeof(StoreSection) * count;
+    for (int i = 0; i < count; i++) {
+        offset = (offset + 7) & ~(uint64_t)7;
+        table[i].type = sections[i].type;
+        table[i].part = sections[i].part;
+        table[i].row_size = sections[i].row_size;
+        table[i].count = sections[i].count;
+        table[i].offset = offset;
+        table[i].checksum = store_checksum(sections[i].data, (size_t)(sections[i].count * sections[i].row_size));
+        offset += sections[i].count * sections[i].row_size;
+    }
+
+    StoreHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, STORE_MAGIC, sizeof(header.magic));
+    header.version = STORE_VERSION;
+    header.section_count = (uint32_t)count;
+    header.created_at = (int64_t)time(NULL);
+    header.checksum = store_checksum(table, sizeof(StoreSection) * count);
+
+    FILE* fp = fopen(tmp, "wb");
+    if (!fp) {
+        free(table);
+        return -1;
+    }
+
+    static const char padding[8] = { 0 };
+    uint64_t written = sizeof(StoreHeader) + sizeof(StoreSection) * count;
+    int ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+             fwrite(table, sizeof(StoreSection), count, fp) == (size_t)count;
+    for (int i = 0; ok && i < count; i++) {
+        size_t pad = (size_t)(table[i].offset - written);
+        size_t length = (size_t)(sections[i].count * sections[i].row_size);
+        ok = fwrite(padding, 1, pad, fp) == pad && fwrite(sections[i].data, 1, length, fp) == length;
+        written = table[i].offset + length;
+    }
+    free(table);
+
+    ok = ok && fflush(fp) == 0;
+    if (ok) sync_file(fp);
+    if (fclose(fp) != 0) ok = 0;
+
+#if defined(_WIN32)
+    if (ok && !MoveFileExA(tmp, STORE_FILE, MOVEFILE_REPLACE_EXISTING)) ok = 0;
+#else
+    if (ok && rename(tmp, STORE_FILE) != 0) ok = 0;
+
+    /* Make the rename itself durable */
+    int dir = ok ? open(DATA_DIR, O_RDONLY) : -1;
+    if (dir >= 0) {
+        fsync(dir);
+        close(dir);
+    }
+#endif
+    if (!ok) remove(tmp);
+    return ok ? 0 : -1;
+}
+
+/*
+ * Fold the log into the snapshot. The current log is set aside and a new
+ * one started before the tables are copied; every record in the
+ * set-aside log was applied in memory before it was written, so the
+ * copies include it. If an earlier snapshot failed, the current log is
+ * appended to the one it left instead. Writers are only blocked while
+ * their table is copied, and the sync tick only while the logs are
+ * swapped. Replaying a record twice after a crash is harmless because
+ * every record is a full row.
+ */
+static void wal_compact(void) {
+    pthread_mutex_lock(&g_snapshot_mutex);
+
+    pthread_mutex_lock(&g_compact_mutex);
+    pthread_mutex_lock(&g_wal_mutex);
+    g_compact_wanted = 0;
+    if (g_wal) {
+        fflush(g_wal);
+        sync_file(g_wal);
+        fclose(g_wal);
+        g_wal = NULL;
+    }
+
+    /* An old log still here means the last snapshot failed; it must not be overwritten */
+    FILE* old = fopen(WAL_OLD_FILE, "rb");
+    if (old) fclose(old);
+    if (old && wal_fold_into_old() < 0) {
+        g_wal = wal_open();
+        g_wal_bytes = g_wal ? ftell(g_wal) : 0;
+        pthread_mutex_unlock(&g_wal_mutex);
+        pthread_mutex_unlock(&g_compact_mutex);
+        pthread_mutex_unlock(&g_snapshot_mutex);
+        log_message(LOG_ERROR, "Cannot join the data log to the one left by a failed compaction");
+        return;
+    }
+    if (!old) rename(WAL_FILE, WAL_OLD_FILE);
+    g_wal = wal_open();
+    g_wal_bytes = 0;
+    g_wal_dirty = 0;
+    pthread_mutex_unlock(&g_wal_mutex);
+    pthread_mutex_unlock(&g_compact_mutex);
+
+    SectionData sections[5 + HISTORY_SHARDS * 3];
+    int count = 0;
+    int ok = 1;
+
+    READ_LOCK(&g_user_lock);
+    int user_count = g_users.count;
+    if (add_table_section(sections, &count, SECTION_USERS, 0, &g_users) < 0) ok = 0;
+    if (add_index_section(sections, &count, SECTION_USER_NAME_INDEX, 0, &g_user_by_name) < 0) ok = 0;
+    if (add_index_section(sections, &count, SECTION_USER_ID_INDEX, 0, &g_user_by_id) < 0) ok = 0;
+    READ_UNLOCK(&g_user_lock);
+
+    READ_LOCK(&g_video_lock);
+    int video_count = g_videos.count;
+    if (add_table_section(sections, &count, SECTION_VIDEOS, 0, &g_videos) < 0) ok = 0;
+    if (add_index_section(sections, &count, SECTION_VIDEO_ID_INDEX, 0, &g_video_by_id) < 0) ok = 0;
+    READ_UNLOCK(&g_video_lock);
+
+    int history_count = 0;
+    for (int i = 0; i < HISTORY_SHARDS; i++) {
+        READ_LOCK(&g_history[i].lock);
+        history_count += g_history[i].entry_count;
+        if (add_history_sections(sections, &count, i, &g_history[i]) < 0) ok = 0;
+        if (add_index_section(sections, &count, SECTION_HISTORY_USER_INDEX, i, &g_history[i].by_user) < 0) ok = 0;
+        READ_UNLOCK(&g_history[i].lock);
+    }
+
+    ok = ok && store_write(sections, count) == 0;
+    for (int i = 0; i < count; i++) {
+        free(sections[i].data);
+    }
+
+    if (ok) {
+        remove(WAL_OLD_FILE);
+        remove(LEGACY_USERS_FILE);
+        remove(LEGACY_VIDEOS_FILE);
+        remove(LEGACY_HISTORY_FILE);
+        log_message(LOG_DEBUG, "Compacted data log: %d users, %d videos, %d history records",
+                    user_count, video_count, history_count);
+    } else {
+        log_message(LOG_ERROR, "Failed to write data snapshot; keeping the log");
+    }
+
+    pthread_mutex_unlock(&g_snapshot_mutex);
+}
+
+/* Heap operations on session expiry; callers hold g_session_lock for writing */
+static int expiry_push(time_t expires_at, int handle) {
+    if (g_session_heap_count == g_session_heap_size) {
+        int size = g_session_heap_size > 0 ? g_session_heap_size * 2 : 64;
+        SessionExpiry* heap = realloc(g_session_heap, sizeof(SessionExpiry) * size);
+        if (!heap) return -1;
+        g_session_heap = heap;
+        g_session_heap_size = size;
+    }
+
+    int i = g_session_heap_count++;
+    while (i > 0 && g_session_heap[(i - 1) / 2].expires_at > expires_at) {
+        g_session_heap[i] = g_session_heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    g_session_heap[i].expires_at = expires_at;
+    g_session_heap[i].handle = handle;
+    return 0;
+}
+
+static void expiry_pop(void) {
+    SessionExpiry last = g_session_heap[--g_session_heap_count];
+    int i = 0;
+    for (;;) {
+        int child = i * 2 + 1;
+        if (child >= g_session_heap_count) break;
+        if (child + 1 < g_session_heap_count &&
+            g_session_heap[child + 1].expires_at < g_session_heap[child].expires_at) {
+            child++;
+        }
+        if (g_session_heap[child].expires_at >= last.expires_at) break;
+        g_session_heap[i] = g_session_heap[child];
+        i = child;
+    }
+    if (g_session_heap_count > 0) g_session_heap[i] = last;
+}
+
+/* Unindex a session and make its slot reusable (caller holds g_session_lock for writing) */
+static void session_release(int handle) {
+    /* If the free stack can't grow, the slot is just not reused */
+    if (g_session_free_count == g_session_free_size) {
+        int size = g_session_free_size > 0 ? g_session_free_size * 2 : 64;
+        int* stack = realloc(g_session_free, sizeof(int) * size);
+        if (stack) {
+            g_session_free = stack;
+            g_session_free_size = size;
+        }
+    }
+    index_remove(&g_session_by_token, handle);
+    ((Session*)table_row(&g_sessions, handle))->active = 0;
+    if (g_session_free_count < g_session_free_size) {
+        g_session_free[g_session_free_count++] = handle;
+    }
+}
+
+/* Evict up to SESSION_PURGE_BATCH sessions that have expired; returns how many */
+static int session_expire(time_t now) {
+    int evicted = 0;
+
+    WRITE_LOCK(&g_session_lock);
+    for (int n = 0; n < SESSION_PURGE_BATCH && g_session_heap_count > 0 &&
+                    g_session_heap[0].expires_at <= now; n++) {
+        SessionExpiry due = g_session_heap[0];
+        expiry_pop();
+
+        /* Skip entries of destroyed sessions, whose slot may hold a newer one */
+        Session* s = table_row(&g_sessions, due.handle);
+        if (s->active && s->expires_at == due.expires_at) {
+            session_release(due.handle);
+            evicted++;
+        }
+    }
+    WRITE_UNLOCK(&g_session_lock);
+
+    return evicted;
+}
+
+/*
+ * Background tick: flush and sync the log every DATA_SYNC_MS, evict
+ * expired sessions, and ask for compaction when the log grows.
+ */
+#if defined(_WIN32)
+static unsigned __stdcall data_worker(void* arg) {
+#else
+static void* data_worker(void* arg) {
+#endif
+    (void)arg;
+
+    for (;;) {
+        usleep((DATA_SYNC_MS > 0 ? DATA_SYNC_MS : 1000) * 1000);
+
+        /* Appends continue during the sync; compaction waits to swap the file */
+        pthread_mutex_lock(&g_compact_mutex);
+        pthread_mutex_lock(&g_wal_mutex);
+        FILE* wal = g_wal_dirty ? g_wal : NULL;
+        if (wal) fflush(wal);
+        g_wal_dirty = 0;
+        long long wal_bytes = g_wal_bytes;
+        pthread_mutex_unlock(&g_wal_mutex);
+
+        if (wal) sync_file(wal);
+        pthread_mutex_unlock(&g_compact_mutex);
+
+        int evicted = session_expire(time(NULL));
+        if (evicted > 0) {
+            log_message(LOG_DEBUG, "Expired %d sessions", evicted);
+        }
+
+        if (wal_bytes > (long long)DATA_WAL_COMPACT_MB * 1024 * 1024) {
+            pthread_mutex_lock(&g_wal_mutex);
+            g_compact_wanted = 1;
+            pthread_cond_signal(&g_compact_cond);
+            pthread_mutex_unlock(&g_wal_mutex);
         }
     }
-    pthread_mutex_unlock(&g_data_mutex);
+
+#if defined(_WIN32)
+    return 0;
+#else
     return NULL;
+#endif
 }
 
-void session_destroy(const char* token) {
-    pthread_mutex_lock(&g_data_mutex);
-    for (int i = 0; i < g_session_count; i++) {
-        if (strcmp(g_sessions[i].token, token) == 0) {
-            g_sessions[i].active = 0;
-            break;
+/* Compaction runs on its own thread so the sync tick keeps covering the new log */
+#if defined(_WIN32)
+static unsigned __stdcall compact_worker(void* arg) {
+#else
+static void* compact_worker(void* arg) {
+#endif
+    (void)arg;
+
+    for (;;) {
+        pthread_mutex_lock(&g_wal_mutex);
+        while (!g_compact_wanted) {
+            pthread_cond_wait(&g_compact_cond, &g_wal_mutex);
         }
+        pthread_mutex_unlock(&g_wal_mutex);
+
+        wal_compact();
     }
-    pthread_mutex_unlock(&g_data_mutex);
+
+#if defined(_WIN32)
+    return 0;
+#else
+    return NULL;
+#endif
 }
 
-/* Video functions */
-int video_add(const char* title, const char* filename, const char* thumbnail, int duration, const char* description) {
-    pthread_mutex_lock(&g_data_mutex);
-    
-    if (g_video_count >= MAX_VIDEOS) {
-        pthread_mutex_unlock(&g_data_mutex);
+/* Initialize data storage */
+static int file_init(void) {
+    if (!g_mutex_initialized) {
+        RWLOCK_INIT(&g_user_lock);
+        RWLOCK_INIT(&g_video_lock);
+        RWLOCK_INIT(&g_session_lock);
+        for (int i = 0; i < HISTORY_SHARDS; i++) {
+            RWLOCK_INIT(&g_history[i].lock);
+        }
+        pthread_mutex_init(&g_wal_mutex, NULL);
+        pthread_mutex_init(&g_compact_mutex, NULL);
+        pthread_mutex_init(&g_snapshot_mutex, NULL);
+        pthread_cond_init(&g_compact_cond, NULL);
+        g_mutex_initialized = 1;
+    }
+
+    /* Tables start empty and grow with the data */
+    table_init(&g_users, sizeof(UserRecord));
+    index_init(&g_user_by_name, &g_users, user_name_hash);
+    index_init(&g_user_by_id, &g_users, user_id_hash);
+    table_init(&g_videos, sizeof(VideoRecord));
+    index_init(&g_video_by_id, &g_videos, video_id_hash);
+    table_init(&g_sessions, sizeof(Session));
+    index_init(&g_session_by_token, &g_sessions, session_hash);
+    for (int i = 0; i < HISTORY_SHARDS; i++) {
+        table_init(&g_history[i].users, sizeof(UserHistory));
+        index_init(&g_history[i].by_user, &g_history[i].users, user_history_hash);
+        g_history[i].entry_count = 0;
+    }
+
+    log_message(LOG_INFO, "Data storage initialized (file store in %s)", DATA_DIR);
+    return 0;
+}
+
+/* Save data to file: fold the log into a fresh snapshot */
+static void file_save(void) {
+    wal_compact();
+}
+
+/* Load data from file */
+static void file_load(void) {
+    double started = monotonic_seconds();
+
+    int loaded = store_load();
+    if (loaded < 0) {
+        /* Keep the damaged file for inspection; the log may still hold recent changes */
+        char bad[MAX_PATH_LEN];
+        snprintf(bad, sizeof(bad), "%s.bad", STORE_FILE);
+        rename(STORE_FILE, bad);
+        log_message(LOG_ERROR, "Data snapshot is damaged, moved to %s", bad);
+    } else if (loaded == 0) {
+        read_legacy_table(LEGACY_USERS_FILE, sizeof(User), load_legacy_user);
+        read_legacy_table(LEGACY_VIDEOS_FILE, sizeof(Video), load_legacy_video);
+        read_legacy_table(LEGACY_HISTORY_FILE, sizeof(WatchHistory), load_legacy_history);
+    }
+
+    int history_count = 0;
+    for (int i = 0; i < HISTORY_SHARDS; i++) {
+        history_count += g_history[i].entry_count;
+    }
+    log_message(LOG_INFO, "Loaded %d users, %d videos, %d watch history records in %.1f ms",
+                g_users.count, g_videos.count, history_count, (monotonic_seconds() - started) * 1000);
+
+    /* Replay changes made since the snapshot, oldest log first */
+    int rewrite = 0;
+    int replayed_old = wal_replay(WAL_OLD_FILE, &rewrite);
+    int replayed = replayed_old + wal_replay(WAL_FILE, &rewrite);
+    if (replayed > 0) {
+        log_message(LOG_INFO, "Replayed %d logged changes", replayed);
+    }
+
+    /*
+     * A log left from an interrupted compaction, a torn log, or legacy
+     * tables are folded into a new snapshot now. Otherwise the current
+     * log stays and grows until the compaction thread takes it, so
+     * startup does not rewrite the snapshot.
+     */
+    if (replayed_old > 0 || rewrite || loaded <= 0) {
+        wal_compact();
+    } else {
+        pthread_mutex_lock(&g_wal_mutex);
+        g_wal = wal_open();
+        g_wal_bytes = g_wal ? ftell(g_wal) : 0;
+        pthread_mutex_unlock(&g_wal_mutex);
+        remove(WAL_OLD_FILE);
+    }
+
+#if defined(_WIN32)
+    HANDLE h = (HANDLE)_beginthreadex(NULL, 0, data_worker, NULL, 0, NULL);
+    if (h) CloseHandle(h);
+    h = (HANDLE)_beginthreadex(NULL, 0, compact_worker, NULL, 0, NULL);
+    if (h) CloseHandle(h);
+#else
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, data_worker, NULL) == 0) {
+        pthread_detach(thread);
+    }
+    if (pthread_create(&thread, NULL, compact_worker, NULL) == 0) {
+        pthread_detach(thread);
+    }
+#endif
+}
+
+/* User functions */
+static int file_user_find_by_username(const char* username, User* user) {
+    READ_LOCK(&g_user_lock);
+    UserRecord* u = find_user_by_name(username);
+    int found = u && u->active;
+    if (found) user_from_record(user, u);
+    READ_UNLOCK(&g_user_lock);
+
+    return found ? 0 : -1;
+}
+
+static int file_user_find_by_id(int id, User* user) {
+    READ_LOCK(&g_user_lock);
+    UserRecord* u = find_user_by_id(id);
+    int found = u && u->active;
+    if (found) user_from_record(user, u);
+    READ_UNLOCK(&g_user_lock);
+
+    return found ? 0 : -1;
+}
+
+/* Replace a password hash, unless it changed since old_hash was read */
+static int file_user_set_password_hash(int id, const char* old_hash, const char* new_hash) {
+    WRITE_LOCK(&g_user_lock);
+    UserRecord* u = find_user_by_id(id);
+    int replaced = u && strcmp(u->password_hash, old_hash) == 0;
+    if (replaced) {
+        copy_string(u->password_hash, sizeof(u->password_hash), new_hash);
+        wal_append(WAL_USER, u, sizeof(UserRecord));
+    }
+    WRITE_UNLOCK(&g_user_lock);
+
+    return replaced ? 0 : -1;
+}
+
+static int file_user_create(const char* username, const char* password_hash) {
+    WRITE_LOCK(&g_user_lock);
+
+    if (find_user_by_name(username)) {
+        WRITE_UNLOCK(&g_user_lock);
+        log_message(LOG_WARN, "Failed to create user: %s", username);
         return -1;
     }
-    
-    Video* v = &g_videos[g_video_count];
-    v->id = g_video_count + 1;
-    strncpy(v->title, title, sizeof(v->title) - 1);
-    strncpy(v->filename, filename, sizeof(v->filename) - 1);
-    strncpy(v->thumbnail, thumbnail, sizeof(v->thumbnail) - 1);
-    v->duration_sec = duration;
+
+    /* Ids follow the highest one; the newest user sits at the end of the table */
+    UserRecord row;
+    memset(&row, 0, sizeof(UserRecord));
+    row.id = g_users.count > 0 ? ((UserRecord*)table_row(&g_users, g_users.count - 1))->id + 1 : 1;
+    while (find_user_by_id(row.id)) row.id++;
+    copy_string(row.username, sizeof(row.username), username);
+    copy_string(row.password_hash, sizeof(row.password_hash), password_hash);
+    row.active = 1;
+
+    UserRecord* u = put_user(&row);
+    if (u) wal_append(WAL_USER, u, sizeof(UserRecord));
+
+    WRITE_UNLOCK(&g_user_lock);
+    if (!u) return -1;
+    log_message(LOG_INFO, "Created new user: %s", username);
+    return 0;
+}
+
+/* Session functions */
+
+/* Find a session by token (caller holds g_session_lock) */
+static int session_lookup(const char* token) {
+    unsigned int step = 0;
+    int handle;
+    while ((handle = index_probe(&g_session_by_token, hash_string(token), &step)) >= 0) {
+        Session* s = table_row(&g_sessions, handle);
+        if (strcmp(s->token, token) == 0) return handle;
+    }
+    return -1;
+}
+
+static int file_session_create(int user_id, Session* copy) {
+    WRITE_LOCK(&g_session_lock);
+
+    int handle = g_session_free_count > 0 ? g_session_free[--g_session_free_count]
+                                          : table_add(&g_sessions);
+    if (handle < 0) {
+        WRITE_UNLOCK(&g_session_lock);
+        return -1;
+    }
+
+    Session* session = table_row(&g_sessions, handle);
+    do {
+        if (generate_session_token(session->token, sizeof(session->token)) < 0) {
+            session->active = 0;
+            WRITE_UNLOCK(&g_session_lock);
+            return -1;
+        }
+    } while (session_lookup(session->token) >= 0);
+    session->user_id = user_id;
+    session->expires_at = time(NULL) + SESSION_TIMEOUT;
+    session->active = 1;
+
+    if (expiry_push(session->expires_at, handle) < 0 || index_insert(&g_session_by_token, handle) < 0) {
+        session->active = 0;
+        WRITE_UNLOCK(&g_session_lock);
+        return -1;
+    }
+
+    *copy = *session;
+    WRITE_UNLOCK(&g_session_lock);
+    return 0;
+}
+
+static int file_session_find(const char* token, Session* copy) {
+    READ_LOCK(&g_session_lock);
+    time_t now = time(NULL);
+
+    int handle = session_lookup(token);
+    Session* s = handle >= 0 ? table_row(&g_sessions, handle) : NULL;
+    int found = s && s->expires_at > now;
+    if (found) *copy = *s;
+    READ_UNLOCK(&g_session_lock);
+
+    return found ? 0 : -1;
+}
+
+static void file_session_destroy(const char* token) {
+    WRITE_LOCK(&g_session_lock);
+    int handle = session_lookup(token);
+    if (handle >= 0) session_release(handle);
+    WRITE_UNLOCK(&g_session_lock);
+}
+
+/* Video functions */
+static int file_video_add(const char* title, const char* filename, const char* thumbnail, int duration,
+                          const char* description) {
+    VideoRecord row;
+    memset(&row, 0, sizeof(VideoRecord));
+    copy_string(row.title, sizeof(row.title), title);
+    copy_string(row.filename, sizeof(row.filename), filename);
+    copy_string(row.thumbnail, sizeof(row.thumbnail), thumbnail);
+    row.duration_sec = duration;
     if (description) {
-        strncpy(v->description, description, sizeof(v->description) - 1);
-    }
-    
-    g_video_count++;
-    pthread_mutex_unlock(&g_data_mutex);
-    
-    data_save();
-    return v->id;
-}
-
-Video* video_find_by_id(int id) {
-    pthread_mutex_lock(&g_data_mutex);
-    for (int i = 0; i < g_video_count; i++) {
-        if (g_videos[i].id == id) {
-            pthread_mutex_unlock(&g_data_mutex);
-            return &g_videos[i];
+        copy_string(row.description, sizeof(row.description), description);
+    }
+
+    WRITE_LOCK(&g_video_lock);
+    row.id = g_videos.count + 1;
+    VideoRecord* v = put_video(&row);
+    if (v) wal_append(WAL_VIDEO, v, sizeof(VideoRecord));
+    WRITE_UNLOCK(&g_video_lock);
+
+    return v ? row.id : -1;
+}
+
+static int file_video_find_by_id(int id, Video* video) {
+    READ_LOCK(&g_video_lock);
+    VideoRecord* v = find_video(id);
+    if (v) video_from_record(video, v);
+    READ_UNLOCK(&g_video_lock);
+
+    return v ? 0 : -1;
+}
+
+static int file_videos_find(const int* ids, int count, Video* videos) {
+    int found = 0;
+
+    READ_LOCK(&g_video_lock);
+    for (int i = 0; i < count; i++) {
+        VideoRecord* v = find_video(ids[i]);
+        if (v) {
+            video_from_record(&videos[i], v);
+            found++;
+        } else {
+            memset(&videos[i], 0, sizeof(Video));
         }
     }
-    pthread_mutex_unlock(&g_data_mutex);
-    return NULL;
+    READ_UNLOCK(&g_video_lock);
+
+    return found;
 }
 
-int video_get_all(Video** videos) {
-    *videos = g_videos;
-    return g_video_count;
+static int file_video_set_duration(int id, int duration) {
+    WRITE_LOCK(&g_video_lock);
+    VideoRecord* v = find_video(id);
+    if (v) {
+        v->duration_sec = duration;
+        wal_append(WAL_VIDEO, v, sizeof(VideoRecord));
+    }
+    WRITE_UNLOCK(&g_video_lock);
+
+    return v ? 0 : -1;
 }
 
-int video_count(void) {
-    return g_video_count;
+static int file_video_get_all(Video** videos) {
+    READ_LOCK(&g_video_lock);
+    int count = g_videos.count;
+    *videos = count > 0 ? malloc(sizeof(Video) * count) : NULL;
+    if (!*videos) count = 0;
+    for (int i = 0; i < count; i++) {
+        video_from_record(&(*videos)[i], table_row(&g_videos, i));
+    }
+    READ_UNLOCK(&g_video_lock);
+
+    return count;
+}
+
+static int file_video_count(void) {
+    READ_LOCK(&g_video_lock);
+    int count = g_videos.count;
+    READ_UNLOCK(&g_video_lock);
+    return count;
 }
 
 /* Watch history functions */
-WatchHistory* history_find(int user_id, int video_id) {
-    pthread_mutex_lock(&g_data_mutex);
-    for (int i = 0; i < g_history_count; i++) {
-        if (g_history[i].user_id == user_id && g_history[i].video_id == video_id) {
-            pthread_mutex_unlock(&g_data_mutex);
-            return &g_history[i];
+static int file_history_find(int user_id, int video_id, WatchHistory* history) {
+    HistoryShard* shard = history_shard(user_id);
+
+    READ_LOCK(&shard->lock);
+    UserHistory* uh = find_user_history(shard, user_id);
+    int pos = uh ? find_entry(uh, video_id) : -1;
+    if (pos >= 0) history_from_entry(history, user_id, &uh->entries[pos]);
+    READ_UNLOCK(&shard->lock);
+
+    return pos >= 0 ? 0 : -1;
+}
+
+static int file_history_update(int user_id, int video_id, int position) {
+    HistoryShard* shard = history_shard(user_id);
+
+    HistoryRecord row;
+    memset(&row, 0, sizeof(HistoryRecord));
+    row.user_id = user_id;
+    row.video_id = video_id;
+    row.last_pos_sec = position;
+    row.updated_at = (int64_t)time(NULL);
+
+    WRITE_LOCK(&shard->lock);
+    int result = put_history(shard, &row);
+    if (result == 0) wal_append(WAL_HISTORY, &row, sizeof(HistoryRecord));
+    WRITE_UNLOCK(&shard->lock);
+
+    return result;
+}
+
+/* Store rows grouped by shard: one lock and one log write per shard */
+static int file_history_update_batch(const WatchHistory* rows, int count) {
+    HistoryRecord* records = malloc(sizeof(HistoryRecord) * count);
+    if (!records) return -1;
+
+    int starts[HISTORY_SHARDS + 1];
+    memset(starts, 0, sizeof(starts));
+    for (int i = 0; i < count; i++) {
+        starts[(unsigned int)rows[i].user_id % HISTORY_SHARDS + 1]++;
+    }
+    for (int s = 0; s < HISTORY_SHARDS; s++) starts[s + 1] += starts[s];
+
+    int fill[HISTORY_SHARDS];
+    memcpy(fill, starts, sizeof(fill));
+    int64_t now = (int64_t)time(NULL);
+    for (int i = 0; i < count; i++) {
+        HistoryRecord* row = &records[fill[(unsigned int)rows[i].user_id % HISTORY_SHARDS]++];
+        memset(row, 0, sizeof(HistoryRecord));
+        row->user_id = rows[i].user_id;
+        row->video_id = rows[i].video_id;
+        row->last_pos_sec = rows[i].last_pos_sec;
+        row->updated_at = rows[i].updated_at > 0 ? (int64_t)rows[i].updated_at : now;
+    }
+
+    int stored = 0;
+    for (int s = 0; s < HISTORY_SHARDS; s++) {
+        if (starts[s] == starts[s + 1]) continue;
+        HistoryShard* shard = &g_history[s];
+
+        WRITE_LOCK(&shard->lock);
+        int kept = starts[s];
+        for (int i = starts[s]; i < starts[s + 1]; i++) {
+            if (put_history(shard, &records[i]) == 0) records[kept++] = records[i];
         }
+        wal_append_rows(WAL_HISTORY, &records[starts[s]], sizeof(HistoryRecord), kept - starts[s]);
+        WRITE_UNLOCK(&shard->lock);
+
+        stored += kept - starts[s];
     }
-    pthread_mutex_unlock(&g_data_mutex);
-    return NULL;
+
+    free(records);
+    return stored;
 }
 
-int history_update(int user_id, int video_id, int position) {
-    pthread_mutex_lock(&g_data_mutex);
-    
-    /* Find existing record */
-    for (int i = 0; i < g_history_count; i++) {
-        if (g_history[i].user_id == user_id && g_history[i].video_id == video_id) {
-            g_history[i].last_pos_sec = position;
-            g_history[i].updated_at = time(NULL);
-            pthread_mutex_unlock(&g_data_mutex);
-            data_save();
-            return 0;
+/*
+ * Rank videos by watch activity over the last days: each history record
+ * counts 1 / (1 + age in days). Writes up to max_count video ids, most
+ * active first, and returns how many were written.
+ */
+static int file_history_top_videos(int days, int* video_ids, int max_count) {
+    /* Video ids are assigned densely from 1, so scores are indexed by id */
+    int size = file_video_count() + 1;
+    double* scores = calloc(size, sizeof(double));
+    if (!scores) return 0;
+    time_t now = time(NULL);
+
+    for (int s = 0; s < HISTORY_SHARDS; s++) {
+        HistoryShard* shard = &g_history[s];
+        READ_LOCK(&shard->lock);
+        for (int i = 0; i < shard->users.count; i++) {
+            UserHistory* uh = table_row(&shard->users, i);
+            for (int j = 0; j < uh->count; j++) {
+                HistoryEntry* e = &uh->entries[j];
+                double age_days = difftime(now, (time_t)e->updated_at) / 86400.0;
+                if (age_days < 0) age_days = 0;
+                if (age_days > days || e->video_id <= 0 || e->video_id >= size) continue;
+                scores[e->video_id] += 1.0 / (1.0 + age_days);
+            }
         }
+        READ_UNLOCK(&shard->lock);
     }
-    
-    /* Create new record */
-    if (g_history_count >= MAX_USERS * MAX_VIDEOS) {
-        pthread_mutex_unlock(&g_data_mutex);
-        return -1;
+
+    /* Partial selection: only the top max_count are needed */
+    int written = 0;
+    while (written < max_count) {
+        int best = 0;
+        for (int id = 1; id < size; id++) {
+            if (scores[id] > scores[best]) best = id;
+        }
+        if (best == 0) break;
+        video_ids[written++] = best;
+        scores[best] = 0;
     }
-    
-    WatchHistory* h = &g_history[g_history_count];
-    h->user_id = user_id;
-    h->video_id = video_id;
-    h->last_pos_sec = position;
-    h->updated_at = time(NULL);
-    g_history_count++;
-    
-    pthread_mutex_unlock(&g_data_mutex);
-    data_save();
-    return 0;
+
+    free(scores);
+    return written;
 }
 
-int history_get_user_history(int user_id, WatchHistory* out_history, int max_count) {
-    pthread_mutex_lock(&g_data_mutex);
+/* A viewer's history, most recently updated first */
+static int file_history_get_user_history(int user_id, WatchHistory* out_history, int max_count) {
+    HistoryShard* shard = history_shard(user_id);
     int count = 0;
-    
-    for (int i = 0; i < g_history_count && count < max_count; i++) {
-        if (g_history[i].user_id == user_id) {
-            out_history[count++] = g_history[i];
-        }
+
+    READ_LOCK(&shard->lock);
+    UserHistory* uh = find_user_history(shard, user_id);
+    for (int i = uh ? uh->count - 1 : -1; i >= 0 && count < max_count; i--) {
+        history_from_entry(&out_history[count++], user_id, &uh->entries[i]);
     }
-    
-    pthread_mutex_unlock(&g_data_mutex);
+    READ_UNLOCK(&shard->lock);
+
     return count;
 }
+
+const StorageBackend file_backend = {
+    "file",
+    file_init,
+    file_load,
+    file_save,
+    file_user_find_by_username,
+    file_user_find_by_id,
+    file_user_create,
+    file_user_set_password_hash,
+    file_session_create,
+    file_session_find,
+    file_session_destroy,
+    file_video_add,
+    file_video_find_by_id,
+    file_videos_find,
+    file_video_set_duration,
+    file_video_get_all,
+    file_video_count,
+    file_history_find,
+    file_history_update,
+    file_history_update_batch,
+    file_history_get_user_history,
+    file_history_top_videos
+};
@@ -1,16 +1,14 @@
 /*
  * OTT Video Streaming Server - PostgreSQL Database Module
- * Replaces data.c to provide DB storage
+ * The "postgres" storage backend (see backend.c), built with HAVE_POSTGRES
  */
 
 #include "common.h"
-#include "libpq-fe.h"
 
-/* Thread-local storage for return buffers */
 #if defined(_WIN32)
-    #define THREAD_LOCAL __declspec(thread)
+    #include "libpq-fe.h"
 #else
-    #define THREAD_LOCAL __thread
+    #include <libpq-fe.h>
 #endif
 
 /* Database connection */
@@ -25,9 +23,6 @@ static int g_db_initialized = 0;
 #define DB_USER "ott"
 #define DB_PASS "ott123"
 
-/* Forward declaration */
-unsigned long simple_hash(const char* str);
-
 /* Internal: Execute query and return result */
 static PGresult* db_query(const char* query) {
     if (!g_db_conn) return NULL;
@@ -64,9 +59,53 @@ static PGresult* db_query_params(const char* query, int nParams, const char* con
     return result;
 }
 
-/* Initialize database connection (Renamed to match main.c expectation) */
-void data_init(void) {
-    if (g_db_initialized) return;
+/*
+ * Delete expired sessions every SESSION_PURGE_SECONDS, SESSION_PURGE_BATCH
+ * rows per statement so requests get the connection between batches.
+ */
+#if defined(_WIN32)
+static unsigned __stdcall session_purge_worker(void* arg) {
+#else
+static void* session_purge_worker(void* arg) {
+#endif
+    (void)arg;
+    
+    char batch[16];
+    snprintf(batch, sizeof(batch), "%d", SESSION_PURGE_BATCH);
+    const char* params[1] = { batch };
+    
+    for (;;) {
+        sleep(SESSION_PURGE_SECONDS);
+        
+        int purged = 0;
+        int deleted;
+        do {
+            PGresult* result = db_query_params(
+                "DELETE FROM sessions WHERE id IN "
+                "(SELECT id FROM sessions WHERE expires_at < NOW() LIMIT $1::int)",
+                1, params);
+            if (!result) break;
+            
+            deleted = atoi(PQcmdTuples(result));
+            purged += deleted;
+            PQclear(result);
+        } while (deleted == SESSION_PURGE_BATCH);
+        
+        if (purged > 0) {
+            log_message(LOG_DEBUG, "Purged %d expired sessions", purged);
+        }
+    }
+    
+#if defined(_WIN32)
+    return 0;
+#else
+    return NULL;
+#endif
+}
+
+/* Connect to the database */
+static int pg_init(void) {
+    if (g_db_initialized) return 0;
     
     pthread_mutex_init(&g_db_mutex, NULL);
     
@@ -83,15 +122,26 @@ void data_init(void) {
         log_message(LOG_ERROR, "PostgreSQL connection failed: %s", PQerrorMessage(g_db_conn));
         PQfinish(g_db_conn);
         g_db_conn = NULL;
-        return;
+        return -1;
     }
     
     g_db_initialized = 1;
     log_message(LOG_INFO, "Connected to PostgreSQL database successfully");
+    
+#if defined(_WIN32)
+    HANDLE h = (HANDLE)_beginthreadex(NULL, 0, session_purge_worker, NULL, 0, NULL);
+    if (h) CloseHandle(h);
+#else
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, session_purge_worker, NULL) == 0) {
+        pthread_detach(thread);
+    }
+#endif
+    return 0;
 }
 
-/* Cleanup (Called by main.c:data_save) */
-void data_save(void) {
+/* Close the connection at shutdown */
+static void pg_save(void) {
     if (g_db_conn) {
         PQfinish(g_db_conn);
         g_db_conn = NULL;
@@ -100,48 +150,53 @@ void data_save(void) {
     g_db_initialized = 0;
 }
 
-/* Legacy: Load data (No-op for DB) */
-void data_load(void) {
-    // Database is already loaded
+/* Nothing to load: rows are read on demand */
+static void pg_load(void) {
+}
+
+/* Build a PostgreSQL array literal such as {1,2,3} from every stride-th int */
+static char* int_array(const int* values, int count, size_t stride) {
+    char* text = malloc((size_t)count * 12 + 3);
+    if (!text) return NULL;
+    
+    size_t len = 0;
+    text[len++] = '{';
+    for (int i = 0; i < count; i++) {
+        const int* value = (const int*)((const char*)values + stride * i);
+        len += sprintf(text + len, i > 0 ? ",%d" : "%d", *value);
+    }
+    text[len++] = '}';
+    text[len] = '\0';
+    return text;
 }
 
 /* ==================== USER FUNCTIONS ==================== */
 
-User* user_find_by_username(const char* username) {
-    fprintf(stderr, "DEBUG: user_find_by_username called for '%s'\n", username);
-    static THREAD_LOCAL User user;
-    memset(&user, 0, sizeof(User));
-    
+static void user_from_row(PGresult* result, int row, User* user) {
+    memset(user, 0, sizeof(User));
+    user->id = atoi(PQgetvalue(result, row, 0));
+    strncpy(user->username, PQgetvalue(result, row, 1), sizeof(user->username) - 1);
+    strncpy(user->password_hash, PQgetvalue(result, row, 2), sizeof(user->password_hash) - 1);
+    user->active = (PQgetvalue(result, row, 3)[0] == 't') ? 1 : 0;
+}
+
+static int pg_user_find_by_username(const char* username, User* user) {
     const char* params[1] = { username };
     PGresult* result = db_query_params(
         "SELECT id, username, password_hash, active FROM users WHERE username = $1",
         1, params);
     
-    if (!result) {
-        fprintf(stderr, "DEBUG: db_query_params returned NULL\n");
-        return NULL;
-    }
-
-    if (PQntuples(result) == 0) {
-        fprintf(stderr, "DEBUG: No user found for '%s'\n", username);
+    if (!result || PQntuples(result) == 0) {
         if (result) PQclear(result);
-        return NULL;
+        return -1;
     }
     
-    user.id = atoi(PQgetvalue(result, 0, 0));
-    strncpy(user.username, PQgetvalue(result, 0, 1), sizeof(user.username) - 1);
-    strncpy(user.password_hash, PQgetvalue(result, 0, 2), sizeof(user.password_hash) - 1);
-    user.active = (PQgetvalue(result, 0, 3)[0] == 't') ? 1 : 0;
-    
-    fprintf(stderr, "DEBUG: User found: %s\n", username);
+    user_from_row(result, 0, user);
     PQclear(result);
-    return &user;
+    return 0;
 }
 
-User* user_find_by_id(int id) {
-    static THREAD_LOCAL User user;
-    memset(&user, 0, sizeof(User));
-    
+static int pg_user_find_by_id(int id, User* user) {
     char id_str[16];
     snprintf(id_str, sizeof(id_str), "%d", id);
     
@@ -152,30 +207,32 @@ User* user_find_by_id(int id) {
     
     if (!result || PQntuples(result) == 0) {
         if (result) PQclear(result);
-        return NULL;
+        return -1;
     }
     
-    user.id = atoi(PQgetvalue(result, 0, 0));
-    strncpy(user.username, PQgetvalue(result, 0, 1), sizeof(user.username) - 1);
-    strncpy(user.password_hash, PQgetvalue(result, 0, 2), sizeof(user.password_hash) - 1);
-    user.active = (PQgetvalue(result, 0, 3)[0] == 't') ? 1 : 0;
-    
+    user_from_row(result, 0, user);
     PQclear(result);
-    return &user;
+    return 0;
 }
 
-int user_verify_password(User* user, const char* password) {
-    char hash_str[256];
-    snprintf(hash_str, sizeof(hash_str), "%lu", simple_hash(password));
-    log_message(LOG_INFO, "Login Verify: Username=%s, StoredHash=%s, ComputedHash=%s", user->username, user->password_hash, hash_str);
-    return strcmp(user->password_hash, hash_str) == 0;
+/* Replace a password hash, unless it changed since old_hash was read */
+static int pg_user_set_password_hash(int id, const char* old_hash, const char* new_hash) {
+    char id_str[16];
+    snprintf(id_str, sizeof(id_str), "%d", id);
+    
+    const char* params[3] = { id_str, new_hash, old_hash };
+    PGresult* result = db_query_params(
+        "UPDATE users SET password_hash = $2 WHERE id = $1 AND password_hash = $3",
+        3, params);
+    if (!result) return -1;
+    
+    int updated = atoi(PQcmdTuples(result));
+    PQclear(result);
+    return updated > 0 ? 0 : -1;
 }
 
-int user_create(const char* username, const char* password) {
-    char hash_str[256];
-    snprintf(hash_str, sizeof(hash_str), "%lu", simple_hash(password));
-
-    const char* params[2] = { username, hash_str };
+static int pg_user_create(const char* username, const char* password_hash) {
+    const char* params[2] = { username, password_hash };
     PGresult* result = db_query_params(
         "INSERT INTO users (username, password_hash) VALUES ($1, $2)",
         2, params);
@@ -192,7 +249,27 @@ int user_create(const char* username, const char* password) {
 
 /* ==================== VIDEO FUNCTIONS ==================== */
 
-int video_add(const char* title, const char* filename, const char* thumbnail, int duration, const char* description) {
+#define VIDEO_COLUMNS "id, title, filename, thumbnail, duration_sec, description"
+
+static void video_from_row(PGresult* result, int row, Video* video) {
+    memset(video, 0, sizeof(Video));
+    video->id = atoi(PQgetvalue(result, row, 0));
+    strncpy(video->title, PQgetvalue(result, row, 1), sizeof(video->title) - 1);
+    strncpy(video->filename, PQgetvalue(result, row, 2), sizeof(video->filename) - 1);
+    
+    if (!PQgetisnull(result, row, 3)) {
+        strncpy(video->thumbnail, PQgetvalue(result, row, 3), sizeof(video->thumbnail) - 1);
+    }
+    
+    video->duration_sec = atoi(PQgetvalue(result, row, 4));
+    
+    if (!PQgetisnull(result, row, 5)) {
+        strncpy(video->description, PQgetvalue(result, row, 5), sizeof(video->description) - 1);
+    }
+}
+
+static int pg_video_add(const char* title, const char* filename, const char* thumbnail, int duration,
+                        const char* description) {
     char duration_str[16];
     snprintf(duration_str, sizeof(duration_str), "%d", duration);
     
@@ -216,78 +293,90 @@ int video_add(const char* title, const char* filename, const char* thumbnail, in
     return id;
 }
 
-Video* video_find_by_id(int id) {
-    static THREAD_LOCAL Video video;
-    memset(&video, 0, sizeof(Video));
-    
+static int pg_video_find_by_id(int id, Video* video) {
     char id_str[16];
     snprintf(id_str, sizeof(id_str), "%d", id);
     
     const char* params[1] = { id_str };
     PGresult* result = db_query_params(
-        "SELECT id, title, filename, thumbnail, duration_sec, description FROM videos WHERE id = $1",
+        "SELECT " VIDEO_COLUMNS " FROM videos WHERE id = $1",
         1, params);
     
     if (!result || PQntuples(result) == 0) {
         if (result) PQclear(result);
-        return NULL;
+        return -1;
     }
     
-    video.id = atoi(PQgetvalue(result, 0, 0));
-    strncpy(video.title, PQgetvalue(result, 0, 1), sizeof(video.title) - 1);
-    strncpy(video.filename, PQgetvalue(result, 0, 2), sizeof(video.filename) - 1);
-    
-    char* thumb = PQgetvalue(result, 0, 3);
-    if (thumb && !PQgetisnull(result, 0, 3)) {
-        strncpy(video.thumbnail, thumb, sizeof(video.thumbnail) - 1);
+    video_from_row(result, 0, video);
+    PQclear(result);
+    return 0;
+}
+
+/* One query for all ids */
+static int pg_videos_find(const int* ids, int count, Video* videos) {
+    for (int i = 0; i < count; i++) {
+        memset(&videos[i], 0, sizeof(Video));
     }
     
-    video.duration_sec = atoi(PQgetvalue(result, 0, 4));
+    char* id_list = int_array(ids, count, sizeof(int));
+    if (!id_list) return 0;
     
-    char* desc = PQgetvalue(result, 0, 5);
-    if (desc && !PQgetisnull(result, 0, 5)) {
-        strncpy(video.description, desc, sizeof(video.description) - 1);
+    const char* params[1] = { id_list };
+    PGresult* result = db_query_params(
+        "SELECT " VIDEO_COLUMNS " FROM videos WHERE id = ANY($1::int[])",
+        1, params);
+    free(id_list);
+    if (!result) return 0;
+    
+    int found = 0;
+    for (int row = 0; row < PQntuples(result); row++) {
+        int id = atoi(PQgetvalue(result, row, 0));
+        for (int i = 0; i < count; i++) {
+            if (ids[i] == id) {
+                video_from_row(result, row, &videos[i]);
+                found++;
+            }
+        }
     }
     
     PQclear(result);
-    return &video;
+    return found;
 }
 
-int video_get_all(Video** videos) {
-    static THREAD_LOCAL Video video_buffer[MAX_VIDEOS];
+static int pg_video_set_duration(int id, int duration) {
+    char id_str[16], duration_str[16];
+    snprintf(id_str, sizeof(id_str), "%d", id);
+    snprintf(duration_str, sizeof(duration_str), "%d", duration);
+    
+    const char* params[2] = { id_str, duration_str };
+    PGresult* result = db_query_params(
+        "UPDATE videos SET duration_sec = $2 WHERE id = $1", 2, params);
+    
+    if (!result) return -1;
     
-    PGresult* result = db_query(
-        "SELECT id, title, filename, thumbnail, duration_sec, description FROM videos ORDER BY id");
+    PQclear(result);
+    return 0;
+}
+
+static int pg_video_get_all(Video** videos) {
+    *videos = NULL;
     
+    PGresult* result = db_query("SELECT " VIDEO_COLUMNS " FROM videos ORDER BY id");
     if (!result) return 0;
     
     int count = PQntuples(result);
-    if (count > MAX_VIDEOS) count = MAX_VIDEOS;
+    *videos = count > 0 ? malloc(sizeof(Video) * count) : NULL;
+    if (!*videos) count = 0;
     
     for (int i = 0; i < count; i++) {
-        video_buffer[i].id = atoi(PQgetvalue(result, i, 0));
-        strncpy(video_buffer[i].title, PQgetvalue(result, i, 1), sizeof(video_buffer[i].title) - 1);
-        strncpy(video_buffer[i].filename, PQgetvalue(result, i, 2), sizeof(video_buffer[i].filename) - 1);
-        
-        char* thumb = PQgetvalue(result, i, 3);
-        if (thumb && !PQgetisnull(result, i, 3)) {
-            strncpy(video_buffer[i].thumbnail, thumb, sizeof(video_buffer[i].thumbnail) - 1);
-        }
-        
-        video_buffer[i].duration_sec = atoi(PQgetvalue(result, i, 4));
-        
-        char* desc = PQgetvalue(result, i, 5);
-        if (desc && !PQgetisnull(result, i, 5)) {
-            strncpy(video_buffer[i].description, desc, sizeof(video_buffer[i].description) - 1);
-        }
+        video_from_row(result, i, &(*videos)[i]);
     }
     
     PQclear(result);
-    *videos = video_buffer;
     return count;
 }
 
-int video_count(void) {
+static int pg_video_count(void) {
     PGresult* result = db_query("SELECT COUNT(*) FROM videos");
     if (!result) return 0;
     
@@ -298,39 +387,33 @@ int video_count(void) {
 
 /* ==================== SESSION FUNCTIONS ==================== */
 
-Session* session_create(int user_id) {
-    static THREAD_LOCAL Session session;
-    memset(&session, 0, sizeof(Session));
+static int pg_session_create(int user_id, Session* session) {
+    memset(session, 0, sizeof(Session));
     
     char user_id_str[16];
     snprintf(user_id_str, sizeof(user_id_str), "%d", user_id);
     
     /* Generate random token */
-    generate_session_token(session.token, sizeof(session.token));
+    if (generate_session_token(session->token, sizeof(session->token)) < 0) return -1;
     
-    const char* params[2] = { user_id_str, session.token };
+    const char* params[2] = { user_id_str, session->token };
     PGresult* result = db_query_params(
         "INSERT INTO sessions (user_id, token, expires_at) "
         "VALUES ($1, $2, NOW() + INTERVAL '24 hours') RETURNING id",
         2, params);
     
-    if (!result) return NULL;
+    if (!result) return -1;
     
-    session.user_id = user_id;
-    session.active = 1;
-    session.expires_at = time(NULL) + SESSION_TIMEOUT;
+    session->user_id = user_id;
+    session->active = 1;
+    session->expires_at = time(NULL) + SESSION_TIMEOUT;
     
     PQclear(result);
     log_message(LOG_INFO, "Created session for user_id=%d", user_id);
-    return &session;
+    return 0;
 }
 
-Session* session_find(const char* token) {
-    static THREAD_LOCAL Session session;
-    memset(&session, 0, sizeof(Session));
-    
-    if (!token || !*token) return NULL;
-    
+static int pg_session_find(const char* token, Session* session) {
     const char* params[1] = { token };
     PGresult* result = db_query_params(
         "SELECT user_id, token FROM sessions "
@@ -339,18 +422,19 @@ Session* session_find(const char* token) {
     
     if (!result || PQntuples(result) == 0) {
         if (result) PQclear(result);
-        return NULL;
+        return -1;
     }
     
-    session.user_id = atoi(PQgetvalue(result, 0, 0));
-    strncpy(session.token, PQgetvalue(result, 0, 1), sizeof(session.token) - 1);
-    session.active = 1;
+    memset(session, 0, sizeof(Session));
+    session->user_id = atoi(PQgetvalue(result, 0, 0));
+    strncpy(session->token, PQgetvalue(result, 0, 1), sizeof(session->token) - 1);
+    session->active = 1;
     
     PQclear(result);
-    return &session;
+    return 0;
 }
 
-void session_destroy(const char* token) {
+static void pg_session_destroy(const char* token) {
     const char* params[1] = { token };
     PGresult* result = db_query_params("DELETE FROM sessions WHERE token = $1", 1, params);
     if (result) PQclear(result);
@@ -359,10 +443,7 @@ void session_destroy(const char* token) {
 
 /* ==================== WATCH HISTORY FUNCTIONS ==================== */
 
-WatchHistory* history_find(int user_id, int video_id) {
-    static THREAD_LOCAL WatchHistory history;
-    memset(&history, 0, sizeof(WatchHistory));
-    
+static int pg_history_find(int user_id, int video_id, WatchHistory* history) {
     char user_id_str[16], video_id_str[16];
     snprintf(user_id_str, sizeof(user_id_str), "%d", user_id);
     snprintf(video_id_str, sizeof(video_id_str), "%d", video_id);
@@ -375,18 +456,19 @@ WatchHistory* history_find(int user_id, int video_id) {
     
     if (!result || PQntuples(result) == 0) {
         if (result) PQclear(result);
-        return NULL;
+        return -1;
     }
     
-    history.user_id = atoi(PQgetvalue(result, 0, 0));
-    history.video_id = atoi(PQgetvalue(result, 0, 1));
-    history.last_pos_sec = atoi(PQgetvalue(result, 0, 2));
+    memset(history, 0, sizeof(WatchHistory));
+    history->user_id = atoi(PQgetvalue(result, 0, 0));
+    history->video_id = atoi(PQgetvalue(result, 0, 1));
+    history->last_pos_sec = atoi(PQgetvalue(result, 0, 2));
     
     PQclear(result);
-    return &history;
+    return 0;
 }
 
-int history_update(int user_id, int video_id, int position) {
+static int pg_history_update(int user_id, int video_id, int position) {
     char user_id_str[16], video_id_str[16], pos_str[16];
     snprintf(user_id_str, sizeof(user_id_str), "%d", user_id);
     snprintf(video_id_str, sizeof(video_id_str), "%d", video_id);
@@ -406,7 +488,82 @@ int history_update(int user_id, int video_id, int position) {
     return 0;
 }
 
-int history_get_user_history(int user_id, WatchHistory* out_history, int max_count) {
+/*
+ * Upsert all rows in one statement from arrays. The last row for a
+ * user and video wins, since one statement can't update a row twice.
+ */
+static int pg_history_update_batch(const WatchHistory* rows, int count) {
+    char* users = int_array(&rows[0].user_id, count, sizeof(WatchHistory));
+    char* videos = int_array(&rows[0].video_id, count, sizeof(WatchHistory));
+    char* positions = int_array(&rows[0].last_pos_sec, count, sizeof(WatchHistory));
+    char* updated = malloc((size_t)count * 21 + 3);
+    if (updated) {
+        size_t len = 0;
+        updated[len++] = '{';
+        for (int i = 0; i < count; i++) {
+            len += sprintf(updated + len, i > 0 ? ",%lld" : "%lld", (long long)rows[i].updated_at);
+        }
+        strcpy(updated + len, "}");
+    }
+    
+    int stored = -1;
+    if (users && videos && positions && updated) {
+        const char* params[4] = { users, videos, positions, updated };
+        PGresult* result = db_query_params(
+            "INSERT INTO watch_history (user_id, video_id, last_pos_sec, updated_at) "
+            "SELECT DISTINCT ON (u, v) u, v, p, "
+            "CASE WHEN t > 0 THEN to_timestamp(t) ELSE NOW() END "
+            "FROM unnest($1::int[], $2::int[], $3::int[], $4::bigint[]) WITH ORDINALITY AS r(u, v, p, t, n) "
+            "ORDER BY u, v, n DESC "
+            "ON CONFLICT (user_id, video_id) DO UPDATE "
+            "SET last_pos_sec = EXCLUDED.last_pos_sec, updated_at = EXCLUDED.updated_at",
+            4, params);
+        if (result) {
+            stored = atoi(PQcmdTuples(result));
+            PQclear(result);
+        }
+    }
+    
+    free(users);
+    free(videos);
+    free(positions);
+    free(updated);
+    return stored;
+}
+
+/*
+ * Rank videos by watch activity over the last days: each history row
+ * counts 1 / (1 + age in days). Writes up to max_count video ids, most
+ * active first, and returns how many were written.
+ */
+static int pg_history_top_videos(int days, int* video_ids, int max_count) {
+    char days_str[16];
+    char limit_str[16];
+    snprintf(days_str, sizeof(days_str), "%d", days);
+    snprintf(limit_str, sizeof(limit_str), "%d", max_count);
+    
+    const char* params[2] = { days_str, limit_str };
+    PGresult* result = db_query_params(
+        "SELECT video_id, "
+        "SUM(1.0 / (1.0 + EXTRACT(EPOCH FROM (NOW() - updated_at)) / 86400.0)) AS score "
+        "FROM watch_history WHERE updated_at > NOW() - ($1::int * INTERVAL '1 day') "
+        "GROUP BY video_id ORDER BY score DESC LIMIT $2::int",
+        2, params);
+    
+    if (!result) return 0;
+    
+    int count = PQntuples(result);
+    if (count > max_count) count = max_count;
+    
+    for (int i = 0; i < count; i++) {
+        video_ids[i] = atoi(PQgetvalue(result, i, 0));
+    }
+    
+    PQclear(result);
+    return count;
+}
+
+static int pg_history_get_user_history(int user_id, WatchHistory* out_history, int max_count) {
     char user_id_str[16];
     snprintf(user_id_str, sizeof(user_id_str), "%d", user_id);
     
@@ -430,3 +587,28 @@ int history_get_user_history(int user_id, WatchHistory* out_history, int max_cou
     PQclear(result);
     return count;
 }
+
+const StorageBackend postgres_backend = {
+    "postgres",
+    pg_init,
+    pg_load,
+    pg_save,
+    pg_user_find_by_username,
+    pg_user_find_by_id,
+    pg_user_create,
+    pg_user_set_password_hash,
+    pg_session_create,
+    pg_session_find,
+    pg_session_destroy,
+    pg_video_add,
+    pg_video_find_by_id,
+    pg_videos_find,
+    pg_video_set_duration,
+    pg_video_get_all,
+    pg_video_count,
+    pg_history_find,
+    pg_history_update,
+    pg_history_update_batch,
+    pg_history_get_user_history,
+    pg_history_top_videos
+};
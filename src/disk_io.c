@@ -0,0 +1,700 @@
+/*
+ * OTT Video Streaming Server - Disk I/O Thread Pools
+ * Blocking file reads run on a small thread pool per storage device so a
+ * slow disk only stalls requests for files on that disk. Each device has
+ * its own queue-depth limit; network workers post read jobs and wait for
+ * them with a short timeout instead of blocking inside read() themselves.
+ * A device counts as saturated once the workers waiting on it reach their
+ * share of the worker pool, so a hung disk can't hold every worker. Only
+ * network workers count; prefetch and warmup threads mark themselves as
+ * background readers. A response body already under way waits for queue
+ * space and for its reads on a longer budget, since it has no way left to
+ * report a refusal.
+ *
+ * Reads are issued on DISK_IO_ALIGN boundaries into aligned buffers, so
+ * the same pools also serve descriptors opened with disk_open_direct.
+ *
+ * Identical reads in flight are coalesced: a request for the same file,
+ * offset and length attaches to the existing job instead of reading the
+ * bytes again. Attaching takes a reference with a CAS and no lock.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+    #define _GNU_SOURCE
+#endif
+
+#include "common.h"
+
+#if defined(_WIN32)
+    #include <io.h>
+    #include <sys/stat.h>
+#endif
+
+#define MAX_DISK_DEVICES 8
+#define MAX_DISK_JOBS 512
+#define DISK_IO_MAX_READ (1024 * 1024)
+
+/* Sector alignment required for unbuffered reads */
+#define DISK_IO_ALIGN 4096
+
+/* Idle block-sized buffers kept for reuse */
+#define DISK_BUFFER_POOL 64
+#define DISK_POOL_BUFFER_SIZE (DISK_IO_BLOCK_SIZE + 2 * DISK_IO_ALIGN)
+
+/* Direct-mapped table of reads in flight */
+#define DISK_FLIGHT_SLOTS 1024
+
+#define JOB_FREE 0
+#define JOB_QUEUED 1
+#define JOB_RUNNING 2
+#define JOB_DONE 3
+
+typedef struct {
+    volatile int state;
+    volatile int refs;    /* requesters attached; the last release frees it */
+    int abandoned;        /* caller gave up waiting; worker frees the job */
+    int device;
+    int fd;               /* private duplicate, closed when the read finishes */
+    long long file;       /* device and file identity, 0 if unknown */
+    int flight;           /* slot in g_inflight */
+    long long offset;
+    long length;
+    long result;
+    long skip;            /* bytes before offset in the aligned read */
+    long span;            /* aligned read length */
+    long capacity;        /* buffer size */
+    char* buffer;
+    int next;             /* next job in the device queue, -1 at the tail */
+} DiskJob;
+
+typedef struct {
+    long long dev;
+    int in_use;
+    int queue_head;
+    int queue_tail;
+    int depth;            /* queued + running jobs */
+    int waiters;          /* network workers blocked in disk_io_wait on this device */
+    pthread_cond_t work_cond;
+    long long completed;
+    long long rejected;
+    long long timeouts;
+    volatile long long coalesced;
+    double busy_seconds;
+    double latency_ms;    /* smoothed read latency */
+} DiskDevice;
+
+static DiskJob g_jobs[MAX_DISK_JOBS];
+static DiskDevice g_devices[MAX_DISK_DEVICES];
+static volatile int g_inflight[DISK_FLIGHT_SLOTS];   /* job index + 1, 0 if empty */
+static char* g_buffer_pool[DISK_BUFFER_POOL];
+static int g_buffer_pool_count = 0;
+static pthread_mutex_t g_io_mutex;
+static pthread_cond_t g_done_cond;
+static int g_threads_per_device = 4;
+static int g_queue_depth = 64;
+static int g_max_waiters = 4;
+static volatile int g_io_running = 1;
+
+/* Set on prefetch and warmup threads; their waits don't use the worker share */
+static THREAD_LOCAL int t_background = 0;
+
+/* Initialize the disk I/O layer; max_waiters is how many threads may wait on one device */
+void disk_io_init(int threads_per_device, int queue_depth, int max_waiters) {
+    pthread_mutex_init(&g_io_mutex, NULL);
+    pthread_cond_init(&g_done_cond, NULL);
+    memset(g_jobs, 0, sizeof(g_jobs));
+    memset(g_devices, 0, sizeof(g_devices));
+    memset((void*)g_inflight, 0, sizeof(g_inflight));
+
+    g_threads_per_device = threads_per_device > 0 ? threads_per_device : 1;
+    g_queue_depth = queue_depth > 0 ? queue_depth : 1;
+    g_max_waiters = max_waiters > 0 ? max_waiters : 1;
+
+    log_message(LOG_INFO, "Disk I/O pools: %d threads, %d queued reads and %d waiting workers per device",
+                g_threads_per_device, g_queue_depth, g_max_waiters);
+}
+
+/* Mark the calling thread as a background reader */
+void disk_io_background(void) {
+    t_background = 1;
+}
+
+/* Open a file for positioned reads; reports its size and device */
+int disk_open(const char* path, long* size, long long* dev) {
+#if defined(_WIN32)
+    int fd = _open(path, _O_RDONLY | _O_BINARY);
+    if (fd < 0) return -1;
+
+    struct _stat64 st;
+    if (_fstat64(fd, &st) != 0 || (st.st_mode & _S_IFDIR)) {
+        _close(fd);
+        return -1;
+    }
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || S_ISDIR(st.st_mode)) {
+        close(fd);
+        return -1;
+    }
+#endif
+
+    if (size) *size = (long)st.st_size;
+    if (dev) *dev = (long long)st.st_dev;
+    return fd;
+}
+
+/*
+ * Open a file for unbuffered reads that bypass the page cache. Returns -1
+ * where the platform or filesystem doesn't support it; callers then fall
+ * back to disk_open.
+ */
+int disk_open_direct(const char* path) {
+#if defined(_WIN32)
+    HANDLE h = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                           FILE_FLAG_NO_BUFFERING, NULL);
+    if (h == INVALID_HANDLE_VALUE) return -1;
+
+    int fd = _open_osfhandle((intptr_t)h, _O_RDONLY);
+    if (fd < 0) CloseHandle(h);
+    return fd;
+#elif defined(O_DIRECT)
+    return open(path, O_RDONLY | O_DIRECT);
+#else
+    (void)path;
+    return -1;
+#endif
+}
+
+void disk_close(int fd) {
+#if defined(_WIN32)
+    _close(fd);
+#else
+    close(fd);
+#endif
+}
+
+/* Positioned read that does not move a shared file offset */
+long disk_pread(int fd, char* buf, long length, long long offset) {
+#if defined(_WIN32)
+    HANDLE h = (HANDLE)_get_osfhandle(fd);
+    OVERLAPPED ov;
+    DWORD n = 0;
+
+    memset(&ov, 0, sizeof(ov));
+    ov.Offset = (DWORD)(offset & 0xFFFFFFFF);
+    ov.OffsetHigh = (DWORD)(offset >> 32);
+
+    if (!ReadFile(h, buf, (DWORD)length, &n, &ov)) {
+        return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+    }
+    return (long)n;
+#else
+    long total = 0;
+    while (total < length) {
+        ssize_t n = pread(fd, buf + total, (size_t)(length - total), (off_t)(offset + total));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return total > 0 ? total : -1;
+        }
+        if (n == 0) break;
+        total += (long)n;
+    }
+    return total;
+#endif
+}
+
+static int dup_fd(int fd) {
+#if defined(_WIN32)
+    return _dup(fd);
+#else
+    return dup(fd);
+#endif
+}
+
+static char* aligned_alloc_buffer(long size) {
+#if defined(_WIN32)
+    return (char*)_aligned_malloc((size_t)size, DISK_IO_ALIGN);
+#else
+    void* p = NULL;
+    return posix_memalign(&p, DISK_IO_ALIGN, (size_t)size) == 0 ? (char*)p : NULL;
+#endif
+}
+
+static void aligned_free_buffer(char* p) {
+#if defined(_WIN32)
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+/* Take an aligned buffer, reusing a pooled one for block-sized reads (caller holds g_io_mutex) */
+static char* buffer_get(long size, long* capacity) {
+    if (size <= DISK_POOL_BUFFER_SIZE) {
+        *capacity = DISK_POOL_BUFFER_SIZE;
+        if (g_buffer_pool_count > 0) return g_buffer_pool[--g_buffer_pool_count];
+    } else {
+        *capacity = size;
+    }
+    return aligned_alloc_buffer(*capacity);
+}
+
+static void buffer_put(char* p, long capacity) {
+    if (!p) return;
+    if (capacity == DISK_POOL_BUFFER_SIZE && g_buffer_pool_count < DISK_BUFFER_POOL) {
+        g_buffer_pool[g_buffer_pool_count++] = p;
+    } else {
+        aligned_free_buffer(p);
+    }
+}
+
+/* Return a job to the free list (caller holds g_io_mutex) */
+static void job_free(DiskJob* job) {
+    ATOMIC_CAS(&g_inflight[job->flight], (int)(job - g_jobs) + 1, 0);
+    buffer_put(job->buffer, job->capacity);
+    job->buffer = NULL;
+    ATOMIC_STORE(&job->state, JOB_FREE);
+}
+
+/* Identity of an open file that is stable across descriptors, 0 if unknown */
+static long long file_identity(int fd, long long dev) {
+#if defined(_WIN32)
+    BY_HANDLE_FILE_INFORMATION info;
+    if (!GetFileInformationByHandle((HANDLE)_get_osfhandle(fd), &info)) return 0;
+    long long ino = ((long long)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+#else
+    struct stat st;
+    if (fstat(fd, &st) != 0) return 0;
+    long long ino = (long long)st.st_ino;
+#endif
+    return (ino * 1000003LL) ^ dev ^ 1;
+}
+
+static int flight_slot(long long file, long long offset, long length) {
+    unsigned long long h = (unsigned long long)file * 0x9E3779B97F4A7C15ULL;
+    h ^= (unsigned long long)offset + 0x7F4A7C15ULL + (h << 6) + (h >> 2);
+    h ^= (unsigned long long)length + (h << 6) + (h >> 2);
+    return (int)(h % DISK_FLIGHT_SLOTS);
+}
+
+void disk_io_release(int job_id);
+
+/* Take a reference on a live job unless it is already being freed */
+static int job_pin(DiskJob* job) {
+    for (;;) {
+        int refs = ATOMIC_LOAD(&job->refs);
+        if (refs <= 0) return 0;
+        if (ATOMIC_CAS(&job->refs, refs, refs + 1)) return 1;
+    }
+}
+
+/* Attach to an identical read already in flight; returns its handle or -1 */
+static int job_attach(long long file, long long offset, long length) {
+    int slot = flight_slot(file, offset, length);
+    int idx = ATOMIC_LOAD(&g_inflight[slot]) - 1;
+    if (idx < 0) return -1;
+
+    DiskJob* job = &g_jobs[idx];
+    if (!job_pin(job)) return -1;
+
+    /* The slot may have been reused for another read before we pinned it */
+    if (job->file != file || job->offset != offset || job->length != length) {
+        disk_io_release(idx);
+        return -1;
+    }
+
+    ATOMIC_ADD64(&g_devices[job->device].coalesced, 1);
+    return idx;
+}
+
+/* Worker loop for one device */
+#if defined(_WIN32)
+static unsigned __stdcall disk_worker(void* arg) {
+#else
+static void* disk_worker(void* arg) {
+#endif
+    DiskDevice* d = (DiskDevice*)arg;
+
+    pthread_mutex_lock(&g_io_mutex);
+    while (g_io_running) {
+        if (d->queue_head < 0) {
+            pthread_cond_wait(&d->work_cond, &g_io_mutex);
+            continue;
+        }
+
+        int idx = d->queue_head;
+        DiskJob* job = &g_jobs[idx];
+        d->queue_head = job->next;
+        if (d->queue_head < 0) d->queue_tail = -1;
+        ATOMIC_STORE(&job->state, JOB_RUNNING);
+        pthread_mutex_unlock(&g_io_mutex);
+
+        double started = monotonic_seconds();
+        long result = disk_pread(job->fd, job->buffer, job->span, job->offset - job->skip);
+        if (result >= 0) {
+            result = result > job->skip ? result - job->skip : 0;
+            if (result > job->length) result = job->length;
+        }
+        double elapsed = monotonic_seconds() - started;
+        disk_close(job->fd);
+
+        pthread_mutex_lock(&g_io_mutex);
+        d->depth--;
+        d->completed++;
+        d->busy_seconds += elapsed;
+        d->latency_ms += 0.2 * (elapsed * 1000 - d->latency_ms);
+        job->result = result;
+        if (job->abandoned) {
+            job_free(job);
+        } else {
+            ATOMIC_STORE(&job->state, JOB_DONE);
+            pthread_cond_broadcast(&g_done_cond);
+        }
+    }
+    pthread_mutex_unlock(&g_io_mutex);
+
+#if defined(_WIN32)
+    return 0;
+#else
+    return NULL;
+#endif
+}
+
+/* Block on g_done_cond for at most remaining seconds (caller holds g_io_mutex) */
+static void done_wait(double remaining) {
+#if defined(_WIN32)
+    SleepConditionVariableCS(&g_done_cond, &g_io_mutex, (DWORD)(remaining * 1000) + 1);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    long long ns = ts.tv_nsec + (long long)(remaining * 1e9);
+    ts.tv_sec += (time_t)(ns / 1000000000LL);
+    ts.tv_nsec = (long)(ns % 1000000000LL);
+    pthread_cond_timedwait(&g_done_cond, &g_io_mutex, &ts);
+#endif
+}
+
+/* Pool serving a device, or -1 if none has been started (caller holds g_io_mutex) */
+static int device_find(long long dev) {
+    int full = 1;
+
+    for (int i = 0; i < MAX_DISK_DEVICES; i++) {
+        if (g_devices[i].in_use && g_devices[i].dev == dev) return i;
+        if (!g_devices[i].in_use) full = 0;
+    }
+
+    /* Unknown devices beyond the table share the last pool */
+    return full ? MAX_DISK_DEVICES - 1 : -1;
+}
+
+/* Find or start the pool for a device (caller holds g_io_mutex) */
+static int device_for(long long dev) {
+    int free_slot = -1;
+
+    for (int i = 0; i < MAX_DISK_DEVICES; i++) {
+        if (g_devices[i].in_use && g_devices[i].dev == dev) return i;
+        if (!g_devices[i].in_use && free_slot < 0) free_slot = i;
+    }
+
+    /* Unknown devices beyond the table share the last pool */
+    if (free_slot < 0) return MAX_DISK_DEVICES - 1;
+
+    DiskDevice* d = &g_devices[free_slot];
+    d->dev = dev;
+    d->in_use = 1;
+    d->queue_head = -1;
+    d->queue_tail = -1;
+    pthread_cond_init(&d->work_cond, NULL);
+
+    for (int t = 0; t < g_threads_per_device; t++) {
+#if defined(_WIN32)
+        HANDLE h = (HANDLE)_beginthreadex(NULL, 0, disk_worker, d, 0, NULL);
+        if (h) CloseHandle(h);
+#else
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, disk_worker, d) == 0) {
+            pthread_detach(thread);
+        }
+#endif
+    }
+
+    log_message(LOG_INFO, "Started disk I/O pool for device %lld", dev);
+    return free_slot;
+}
+
+/*
+ * Queue a read of length bytes at offset, or attach to an identical one
+ * already in flight. Returns a job handle, or -1 if the device's queue is
+ * full or the request is invalid.
+ */
+int disk_io_submit(int fd, long long dev, long long offset, long length) {
+    if (length <= 0 || length > DISK_IO_MAX_READ) return -1;
+
+    long long file = file_identity(fd, dev);
+    if (file != 0) {
+        int attached = job_attach(file, offset, length);
+        if (attached >= 0) return attached;
+    }
+
+    pthread_mutex_lock(&g_io_mutex);
+
+    int di = device_for(dev);
+    DiskDevice* d = &g_devices[di];
+
+    if (d->depth >= g_queue_depth) {
+        d->rejected++;
+        pthread_mutex_unlock(&g_io_mutex);
+        return -1;
+    }
+
+    int idx = -1;
+    for (int i = 0; i < MAX_DISK_JOBS; i++) {
+        if (g_jobs[i].state == JOB_FREE) {
+            idx = i;
+            break;
+        }
+    }
+
+    /* Widen the read to aligned boundaries */
+    long skip = (long)(offset % DISK_IO_ALIGN);
+    long aligned = (skip + length + DISK_IO_ALIGN - 1) / DISK_IO_ALIGN * DISK_IO_ALIGN;
+
+    long capacity = 0;
+    char* buffer = idx >= 0 ? buffer_get(aligned, &capacity) : NULL;
+    int job_fd = buffer ? dup_fd(fd) : -1;
+    if (job_fd < 0) {
+        buffer_put(buffer, capacity);
+        d->rejected++;
+        pthread_mutex_unlock(&g_io_mutex);
+        return -1;
+    }
+
+    DiskJob* job = &g_jobs[idx];
+    job->abandoned = 0;
+    job->device = di;
+    job->fd = job_fd;
+    job->file = file;
+    job->flight = flight_slot(file, offset, length);
+    job->offset = offset;
+    job->length = length;
+    job->result = 0;
+    job->skip = skip;
+    job->span = aligned;
+    job->capacity = capacity;
+    job->buffer = buffer;
+    job->next = -1;
+    ATOMIC_STORE(&job->state, JOB_QUEUED);
+    ATOMIC_STORE(&job->refs, 1);
+
+    if (file != 0) {
+        ATOMIC_STORE(&g_inflight[job->flight], idx + 1);
+    }
+
+    if (d->queue_tail >= 0) {
+        g_jobs[d->queue_tail].next = idx;
+    } else {
+        d->queue_head = idx;
+    }
+    d->queue_tail = idx;
+    d->depth++;
+
+    pthread_cond_signal(&d->work_cond);
+    pthread_mutex_unlock(&g_io_mutex);
+    return idx;
+}
+
+/*
+ * Like disk_io_submit, but wait up to timeout_ms for room when the
+ * device's queue is full instead of failing at once.
+ */
+int disk_io_submit_wait(int fd, long long dev, long long offset, long length, int timeout_ms) {
+    if (length <= 0 || length > DISK_IO_MAX_READ) return -1;
+
+    double deadline = monotonic_seconds() + timeout_ms / 1000.0;
+    for (;;) {
+        int job = disk_io_submit(fd, dev, offset, length);
+        if (job >= 0) return job;
+
+        double remaining = deadline - monotonic_seconds();
+        if (remaining <= 0) return -1;
+
+        /* Cancelled jobs free room without a signal, so poll as well */
+        pthread_mutex_lock(&g_io_mutex);
+        done_wait(remaining < 0.05 ? remaining : 0.05);
+        pthread_mutex_unlock(&g_io_mutex);
+    }
+}
+
+/* Remove a queued job from its device queue (caller holds g_io_mutex) */
+static void unlink_queued(DiskJob* job, int idx) {
+    DiskDevice* d = &g_devices[job->device];
+    int prev = -1;
+
+    for (int i = d->queue_head; i >= 0; prev = i, i = g_jobs[i].next) {
+        if (i != idx) continue;
+
+        if (prev >= 0) {
+            g_jobs[prev].next = job->next;
+        } else {
+            d->queue_head = job->next;
+        }
+        if (d->queue_tail == idx) d->queue_tail = prev;
+        d->depth--;
+        return;
+    }
+}
+
+/*
+ * Wait for a job. On success *data points at the bytes read (valid until
+ * disk_io_release) and the byte count is returned. On timeout or error
+ * the job is released and -1 is returned.
+ */
+long disk_io_wait(int job_id, const char** data, int timeout_ms) {
+    if (job_id < 0 || job_id >= MAX_DISK_JOBS) return -1;
+
+    DiskJob* job = &g_jobs[job_id];
+    double deadline = monotonic_seconds() + timeout_ms / 1000.0;
+
+    /* Attached to a read that has already finished */
+    if (ATOMIC_LOAD(&job->state) == JOB_DONE) {
+        if (job->result < 0) {
+            disk_io_release(job_id);
+            return -1;
+        }
+        *data = job->buffer + job->skip;
+        return job->result;
+    }
+
+    pthread_mutex_lock(&g_io_mutex);
+    DiskDevice* d = &g_devices[job->device];
+    if (!t_background) d->waiters++;
+    while (job->state != JOB_DONE) {
+        double remaining = deadline - monotonic_seconds();
+        if (remaining <= 0) break;
+        done_wait(remaining);
+    }
+
+    if (!t_background) d->waiters--;
+    if (job->state != JOB_DONE) {
+        d->timeouts++;
+        pthread_mutex_unlock(&g_io_mutex);
+        disk_io_release(job_id);
+        log_message(LOG_WARN, "Disk read timed out after %d ms", timeout_ms);
+        return -1;
+    }
+
+    long result = job->result;
+    pthread_mutex_unlock(&g_io_mutex);
+
+    if (result < 0) {
+        disk_io_release(job_id);
+        return -1;
+    }
+
+    *data = job->buffer + job->skip;
+    return result;
+}
+
+/*
+ * Drop a reference to a job. The last one frees it: a job still queued is
+ * cancelled and one still running is abandoned to its worker.
+ */
+void disk_io_release(int job_id) {
+    if (job_id < 0 || job_id >= MAX_DISK_JOBS) return;
+
+    DiskJob* job = &g_jobs[job_id];
+    if (ATOMIC_ADD(&job->refs, -1) > 1) return;
+
+    pthread_mutex_lock(&g_io_mutex);
+    if (job->state == JOB_DONE) {
+        job_free(job);
+    } else if (job->state == JOB_QUEUED) {
+        unlink_queued(job, job_id);
+        disk_close(job->fd);
+        job_free(job);
+    } else if (job->state == JOB_RUNNING) {
+        job->abandoned = 1;
+    }
+    pthread_mutex_unlock(&g_io_mutex);
+}
+
+/* Synchronous read through the device pool into a caller buffer */
+long disk_io_read(int fd, long long dev, char* buf, long length, long long offset) {
+    int job = disk_io_submit(fd, dev, offset, length);
+    if (job < 0) return -1;
+
+    const char* data;
+    long n = disk_io_wait(job, &data, DISK_IO_TIMEOUT_MS);
+    if (n < 0) return -1;
+
+    memcpy(buf, data, (size_t)n);
+    disk_io_release(job);
+    return n;
+}
+
+/*
+ * True when a device's queue is full, or when as many threads as it may
+ * hold are already waiting on it; new requests should be turned away.
+ */
+int disk_io_saturated(long long dev) {
+    int saturated = 0;
+
+    pthread_mutex_lock(&g_io_mutex);
+    int i = device_find(dev);
+    if (i >= 0) {
+        saturated = g_devices[i].depth >= g_queue_depth || g_devices[i].waiters >= g_max_waiters;
+    }
+    pthread_mutex_unlock(&g_io_mutex);
+    return saturated;
+}
+
+/*
+ * Live load of a device: expected wait for a new read in milliseconds,
+ * estimated as (queued + running + 1) times the smoothed read latency.
+ * Devices without a pool yet count as idle.
+ */
+double disk_io_load(long long dev) {
+    double load = 0;
+
+    pthread_mutex_lock(&g_io_mutex);
+    int i = device_find(dev);
+    if (i >= 0) {
+        DiskDevice* d = &g_devices[i];
+        double latency = d->latency_ms < 0.1 ? 0.1 : d->latency_ms;
+        load = (d->depth + 1) * latency;
+    }
+    pthread_mutex_unlock(&g_io_mutex);
+    return load;
+}
+
+/* Write per-device metrics as a JSON array */
+int disk_io_stats_json(char* buf, size_t size) {
+    size_t used = 0;
+    int first = 1;
+
+    used += snprintf(buf + used, size - used, "[");
+
+    pthread_mutex_lock(&g_io_mutex);
+    for (int i = 0; i < MAX_DISK_DEVICES && used < size; i++) {
+        DiskDevice* d = &g_devices[i];
+        if (!d->in_use) continue;
+
+        used += snprintf(buf + used, size - used,
+            "%s{\"device\":%lld,\"depth\":%d,\"waiters\":%d,\"completed\":%lld,\"rejected\":%lld,"
+            "\"timeouts\":%lld,\"coalesced\":%lld,\"avg_read_ms\":%.2f}",
+            first ? "" : ",", d->dev, d->depth, d->waiters, d->completed, d->rejected, d->timeouts,
+            (long long)ATOMIC_LOAD64(&d->coalesced),
+            d->completed > 0 ? d->busy_seconds * 1000 / d->completed : 0.0);
+        first = 0;
+    }
+    if (used >= size) used = size - 1;
+    pthread_mutex_unlock(&g_io_mutex);
+
+    if (used < size) {
+        used += snprintf(buf + used, size - used, "]");
+    }
+    return (int)used;
+}
@@ -1,10 +1,46 @@
 /*
  * OTT Video Streaming Server - FFmpeg Helper
- * Thumbnail extraction and video duration detection
+ * Thumbnail extraction, trick-play sprites and video duration detection
  */
 
 #include "common.h"
 
+extern int mp4_faststart_ingest(const char* video_path, const char* filename);
+extern int storage_root_count(void);
+extern const char* storage_root_path(int index);
+extern int video_add(const char* title, const char* filename, const char* thumbnail, int duration,
+                     const char* description);
+extern int video_get_all(Video** videos);
+
+#if !defined(_WIN32)
+/*
+ * Run a tool with its arguments handed straight to execvp, so file names
+ * never pass through a shell. Stdout goes to out_path, or is discarded
+ * along with stderr. Returns the exit status, -1 if the tool didn't run.
+ */
+static int run_tool(char* const argv[], const char* out_path) {
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_RDWR);
+        int out_fd = out_path ? open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : null_fd;
+        if (null_fd < 0 || out_fd < 0) _exit(127);
+        dup2(null_fd, STDIN_FILENO);
+        dup2(out_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) return -1;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+#endif
+
 /* Check if FFmpeg is available */
 int ffmpeg_check_available(void) {
 #if defined(_WIN32)
@@ -17,22 +53,22 @@ int ffmpeg_check_available(void) {
 
 /* Extract thumbnail from video at specific timestamp */
 int ffmpeg_extract_thumbnail(const char* video_path, const char* output_path, int timestamp_sec) {
-    char command[1024];
+    log_message(LOG_DEBUG, "Extracting thumbnail from %s at %ds", video_path, timestamp_sec);
     
 #if defined(_WIN32)
+    char command[1024];
     snprintf(command, sizeof(command),
         ".\\ffmpeg.exe -y -ss %d -i \"%s\" -frames:v 1 -q:v 2 \"%s\" >nul 2>&1",
         timestamp_sec, video_path, output_path);
+    int result = system(command);
 #else
-    snprintf(command, sizeof(command),
-        "ffmpeg -y -ss %d -i \"%s\" -frames:v 1 -q:v 2 \"%s\" >/dev/null 2>&1",
-        timestamp_sec, video_path, output_path);
+    char seek[16];
+    snprintf(seek, sizeof(seek), "%d", timestamp_sec);
+    char* const argv[] = {"ffmpeg", "-y", "-ss", seek, "-i", (char*)video_path,
+                          "-frames:v", "1", "-q:v", "2", (char*)output_path, NULL};
+    int result = run_tool(argv, NULL);
 #endif
     
-    log_message(LOG_DEBUG, "Extracting thumbnail: %s", command);
-    
-    int result = system(command);
-    
     if (result != 0) {
         log_message(LOG_WARN, "Failed to extract thumbnail from %s", video_path);
         return -1;
@@ -44,23 +80,22 @@ int ffmpeg_extract_thumbnail(const char* video_path, const char* output_path, in
 
 /* Get video duration in seconds using FFprobe */
 int ffmpeg_get_duration(const char* video_path) {
-    char command[1024];
     char duration_file[256];
     
 #if defined(_WIN32)
+    char command[1024];
     snprintf(duration_file, sizeof(duration_file), "%s\\duration_tmp.txt", DATA_DIR);
     snprintf(command, sizeof(command),
         ".\\ffprobe.exe -v error -show_entries format=duration -of default=noprint_wrappers=1:nokey=1 \"%s\" > \"%s\" 2>nul",
         video_path, duration_file);
+    int result = system(command);
 #else
     snprintf(duration_file, sizeof(duration_file), "%s/duration_tmp.txt", DATA_DIR);
-    snprintf(command, sizeof(command),
-        "ffprobe -v error -show_entries format=duration -of default=noprint_wrappers=1:nokey=1 \"%s\" > \"%s\" 2>/dev/null",
-        video_path, duration_file);
+    char* const argv[] = {"ffprobe", "-v", "error", "-show_entries", "format=duration",
+                          "-of", "default=noprint_wrappers=1:nokey=1", (char*)video_path, NULL};
+    int result = run_tool(argv, duration_file);
 #endif
     
-    int result = system(command);
-    
     if (result != 0) {
         log_message(LOG_WARN, "Failed to get duration for %s", video_path);
         return 0;
@@ -82,37 +117,122 @@ int ffmpeg_get_duration(const char* video_path) {
     return (int)duration;
 }
 
-/* Scan video directory and generate thumbnails */
-int ffmpeg_scan_videos(void) {
+/*
+ * Generate trick-play sprite sheets for scrubbing previews: one frame every
+ * TRICKPLAY_INTERVAL seconds, tiled TRICKPLAY_COLUMNS x TRICKPLAY_ROWS per
+ * sheet, plus a WebVTT track mapping each interval to its tile. The VTT is
+ * written last, so its presence means the sheets are complete.
+ */
+int ffmpeg_generate_trickplay(const char* video_path, const char* basename, int duration_sec) {
+    char vtt_path[MAX_PATH_LEN];
+    char part_path[MAX_PATH_LEN];
+    
+    if (duration_sec <= 0) return -1;
+    
+    if (snprintf(vtt_path, sizeof(vtt_path), "%s/%s.vtt", TRICKPLAY_DIR, basename) >= (int)sizeof(vtt_path) ||
+        snprintf(part_path, sizeof(part_path), "%s.part", vtt_path) >= (int)sizeof(part_path)) {
+        return -1;
+    }
+    
+    log_message(LOG_DEBUG, "Generating trick-play sprites for %s", video_path);
+    
+#if defined(_WIN32)
+    char command[1024];
+    snprintf(command, sizeof(command),
+        ".\\ffmpeg.exe -y -i \"%s\" -an -vf \"fps=1/%d,scale=%d:%d:force_original_aspect_ratio=decrease,"
+        "pad=%d:%d:(ow-iw)/2:(oh-ih)/2,tile=%dx%d\" -q:v 5 \"%s\\%s_%%03d.jpg\" >nul 2>&1",
+        video_path, TRICKPLAY_INTERVAL, TRICKPLAY_TILE_WIDTH, TRICKPLAY_TILE_HEIGHT,
+        TRICKPLAY_TILE_WIDTH, TRICKPLAY_TILE_HEIGHT, TRICKPLAY_COLUMNS, TRICKPLAY_ROWS,
+        TRICKPLAY_DIR, basename);
+    int result = system(command);
+#else
+    char filter[256];
+    char sheets[MAX_PATH_LEN];
+    snprintf(filter, sizeof(filter),
+        "fps=1/%d,scale=%d:%d:force_original_aspect_ratio=decrease,"
+        "pad=%d:%d:(ow-iw)/2:(oh-ih)/2,tile=%dx%d",
+        TRICKPLAY_INTERVAL, TRICKPLAY_TILE_WIDTH, TRICKPLAY_TILE_HEIGHT,
+        TRICKPLAY_TILE_WIDTH, TRICKPLAY_TILE_HEIGHT, TRICKPLAY_COLUMNS, TRICKPLAY_ROWS);
+    if (snprintf(sheets, sizeof(sheets), "%s/%s_%%03d.jpg", TRICKPLAY_DIR, basename) >= (int)sizeof(sheets)) {
+        return -1;
+    }
+    char* const argv[] = {"ffmpeg", "-y", "-i", (char*)video_path, "-an", "-vf", filter,
+                          "-q:v", "5", sheets, NULL};
+    int result = run_tool(argv, NULL);
+#endif
+    
+    if (result != 0) {
+        log_message(LOG_WARN, "Failed to generate trick-play sprites for %s", video_path);
+        return -1;
+    }
+    
+    FILE* fp = fopen(part_path, "w");
+    if (!fp) return -1;
+    
+    fprintf(fp, "WEBVTT\n\n");
+    
+    int per_sheet = TRICKPLAY_COLUMNS * TRICKPLAY_ROWS;
+    int frames = (duration_sec + TRICKPLAY_INTERVAL - 1) / TRICKPLAY_INTERVAL;
+    for (int i = 0; i < frames; i++) {
+        int start = i * TRICKPLAY_INTERVAL;
+        int end = start + TRICKPLAY_INTERVAL;
+        if (end > duration_sec) end = duration_sec;
+        
+        int tile = i % per_sheet;
+        fprintf(fp, "%02d:%02d:%02d.000 --> %02d:%02d:%02d.000\n",
+                start / 3600, (start / 60) % 60, start % 60,
+                end / 3600, (end / 60) % 60, end % 60);
+        fprintf(fp, "%s_%03d.jpg#xywh=%d,%d,%d,%d\n\n", basename, i / per_sheet + 1,
+                (tile % TRICKPLAY_COLUMNS) * TRICKPLAY_TILE_WIDTH,
+                (tile / TRICKPLAY_COLUMNS) * TRICKPLAY_TILE_HEIGHT,
+                TRICKPLAY_TILE_WIDTH, TRICKPLAY_TILE_HEIGHT);
+    }
+    
+    if (fclose(fp) != 0) {
+        remove(part_path);
+        return -1;
+    }
+    
+    remove(vtt_path);
+    if (rename(part_path, vtt_path) != 0) {
+        remove(part_path);
+        return -1;
+    }
+    
+    log_message(LOG_INFO, "Trick-play track generated: %s (%d frames)", vtt_path, frames);
+    return 0;
+}
+
+/* Scan one storage root and generate thumbnails; returns the number of new videos */
+static int scan_root(const char* root, int has_ffmpeg) {
     int count = 0;
     char video_path[MAX_PATH_LEN];
     char thumb_path[MAX_PATH_LEN];
-    int has_ffmpeg = ffmpeg_check_available();
     
-    log_message(LOG_INFO, "Scanning video directory: %s", VIDEO_DIR);
-    if (!has_ffmpeg) {
-        log_message(LOG_WARN, "FFmpeg not found - registering videos without thumbnails");
-    }
+    log_message(LOG_INFO, "Scanning video directory: %s", root);
     
 #if defined(_WIN32)
     WIN32_FIND_DATAA fd;
     char search_path[MAX_PATH_LEN];
-    snprintf(search_path, sizeof(search_path), "%s\\*.mp4", VIDEO_DIR);
+    snprintf(search_path, sizeof(search_path), "%s\\*.mp4", root);
     
     HANDLE hFind = FindFirstFileA(search_path, &fd);
     log_message(LOG_INFO, "Searching for videos in: %s", search_path);
     
     if (hFind == INVALID_HANDLE_VALUE) {
-        log_message(LOG_WARN, "No MP4 files found in %s (Error: %d)", VIDEO_DIR, GetLastError());
+        log_message(LOG_WARN, "No MP4 files found in %s (Error: %d)", root, GetLastError());
         return 0;
     }
     
     do {
         if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
         
-        snprintf(video_path, sizeof(video_path), "%s\\%s", VIDEO_DIR, fd.cFileName);
+        snprintf(video_path, sizeof(video_path), "%s\\%s", root, fd.cFileName);
         log_message(LOG_INFO, "Found file: %s", fd.cFileName);
         
+        /* Move a trailing moov atom to the front (once per file) */
+        mp4_faststart_ingest(video_path, fd.cFileName);
+        
         /* Generate thumbnail filename */
         char* ext = strrchr(fd.cFileName, '.');
         char basename[256];
@@ -134,16 +254,24 @@ int ffmpeg_scan_videos(void) {
         /* Get duration (0 if no FFmpeg) */
         int duration = has_ffmpeg ? ffmpeg_get_duration(video_path) : 0;
         
+        /* Sprite sheets for scrubbing previews */
+        char vtt_path[MAX_PATH_LEN];
+        snprintf(vtt_path, sizeof(vtt_path), "%s\\%s.vtt", TRICKPLAY_DIR, basename);
+        if (has_ffmpeg && GetFileAttributesA(vtt_path) == INVALID_FILE_ATTRIBUTES) {
+            ffmpeg_generate_trickplay(video_path, basename, duration);
+        }
+        
         /* Check if video already in database */
-        Video* existing = NULL;
+        int existing = 0;
         Video* videos;
         int video_count = video_get_all(&videos);
         for (int i = 0; i < video_count; i++) {
             if (strcmp(videos[i].filename, fd.cFileName) == 0) {
-                existing = &videos[i];
+                existing = 1;
                 break;
             }
         }
+        free(videos);
         
         if (!existing) {
             /* Create title from filename */
@@ -166,9 +294,9 @@ int ffmpeg_scan_videos(void) {
     
     FindClose(hFind);
 #else
-    DIR* dir = opendir(VIDEO_DIR);
+    DIR* dir = opendir(root);
     if (!dir) {
-        log_message(LOG_WARN, "Cannot open video directory: %s", VIDEO_DIR);
+        log_message(LOG_WARN, "Cannot open video directory: %s", root);
         return 0;
     }
     
@@ -178,7 +306,10 @@ int ffmpeg_scan_videos(void) {
         char* ext = strrchr(entry->d_name, '.');
         if (!ext || strcasecmp(ext, ".mp4") != 0) continue;
         
-        snprintf(video_path, sizeof(video_path), "%s/%s", VIDEO_DIR, entry->d_name);
+        snprintf(video_path, sizeof(video_path), "%s/%s", root, entry->d_name);
+        
+        /* Move a trailing moov atom to the front (once per file) */
+        mp4_faststart_ingest(video_path, entry->d_name);
         
         /* Generate thumbnail filename */
         char basename[256];
@@ -190,24 +321,32 @@ int ffmpeg_scan_videos(void) {
         
         /* Check if thumbnail already exists */
         struct stat st;
-        if (stat(thumb_path, &st) != 0) {
+        if (has_ffmpeg && stat(thumb_path, &st) != 0) {
             /* Extract thumbnail at 10 seconds */
             ffmpeg_extract_thumbnail(video_path, thumb_path, 10);
         }
         
-        /* Get duration */
-        int duration = ffmpeg_get_duration(video_path);
+        /* Get duration (0 if no FFmpeg) */
+        int duration = has_ffmpeg ? ffmpeg_get_duration(video_path) : 0;
+        
+        /* Sprite sheets for scrubbing previews */
+        char vtt_path[MAX_PATH_LEN];
+        snprintf(vtt_path, sizeof(vtt_path), "%s/%s.vtt", TRICKPLAY_DIR, basename);
+        if (has_ffmpeg && stat(vtt_path, &st) != 0) {
+            ffmpeg_generate_trickplay(video_path, basename, duration);
+        }
         
         /* Check if video already in database */
-        Video* existing = NULL;
+        int existing = 0;
         Video* videos;
         int video_count = video_get_all(&videos);
         for (int i = 0; i < video_count; i++) {
             if (strcmp(videos[i].filename, entry->d_name) == 0) {
-                existing = &videos[i];
+                existing = 1;
                 break;
             }
         }
+        free(videos);
         
         if (!existing) {
             /* Create title from filename */
@@ -230,6 +369,22 @@ int ffmpeg_scan_videos(void) {
     closedir(dir);
 #endif
     
+    return count;
+}
+
+/* Scan every storage root; a file present on several roots is one title */
+int ffmpeg_scan_videos(void) {
+    int count = 0;
+    int has_ffmpeg = ffmpeg_check_available();
+    
+    if (!has_ffmpeg) {
+        log_message(LOG_WARN, "FFmpeg not found - registering videos without thumbnails");
+    }
+    
+    for (int i = 0; i < storage_root_count(); i++) {
+        count += scan_root(storage_root_path(i), has_ffmpeg);
+    }
+    
     log_message(LOG_INFO, "Scan complete. Added %d new videos.", count);
     return count;
 }
@@ -242,8 +397,7 @@ void ffmpeg_create_default_thumbnail(const char* output_path) {
 #if defined(_WIN32)
     CopyFileA(default_thumb, output_path, FALSE);
 #else
-    char command[512];
-    snprintf(command, sizeof(command), "cp \"%s\" \"%s\" 2>/dev/null", default_thumb, output_path);
-    system(command);
+    char* const argv[] = {"cp", (char*)default_thumb, (char*)output_path, NULL};
+    run_tool(argv, NULL);
 #endif
 }
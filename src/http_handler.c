@@ -8,25 +8,98 @@
 extern int parse_http_request(const char* raw, HttpRequest* req);
 extern char* get_cookie_value(const char* cookies, const char* name, char* value, size_t value_size);
 
-extern void data_init(void);
-extern void data_load(void);
-extern void data_save(void);
-extern User* user_find_by_username(const char* username);
-extern User* user_find_by_id(int id);
-extern int user_verify_password(User* user, const char* password);
+extern int user_find_by_username(const char* username, User* user);
+extern int user_find_by_id(int id, User* user);
+extern int user_verify_password(const User* user, const char* password);
 extern int user_create(const char* username, const char* password);
-extern Session* session_create(int user_id);
-extern Session* session_find(const char* token);
+extern int session_create(int user_id, Session* session);
+extern int session_find(const char* token, Session* session);
 extern void session_destroy(const char* token);
-extern Video* video_find_by_id(int id);
+extern int token_create(int user_id, char* token, size_t size);
+extern int token_verify(const char* token);
+extern void token_revoke(const char* token);
+extern int auth_submit(SOCKET client, void (*task)(SOCKET, const char*, const char*),
+                       const char* username, const char* password);
+extern int password_verify(const char* password, const char* stored);
+extern int auth_stats_json(char* buf, size_t size);
+extern int video_find_by_id(int id, Video* video);
+extern int videos_find(const int* ids, int count, Video* videos);
 extern int video_get_all(Video** videos);
 extern int video_count(void);
-extern WatchHistory* history_find(int user_id, int video_id);
+extern int history_find(int user_id, int video_id, WatchHistory* history);
 extern int history_update(int user_id, int video_id, int position);
 extern int history_get_user_history(int user_id, WatchHistory* out_history, int max_count);
 
 extern int ffmpeg_scan_videos(void);
 
+extern long stream_tune_range(int user_id, int video_id, long range_start);
+extern void stream_tune_complete(int user_id, int video_id, long range_start, long bytes_sent,
+                                 double elapsed_sec);
+extern void stream_hint_before(int fd, long offset, long length);
+extern void stream_hint_after(int fd, int video_id, long next_offset, long next_length,
+                              long file_size);
+extern int stream_title_is_cold(int video_id);
+extern double stream_title_heat(int video_id);
+
+extern int chunk_cache_get(int video_id, int rendition, int fd, long long dev, long file_size,
+                           long offset, long max_len, const char** data, long* len);
+extern void chunk_cache_release(int handle);
+extern int chunk_cache_stats_json(char* buf, size_t size);
+
+extern int pacing_begin(int user_id, int video_id, double bitrate, double burst_factor);
+extern long pacing_grant(int handle, SOCKET client, long want);
+extern void pacing_end(int handle, long unsent);
+extern int pacing_stats_json(char* buf, size_t size);
+
+extern int disk_open(const char* path, long* size, long long* dev);
+extern int disk_open_direct(const char* path);
+extern void disk_close(int fd);
+extern int disk_io_submit_wait(int fd, long long dev, long long offset, long length, int timeout_ms);
+extern long disk_io_wait(int job_id, const char** data, int timeout_ms);
+extern void disk_io_release(int job_id);
+extern int disk_io_saturated(long long dev);
+extern int disk_io_stats_json(char* buf, size_t size);
+
+extern int storage_resolve(const char* filename, char* path, size_t path_size);
+extern void storage_title_popular(const char* filename);
+extern int storage_stats_json(char* buf, size_t size);
+
+extern int tier_resolve(const char* filename, double heat, char* path, size_t path_size);
+extern int tier_stats_json(char* buf, size_t size);
+
+extern void prefetch_note_range(int user_id, int video_id, int rendition, const char* path,
+                                long long dev, long file_size, long range_start, long range_end,
+                                double bitrate, int direct);
+extern void prefetch_note_position(int user_id, int video_id, int position_sec);
+extern int prefetch_stats_json(char* buf, size_t size);
+extern int warmup_stats_json(char* buf, size_t size);
+
+extern int rendition_select(SOCKET client, int user_id, Video* video, int* pin, char* filename,
+                            size_t filename_size, int* rendition);
+extern int rendition_stats_json(char* buf, size_t size);
+
+extern int live_ingest(SOCKET client, const char* channel, const char* name, int chunked,
+                       long long content_length, const char* prefix, int prefix_len);
+extern int live_delete(const char* channel, const char* name);
+extern void* live_open(const char* channel, const char* name, int timeout_ms);
+extern long live_length(void* handle);
+extern long live_read(void* handle, long offset, const char** data, int timeout_ms);
+extern void live_release(void* handle);
+extern int live_playlist_wait(const char* channel, const char* name, long long msn, int part,
+                              int timeout_ms);
+extern int live_block_begin(void);
+extern void live_block_end(void);
+extern int live_stats_json(char* buf, size_t size);
+
+extern int upload_create(int user_id, const char* filename, long long length, char* id);
+extern int upload_offset(const char* id, int user_id, long long* offset, long long* length,
+                         int* video_id);
+extern int upload_cancel(const char* id, int user_id);
+extern int upload_write(SOCKET client, const char* id, int user_id, long long offset,
+                        long long content_length, const char* prefix, int prefix_len,
+                        long long* new_offset);
+extern int upload_stats_json(char* buf, size_t size);
+
 /* Send HTTP response helper */
 static void send_response(SOCKET client, const char* status, const char* content_type, 
                           const char* extra_headers, const char* body, size_t body_len) {
@@ -51,6 +124,18 @@ static void send_response(SOCKET client, const char* status, const char* content
     }
 }
 
+/* Send a whole buffer, retrying partial sends */
+static int send_all(SOCKET client, const char* data, long len) {
+    while (len > 0) {
+        int chunk = len > BUFFER_SIZE * 16 ? BUFFER_SIZE * 16 : (int)len;
+        int sent = send(client, data, chunk, 0);
+        if (sent <= 0) return -1;
+        data += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
 /* Send JSON response */
 static void send_json(SOCKET client, const char* status, const char* json) {
     send_response(client, status, "application/json", NULL, json, strlen(json));
@@ -83,6 +168,68 @@ static void send_redirect(SOCKET client, const char* location, const char* cooki
     send(client, header, len, 0);
 }
 
+/* Tell the client to retry when a storage device is overloaded */
+static void send_busy(SOCKET client) {
+    const char* msg = "Storage busy";
+    send_response(client, HTTP_503, "text/plain", "Retry-After: 1\r\n", msg, strlen(msg));
+}
+
+/* Tell a live viewer to retry when too many requests are already waiting */
+static void send_live_busy(SOCKET client) {
+    const char* msg = "Live stream not ready";
+    send_response(client, HTTP_503, "text/plain", "Retry-After: 1\r\n", msg, strlen(msg));
+}
+
+/* Tell the client to retry when every auth thread is taken */
+static void send_auth_busy(SOCKET client) {
+    const char* msg = "Too many login attempts in progress, try again shortly";
+    send_response(client, HTTP_429, "text/plain", "Retry-After: 1\r\n", msg, strlen(msg));
+}
+
+/*
+ * Send [offset, offset + length) of a file. Blocks are read on the
+ * device's I/O pool, and the next block is requested while the current
+ * one is being sent. The headers are already out by now, so a full queue
+ * or a slow read is waited out rather than cutting the body short.
+ * Returns the number of bytes sent.
+ */
+static long send_file_range(SOCKET client, int fd, long long dev, long offset, long length) {
+    long sent = 0;
+    long block = length < DISK_IO_BLOCK_SIZE ? length : DISK_IO_BLOCK_SIZE;
+    int job = length > 0 ? disk_io_submit_wait(fd, dev, offset, block, DISK_IO_BODY_TIMEOUT_MS) : -1;
+    
+    while (job >= 0) {
+        const char* data;
+        long n = disk_io_wait(job, &data, DISK_IO_BODY_TIMEOUT_MS);
+        if (n <= 0) {
+            if (n == 0) disk_io_release(job);
+            break;
+        }
+        
+        /* Start the next read before sending this block */
+        int next = -1;
+        long left = length - sent - n;
+        if (left > 0) {
+            next = disk_io_submit_wait(fd, dev, offset + sent + n,
+                                       left < DISK_IO_BLOCK_SIZE ? left : DISK_IO_BLOCK_SIZE,
+                                       DISK_IO_BODY_TIMEOUT_MS);
+        }
+        
+        int failed = send_all(client, data, n) != 0;
+        disk_io_release(job);
+        
+        if (failed) {
+            disk_io_release(next);
+            break;
+        }
+        
+        sent += n;
+        job = next;
+    }
+    
+    return sent;
+}
+
 /* Send static file */
 static void send_static_file(SOCKET client, const char* path, HttpRequest* req) {
     char full_path[MAX_PATH_LEN];
@@ -104,14 +251,16 @@ static void send_static_file(SOCKET client, const char* path, HttpRequest* req)
     }
 #endif
     
-    FILE* fp = fopen(full_path, "rb");
-    if (!fp) {
+    long file_size;
+    long long dev;
+    int fd = disk_open(full_path, &file_size, &dev);
+    if (fd < 0) {
         /* Try index.html for directory */
         char index_path[MAX_PATH_LEN];
         snprintf(index_path, sizeof(index_path), "%s/index.html", full_path);
-        fp = fopen(index_path, "rb");
+        fd = disk_open(index_path, &file_size, &dev);
         
-        if (!fp) {
+        if (fd < 0) {
             const char* msg = "Not Found";
             send_response(client, HTTP_404, "text/plain", NULL, msg, strlen(msg));
             return;
@@ -119,46 +268,66 @@ static void send_static_file(SOCKET client, const char* path, HttpRequest* req)
         strcpy(full_path, index_path);
     }
     
-    /* Get file size */
-    fseek(fp, 0, SEEK_END);
-    long file_size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
+    if (disk_io_saturated(dev)) {
+        disk_close(fd);
+        send_busy(client);
+        return;
+    }
     
     const char* content_type = get_content_type(full_path);
     
+    /* Generated images never change under the same name, so browsers may keep them */
+    char cache_control[64] = "";
+    if (strncmp(path, "thumbnails/", 11) == 0 || strncmp(path, "trickplay/", 10) == 0) {
+        snprintf(cache_control, sizeof(cache_control),
+                 "Cache-Control: public, max-age=%d\r\n", STATIC_MAX_AGE);
+    }
+    
     /* Send header */
     char header[512];
     int header_len = snprintf(header, sizeof(header),
         HTTP_200
         "Content-Type: %s\r\n"
         "Content-Length: %ld\r\n"
+        "%s"
         "Connection: close\r\n"
         "\r\n",
-        content_type, file_size);
+        content_type, file_size, cache_control);
     
     send(client, header, header_len, 0);
     
     /* Send file content */
-    char buffer[BUFFER_SIZE];
-    size_t bytes_read;
-    while ((bytes_read = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
-        send(client, buffer, (int)bytes_read, 0);
-    }
+    send_file_range(client, fd, dev, 0, file_size);
     
-    fclose(fp);
+    disk_close(fd);
 }
 
 /* Stream video with Range support */
 static void stream_video(SOCKET client, int video_id, HttpRequest* req, int user_id) {
-    Video* video = video_find_by_id(video_id);
+    Video row;
+    Video* video = video_find_by_id(video_id, &row) == 0 ? &row : NULL;
     if (!video) {
         const char* msg = "Video not found";
         send_response(client, HTTP_404, "text/plain", NULL, msg, strlen(msg));
         return;
     }
     
+    /* Keep the viewer on the rendition that fits their link, pinned by a cookie */
+    char pinned[16];
+    int pin = get_cookie_value(req->cookie, "rendition", pinned, sizeof(pinned)) ? atoi(pinned) : -1;
+    int pin_before = pin;
+    char filename[256];
+    int rendition_id;
+    int kbps = rendition_select(client, user_id, video, &pin, filename, sizeof(filename),
+                                &rendition_id);
+    
+    /* Read from the fast tier, or else the least-loaded storage root holding the file */
+    double heat = stream_title_heat(video_id);
     char video_path[MAX_PATH_LEN];
-    snprintf(video_path, sizeof(video_path), "%s/%s", VIDEO_DIR, video->filename);
+    int fast = kbps == 0 && tier_resolve(filename, heat, video_path, sizeof(video_path));
+    if (!fast && storage_resolve(filename, video_path, sizeof(video_path)) < 0) {
+        snprintf(video_path, sizeof(video_path), "%s/%s", VIDEO_DIR, filename);
+    }
     
 #if defined(_WIN32)
     for (char* p = video_path; *p; p++) {
@@ -166,18 +335,31 @@ static void stream_video(SOCKET client, int video_id, HttpRequest* req, int user
     }
 #endif
     
-    FILE* fp = fopen(video_path, "rb");
-    if (!fp) {
+    long file_size;
+    long long dev;
+    int fd = disk_open(video_path, &file_size, &dev);
+    if (fd < 0 && fast && storage_resolve(filename, video_path, sizeof(video_path)) >= 0) {
+        /* The fast tier copy was demoted after tier_resolve; serve the original */
+#if defined(_WIN32)
+        for (char* p = video_path; *p; p++) {
+            if (*p == '/') *p = '\\';
+        }
+#endif
+        fd = disk_open(video_path, &file_size, &dev);
+    }
+    if (fd < 0) {
         log_message(LOG_ERROR, "Cannot open video file: %s", video_path);
         const char* msg = "Video file not found";
         send_response(client, HTTP_404, "text/plain", NULL, msg, strlen(msg));
         return;
     }
     
-    /* Get file size */
-    fseek(fp, 0, SEEK_END);
-    long file_size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
+    /* Shed load instead of queueing behind a saturated disk */
+    if (disk_io_saturated(dev)) {
+        disk_close(fd);
+        send_busy(client);
+        return;
+    }
     
     /* Handle start parameter */
     char start_param[32] = {0};
@@ -193,6 +375,7 @@ static void stream_video(SOCKET client, int video_id, HttpRequest* req, int user
     
     long range_start = 0;
     long range_end = file_size - 1;
+    long window = 0;
     
     if (req->has_range) {
         if (req->range_start >= 0) {
@@ -202,18 +385,46 @@ static void stream_video(SOCKET client, int video_id, HttpRequest* req, int user
             range_end = req->range_end;
         }
         
-        /* Limit chunk size */
-        if (range_end - range_start > 1024 * 1024) {
-            range_end = range_start + 1024 * 1024 - 1;
+        /* Limit chunk size to this viewer's adaptive window */
+        window = stream_tune_range(user_id, video_id, range_start);
+        if (range_end - range_start + 1 > window) {
+            range_end = range_start + window - 1;
         }
     }
     
+    /*
+     * Pace the stream relative to the title's average bitrate. A range
+     * response is cut to what the stream may send now, so the worker is
+     * free again soon; whole-file downloads are not paced.
+     */
+    double bitrate = video->duration_sec > 0 ? (double)file_size / video->duration_sec : 0;
+    int pacer = -1;
+    if (req->has_range && range_start <= range_end) {
+        pacer = pacing_begin(user_id, video_id, bitrate, PACING_BURST_FACTOR);
+        range_end = range_start + pacing_grant(pacer, client, range_end - range_start + 1) - 1;
+    }
+    
+    /* Spread popular titles over more disks */
+    if (kbps == 0 && heat >= STORAGE_REPLICATE_HEAT) {
+        storage_title_popular(video->filename);
+    }
+    
     long content_length = range_end - range_start + 1;
     
     const char* content_type = get_content_type(video->filename);
     char header[512];
     int header_len;
     
+    char rendition[128] = "";
+    int used = 0;
+    if (kbps > 0) {
+        used = snprintf(rendition, sizeof(rendition), "X-Rendition: %dk\r\n", kbps);
+    }
+    if (pin >= 0 && pin != pin_before) {
+        snprintf(rendition + used, sizeof(rendition) - used,
+                 "Set-Cookie: rendition=%d; Path=/video/%d; HttpOnly\r\n", pin, video_id);
+    }
+    
     if (req->has_range) {
         header_len = snprintf(header, sizeof(header),
             HTTP_206
@@ -221,98 +432,418 @@ static void stream_video(SOCKET client, int video_id, HttpRequest* req, int user
             "Content-Length: %ld\r\n"
             "Content-Range: bytes %ld-%ld/%ld\r\n"
             "Accept-Ranges: bytes\r\n"
+            "%s"
             "Connection: close\r\n"
             "\r\n",
-            content_type, content_length, range_start, range_end, file_size);
+            content_type, content_length, range_start, range_end, file_size, rendition);
     } else {
         header_len = snprintf(header, sizeof(header),
             HTTP_200
             "Content-Type: %s\r\n"
             "Content-Length: %ld\r\n"
             "Accept-Ranges: bytes\r\n"
+            "%s"
             "Connection: close\r\n"
             "\r\n",
-            content_type, file_size);
+            content_type, file_size, rendition);
     }
     
     send(client, header, header_len, 0);
     
-    /* Seek to start position */
-    fseek(fp, range_start, SEEK_SET);
+    /*
+     * Cold titles are read with direct I/O so a one-off viewing doesn't
+     * push the hot catalog out of the page cache; hot ones use the
+     * chunk cache and buffered reads.
+     */
+    int direct_fd = -1;
+    if (DIRECT_IO_COLD_TITLES && stream_title_is_cold(video_id)) {
+        direct_fd = disk_open_direct(video_path);
+    }
+    
+    if (direct_fd < 0) {
+        stream_hint_before(fd, range_start, content_length);
+    }
     
-    /* Send video data */
-    char buffer[BUFFER_SIZE];
+    /*
+     * Send video data from the shared chunk cache when possible. Cold
+     * titles only use chunks the prefetcher has already loaded and read
+     * everything else directly.
+     */
     long bytes_remaining = content_length;
+    double started = monotonic_seconds();
     
     while (bytes_remaining > 0) {
-        size_t to_read = bytes_remaining > sizeof(buffer) ? sizeof(buffer) : bytes_remaining;
-        size_t bytes_read = fread(buffer, 1, to_read, fp);
+        long offset = range_start + (content_length - bytes_remaining);
+        const char* data;
+        long len;
+        
+        int handle = chunk_cache_get(video_id, rendition_id, direct_fd < 0 ? fd : -1, dev, file_size,
+                                     offset, bytes_remaining, &data, &len);
+        if (handle >= 0) {
+            int failed = send_all(client, data, len) != 0;
+            chunk_cache_release(handle);
+            if (failed) break;
+            
+            bytes_remaining -= len;
+            continue;
+        }
         
-        if (bytes_read == 0) break;
+        /* Uncacheable: read the rest of this chunk, or of a cold range, directly */
+        long span = CACHE_CHUNK_SIZE - offset % CACHE_CHUNK_SIZE;
+        if (span > bytes_remaining || direct_fd >= 0) span = bytes_remaining;
         
-        int sent = send(client, buffer, (int)bytes_read, 0);
-        if (sent <= 0) break;
+        long sent = send_file_range(client, direct_fd >= 0 ? direct_fd : fd, dev, offset, span);
+        bytes_remaining -= sent;
+        if (sent < span) break;
+    }
+    
+    pacing_end(pacer, bytes_remaining);
+    
+    if (req->has_range) {
+        long bytes_sent = content_length - bytes_remaining;
+        stream_tune_complete(user_id, video_id, range_start, bytes_sent,
+                             monotonic_seconds() - started);
+        if (direct_fd < 0) {
+            stream_hint_after(fd, video_id, range_start + bytes_sent, window, file_size);
+        }
         
-        bytes_remaining -= bytes_read;
+        /* Warm the chunk cache ahead of this viewer's playhead */
+        prefetch_note_range(user_id, video_id, rendition_id, video_path, dev, file_size,
+                            range_start, range_start + bytes_sent, bitrate, direct_fd >= 0);
     }
     
-    fclose(fp);
+    if (direct_fd >= 0) disk_close(direct_fd);
+    disk_close(fd);
     
     log_message(LOG_DEBUG, "Streamed %ld bytes of %s (range: %ld-%ld)", 
                 content_length, video->filename, range_start, range_end);
 }
 
-/* Handle login POST */
-static void handle_login(SOCKET client, HttpRequest* req) {
-    char username[64] = {0};
-    char password[64] = {0};
+/* Split /live/<channel>/<file> into its parts */
+static int parse_live_path(const char* path, char* channel, size_t channel_size,
+                           char* name, size_t name_size) {
+    const char* start = path + 6;
+    const char* slash = strchr(start, '/');
+    if (!slash || slash == start || (size_t)(slash - start) >= channel_size) return -1;
+    if (slash[1] == '\0' || strchr(slash + 1, '/') || strstr(path, "..")) return -1;
+    if (strlen(slash + 1) >= name_size) return -1;
+
+    memcpy(channel, start, slash - start);
+    channel[slash - start] = '\0';
+    strcpy(name, slash + 1);
+    return 0;
+}
+
+/* Only an encoder on this machine may publish to live channels */
+static int is_local_peer(SOCKET client) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    if (getpeername(client, (struct sockaddr*)&addr, &len) != 0 || addr.sin_family != AF_INET) {
+        return 0;
+    }
+    return (ntohl(addr.sin_addr.s_addr) >> 24) == 127;
+}
+
+/* Live ingest: PUT/POST stores a file, DELETE removes one */
+static void handle_live_ingest(SOCKET client, HttpRequest* req, const char* raw, int raw_length) {
+    char channel[64];
+    char name[128];
     
-    /* Parse form data */
-    get_query_param(req->body, "username", username, sizeof(username));
-    get_query_param(req->body, "password", password, sizeof(password));
+    if (!is_local_peer(client)) {
+        send_response(client, HTTP_403, "text/plain", NULL, "Forbidden", 9);
+        return;
+    }
+    if (parse_live_path(req->path, channel, sizeof(channel), name, sizeof(name)) < 0) {
+        send_response(client, HTTP_400, "text/plain", NULL, "Bad Request", 11);
+        return;
+    }
     
-    if (!username[0] || !password[0]) {
-        send_redirect(client, "/login.html?error=missing", NULL);
+    if (strcmp(req->method, "DELETE") == 0) {
+        int found = live_delete(channel, name) == 0;
+        send_response(client, found ? HTTP_204 : HTTP_404, "text/plain", NULL, NULL, 0);
         return;
     }
     
-    User* user = user_find_by_username(username);
+    /* Body bytes that arrived with the headers */
+    const char* body = strstr(raw, "\r\n\r\n");
+    int prefix_len = body ? raw_length - (int)(body + 4 - raw) : 0;
+    
+    int result = live_ingest(client, channel, name, req->chunked, req->content_length,
+                             body ? body + 4 : NULL, prefix_len);
+    if (result == -2) {
+        const char* msg = "Too many live uploads in progress";
+        send_response(client, HTTP_503, "text/plain", "Retry-After: 1\r\n", msg, strlen(msg));
+        return;
+    }
+    if (result < 0) {
+        send_response(client, HTTP_500, "text/plain", NULL, "Upload failed", 13);
+        return;
+    }
+    send_response(client, HTTP_201, "text/plain", NULL, NULL, 0);
+}
+
+/*
+ * Serve a live playlist or segment from memory. Playlist requests with
+ * _HLS_msn (and _HLS_part) wait for that part to be published. A segment
+ * still being uploaded is relayed with chunked encoding as it arrives.
+ * Waiting holds this worker, so a request that would wait without a
+ * blocking slot from live_block_begin gets a 503 instead.
+ */
+static void stream_live(SOCKET client, HttpRequest* req) {
+    char channel[64];
+    char name[128];
+    
+    if (parse_live_path(req->path, channel, sizeof(channel), name, sizeof(name)) < 0) {
+        send_response(client, HTTP_404, "text/plain", NULL, "Not Found", 9);
+        return;
+    }
+    
+    const char* ext = strrchr(name, '.');
+    int playlist = ext && strcmp(ext, ".m3u8") == 0;
+    
+    int blocking = 0;
+    char msn[32] = {0};
+    if (playlist && get_query_param(req->query, "_HLS_msn", msn, sizeof(msn))) {
+        char part[32] = {0};
+        get_query_param(req->query, "_HLS_part", part, sizeof(part));
+        blocking = live_block_begin();
+        if (live_playlist_wait(channel, name, atoll(msn), part[0] ? atoi(part) : -1,
+                               blocking ? LIVE_BLOCK_TIMEOUT_MS : 0) < 0) {
+            if (blocking) live_block_end();
+            send_live_busy(client);
+            return;
+        }
+    }
+    
+    /* Anything not published yet is waited for only with a slot */
+    void* handle = live_open(channel, name, 0);
+    if (!handle && !blocking && (blocking = live_block_begin()) == 0) {
+        send_live_busy(client);
+        return;
+    }
+    if (!handle) handle = live_open(channel, name, LIVE_BLOCK_TIMEOUT_MS);
+    if (!handle) {
+        live_block_end();
+        send_response(client, HTTP_404, "text/plain", NULL, "Not Found", 9);
+        return;
+    }
+    
+    long length = live_length(handle);
+    if (length < 0 && !blocking && (blocking = live_block_begin()) == 0) {
+        live_release(handle);
+        send_live_busy(client);
+        return;
+    }
+    
+    char header[512];
+    int header_len;
+    
+    if (length >= 0) {
+        header_len = snprintf(header, sizeof(header),
+            HTTP_200
+            "Content-Type: %s\r\n"
+            "Content-Length: %ld\r\n"
+            "%s"
+            "Connection: close\r\n"
+            "\r\n",
+            get_content_type(name), length, playlist ? "Cache-Control: no-cache\r\n" : "");
+    } else {
+        header_len = snprintf(header, sizeof(header),
+            HTTP_200
+            "Content-Type: %s\r\n"
+            "Transfer-Encoding: chunked\r\n"
+            "Connection: close\r\n"
+            "\r\n",
+            get_content_type(name));
+    }
+    
+    if (send_all(client, header, header_len) == 0) {
+        long offset = 0;
+        for (;;) {
+            const char* data;
+            long n = live_read(handle, offset, &data, LIVE_BLOCK_TIMEOUT_MS);
+            if (n < 0) break;   /* upload stalled or aborted: drop the connection */
+            
+            if (length < 0) {
+                char size_line[32];
+                int size_len = snprintf(size_line, sizeof(size_line), "%lx\r\n", n);
+                if (send_all(client, size_line, size_len) < 0) break;
+                if (n == 0) {
+                    send_all(client, "\r\n", 2);
+                    break;
+                }
+                if (send_all(client, data, n) < 0 || send_all(client, "\r\n", 2) < 0) break;
+            } else {
+                if (n == 0 || send_all(client, data, n) < 0) break;
+            }
+            offset += n;
+        }
+    }
+    
+    live_release(handle);
+    if (blocking) live_block_end();
+}
+
+/*
+ * API: Resumable uploads (tus-style)
+ *   POST   /api/uploads?filename=x.mp4  with Upload-Length   creates an upload
+ *   HEAD   /api/uploads/{id}                                 reports Upload-Offset, and
+ *                                                            Upload-Video-Id once added
+ *   PATCH  /api/uploads/{id}           with Upload-Offset    writes chunks
+ *   DELETE /api/uploads/{id}                                 abandons it
+ */
+static void api_uploads(SOCKET client, HttpRequest* req, int user_id, const char* raw,
+                        int raw_length) {
+    char headers[256];
+    const char* id = req->path + 12;
+    if (*id == '/') id++;
+    
+    if (strcmp(req->method, "POST") == 0 && *id == '\0') {
+        char filename[256] = {0};
+        get_query_param(req->query, "filename", filename, sizeof(filename));
+        
+        char new_id[64];
+        int result = upload_create(user_id, filename, req->upload_length, new_id);
+        if (result == -2) {
+            send_json(client, HTTP_409, "{\"error\":\"Invalid or existing filename\"}");
+        } else if (result < 0) {
+            send_json(client, HTTP_400, "{\"error\":\"Cannot create upload\"}");
+        } else {
+            char json[128];
+            snprintf(headers, sizeof(headers),
+                     "Location: /api/uploads/%s\r\nTus-Resumable: 1.0.0\r\n", new_id);
+            snprintf(json, sizeof(json), "{\"id\":\"%s\",\"chunk_size\":%lld}", new_id,
+                     (long long)UPLOAD_CHUNK_MB * 1024 * 1024);
+            send_response(client, HTTP_201, "application/json", headers, json, strlen(json));
+        }
+        return;
+    }
+    
+    long long offset, length;
+    int video_id;
+    if (upload_offset(id, user_id, &offset, &length, &video_id) < 0) {
+        send_json(client, HTTP_404, "{\"error\":\"Upload not found\"}");
+        return;
+    }
+    
+    if (strcmp(req->method, "HEAD") == 0) {
+        /* No body, but the headers describe the upload */
+        char added[48] = "";
+        if (video_id > 0) {
+            snprintf(added, sizeof(added), "Upload-Video-Id: %d\r\n", video_id);
+        }
+        
+        char header[512];
+        int header_len = snprintf(header, sizeof(header),
+            HTTP_200
+            "Upload-Offset: %lld\r\n"
+            "Upload-Length: %lld\r\n"
+            "%s"
+            "Tus-Resumable: 1.0.0\r\n"
+            "Cache-Control: no-store\r\n"
+            "Content-Length: 0\r\n"
+            "Connection: close\r\n"
+            "\r\n",
+            offset, length, added);
+        send(client, header, header_len, 0);
+        return;
+    }
+    
+    if (strcmp(req->method, "DELETE") == 0) {
+        if (upload_cancel(id, user_id) < 0) {
+            send_json(client, HTTP_409, "{\"error\":\"Upload in progress\"}");
+        } else {
+            send_response(client, HTTP_204, "text/plain", NULL, NULL, 0);
+        }
+        return;
+    }
+    
+    if (strcmp(req->method, "PATCH") == 0 && req->upload_offset >= 0 && !req->chunked) {
+        const char* body = strstr(raw, "\r\n\r\n");
+        int prefix_len = body ? raw_length - (int)(body + 4 - raw) : 0;
+        
+        long long new_offset;
+        int result = upload_write(client, id, user_id, req->upload_offset, req->content_length,
+                                  body ? body + 4 : NULL, prefix_len, &new_offset);
+        
+        snprintf(headers, sizeof(headers),
+                 "Upload-Offset: %lld\r\nTus-Resumable: 1.0.0\r\n", new_offset);
+        
+        if (result == 0) {
+            send_response(client, HTTP_204, "text/plain", headers, NULL, 0);
+        } else if (result == -2) {
+            send_response(client, HTTP_409, "text/plain", headers, "Offset conflict", 15);
+        } else {
+            send_response(client, HTTP_500, "text/plain", headers, "Upload interrupted", 18);
+        }
+        return;
+    }
+    
+    send_json(client, HTTP_400, "{\"error\":\"Unsupported upload request\"}");
+}
+
+/* Runs on an auth thread: check the password and start a session */
+static void login_task(SOCKET client, const char* username, const char* password) {
+    User row;
+    User* user = user_find_by_username(username, &row) == 0 ? &row : NULL;
+    if (!user) password_verify(password, NULL);   /* same cost as a wrong password */
     if (!user || !user_verify_password(user, password)) {
         log_message(LOG_WARN, "Login failed for user: %s", username);
         send_redirect(client, "/login.html?error=invalid", NULL);
         return;
     }
     
-    /* Create session */
-    Session* session = session_create(user->id);
+    /* Create session: a signed token, or a server-side session */
+    char token[128];
+    if (SESSION_SIGNED_TOKENS) {
+        if (token_create(user->id, token, sizeof(token)) < 0) token[0] = '\0';
+    } else {
+        Session session;
+        snprintf(token, sizeof(token), "%s", session_create(user->id, &session) == 0 ? session.token : "");
+    }
+    if (!token[0]) {
+        log_message(LOG_ERROR, "Failed to create session for user: %s", username);
+        send_redirect(client, "/login.html?error=failed", NULL);
+        return;
+    }
     
     char cookie[256];
-    snprintf(cookie, sizeof(cookie), "session=%s; Path=/; HttpOnly", session->token);
+    snprintf(cookie, sizeof(cookie), "session=%s; Path=/; HttpOnly", token);
     
     log_message(LOG_INFO, "User logged in: %s", username);
     send_redirect(client, "/list.html", cookie);
 }
 
-/* Handle register POST */
-static void handle_register(SOCKET client, HttpRequest* req) {
+/* Handle login POST. Returns 1 if an auth thread took over the client. */
+static int handle_login(SOCKET client, HttpRequest* req) {
     char username[64] = {0};
-    char password[64] = {0};
-
+    char password[MAX_PASSWORD_LEN + 2] = {0};   /* room to tell an over-long one apart */
+    
     /* Parse form data */
     get_query_param(req->body, "username", username, sizeof(username));
     get_query_param(req->body, "password", password, sizeof(password));
-
+    
     if (!username[0] || !password[0]) {
-        send_redirect(client, "/register.html?error=missing", NULL);
-        return;
+        send_redirect(client, "/login.html?error=missing", NULL);
+        return 0;
     }
-
-    if (user_find_by_username(username)) {
-        log_message(LOG_WARN, "Registration failed: user already exists: %s", username);
-        send_redirect(client, "/register.html?error=exists", NULL);
-        return;
+    
+    int queued = auth_submit(client, login_task, username, password);
+    memset(password, 0, sizeof(password));
+    if (queued == -2) {
+        send_redirect(client, "/login.html?error=invalid", NULL);
+        return 0;
+    }
+    if (queued < 0) {
+        log_message(LOG_WARN, "Login rejected, auth queue full: %s", username);
+        send_auth_busy(client);
+        return 0;
     }
+    return 1;
+}
 
+/* Runs on an auth thread: hash the password and add the user */
+static void register_task(SOCKET client, const char* username, const char* password) {
     if (user_create(username, password) != 0) {
         log_message(LOG_ERROR, "Registration failed for user: %s", username);
         send_redirect(client, "/register.html?error=failed", NULL);
@@ -323,13 +854,52 @@ static void handle_register(SOCKET client, HttpRequest* req) {
     send_redirect(client, "/login.html?registered=true", NULL);
 }
 
+/* Handle register POST. Returns 1 if an auth thread took over the client. */
+static int handle_register(SOCKET client, HttpRequest* req) {
+    char username[64] = {0};
+    char password[MAX_PASSWORD_LEN + 2] = {0};
+
+    /* Parse form data */
+    get_query_param(req->body, "username", username, sizeof(username));
+    get_query_param(req->body, "password", password, sizeof(password));
+
+    if (!username[0] || !password[0]) {
+        send_redirect(client, "/register.html?error=missing", NULL);
+        return 0;
+    }
+
+    User existing;
+    if (user_find_by_username(username, &existing) == 0) {
+        log_message(LOG_WARN, "Registration failed: user already exists: %s", username);
+        send_redirect(client, "/register.html?error=exists", NULL);
+        return 0;
+    }
+
+    int queued = auth_submit(client, register_task, username, password);
+    memset(password, 0, sizeof(password));
+    if (queued == -2) {
+        send_redirect(client, "/register.html?error=toolong", NULL);
+        return 0;
+    }
+    if (queued < 0) {
+        log_message(LOG_WARN, "Registration rejected, auth queue full: %s", username);
+        send_auth_busy(client);
+        return 0;
+    }
+    return 1;
+}
+
 /* Handle logout */
 static void handle_logout(SOCKET client, HttpRequest* req) {
-    char token[65] = {0};
+    char token[128] = {0};
     get_cookie_value(req->cookie, "session", token, sizeof(token));
     
     if (token[0]) {
-        session_destroy(token);
+        if (SESSION_SIGNED_TOKENS) {
+            token_revoke(token);
+        } else {
+            session_destroy(token);
+        }
     }
     
     send_redirect(client, "/login.html", "session=; Path=/; Max-Age=0");
@@ -340,52 +910,87 @@ static void api_get_videos(SOCKET client, int user_id) {
     Video* videos;
     int count = video_get_all(&videos);
     
-    char json[16384] = "[";
-    char* p = json + 1;
-    size_t remaining = sizeof(json) - 2;
+    /* Fetch the user's whole history once and index positions by video id */
+    int max_id = 0;
+    for (int i = 0; i < count; i++) {
+        if (videos[i].id > max_id) max_id = videos[i].id;
+    }
+    int* last_pos = calloc(max_id + 1, sizeof(int));
+    WatchHistory* history = malloc(sizeof(WatchHistory) * (count > 0 ? count : 1));
+    int history_count = last_pos && history ? history_get_user_history(user_id, history, count) : 0;
+    for (int i = 0; i < history_count; i++) {
+        if (history[i].video_id > 0 && history[i].video_id <= max_id) {
+            last_pos[history[i].video_id] = history[i].last_pos_sec;
+        }
+    }
+    free(history);
+    
+    /* Room for every entry at its longest, so the list is never cut short */
+    size_t size = (size_t)count * (sizeof(videos->title) + sizeof(videos->thumbnail) + 96) + sizeof("[]");
+    char* json = malloc(size);
+    if (!json) {
+        free(last_pos);
+        free(videos);
+        send_json(client, HTTP_500, "{\"error\":\"Out of memory\"}");
+        return;
+    }
     
+    char* p = json;
+    *p++ = '[';
     for (int i = 0; i < count; i++) {
         Video* v = &videos[i];
         
-        /* Check watch history */
-        int last_pos = 0;
-        WatchHistory* h = history_find(user_id, v->id);
-        if (h) {
-            last_pos = h->last_pos_sec;
-        }
-        
-        int written = snprintf(p, remaining,
+        p += sprintf(p,
             "%s{\"id\":%d,\"title\":\"%s\",\"thumbnail\":\"%s\",\"duration\":%d,\"last_pos\":%d}",
             i > 0 ? "," : "",
-            v->id, v->title, v->thumbnail, v->duration_sec, last_pos);
-        
-        p += written;
-        remaining -= written;
+            v->id, v->title, v->thumbnail, v->duration_sec,
+            last_pos && v->id > 0 ? last_pos[v->id] : 0);
     }
-    
-    strcat(p, "]");
+    strcpy(p, "]");
+    free(last_pos);
+    free(videos);
     
     send_json(client, HTTP_200, json);
+    free(json);
 }
 
 /* API: Get single video info */
 static void api_get_video(SOCKET client, int video_id, int user_id) {
-    Video* v = video_find_by_id(video_id);
+    Video row;
+    Video* v = video_find_by_id(video_id, &row) == 0 ? &row : NULL;
     if (!v) {
         send_json(client, HTTP_404, "{\"error\":\"Video not found\"}");
         return;
     }
     
     int last_pos = 0;
-    WatchHistory* h = history_find(user_id, v->id);
-    if (h) {
-        last_pos = h->last_pos_sec;
+    WatchHistory h;
+    if (history_find(user_id, v->id, &h) == 0) {
+        last_pos = h.last_pos_sec;
     }
     
-    char json[1024];
-    snprintf(json, sizeof(json),
-        "{\"id\":%d,\"title\":\"%s\",\"thumbnail\":\"%s\",\"duration\":%d,\"last_pos\":%d,\"filename\":\"%s\"}",
-        v->id, v->title, v->thumbnail, v->duration_sec, last_pos, v->filename);
+    /* Scrubbing preview track, if sprites were generated for this title */
+    char base[sizeof(v->filename)];
+    strcpy(base, v->filename);
+    char* ext = strrchr(base, '.');
+    if (ext) *ext = '\0';
+    
+    char trickplay[300] = "";
+    char vtt_path[MAX_PATH_LEN];
+    snprintf(vtt_path, sizeof(vtt_path), "%s/%s.vtt", TRICKPLAY_DIR, base);
+    FILE* vtt = fopen(vtt_path, "r");
+    if (vtt) {
+        fclose(vtt);
+        snprintf(trickplay, sizeof(trickplay), "trickplay/%s.vtt", base);
+    }
+    
+    char json[1536];
+    if (snprintf(json, sizeof(json),
+        "{\"id\":%d,\"title\":\"%s\",\"thumbnail\":\"%s\",\"duration\":%d,\"last_pos\":%d,\"filename\":\"%s\",\"trickplay\":\"%s\"}",
+        v->id, v->title, v->thumbnail, v->duration_sec, last_pos, v->filename, trickplay) >= (int)sizeof(json)) {
+        send_json(client, HTTP_500, "{\"error\":\"Video record too long\"}");
+        return;
+    }
     
     send_json(client, HTTP_200, json);
 }
@@ -401,6 +1006,9 @@ static void api_update_history(SOCKET client, int video_id, int user_id, HttpReq
     
     int position = atoi(pos_str);
     
+    /* A playhead that stopped moving means the viewer paused */
+    prefetch_note_position(user_id, video_id, position);
+    
     if (history_update(user_id, video_id, position) == 0) {
         send_json(client, HTTP_200, "{\"success\":true}");
     } else {
@@ -410,64 +1018,129 @@ static void api_update_history(SOCKET client, int video_id, int user_id, HttpReq
 
 /* API: Get watch history */
 static void api_get_history(SOCKET client, int user_id) {
-    WatchHistory history[MAX_VIDEOS];
-    int count = history_get_user_history(user_id, history, MAX_VIDEOS);
-    
-    char json[8192] = "[";
-    char* p = json + 1;
-    size_t remaining = sizeof(json) - 2;
+    /* At most one record per title */
+    int max_count = video_count();
+    WatchHistory* history = malloc(sizeof(WatchHistory) * (max_count > 0 ? max_count : 1));
+    int count = history ? history_get_user_history(user_id, history, max_count) : 0;
+    
+    /* Titles for every entry in one lookup */
+    int* ids = malloc(sizeof(int) * (count > 0 ? count : 1));
+    Video* videos = malloc(sizeof(Video) * (count > 0 ? count : 1));
+    if (!ids || !videos) count = 0;
+    for (int i = 0; i < count; i++) {
+        ids[i] = history[i].video_id;
+    }
+    videos_find(ids, count, videos);
+    
+    /* Room for every entry at its longest, so the list is never cut short */
+    size_t size = (size_t)count * (sizeof(videos->title) + 96) + sizeof("[]");
+    char* json = malloc(size);
+    if (!json) {
+        free(videos);
+        free(ids);
+        free(history);
+        send_json(client, HTTP_500, "{\"error\":\"Out of memory\"}");
+        return;
+    }
     
+    char* p = json;
+    *p++ = '[';
+    int shown = 0;
     for (int i = 0; i < count; i++) {
-        Video* v = video_find_by_id(history[i].video_id);
-        if (!v) continue;
+        Video* v = &videos[i];
+        if (v->id == 0) continue;
         
-        int written = snprintf(p, remaining,
+        p += sprintf(p,
             "%s{\"video_id\":%d,\"title\":\"%s\",\"last_pos\":%d,\"duration\":%d}",
-            i > 0 ? "," : "",
+            shown > 0 ? "," : "",
             history[i].video_id, v->title, history[i].last_pos_sec, v->duration_sec);
-        
-        p += written;
-        remaining -= written;
+        shown++;
     }
-    
-    strcat(p, "]");
+    strcpy(p, "]");
+    free(videos);
+    free(ids);
+    free(history);
     
     send_json(client, HTTP_200, json);
+    free(json);
 }
 
 /* API: Get current user */
 static void api_get_user(SOCKET client, int user_id) {
-    User* user = user_find_by_id(user_id);
+    User row;
+    User* user = user_find_by_id(user_id, &row) == 0 ? &row : NULL;
     if (!user) {
         send_json(client, HTTP_401, "{\"error\":\"Not authenticated\"}");
         return;
     }
     
-    char json[256];
+    char json[384];
     snprintf(json, sizeof(json), "{\"id\":%d,\"username\":\"%s\"}", user->id, user->username);
     send_json(client, HTTP_200, json);
 }
 
-/* Main request handler */
-void handle_request(SOCKET client, const char* raw_request) {
+/* API: Get server metrics */
+static void api_get_stats(SOCKET client) {
+    char cache[512];
+    char pacing[256];
+    char disk[1536];
+    char storage[2048];
+    char tier[512];
+    char prefetch[256];
+    char warmup[256];
+    char renditions[256];
+    char live[256];
+    char uploads[256];
+    char auth[256];
+    chunk_cache_stats_json(cache, sizeof(cache));
+    pacing_stats_json(pacing, sizeof(pacing));
+    disk_io_stats_json(disk, sizeof(disk));
+    storage_stats_json(storage, sizeof(storage));
+    tier_stats_json(tier, sizeof(tier));
+    prefetch_stats_json(prefetch, sizeof(prefetch));
+    warmup_stats_json(warmup, sizeof(warmup));
+    rendition_stats_json(renditions, sizeof(renditions));
+    live_stats_json(live, sizeof(live));
+    upload_stats_json(uploads, sizeof(uploads));
+    auth_stats_json(auth, sizeof(auth));
+    
+    char json[8192];
+    snprintf(json, sizeof(json),
+             "{\"chunk_cache\":%s,\"pacing\":%s,\"disk_io\":%s,\"storage\":%s,"
+             "\"fast_tier\":%s,\"prefetch\":%s,\"warmup\":%s,\"renditions\":%s,\"live\":%s,\"uploads\":%s,"
+             "\"auth\":%s}",
+             cache, pacing, disk, storage, tier, prefetch, warmup, renditions, live, uploads, auth);
+    send_json(client, HTTP_200, json);
+}
+
+/*
+ * Main request handler. Returns 1 if the connection was handed to
+ * another thread, which closes it; 0 if the caller should close it.
+ */
+int handle_request(SOCKET client, const char* raw_request, int raw_length) {
     HttpRequest req;
     
     if (parse_http_request(raw_request, &req) < 0) {
         const char* msg = "Bad Request";
         send_response(client, HTTP_400, "text/plain", NULL, msg, strlen(msg));
-        return;
+        return 0;
     }
     
     log_message(LOG_INFO, "%s %s", req.method, req.path);
     
     /* Get session */
     int user_id = 0;
-    char token[65] = {0};
+    char token[128] = {0};
     get_cookie_value(req.cookie, "session", token, sizeof(token));
     
-    Session* session = session_find(token);
-    if (session) {
-        user_id = session->user_id;
+    if (SESSION_SIGNED_TOKENS) {
+        /* Checked locally: no session store lookup */
+        user_id = token_verify(token);
+    } else {
+        Session session;
+        if (session_find(token, &session) == 0) {
+            user_id = session.user_id;
+        }
     }
     
     /* Route request */
@@ -475,9 +1148,10 @@ void handle_request(SOCKET client, const char* raw_request) {
     /* Static files */
     if (strncmp(req.path, "/css/", 5) == 0 ||
         strncmp(req.path, "/js/", 4) == 0 ||
-        strncmp(req.path, "/thumbnails/", 12) == 0) {
+        strncmp(req.path, "/thumbnails/", 12) == 0 ||
+        strncmp(req.path, "/trickplay/", 11) == 0) {
         send_static_file(client, req.path, &req);
-        return;
+        return 0;
     }
     
     /* Root - redirect based on auth */
@@ -487,19 +1161,19 @@ void handle_request(SOCKET client, const char* raw_request) {
         } else {
             send_redirect(client, "/login.html", NULL);
         }
-        return;
+        return 0;
     }
     
     /* Login page */
     if (strcmp(req.path, "/login.html") == 0) {
         send_static_file(client, "login.html", &req);
-        return;
+        return 0;
     }
 
     /* Register page */
     if (strcmp(req.path, "/register.html") == 0) {
         send_static_file(client, "register.html", &req);
-        return;
+        return 0;
     }
     
     /* Index page */
@@ -509,25 +1183,30 @@ void handle_request(SOCKET client, const char* raw_request) {
         } else {
             send_static_file(client, "index.html", &req);
         }
-        return;
+        return 0;
     }
     
     /* Login POST */
     if (strcmp(req.path, "/login") == 0 && strcmp(req.method, "POST") == 0) {
-        handle_login(client, &req);
-        return;
+        return handle_login(client, &req);
     }
 
-    /* Register POST */
+    /* Live ingest from the local encoder, which has no session */
+    if (strncmp(req.path, "/live/", 6) == 0 &&
+        (strcmp(req.method, "PUT") == 0 || strcmp(req.method, "POST") == 0 ||
+         strcmp(req.method, "DELETE") == 0)) {
+        handle_live_ingest(client, &req, raw_request, raw_length);
+        return 0;
+    }
+    
     if (strcmp(req.path, "/register") == 0 && strcmp(req.method, "POST") == 0) {
-        handle_register(client, &req);
-        return;
+        return handle_register(client, &req);
     }
     
     /* Logout */
     if (strcmp(req.path, "/logout") == 0) {
         handle_logout(client, &req);
-        return;
+        return 0;
     }
     
     /* Protected pages - require login */
@@ -535,48 +1214,55 @@ void handle_request(SOCKET client, const char* raw_request) {
         if (strcmp(req.path, "/list.html") == 0 ||
             strcmp(req.path, "/player.html") == 0 ||
             strncmp(req.path, "/api/", 5) == 0 ||
-            strncmp(req.path, "/video/", 7) == 0) {
+            strncmp(req.path, "/video/", 7) == 0 ||
+            strncmp(req.path, "/live/", 6) == 0) {
             send_redirect(client, "/login.html", NULL);
-            return;
+            return 0;
         }
     }
     
     /* List page */
     if (strcmp(req.path, "/list.html") == 0) {
         send_static_file(client, "list.html", &req);
-        return;
+        return 0;
     }
     
     /* Player page */
     if (strcmp(req.path, "/player.html") == 0) {
         send_static_file(client, "player.html", &req);
-        return;
+        return 0;
     }
     
     /* Video streaming */
     if (strncmp(req.path, "/video/", 7) == 0) {
         int video_id = atoi(req.path + 7);
         stream_video(client, video_id, &req, user_id);
-        return;
+        return 0;
+    }
+    
+    /* Live channels */
+    if (strncmp(req.path, "/live/", 6) == 0) {
+        stream_live(client, &req);
+        return 0;
     }
     
     /* API endpoints */
     if (strcmp(req.path, "/api/videos") == 0) {
         api_get_videos(client, user_id);
-        return;
+        return 0;
     }
     
     if (strncmp(req.path, "/api/videos/", 12) == 0) {
         int video_id = atoi(req.path + 12);
         api_get_video(client, video_id, user_id);
-        return;
+        return 0;
     }
     
     if (strcmp(req.path, "/api/history") == 0) {
         if (strcmp(req.method, "GET") == 0) {
             api_get_history(client, user_id);
         }
-        return;
+        return 0;
     }
     
     if (strncmp(req.path, "/api/history/", 13) == 0) {
@@ -584,14 +1270,25 @@ void handle_request(SOCKET client, const char* raw_request) {
         if (strcmp(req.method, "POST") == 0) {
             api_update_history(client, video_id, user_id, &req);
         }
-        return;
+        return 0;
+    }
+    
+    if (strncmp(req.path, "/api/uploads", 12) == 0) {
+        api_uploads(client, &req, user_id, raw_request, raw_length);
+        return 0;
     }
     
     if (strcmp(req.path, "/api/user") == 0) {
         api_get_user(client, user_id);
-        return;
+        return 0;
+    }
+    
+    if (strcmp(req.path, "/api/stats") == 0) {
+        api_get_stats(client);
+        return 0;
     }
     
     /* Try static file */
     send_static_file(client, req.path, &req);
+    return 0;
 }
@@ -56,6 +56,7 @@ __declspec(dllimport) int PQntuples(const PGresult *res);
 __declspec(dllimport) int PQnfields(const PGresult *res);
 __declspec(dllimport) char* PQgetvalue(const PGresult *res, int tup_num, int field_num);
 __declspec(dllimport) int PQgetisnull(const PGresult *res, int tup_num, int field_num);
+__declspec(dllimport) char* PQcmdTuples(PGresult *res);
 __declspec(dllimport) void PQclear(PGresult *res);
 
 #ifdef __cplusplus
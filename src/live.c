@@ -0,0 +1,594 @@
+/*
+ * OTT Video Streaming Server - Live Channels
+ * A local encoder pushes CMAF segments and HLS playlists with HTTP PUT to
+ * /live/<channel>/<file>. The last LIVE_SEGMENTS media files of each
+ * channel are held in memory and never written to disk. Viewers read the
+ * shared buffers directly, a file still being uploaded can be read while
+ * it grows (partial segments), and playlist requests carrying _HLS_msn /
+ * _HLS_part block until the encoder publishes that part. Waiting holds a
+ * worker thread, so only a few requests may block at once; the rest are
+ * answered straight away.
+ */
+
+#include "common.h"
+
+#define MAX_LIVE_CHANNELS 8
+#define LIVE_NAME_LEN 128
+#define LIVE_BLOCK_SIZE (64 * 1024)
+#define LIVE_MAX_BLOCKS (LIVE_MAX_FILE_MB * 1024 * 1024 / LIVE_BLOCK_SIZE)
+
+/* Media files in the ring plus playlists and init segments */
+#define LIVE_MAX_FILES (LIVE_SEGMENTS + 16)
+
+#define INGEST_BUFFER_SIZE 16384
+
+typedef struct {
+    char name[LIVE_NAME_LEN];
+    char* blocks[LIVE_MAX_BLOCKS];
+    long length;
+    int complete;
+    int failed;             /* upload aborted before the end */
+    int refs;               /* one for the channel table, one per reader */
+    int pinned;             /* playlists and init segments stay out of the ring */
+    long long msn;          /* playlist: media sequence number in progress */
+    int parts;              /* playlist: parts published for that segment */
+    char hint[LIVE_NAME_LEN]; /* playlist: EXT-X-PRELOAD-HINT file */
+    unsigned long long seq; /* upload order, for ring eviction */
+} LiveFile;
+
+typedef struct {
+    char name[64];
+    LiveFile* files[LIVE_MAX_FILES];
+    unsigned long long next_seq;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;    /* broadcast whenever a file grows or appears */
+    int in_use;
+} LiveChannel;
+
+typedef struct {
+    LiveChannel* channel;
+    LiveFile* file;
+} LiveReader;
+
+/* Buffered reader over the request bytes already received and the socket */
+typedef struct {
+    SOCKET client;
+    char buffer[INGEST_BUFFER_SIZE];
+    int pos;
+    int len;
+} IngestReader;
+
+static LiveChannel g_channels[MAX_LIVE_CHANNELS];
+static pthread_mutex_t g_live_mutex;
+static long long g_ingested_bytes = 0;
+static long long g_served_bytes = 0;
+static long long g_evicted = 0;
+static int g_blocking = 0;
+static int g_max_blocking = 1;
+static long long g_refused = 0;
+static int g_ingesting = 0;
+static int g_max_ingesting = 1;
+static long long g_ingest_refused = 0;
+
+void live_init(int max_blocking, int max_ingesting) {
+    g_max_blocking = max_blocking > 0 ? max_blocking : 1;
+    g_max_ingesting = max_ingesting > 0 ? max_ingesting : 1;
+    pthread_mutex_init(&g_live_mutex, NULL);
+    memset(g_channels, 0, sizeof(g_channels));
+    for (int i = 0; i < MAX_LIVE_CHANNELS; i++) {
+        pthread_mutex_init(&g_channels[i].mutex, NULL);
+        pthread_cond_init(&g_channels[i].cond, NULL);
+    }
+}
+
+/* Wait on a channel's condition until the deadline (caller holds ch->mutex) */
+static int channel_wait(LiveChannel* ch, double deadline) {
+    double remaining = deadline - monotonic_seconds();
+    if (remaining <= 0) return -1;
+
+#if defined(_WIN32)
+    SleepConditionVariableCS(&ch->cond, &ch->mutex, (DWORD)(remaining * 1000) + 1);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    long long ns = ts.tv_nsec + (long long)(remaining * 1e9);
+    ts.tv_sec += (time_t)(ns / 1000000000LL);
+    ts.tv_nsec = (long)(ns % 1000000000LL);
+    pthread_cond_timedwait(&ch->cond, &ch->mutex, &ts);
+#endif
+    return 0;
+}
+
+static LiveChannel* find_channel(const char* name, int create) {
+    LiveChannel* found = NULL;
+
+    pthread_mutex_lock(&g_live_mutex);
+    for (int i = 0; i < MAX_LIVE_CHANNELS && !found; i++) {
+        if (g_channels[i].in_use && strcmp(g_channels[i].name, name) == 0) found = &g_channels[i];
+    }
+    for (int i = 0; i < MAX_LIVE_CHANNELS && !found && create; i++) {
+        if (!g_channels[i].in_use) {
+            found = &g_channels[i];
+            strncpy(found->name, name, sizeof(found->name) - 1);
+            found->in_use = 1;
+            log_message(LOG_INFO, "Live channel started: %s", name);
+        }
+    }
+    pthread_mutex_unlock(&g_live_mutex);
+
+    return found;
+}
+
+/* Drop a reference; the last one frees the buffers (caller holds ch->mutex) */
+static void file_unref(LiveFile* f) {
+    if (--f->refs > 0) return;
+
+    for (int i = 0; i < LIVE_MAX_BLOCKS && f->blocks[i]; i++) {
+        free(f->blocks[i]);
+    }
+    free(f);
+}
+
+static int find_slot(LiveChannel* ch, const char* name) {
+    for (int i = 0; i < LIVE_MAX_FILES; i++) {
+        if (ch->files[i] && strcmp(ch->files[i]->name, name) == 0) return i;
+    }
+    return -1;
+}
+
+/* Evict the oldest media files beyond LIVE_SEGMENTS (caller holds ch->mutex) */
+static void trim_ring(LiveChannel* ch) {
+    for (;;) {
+        int media = 0;
+        int oldest = -1;
+        for (int i = 0; i < LIVE_MAX_FILES; i++) {
+            LiveFile* f = ch->files[i];
+            if (!f || f->pinned) continue;
+            media++;
+            if (oldest < 0 || f->seq < ch->files[oldest]->seq) oldest = i;
+        }
+        if (media <= LIVE_SEGMENTS) return;
+
+        file_unref(ch->files[oldest]);
+        ch->files[oldest] = NULL;
+        ATOMIC_ADD64(&g_evicted, 1);
+    }
+}
+
+/*
+ * Find the segment in progress and the parts published for it: segments
+ * listed after EXT-X-MEDIA-SEQUENCE, then EXT-X-PART lines after the last
+ * full segment. Only the first block is parsed; playlists are far smaller.
+ */
+static void parse_playlist(LiveFile* f) {
+    char text[LIVE_BLOCK_SIZE + 1];
+    long len = f->length < LIVE_BLOCK_SIZE ? f->length : LIVE_BLOCK_SIZE;
+    if (len <= 0) return;
+    memcpy(text, f->blocks[0], len);
+    text[len] = '\0';
+
+    long long msn = 0;
+    int parts = 0;
+
+    char* line = text;
+    while (line && *line) {
+        char* next = strchr(line, '\n');
+        if (next) *next++ = '\0';
+
+        if (strncmp(line, "#EXT-X-MEDIA-SEQUENCE:", 22) == 0) {
+            msn = atoll(line + 22);
+        } else if (strncmp(line, "#EXT-X-PART:", 12) == 0) {
+            parts++;
+        } else if (strncmp(line, "#EXTINF:", 8) == 0) {
+            msn++;
+            parts = 0;
+        } else if (strncmp(line, "#EXT-X-PRELOAD-HINT:", 20) == 0) {
+            char* uri = strstr(line, "URI=\"");
+            char* end = uri ? strchr(uri + 5, '"') : NULL;
+            if (end && end - (uri + 5) < LIVE_NAME_LEN) {
+                memcpy(f->hint, uri + 5, end - (uri + 5));
+                f->hint[end - (uri + 5)] = '\0';
+            }
+        }
+        line = next;
+    }
+
+    f->msn = msn;
+    f->parts = parts;
+}
+
+static int reader_fill(IngestReader* r) {
+    r->pos = 0;
+    r->len = recv(r->client, r->buffer, sizeof(r->buffer), 0);
+    return r->len > 0 ? 0 : -1;
+}
+
+/* Read up to len bytes; returns bytes read, 0 at end of stream */
+static long reader_read(IngestReader* r, char* dst, long len) {
+    if (r->pos >= r->len) {
+        /* Large reads go straight into the destination */
+        if (len >= (long)sizeof(r->buffer)) {
+            long n = recv(r->client, dst, (int)len, 0);
+            return n > 0 ? n : 0;
+        }
+        if (reader_fill(r) < 0) return 0;
+    }
+
+    long n = r->len - r->pos;
+    if (n > len) n = len;
+    memcpy(dst, r->buffer + r->pos, n);
+    r->pos += (int)n;
+    return n;
+}
+
+static int reader_line(IngestReader* r, char* line, int size) {
+    int n = 0;
+    for (;;) {
+        if (r->pos >= r->len && reader_fill(r) < 0) return -1;
+        char c = r->buffer[r->pos++];
+        if (c == '\n') break;
+        if (c != '\r' && n < size - 1) line[n++] = c;
+    }
+    line[n] = '\0';
+    return n;
+}
+
+/* Append up to len bytes from the reader to a file; returns bytes appended, 0 at end */
+static long append_from(LiveChannel* ch, LiveFile* f, IngestReader* r, long len) {
+    long block = f->length / LIVE_BLOCK_SIZE;
+    long in_block = f->length % LIVE_BLOCK_SIZE;
+    if (block >= LIVE_MAX_BLOCKS) return -1;
+
+    if (!f->blocks[block]) {
+        char* mem = malloc(LIVE_BLOCK_SIZE);
+        if (!mem) return -1;
+        pthread_mutex_lock(&ch->mutex);
+        f->blocks[block] = mem;
+        pthread_mutex_unlock(&ch->mutex);
+    }
+
+    if (len > LIVE_BLOCK_SIZE - in_block) len = LIVE_BLOCK_SIZE - in_block;
+    long n = reader_read(r, f->blocks[block] + in_block, len);
+    if (n <= 0) return 0;
+
+    /* Readers see only whole appended ranges */
+    pthread_mutex_lock(&ch->mutex);
+    f->length += n;
+    pthread_cond_broadcast(&ch->cond);
+    pthread_mutex_unlock(&ch->mutex);
+
+    ATOMIC_ADD64(&g_ingested_bytes, n);
+    return n;
+}
+
+/*
+ * Receive a file pushed by the encoder, with Content-Length or chunked
+ * transfer encoding. The new file replaces any previous one of the same
+ * name once its first byte arrives, so viewers can read it as it grows.
+ * prefix holds the body bytes received with the headers. Returns 0 on
+ * success, -1 if the channel is full or the upload fails.
+ */
+static int receive_file(SOCKET client, const char* channel, const char* name, int chunked,
+                        long long content_length, const char* prefix, int prefix_len) {
+    LiveChannel* ch = find_channel(channel, 1);
+    if (!ch || strlen(name) >= LIVE_NAME_LEN) return -1;
+
+    LiveFile* f = calloc(1, sizeof(LiveFile));
+    IngestReader* r = malloc(sizeof(IngestReader));
+    if (!f || !r) {
+        free(f);
+        free(r);
+        return -1;
+    }
+
+    strcpy(f->name, name);
+    const char* ext = strrchr(name, '.');
+    int playlist = ext && strcmp(ext, ".m3u8") == 0;
+    f->pinned = playlist || strncmp(name, "init", 4) == 0;
+    f->refs = 2;   /* the table's and ours */
+
+    r->client = client;
+    r->pos = 0;
+    r->len = prefix_len < (int)sizeof(r->buffer) ? prefix_len : (int)sizeof(r->buffer);
+    memcpy(r->buffer, prefix, r->len);
+
+    /* Playlists are only published complete; media files are visible while uploading */
+    pthread_mutex_lock(&ch->mutex);
+    f->seq = ch->next_seq++;
+    int slot = find_slot(ch, name);
+    if (!playlist) {
+        for (int i = 0; slot < 0 && i < LIVE_MAX_FILES; i++) {
+            if (!ch->files[i]) slot = i;
+        }
+        if (slot < 0) {
+            pthread_mutex_unlock(&ch->mutex);
+            free(f);
+            free(r);
+            return -1;
+        }
+        if (ch->files[slot]) file_unref(ch->files[slot]);
+        ch->files[slot] = f;
+        trim_ring(ch);
+        pthread_cond_broadcast(&ch->cond);
+    }
+    pthread_mutex_unlock(&ch->mutex);
+
+    int ok = 1;
+    if (chunked) {
+        char line[64];
+        for (;;) {
+            if (reader_line(r, line, sizeof(line)) < 0) { ok = 0; break; }
+            long size = strtol(line, NULL, 16);
+            if (size <= 0) break;
+
+            while (size > 0) {
+                long n = append_from(ch, f, r, size);
+                if (n <= 0) { ok = 0; break; }
+                size -= n;
+            }
+            if (!ok || reader_line(r, line, sizeof(line)) < 0) { ok = 0; break; }
+        }
+    } else {
+        long long remaining = content_length;
+        while (remaining > 0) {
+            long n = append_from(ch, f, r, remaining < LIVE_BLOCK_SIZE ? (long)remaining : LIVE_BLOCK_SIZE);
+            if (n <= 0) { ok = 0; break; }
+            remaining -= n;
+        }
+    }
+    free(r);
+
+    pthread_mutex_lock(&ch->mutex);
+    if (ok && playlist) {
+        parse_playlist(f);
+        slot = find_slot(ch, name);
+        for (int i = 0; slot < 0 && i < LIVE_MAX_FILES; i++) {
+            if (!ch->files[i]) slot = i;
+        }
+        if (slot >= 0) {
+            if (ch->files[slot]) file_unref(ch->files[slot]);
+            ch->files[slot] = f;
+        } else {
+            ok = 0;
+        }
+    }
+    if (!ok && playlist) f->refs--;   /* never published */
+    f->complete = 1;
+    f->failed = !ok;
+    pthread_cond_broadcast(&ch->cond);
+    file_unref(f);
+    pthread_mutex_unlock(&ch->mutex);
+
+    if (!ok) log_message(LOG_WARN, "Live upload failed: %s/%s", channel, name);
+    return ok ? 0 : -1;
+}
+
+/*
+ * Store a file from the encoder (see receive_file). Each upload holds a
+ * worker until its body is in, so only so many run at once. Returns 0,
+ * -1 if the upload fails, or -2 if too many are already running.
+ */
+int live_ingest(SOCKET client, const char* channel, const char* name, int chunked,
+                long long content_length, const char* prefix, int prefix_len) {
+    pthread_mutex_lock(&g_live_mutex);
+    int granted = g_ingesting < g_max_ingesting;
+    if (granted) g_ingesting++;
+    else g_ingest_refused++;
+    pthread_mutex_unlock(&g_live_mutex);
+    if (!granted) return -2;
+
+    int result = receive_file(client, channel, name, chunked, content_length, prefix, prefix_len);
+
+    pthread_mutex_lock(&g_live_mutex);
+    g_ingesting--;
+    pthread_mutex_unlock(&g_live_mutex);
+    return result;
+}
+
+/* Remove a file at the encoder's request */
+int live_delete(const char* channel, const char* name) {
+    LiveChannel* ch = find_channel(channel, 0);
+    if (!ch) return -1;
+
+    pthread_mutex_lock(&ch->mutex);
+    int slot = find_slot(ch, name);
+    if (slot >= 0) {
+        file_unref(ch->files[slot]);
+        ch->files[slot] = NULL;
+    }
+    pthread_mutex_unlock(&ch->mutex);
+
+    return slot >= 0 ? 0 : -1;
+}
+
+/*
+ * Claim one of the slots for requests that may wait on the encoder.
+ * Returns 1 if the caller may block (release with live_block_end), 0 if
+ * it must answer without waiting.
+ */
+int live_block_begin(void) {
+    pthread_mutex_lock(&g_live_mutex);
+    int granted = g_blocking < g_max_blocking;
+    if (granted) g_blocking++;
+    else g_refused++;
+    pthread_mutex_unlock(&g_live_mutex);
+    return granted;
+}
+
+void live_block_end(void) {
+    pthread_mutex_lock(&g_live_mutex);
+    g_blocking--;
+    pthread_mutex_unlock(&g_live_mutex);
+}
+
+/* Is the file named by a playlist's preload hint? (caller holds ch->mutex) */
+static int is_hinted(LiveChannel* ch, const char* name) {
+    for (int i = 0; i < LIVE_MAX_FILES; i++) {
+        LiveFile* f = ch->files[i];
+        if (f && f->hint[0] && strcmp(f->hint, name) == 0) return 1;
+    }
+    return 0;
+}
+
+/*
+ * Open a file for reading. A file named in a preload hint may not have
+ * been pushed yet, so wait up to timeout_ms for it to appear. Returns a
+ * reader to pass to live_read and live_release, or NULL.
+ */
+void* live_open(const char* channel, const char* name, int timeout_ms) {
+    LiveChannel* ch = find_channel(channel, 0);
+    if (!ch) return NULL;
+
+    double deadline = monotonic_seconds() + timeout_ms / 1000.0;
+    LiveFile* f = NULL;
+
+    pthread_mutex_lock(&ch->mutex);
+    for (;;) {
+        int slot = find_slot(ch, name);
+        if (slot >= 0) {
+            f = ch->files[slot];
+            f->refs++;
+            break;
+        }
+        if (!is_hinted(ch, name) || channel_wait(ch, deadline) < 0) break;
+    }
+    pthread_mutex_unlock(&ch->mutex);
+
+    if (!f) return NULL;
+
+    LiveReader* reader = malloc(sizeof(LiveReader));
+    if (!reader) {
+        pthread_mutex_lock(&ch->mutex);
+        file_unref(f);
+        pthread_mutex_unlock(&ch->mutex);
+        return NULL;
+    }
+    reader->channel = ch;
+    reader->file = f;
+    return reader;
+}
+
+/* Total size of a file, or -1 while it is still being uploaded */
+long live_length(void* handle) {
+    LiveReader* reader = handle;
+    LiveChannel* ch = reader->channel;
+
+    pthread_mutex_lock(&ch->mutex);
+    long length = reader->file->complete ? reader->file->length : -1;
+    pthread_mutex_unlock(&ch->mutex);
+    return length;
+}
+
+/*
+ * Point *data at the bytes available from offset, waiting up to timeout_ms
+ * for an upload in progress to reach it. The data is shared by all readers
+ * and stays valid until live_release. Returns the byte count, 0 at the end
+ * of the file, or -1 on timeout or an aborted upload.
+ */
+long live_read(void* handle, long offset, const char** data, int timeout_ms) {
+    LiveReader* reader = handle;
+    LiveChannel* ch = reader->channel;
+    LiveFile* f = reader->file;
+    double deadline = monotonic_seconds() + timeout_ms / 1000.0;
+
+    pthread_mutex_lock(&ch->mutex);
+    while (offset >= f->length && !f->complete) {
+        if (channel_wait(ch, deadline) < 0) break;
+    }
+
+    long result;
+    if (offset < f->length) {
+        long in_block = offset % LIVE_BLOCK_SIZE;
+        result = LIVE_BLOCK_SIZE - in_block;
+        if (result > f->length - offset) result = f->length - offset;
+        *data = f->blocks[offset / LIVE_BLOCK_SIZE] + in_block;
+        ATOMIC_ADD64(&g_served_bytes, result);
+    } else {
+        result = f->complete && !f->failed ? 0 : -1;
+    }
+    pthread_mutex_unlock(&ch->mutex);
+
+    return result;
+}
+
+void live_release(void* handle) {
+    LiveReader* reader = handle;
+    LiveChannel* ch = reader->channel;
+
+    pthread_mutex_lock(&ch->mutex);
+    file_unref(reader->file);
+    pthread_mutex_unlock(&ch->mutex);
+    free(reader);
+}
+
+/*
+ * Blocking playlist reload: wait until the playlist lists segment msn, or
+ * part `part` of it (part < 0 for the whole segment). Returns 0 once it
+ * does, -1 on timeout or if the request is too far ahead of the encoder.
+ */
+int live_playlist_wait(const char* channel, const char* name, long long msn, int part,
+                       int timeout_ms) {
+    LiveChannel* ch = find_channel(channel, 0);
+    if (!ch) return -1;
+
+    double deadline = monotonic_seconds() + timeout_ms / 1000.0;
+    int result = -1;
+
+    pthread_mutex_lock(&ch->mutex);
+    for (;;) {
+        int slot = find_slot(ch, name);
+        if (slot >= 0) {
+            LiveFile* f = ch->files[slot];
+
+            /* Requests more than two segments ahead will not be satisfied in time */
+            if (msn > f->msn + 2) break;
+            if (msn < f->msn || (part >= 0 && msn == f->msn && part < f->parts)) {
+                result = 0;
+                break;
+            }
+        }
+        if (channel_wait(ch, deadline) < 0) break;
+    }
+    pthread_mutex_unlock(&ch->mutex);
+
+    return result;
+}
+
+/* Write live channel metrics as a JSON object */
+int live_stats_json(char* buf, size_t size) {
+    int channels = 0;
+    int files = 0;
+    int readers = 0;
+    long long bytes = 0;
+
+    for (int i = 0; i < MAX_LIVE_CHANNELS; i++) {
+        LiveChannel* ch = &g_channels[i];
+        pthread_mutex_lock(&ch->mutex);
+        if (ch->in_use) {
+            channels++;
+            for (int j = 0; j < LIVE_MAX_FILES; j++) {
+                LiveFile* f = ch->files[j];
+                if (!f) continue;
+                files++;
+                readers += f->refs - 1 - !f->complete;
+                bytes += f->length;
+            }
+        }
+        pthread_mutex_unlock(&ch->mutex);
+    }
+
+    pthread_mutex_lock(&g_live_mutex);
+    int blocking = g_blocking;
+    long long refused = g_refused;
+    int ingesting = g_ingesting;
+    long long ingest_refused = g_ingest_refused;
+    pthread_mutex_unlock(&g_live_mutex);
+
+    return snprintf(buf, size,
+        "{\"channels\":%d,\"files\":%d,\"readers\":%d,\"bytes\":%lld,"
+        "\"ingested_bytes\":%lld,\"served_bytes\":%lld,\"evicted\":%lld,"
+        "\"blocking\":%d,\"refused\":%lld,\"ingesting\":%d,\"ingest_refused\":%lld}",
+        channels, files, readers, bytes, (long long)ATOMIC_LOAD64(&g_ingested_bytes),
+        (long long)ATOMIC_LOAD64(&g_served_bytes), (long long)ATOMIC_LOAD64(&g_evicted),
+        blocking, refused, ingesting, ingest_refused);
+}
@@ -6,12 +6,25 @@
 #include "common.h"
 
 /* External function declarations */
-extern void data_init(void);
+extern int data_init(void);
 extern void data_load(void);
 extern void data_save(void);
 extern int ffmpeg_check_available(void);
 extern int ffmpeg_scan_videos(void);
-extern void handle_request(SOCKET client, const char* raw_request);
+extern int handle_request(SOCKET client, const char* raw_request, int raw_length);
+extern void stream_tune_init(void);
+extern void chunk_cache_init(int size_mb);
+extern void pacing_init(int egress_mbps);
+extern void disk_io_init(int threads_per_device, int queue_depth, int max_waiters);
+extern void storage_init(void);
+extern void tier_init(void);
+extern void prefetch_init(int threads);
+extern void warmup_start(void);
+extern void rendition_init(void);
+extern void live_init(int max_blocking, int max_ingesting);
+extern void upload_init(void);
+extern void token_init(void);
+extern void auth_init(int threads, int queue_depth);
 
 /* Thread pool configuration */
 #define THREAD_POOL_SIZE 8
@@ -181,8 +194,9 @@ void* worker_thread(void* arg) {
             }
         }
         
-        if (total > 0) {
-            handle_request(client, request);
+        /* A handed-off connection is closed by the thread that took it */
+        if (total > 0 && handle_request(client, request, total)) {
+            continue;
         }
         
         CLOSESOCKET(client);
@@ -278,6 +292,7 @@ int main(int argc, char* argv[]) {
     /* Create data directory */
     CreateDirectoryA(DATA_DIR, NULL);
     CreateDirectoryA(THUMBNAIL_DIR, NULL);
+    CreateDirectoryA(TRICKPLAY_DIR, NULL);
 #else
     /* Setup signal handler */
     signal(SIGINT, signal_handler);
@@ -287,6 +302,7 @@ int main(int argc, char* argv[]) {
     /* Create data directory */
     mkdir(DATA_DIR, 0755);
     mkdir(THUMBNAIL_DIR, 0755);
+    mkdir(TRICKPLAY_DIR, 0755);
 #endif
     
     log_message(LOG_INFO, "=================================");
@@ -294,8 +310,17 @@ int main(int argc, char* argv[]) {
     log_message(LOG_INFO, "=================================");
     
     /* Initialize data storage */
-    data_init();
+    if (data_init() < 0) {
+        log_message(LOG_ERROR, "Failed to start data storage");
+        return 1;
+    }
     data_load();
+    token_init();
+    auth_init(AUTH_THREADS, AUTH_QUEUE_DEPTH);
+    
+    /* Initialize disk I/O pools and the video storage roots */
+    disk_io_init(DISK_IO_THREADS, DISK_IO_QUEUE_DEPTH, THREAD_POOL_SIZE * DISK_IO_WORKER_SHARE / 100);
+    storage_init();
     
     /* Check FFmpeg and scan videos */
     if (ffmpeg_check_available()) {
@@ -304,8 +329,19 @@ int main(int argc, char* argv[]) {
         log_message(LOG_WARN, "FFmpeg not found - thumbnails will not be generated");
     }
     
-    /* Always scan videos directory */
+    /* Always scan video storage roots */
     ffmpeg_scan_videos();
+    tier_init();
+    rendition_init();
+    live_init(THREAD_POOL_SIZE * LIVE_BLOCK_WORKER_SHARE / 100,
+              THREAD_POOL_SIZE * LIVE_INGEST_WORKER_SHARE / 100);
+    upload_init();
+    
+    /* Initialize per-stream tuning and the shared chunk cache */
+    stream_tune_init();
+    chunk_cache_init(CHUNK_CACHE_MB);
+    pacing_init(EGRESS_LIMIT_MBPS);
+    prefetch_init(PREFETCH_THREADS);
     
     /* Initialize connection queue */
     queue_init(&g_queue);
@@ -334,6 +370,9 @@ int main(int argc, char* argv[]) {
     log_message(LOG_INFO, "Open http://localhost:%s in your browser", port);
     log_message(LOG_INFO, "Default users: admin/admin123, user1/password, test/test");
     
+    /* Warm popular titles in the background while serving */
+    warmup_start();
+    
     /* Main accept loop */
     while (g_running) {
         struct sockaddr_storage client_addr;
@@ -0,0 +1,400 @@
+/*
+ * OTT Video Streaming Server - MP4 Faststart
+ * Moves a trailing moov atom in front of mdat so progressive playback
+ * can start without fetching the end of the file first
+ */
+
+#include "common.h"
+
+#if defined(_WIN32)
+    #include <sys/stat.h>
+    #include <io.h>
+    #define FSEEK64 _fseeki64
+    #define FTELL64 _ftelli64
+#else
+    #define FSEEK64 fseeko
+    #define FTELL64 ftello
+#endif
+
+/* Refuse to load absurdly large moov atoms into memory */
+#define MAX_MOOV_SIZE (64 * 1024 * 1024)
+
+/* Registry of files already processed (size mtime filename per line) */
+#define FASTSTART_INDEX DATA_DIR "/faststart.idx"
+#define MAX_FASTSTART_ENTRIES 1024
+
+typedef struct {
+    char filename[256];
+    long long size;
+    long long mtime;
+} FaststartEntry;
+
+static FaststartEntry g_entries[MAX_FASTSTART_ENTRIES];
+static int g_entry_count = 0;
+static int g_index_loaded = 0;
+static pthread_mutex_t g_faststart_mutex;
+static int g_faststart_mutex_initialized = 0;
+
+/* Big-endian helpers */
+static unsigned int read_be32(const unsigned char* p) {
+    return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) |
+           ((unsigned int)p[2] << 8) | (unsigned int)p[3];
+}
+
+static unsigned long long read_be64(const unsigned char* p) {
+    return ((unsigned long long)read_be32(p) << 32) | read_be32(p + 4);
+}
+
+static void write_be32(unsigned char* p, unsigned int v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static void write_be64(unsigned char* p, unsigned long long v) {
+    write_be32(p, (unsigned int)(v >> 32));
+    write_be32(p + 4, (unsigned int)v);
+}
+
+/* Read a top-level atom header at pos. Returns 0 on success. */
+static int read_atom_header(FILE* fp, long long pos, long long file_size,
+                            long long* atom_size, char type[5]) {
+    unsigned char hdr[16];
+
+    if (FSEEK64(fp, pos, SEEK_SET) != 0) return -1;
+    if (fread(hdr, 1, 8, fp) != 8) return -1;
+
+    long long size = read_be32(hdr);
+    memcpy(type, hdr + 4, 4);
+    type[4] = '\0';
+
+    if (size == 1) {
+        /* 64-bit largesize follows the type */
+        if (fread(hdr + 8, 1, 8, fp) != 8) return -1;
+        size = (long long)read_be64(hdr + 8);
+    } else if (size == 0) {
+        /* Atom extends to end of file */
+        size = file_size - pos;
+    }
+
+    if (size < 8 || pos + size > file_size) return -1;
+
+    *atom_size = size;
+    return 0;
+}
+
+/* Locate the top-level moov and first mdat atoms of an MP4 file */
+int mp4_find_moov(const char* path, long long* moov_offset, long long* moov_size,
+                  long long* mdat_offset) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) return -1;
+
+    FSEEK64(fp, 0, SEEK_END);
+    long long file_size = FTELL64(fp);
+
+    *moov_offset = -1;
+    *moov_size = 0;
+    *mdat_offset = -1;
+
+    long long pos = 0;
+    while (pos + 8 <= file_size) {
+        long long size;
+        char type[5];
+
+        if (read_atom_header(fp, pos, file_size, &size, type) != 0) break;
+
+        if (strcmp(type, "moov") == 0 && *moov_offset < 0) {
+            *moov_offset = pos;
+            *moov_size = size;
+        } else if (strcmp(type, "mdat") == 0 && *mdat_offset < 0) {
+            *mdat_offset = pos;
+        }
+
+        pos += size;
+    }
+
+    fclose(fp);
+    return *moov_offset >= 0 ? 0 : -1;
+}
+
+/*
+ * Walk a container and shift every stco/co64 chunk offset that points into
+ * [range_start, range_end) by delta. Returns -1 if a 32-bit offset overflows.
+ */
+static int patch_chunk_offsets(unsigned char* buf, size_t len,
+                               long long range_start, long long range_end, long long delta) {
+    size_t pos = 0;
+
+    while (pos + 8 <= len) {
+        unsigned long long size = read_be32(buf + pos);
+        const unsigned char* type = buf + pos + 4;
+        size_t header = 8;
+
+        if (size == 1) {
+            if (pos + 16 > len) return -1;
+            size = read_be64(buf + pos + 8);
+            header = 16;
+        } else if (size == 0) {
+            size = len - pos;
+        }
+
+        if (size < header || size > len - pos) return -1;
+
+        unsigned char* body = buf + pos + header;
+        size_t body_len = (size_t)size - header;
+
+        if (memcmp(type, "trak", 4) == 0 || memcmp(type, "mdia", 4) == 0 ||
+            memcmp(type, "minf", 4) == 0 || memcmp(type, "stbl", 4) == 0) {
+            if (patch_chunk_offsets(body, body_len, range_start, range_end, delta) != 0) {
+                return -1;
+            }
+        } else if (memcmp(type, "stco", 4) == 0 || memcmp(type, "co64", 4) == 0) {
+            int wide = memcmp(type, "co64", 4) == 0;
+            size_t entry_size = wide ? 8 : 4;
+
+            if (body_len < 8) return -1;
+            unsigned int entries = read_be32(body + 4);
+            if ((unsigned long long)entries * entry_size > body_len - 8) return -1;
+
+            unsigned char* p = body + 8;
+            for (unsigned int i = 0; i < entries; i++, p += entry_size) {
+                long long offset = wide ? (long long)read_be64(p) : (long long)read_be32(p);
+                if (offset < range_start || offset >= range_end) continue;
+
+                offset += delta;
+                if (wide) {
+                    write_be64(p, (unsigned long long)offset);
+                } else {
+                    if (offset > 0xFFFFFFFFLL) return -1;
+                    write_be32(p, (unsigned int)offset);
+                }
+            }
+        }
+
+        pos += (size_t)size;
+    }
+
+    return 0;
+}
+
+/* Copy [start, end) of src to the current position of dst */
+static int copy_range(FILE* src, FILE* dst, long long start, long long end) {
+    char buffer[BUFFER_SIZE];
+
+    if (FSEEK64(src, start, SEEK_SET) != 0) return -1;
+
+    long long remaining = end - start;
+    while (remaining > 0) {
+        size_t to_read = remaining > (long long)sizeof(buffer) ? sizeof(buffer) : (size_t)remaining;
+        size_t n = fread(buffer, 1, to_read, src);
+        if (n == 0) return -1;
+        if (fwrite(buffer, 1, n, dst) != n) return -1;
+        remaining -= (long long)n;
+    }
+
+    return 0;
+}
+
+/* Flush a file to stable storage before it replaces the original */
+static int sync_file(FILE* fp) {
+    if (fflush(fp) != 0) return -1;
+#if defined(_WIN32)
+    return _commit(_fileno(fp));
+#else
+    return fsync(fileno(fp));
+#endif
+}
+
+/* Atomically replace dst with src */
+static int replace_file(const char* src, const char* dst) {
+#if defined(_WIN32)
+    return MoveFileExA(src, dst, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) ? 0 : -1;
+#else
+    return rename(src, dst);
+#endif
+}
+
+/*
+ * Rewrite an MP4 so that moov precedes mdat.
+ * Returns 1 if the file was rewritten, 0 if it was already faststart, -1 on error.
+ */
+int mp4_faststart_file(const char* path) {
+    long long moov_offset, moov_size, mdat_offset;
+
+    if (mp4_find_moov(path, &moov_offset, &moov_size, &mdat_offset) != 0) {
+        log_message(LOG_WARN, "Faststart: no moov atom in %s", path);
+        return -1;
+    }
+
+    if (mdat_offset < 0 || moov_offset < mdat_offset) {
+        return 0;
+    }
+
+    if (moov_size > MAX_MOOV_SIZE) {
+        log_message(LOG_WARN, "Faststart: moov too large in %s (%lld bytes)", path, moov_size);
+        return -1;
+    }
+
+    FILE* src = fopen(path, "rb");
+    if (!src) return -1;
+
+    FSEEK64(src, 0, SEEK_END);
+    long long file_size = FTELL64(src);
+
+    unsigned char* moov = malloc((size_t)moov_size);
+    if (!moov) {
+        fclose(src);
+        return -1;
+    }
+
+    FSEEK64(src, moov_offset, SEEK_SET);
+    if (fread(moov, 1, (size_t)moov_size, src) != (size_t)moov_size) {
+        free(moov);
+        fclose(src);
+        return -1;
+    }
+
+    /* Compressed movie headers cannot be patched in place */
+    size_t moov_header = read_be32(moov) == 1 ? 16 : 8;
+    if (moov_size >= (long long)moov_header + 8 && memcmp(moov + moov_header + 4, "cmov", 4) == 0) {
+        log_message(LOG_WARN, "Faststart: compressed moov not supported in %s", path);
+        free(moov);
+        fclose(src);
+        return -1;
+    }
+
+    /* Everything between the first mdat and the old moov moves forward by moov_size */
+    if (patch_chunk_offsets(moov + moov_header, (size_t)moov_size - moov_header,
+                            mdat_offset, moov_offset, moov_size) != 0) {
+        log_message(LOG_WARN, "Faststart: cannot patch chunk offsets in %s", path);
+        free(moov);
+        fclose(src);
+        return -1;
+    }
+
+    char tmp_path[MAX_PATH_LEN];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.faststart.tmp", path);
+
+    FILE* dst = fopen(tmp_path, "wb");
+    if (!dst) {
+        free(moov);
+        fclose(src);
+        return -1;
+    }
+
+    int ok = copy_range(src, dst, 0, mdat_offset) == 0 &&
+             fwrite(moov, 1, (size_t)moov_size, dst) == (size_t)moov_size &&
+             copy_range(src, dst, mdat_offset, moov_offset) == 0 &&
+             copy_range(src, dst, moov_offset + moov_size, file_size) == 0 &&
+             sync_file(dst) == 0;
+
+    fclose(dst);
+    fclose(src);
+    free(moov);
+
+    if (!ok || replace_file(tmp_path, path) != 0) {
+        log_message(LOG_ERROR, "Faststart: failed to rewrite %s", path);
+        remove(tmp_path);
+        return -1;
+    }
+
+    log_message(LOG_INFO, "Faststart: moved moov to front of %s", path);
+    return 1;
+}
+
+/* Load the processed-file registry (caller holds g_faststart_mutex) */
+static void faststart_load_index(void) {
+    g_entry_count = 0;
+    g_index_loaded = 1;
+
+    FILE* fp = fopen(FASTSTART_INDEX, "r");
+    if (!fp) return;
+
+    char line[512];
+    while (g_entry_count < MAX_FASTSTART_ENTRIES && fgets(line, sizeof(line), fp)) {
+        FaststartEntry* e = &g_entries[g_entry_count];
+        if (sscanf(line, "%lld %lld %255[^\n]", &e->size, &e->mtime, e->filename) == 3) {
+            g_entry_count++;
+        }
+    }
+
+    fclose(fp);
+}
+
+/* Rewrite the registry file atomically (caller holds g_faststart_mutex) */
+static void faststart_save_index(void) {
+    const char* tmp_path = FASTSTART_INDEX ".tmp";
+    FILE* fp = fopen(tmp_path, "w");
+    if (!fp) return;
+
+    for (int i = 0; i < g_entry_count; i++) {
+        fprintf(fp, "%lld %lld %s\n", g_entries[i].size, g_entries[i].mtime, g_entries[i].filename);
+    }
+
+    if (sync_file(fp) != 0) {
+        fclose(fp);
+        remove(tmp_path);
+        return;
+    }
+    fclose(fp);
+
+    if (replace_file(tmp_path, FASTSTART_INDEX) != 0) {
+        remove(tmp_path);
+    }
+}
+
+/*
+ * Ensure a library file is in faststart layout, processing each file at most
+ * once. Files are identified by name, size and modification time.
+ */
+int mp4_faststart_ingest(const char* video_path, const char* filename) {
+    struct stat st;
+
+    if (!g_faststart_mutex_initialized) {
+        pthread_mutex_init(&g_faststart_mutex, NULL);
+        g_faststart_mutex_initialized = 1;
+    }
+
+    if (stat(video_path, &st) != 0) return -1;
+
+    pthread_mutex_lock(&g_faststart_mutex);
+
+    if (!g_index_loaded) {
+        faststart_load_index();
+    }
+
+    int slot = -1;
+    for (int i = 0; i < g_entry_count; i++) {
+        if (strcmp(g_entries[i].filename, filename) == 0) {
+            slot = i;
+            break;
+        }
+    }
+
+    if (slot >= 0 && g_entries[slot].size == (long long)st.st_size &&
+        g_entries[slot].mtime == (long long)st.st_mtime) {
+        pthread_mutex_unlock(&g_faststart_mutex);
+        return 0;
+    }
+
+    int result = mp4_faststart_file(video_path);
+
+    /* Record the post-rewrite identity; failures are retried on the next scan */
+    if (result >= 0 && stat(video_path, &st) == 0) {
+        if (slot < 0 && g_entry_count < MAX_FASTSTART_ENTRIES) {
+            slot = g_entry_count++;
+        }
+        if (slot >= 0) {
+            FaststartEntry* e = &g_entries[slot];
+            strncpy(e->filename, filename, sizeof(e->filename) - 1);
+            e->filename[sizeof(e->filename) - 1] = '\0';
+            e->size = (long long)st.st_size;
+            e->mtime = (long long)st.st_mtime;
+            faststart_save_index();
+        }
+    }
+
+    pthread_mutex_unlock(&g_faststart_mutex);
+    return result;
+}
@@ -0,0 +1,240 @@
+/*
+ * OTT Video Streaming Server - Bandwidth Pacing
+ * Token-bucket pacing per viewer stream with a max-min fair share of
+ * the global egress budget across active streams. Workers never sleep
+ * for pacing: a range response is cut to what the bucket allows within
+ * PACING_MAX_HOLD, and the kernel spreads it over that time where
+ * SO_MAX_PACING_RATE is available. The player asks for the rest.
+ */
+
+#include "common.h"
+
+#define MAX_PACED_STREAMS 256
+
+/* Bucket depth in seconds of the paced rate; also the startup burst */
+#define PACING_BUCKET_SECONDS 8.0
+
+/* Longest a paced response may take to send, so it holds a worker briefly */
+#define PACING_MAX_HOLD 1.0
+
+/* Smallest response granted, so a stream in deficit still makes progress */
+#define PACING_MIN_GRANT (64 * 1024)
+
+typedef struct {
+    int user_id;
+    int video_id;
+    int connections;      /* active responses on this stream */
+    double demand;        /* bytes/sec wanted, 0 = unbounded */
+    double rate;          /* bytes/sec allowed, 0 = unpaced */
+    double tokens;        /* may go negative while a granted response drains */
+    double last_refill;
+    time_t last_used;
+    int fresh;            /* bucket not filled yet */
+    int in_use;
+} PacedStream;
+
+static PacedStream g_paced[MAX_PACED_STREAMS];
+static pthread_mutex_t g_pacing_mutex;
+static double g_egress_limit = 0;   /* bytes/sec, 0 = unlimited */
+
+/* Initialize pacing with the global egress budget in megabits per second */
+void pacing_init(int egress_mbps) {
+    pthread_mutex_init(&g_pacing_mutex, NULL);
+    memset(g_paced, 0, sizeof(g_paced));
+    g_egress_limit = egress_mbps > 0 ? egress_mbps * 1000000.0 / 8 : 0;
+
+    if (g_egress_limit > 0) {
+        log_message(LOG_INFO, "Egress pacing enabled: %d Mbps shared fairly", egress_mbps);
+    }
+}
+
+/*
+ * Split the egress budget with max-min fairness: streams wanting less
+ * than an equal share get their demand, the rest divide what is left
+ * (caller holds g_pacing_mutex).
+ */
+static void recompute_shares(void) {
+    int assigned[MAX_PACED_STREAMS] = {0};
+    int left = 0;
+
+    for (int i = 0; i < MAX_PACED_STREAMS; i++) {
+        PacedStream* p = &g_paced[i];
+        if (!p->in_use || p->connections == 0) continue;
+
+        if (g_egress_limit <= 0) {
+            p->rate = p->demand;
+            assigned[i] = 1;
+        } else {
+            left++;
+        }
+    }
+
+    double remaining = g_egress_limit;
+    int progress = 1;
+
+    while (left > 0 && progress) {
+        double share = remaining / left;
+        progress = 0;
+
+        for (int i = 0; i < MAX_PACED_STREAMS; i++) {
+            PacedStream* p = &g_paced[i];
+            if (!p->in_use || p->connections == 0 || assigned[i]) continue;
+
+            if (p->demand > 0 && p->demand <= share) {
+                p->rate = p->demand;
+                remaining -= p->demand;
+                assigned[i] = 1;
+                left--;
+                progress = 1;
+            }
+        }
+    }
+
+    if (left > 0) {
+        double share = remaining / left;
+        for (int i = 0; i < MAX_PACED_STREAMS; i++) {
+            PacedStream* p = &g_paced[i];
+            if (p->in_use && p->connections > 0 && !assigned[i]) {
+                p->rate = share;
+            }
+        }
+    }
+}
+
+/* Ask the kernel to pace the socket at rate bytes/sec (0 = unpaced), where supported */
+static void apply_socket_rate(SOCKET client, double rate) {
+#if defined(SO_MAX_PACING_RATE)
+    unsigned int value = rate > 0 && rate < 4294967295.0 ? (unsigned int)rate : ~0U;
+    setsockopt(client, SOL_SOCKET, SO_MAX_PACING_RATE, &value, sizeof(value));
+#else
+    (void)client;
+    (void)rate;
+#endif
+}
+
+/*
+ * Register a response on a viewer stream. bitrate is the title's average
+ * bytes/sec (0 if unknown); the stream may run at bitrate * burst_factor.
+ * Returns a handle for pacing_grant/pacing_end.
+ */
+int pacing_begin(int user_id, int video_id, double bitrate, double burst_factor) {
+    double now = monotonic_seconds();
+    time_t wall = time(NULL);
+
+    pthread_mutex_lock(&g_pacing_mutex);
+
+    int slot = -1;
+    int victim = -1;
+    for (int i = 0; i < MAX_PACED_STREAMS; i++) {
+        PacedStream* p = &g_paced[i];
+        if (p->in_use && p->user_id == user_id && p->video_id == video_id) {
+            slot = i;
+            break;
+        }
+        if (!p->in_use || p->connections == 0) {
+            if (victim < 0 || !p->in_use ||
+                (g_paced[victim].in_use && p->last_used < g_paced[victim].last_used)) {
+                victim = i;
+            }
+        }
+    }
+
+    if (slot < 0) {
+        if (victim < 0) {
+            pthread_mutex_unlock(&g_pacing_mutex);
+            return -1;
+        }
+        slot = victim;
+        memset(&g_paced[slot], 0, sizeof(PacedStream));
+        g_paced[slot].user_id = user_id;
+        g_paced[slot].video_id = video_id;
+        g_paced[slot].fresh = 1;
+        g_paced[slot].in_use = 1;
+    }
+
+    PacedStream* p = &g_paced[slot];
+    p->demand = bitrate > 0 ? bitrate * burst_factor : 0;
+    p->connections++;
+    p->last_used = wall;
+    recompute_shares();
+
+    /* New streams start with a full bucket so playback starts quickly */
+    if (p->fresh) {
+        p->tokens = p->rate * PACING_BUCKET_SECONDS;
+        p->last_refill = now;
+        p->fresh = 0;
+    }
+
+    pthread_mutex_unlock(&g_pacing_mutex);
+    return slot;
+}
+
+/*
+ * Reserve up to want bytes for a response: what the bucket holds plus
+ * what the stream earns in PACING_MAX_HOLD, at least PACING_MIN_GRANT.
+ * The socket is paced to send the grant over PACING_MAX_HOLD. Returns
+ * the bytes the response may carry.
+ */
+long pacing_grant(int handle, SOCKET client, long want) {
+    if (handle < 0) return want;
+
+    double now = monotonic_seconds();
+
+    pthread_mutex_lock(&g_pacing_mutex);
+    PacedStream* p = &g_paced[handle];
+    double rate = p->rate;
+    if (rate <= 0) {
+        p->tokens = 0;
+        pthread_mutex_unlock(&g_pacing_mutex);
+        apply_socket_rate(client, 0);
+        return want;
+    }
+
+    double bucket = rate * PACING_BUCKET_SECONDS;
+    p->tokens += rate * (now - p->last_refill);
+    if (p->tokens > bucket) p->tokens = bucket;
+    p->last_refill = now;
+
+    double allowed = p->tokens + rate * PACING_MAX_HOLD;
+    if (allowed < PACING_MIN_GRANT) allowed = PACING_MIN_GRANT;
+    long grant = allowed < want ? (long)allowed : want;
+    p->tokens -= grant;
+    if (p->tokens < -rate * PACING_MAX_HOLD) p->tokens = -rate * PACING_MAX_HOLD;   /* kernel paces the rest */
+    pthread_mutex_unlock(&g_pacing_mutex);
+
+    double send_rate = grant / PACING_MAX_HOLD;
+    apply_socket_rate(client, send_rate > rate ? send_rate : rate);
+    return grant;
+}
+
+/* Finish a response on a paced stream, returning granted bytes it didn't send */
+void pacing_end(int handle, long unsent) {
+    if (handle < 0) return;
+
+    pthread_mutex_lock(&g_pacing_mutex);
+    PacedStream* p = &g_paced[handle];
+    if (unsent > 0) p->tokens += unsent;
+    if (p->connections > 0) p->connections--;
+    p->last_used = time(NULL);
+    recompute_shares();
+    pthread_mutex_unlock(&g_pacing_mutex);
+}
+
+/* Write pacing metrics as a JSON object */
+int pacing_stats_json(char* buf, size_t size) {
+    int active = 0;
+    double allocated = 0;
+
+    pthread_mutex_lock(&g_pacing_mutex);
+    for (int i = 0; i < MAX_PACED_STREAMS; i++) {
+        if (g_paced[i].in_use && g_paced[i].connections > 0) {
+            active++;
+            allocated += g_paced[i].rate;
+        }
+    }
+    pthread_mutex_unlock(&g_pacing_mutex);
+
+    return snprintf(buf, size,
+        "{\"active_streams\":%d,\"egress_limit_bps\":%.0f,\"allocated_bps\":%.0f}",
+        active, g_egress_limit * 8, allocated * 8);
+}
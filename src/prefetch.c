@@ -0,0 +1,290 @@
+/*
+ * OTT Video Streaming Server - Predictive Prefetch
+ * Playback is sequential, so after each range a viewer requests the
+ * server can predict the next ones. Background threads load the next
+ * PREFETCH_SECONDS of the title into the chunk cache ahead of the
+ * playhead. Viewers that seek, pause or go idle are not prefetched for.
+ */
+
+#include "common.h"
+
+#define MAX_PREFETCH_VIEWERS 256
+#define PREFETCH_MAX_BYTES (16L * 1024 * 1024)
+
+/* Sequential ranges needed before prefetching starts */
+#define PREFETCH_MIN_SEQUENTIAL 2
+
+/* A viewer with no range requests for this long is treated as paused */
+#define PREFETCH_IDLE_SECONDS 30.0
+
+/* Weight of the newest consumption-rate sample */
+#define PREFETCH_RATE_ALPHA 0.3
+
+typedef struct {
+    int user_id;
+    int video_id;
+    int rendition;        /* file being played, 0 = original */
+    char path[MAX_PATH_LEN];
+    long long dev;
+    long file_size;
+    int direct;           /* cold title: load through direct I/O */
+    long next_offset;     /* end of the last range served */
+    long prefetched_to;   /* end of data already loaded ahead */
+    long target;          /* load up to here */
+    double rate;          /* consumption rate, bytes/sec */
+    double last_request;
+    int sequential;       /* consecutive sequential ranges */
+    int generation;       /* bumped on seek or pause to stop work in flight */
+    int last_position;    /* last playhead posted by the player */
+    int paused;
+    int queued;
+    int in_use;
+} PrefetchViewer;
+
+static PrefetchViewer g_viewers[MAX_PREFETCH_VIEWERS];
+static int g_queue[MAX_PREFETCH_VIEWERS];
+static int g_queue_head = 0;
+static int g_queue_count = 0;
+static pthread_mutex_t g_prefetch_mutex;
+static pthread_cond_t g_prefetch_cond;
+static long long g_prefetched_bytes = 0;
+static long long g_backoffs = 0;
+
+extern int disk_open(const char* path, long* size, long long* dev);
+extern int disk_open_direct(const char* path);
+extern void disk_close(int fd);
+extern int disk_io_saturated(long long dev);
+extern void disk_io_background(void);
+extern int chunk_cache_get(int video_id, int rendition, int fd, long long dev, long file_size,
+                           long offset, long max_len, const char** data, long* len);
+extern void chunk_cache_release(int handle);
+
+/* Find a viewer, claiming the least recently active slot if asked (caller holds lock) */
+static PrefetchViewer* find_viewer(int user_id, int video_id, int create) {
+    PrefetchViewer* victim = NULL;
+
+    for (int i = 0; i < MAX_PREFETCH_VIEWERS; i++) {
+        PrefetchViewer* v = &g_viewers[i];
+        if (v->in_use && v->user_id == user_id && v->video_id == video_id) return v;
+        if (v->queued) continue;
+        if (!victim || !v->in_use || (victim->in_use && v->last_request < victim->last_request)) {
+            victim = v;
+        }
+    }
+
+    if (!create || !victim) return NULL;
+
+    int generation = victim->generation + 1;
+    memset(victim, 0, sizeof(PrefetchViewer));
+    victim->user_id = user_id;
+    victim->video_id = video_id;
+    victim->next_offset = -1;
+    victim->generation = generation;
+    victim->last_position = -1;
+    victim->in_use = 1;
+    return victim;
+}
+
+/* Stop prefetching for a viewer until it plays sequentially again (caller holds lock) */
+static void back_off(PrefetchViewer* v) {
+    v->sequential = 0;
+    v->generation++;
+    g_backoffs++;
+}
+
+/* Load [from, to) of a viewer's title into the chunk cache */
+static void prefetch_range(PrefetchViewer* v, int generation, int video_id, int rendition,
+                           const char* path, int direct, long long dev, long file_size,
+                           long from, long to) {
+    int fd = direct ? disk_open_direct(path) : -1;
+    if (fd < 0) fd = disk_open(path, NULL, NULL);
+    if (fd < 0) return;
+
+    long offset = from;
+    while (offset < to) {
+        /* Demand reads come first */
+        if (disk_io_saturated(dev)) break;
+
+        const char* data;
+        long len;
+        int handle = chunk_cache_get(video_id, rendition, fd, dev, file_size, offset,
+                                     to - offset, &data, &len);
+        if (handle < 0) break;
+        chunk_cache_release(handle);
+        offset += len;
+
+        pthread_mutex_lock(&g_prefetch_mutex);
+        int current = v->generation == generation;
+        if (current && offset > v->prefetched_to) v->prefetched_to = offset;
+        g_prefetched_bytes += len;
+        pthread_mutex_unlock(&g_prefetch_mutex);
+
+        if (!current) break;
+    }
+
+    disk_close(fd);
+}
+
+#if defined(_WIN32)
+static unsigned __stdcall prefetch_worker(void* arg) {
+#else
+static void* prefetch_worker(void* arg) {
+#endif
+    (void)arg;
+    disk_io_background();
+
+    for (;;) {
+        pthread_mutex_lock(&g_prefetch_mutex);
+        while (g_queue_count == 0) {
+            pthread_cond_wait(&g_prefetch_cond, &g_prefetch_mutex);
+        }
+
+        PrefetchViewer* v = &g_viewers[g_queue[g_queue_head]];
+        g_queue_head = (g_queue_head + 1) % MAX_PREFETCH_VIEWERS;
+        g_queue_count--;
+        v->queued = 0;
+
+        char path[MAX_PATH_LEN];
+        strcpy(path, v->path);
+        int generation = v->generation;
+        int video_id = v->video_id;
+        int rendition = v->rendition;
+        int direct = v->direct;
+        long long dev = v->dev;
+        long file_size = v->file_size;
+        long from = v->prefetched_to > v->next_offset ? v->prefetched_to : v->next_offset;
+        long to = v->target;
+        int wanted = v->in_use && !v->paused && from < to;
+        pthread_mutex_unlock(&g_prefetch_mutex);
+
+        if (wanted) {
+            prefetch_range(v, generation, video_id, rendition, path, direct, dev, file_size,
+                           from, to);
+        }
+    }
+
+#if defined(_WIN32)
+    return 0;
+#else
+    return NULL;
+#endif
+}
+
+/* Start the prefetch threads */
+void prefetch_init(int threads) {
+    pthread_mutex_init(&g_prefetch_mutex, NULL);
+    pthread_cond_init(&g_prefetch_cond, NULL);
+    memset(g_viewers, 0, sizeof(g_viewers));
+
+    for (int i = 0; i < threads; i++) {
+#if defined(_WIN32)
+        HANDLE h = (HANDLE)_beginthreadex(NULL, 0, prefetch_worker, NULL, 0, NULL);
+        if (h) CloseHandle(h);
+#else
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, prefetch_worker, NULL) == 0) {
+            pthread_detach(thread);
+        }
+#endif
+    }
+
+    log_message(LOG_INFO, "Prefetch: %d threads, %d seconds ahead of playback",
+                threads, PREFETCH_SECONDS);
+}
+
+/*
+ * Record a range served to a viewer and schedule loading what comes next.
+ * The horizon is PREFETCH_SECONDS at the title bitrate, or at the observed
+ * request rate when the bitrate is unknown. A jump in offset is a seek.
+ */
+void prefetch_note_range(int user_id, int video_id, int rendition, const char* path,
+                         long long dev, long file_size, long range_start, long range_end,
+                         double bitrate, int direct) {
+    if (PREFETCH_SECONDS <= 0) return;
+
+    double now = monotonic_seconds();
+
+    pthread_mutex_lock(&g_prefetch_mutex);
+
+    PrefetchViewer* v = find_viewer(user_id, video_id, 1);
+    if (!v) {
+        pthread_mutex_unlock(&g_prefetch_mutex);
+        return;
+    }
+
+    if (range_start == v->next_offset && rendition == v->rendition) {
+        v->sequential++;
+
+        double elapsed = now - v->last_request;
+        if (elapsed > 0.05 && elapsed < PREFETCH_IDLE_SECONDS) {
+            double sample = (range_end - range_start) / elapsed;
+            v->rate = v->rate > 0 ? v->rate + PREFETCH_RATE_ALPHA * (sample - v->rate) : sample;
+        }
+    } else if (v->next_offset >= 0) {
+        back_off(v);
+        v->prefetched_to = range_end;
+    }
+
+    v->rendition = rendition;
+    strncpy(v->path, path, sizeof(v->path) - 1);
+    v->dev = dev;
+    v->file_size = file_size;
+    v->direct = direct;
+    v->next_offset = range_end;
+    v->last_request = now;
+    v->paused = 0;
+
+    double rate = bitrate > 0 ? bitrate : v->rate;
+    long horizon = rate > 0 ? (long)(rate * PREFETCH_SECONDS) : range_end - range_start;
+    if (horizon > PREFETCH_MAX_BYTES) horizon = PREFETCH_MAX_BYTES;
+
+    v->target = range_end + horizon;
+    if (v->target > file_size) v->target = file_size;
+
+    if (v->sequential >= PREFETCH_MIN_SEQUENTIAL && !v->queued &&
+        v->target > v->prefetched_to && g_queue_count < MAX_PREFETCH_VIEWERS) {
+        g_queue[(g_queue_head + g_queue_count) % MAX_PREFETCH_VIEWERS] = (int)(v - g_viewers);
+        g_queue_count++;
+        v->queued = 1;
+        pthread_cond_signal(&g_prefetch_cond);
+    }
+
+    pthread_mutex_unlock(&g_prefetch_mutex);
+}
+
+/* Record a playhead position posted by the player; an unchanged one means paused */
+void prefetch_note_position(int user_id, int video_id, int position_sec) {
+    pthread_mutex_lock(&g_prefetch_mutex);
+
+    PrefetchViewer* v = find_viewer(user_id, video_id, 0);
+    if (v) {
+        if (position_sec == v->last_position && !v->paused) {
+            v->paused = 1;
+            back_off(v);
+        }
+        v->last_position = position_sec;
+    }
+
+    pthread_mutex_unlock(&g_prefetch_mutex);
+}
+
+/* Write prefetch metrics as a JSON object */
+int prefetch_stats_json(char* buf, size_t size) {
+    int active = 0;
+    double now = monotonic_seconds();
+
+    pthread_mutex_lock(&g_prefetch_mutex);
+    for (int i = 0; i < MAX_PREFETCH_VIEWERS; i++) {
+        PrefetchViewer* v = &g_viewers[i];
+        if (v->in_use && !v->paused && v->sequential >= PREFETCH_MIN_SEQUENTIAL &&
+            now - v->last_request < PREFETCH_IDLE_SECONDS) {
+            active++;
+        }
+    }
+    int written = snprintf(buf, size,
+        "{\"active_viewers\":%d,\"queued\":%d,\"prefetched_bytes\":%lld,\"backoffs\":%lld}",
+        active, g_queue_count, g_prefetched_bytes, g_backoffs);
+    pthread_mutex_unlock(&g_prefetch_mutex);
+
+    return written;
+}
@@ -0,0 +1,337 @@
+/*
+ * OTT Video Streaming Server - Rendition Selection
+ * Progressive <video> playback can't switch quality, so the server picks
+ * the rendition for it. Pre-encoded renditions live in a "renditions"
+ * directory under a storage root, named <base>_<kbps>k.mp4. At the start
+ * of a viewing session the viewer's throughput is estimated from earlier
+ * send progress or the socket's TCP_INFO, and the best-fitting rendition
+ * is pinned for the rest of the playback so range offsets stay valid. The
+ * pin travels with the player in a per-video cookie; a table of recent
+ * sessions covers clients that don't keep cookies.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+    #define _GNU_SOURCE
+#endif
+
+#include "common.h"
+
+#if defined(_WIN32)
+    #include <sys/stat.h>
+    #define strcasecmp _stricmp
+#elif defined(__linux__)
+    #include <netinet/tcp.h>
+#endif
+
+#define MAX_RENDITIONS 6
+#define MAX_RENDITION_SESSIONS 256
+#define RENDITION_DIR "renditions"
+
+/* A session with no requests for this long picks a rendition again */
+#define RENDITION_SESSION_SECONDS 1800
+
+typedef struct {
+    char filename[256];   /* relative to a storage root */
+    int kbps;
+} Rendition;
+
+typedef struct {
+    char base[256];       /* source filename without extension */
+    Rendition renditions[MAX_RENDITIONS];   /* ascending bitrate */
+    int count;
+} RenditionSet;
+
+typedef struct {
+    int user_id;
+    int video_id;
+    int choice;           /* index + 1 into the set, 0 = original */
+    time_t last_used;
+} RenditionSession;
+
+static RenditionSet* g_sets = NULL;   /* grown while scanning, fixed afterwards */
+static int g_set_count = 0;
+static int g_set_size = 0;
+static RenditionSession g_sessions[MAX_RENDITION_SESSIONS];
+static pthread_mutex_t g_rendition_mutex;
+static long long g_selections[MAX_RENDITIONS + 1];
+
+extern int storage_root_count(void);
+extern const char* storage_root_path(int index);
+extern int storage_resolve(const char* filename, char* path, size_t path_size);
+extern double stream_user_rate(int user_id);
+
+/* Record <base>_<kbps>k.mp4 in its set (caller holds g_rendition_mutex) */
+static void add_rendition(const char* name) {
+    const char* ext = strrchr(name, '.');
+    const char* sep = strrchr(name, '_');
+    if (!ext || !sep || sep > ext || strcasecmp(ext, ".mp4") != 0) return;
+
+    int kbps = atoi(sep + 1);
+    if (kbps <= 0 || ext[-1] != 'k') return;
+
+    char base[256];
+    size_t len = (size_t)(sep - name);
+    if (len >= sizeof(base)) return;
+    memcpy(base, name, len);
+    base[len] = '\0';
+
+    RenditionSet* set = NULL;
+    for (int i = 0; i < g_set_count; i++) {
+        if (strcmp(g_sets[i].base, base) == 0) set = &g_sets[i];
+    }
+    if (!set) {
+        if (g_set_count == g_set_size) {
+            int size = g_set_size > 0 ? g_set_size * 2 : 16;
+            RenditionSet* grown = realloc(g_sets, sizeof(RenditionSet) * size);
+            if (!grown) return;
+            g_sets = grown;
+            g_set_size = size;
+        }
+        set = &g_sets[g_set_count++];
+        memset(set, 0, sizeof(RenditionSet));
+        strcpy(set->base, base);
+    }
+
+    for (int i = 0; i < set->count; i++) {
+        if (set->renditions[i].kbps == kbps) return;   /* copy on another root */
+    }
+    if (set->count >= MAX_RENDITIONS) return;
+
+    char filename[sizeof(set->renditions[0].filename)];
+    if (snprintf(filename, sizeof(filename), "%s/%s", RENDITION_DIR, name) >= (int)sizeof(filename)) {
+        return;
+    }
+
+    /* Keep the set sorted by bitrate */
+    int pos = set->count;
+    while (pos > 0 && set->renditions[pos - 1].kbps > kbps) {
+        set->renditions[pos] = set->renditions[pos - 1];
+        pos--;
+    }
+    strcpy(set->renditions[pos].filename, filename);
+    set->renditions[pos].kbps = kbps;
+    set->count++;
+}
+
+static void scan_renditions(const char* root) {
+    char dir_path[MAX_PATH_LEN];
+    snprintf(dir_path, sizeof(dir_path), "%s/%s", root, RENDITION_DIR);
+
+#if defined(_WIN32)
+    WIN32_FIND_DATAA fd;
+    char search_path[MAX_PATH_LEN];
+    snprintf(search_path, sizeof(search_path), "%s\\*.mp4", dir_path);
+
+    HANDLE hFind = FindFirstFileA(search_path, &fd);
+    if (hFind == INVALID_HANDLE_VALUE) return;
+    do {
+        if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) add_rendition(fd.cFileName);
+    } while (FindNextFileA(hFind, &fd));
+    FindClose(hFind);
+#else
+    DIR* dir = opendir(dir_path);
+    if (!dir) return;
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        add_rendition(entry->d_name);
+    }
+    closedir(dir);
+#endif
+}
+
+/* Index renditions found under every storage root */
+void rendition_init(void) {
+    pthread_mutex_init(&g_rendition_mutex, NULL);
+    memset(g_sessions, 0, sizeof(g_sessions));
+
+    pthread_mutex_lock(&g_rendition_mutex);
+    g_set_count = 0;
+    for (int i = 0; i < storage_root_count(); i++) {
+        scan_renditions(storage_root_path(i));
+    }
+    int sets = g_set_count;
+    pthread_mutex_unlock(&g_rendition_mutex);
+
+    if (sets > 0) {
+        log_message(LOG_INFO, "Found renditions for %d videos", sets);
+    }
+}
+
+/*
+ * Estimate a fresh connection's throughput in bits/sec from its
+ * congestion window and RTT. Returns 0 where TCP_INFO is unavailable.
+ */
+static double tcp_throughput(SOCKET client) {
+#if defined(__linux__) && defined(TCP_INFO)
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    if (getsockopt(client, IPPROTO_TCP, TCP_INFO, &info, &len) != 0) return 0;
+    if (info.tcpi_rtt == 0) return 0;
+
+    return (double)info.tcpi_snd_cwnd * info.tcpi_snd_mss * 8 * 1000000.0 / info.tcpi_rtt;
+#else
+    (void)client;
+    return 0;
+#endif
+}
+
+/* Bitrate of the source file in kbps, 0 if unknown */
+static int original_kbps(Video* video) {
+    char path[MAX_PATH_LEN];
+    if (video->duration_sec <= 0 || storage_resolve(video->filename, path, sizeof(path)) < 0) {
+        return 0;
+    }
+
+#if defined(_WIN32)
+    struct _stat64 st;
+    if (_stat64(path, &st) != 0) return 0;
+#else
+    struct stat st;
+    if (stat(path, &st) != 0) return 0;
+#endif
+    return (int)((double)st.st_size * 8 / video->duration_sec / 1000);
+}
+
+/*
+ * Pick the highest choice whose bitrate, with RENDITION_HEADROOM to spare,
+ * fits the throughput; the lowest rendition if none fits. An original of
+ * unknown bitrate ranks just above the top rendition. Unknown throughput
+ * keeps the original.
+ */
+static int best_fit(const RenditionSet* set, int original, double throughput) {
+    if (throughput <= 0) return 0;
+    if (original <= 0) original = set->renditions[set->count - 1].kbps + 1;
+
+    int best = 1;
+    int best_kbps = 0;
+
+    for (int i = 0; i <= set->count; i++) {
+        int kbps = i < set->count ? set->renditions[i].kbps : original;
+        if (kbps * 1000.0 * RENDITION_HEADROOM <= throughput && kbps > best_kbps) {
+            best = i < set->count ? i + 1 : 0;
+            best_kbps = kbps;
+        }
+    }
+
+    return best;
+}
+
+/* Find a live session (caller holds g_rendition_mutex) */
+static RenditionSession* find_session(int user_id, int video_id, time_t now) {
+    for (int i = 0; i < MAX_RENDITION_SESSIONS; i++) {
+        RenditionSession* s = &g_sessions[i];
+        if (s->user_id == user_id && s->video_id == video_id &&
+            difftime(now, s->last_used) < RENDITION_SESSION_SECONDS) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+/* Take over the least recently used session slot (caller holds g_rendition_mutex) */
+static RenditionSession* claim_session(int user_id, int video_id, int choice) {
+    RenditionSession* session = &g_sessions[0];
+    for (int i = 1; i < MAX_RENDITION_SESSIONS; i++) {
+        if (g_sessions[i].last_used < session->last_used) session = &g_sessions[i];
+    }
+    session->user_id = user_id;
+    session->video_id = video_id;
+    session->choice = choice;
+    return session;
+}
+
+/* Choice for a pinned kbps, 0 for the original, -1 if the set has no such rendition */
+static int pinned_choice(const RenditionSet* set, int kbps) {
+    if (kbps == 0) return 0;
+    for (int i = 0; i < set->count; i++) {
+        if (set->renditions[i].kbps == kbps) return i + 1;
+    }
+    return -1;
+}
+
+/*
+ * Choose the file to serve for a viewer's request. *pin holds the kbps
+ * the player was pinned to (0 for the original), or -1 if none; it is
+ * set to the kbps to pin, or -1 when the title has no renditions.
+ * Writes the filename (relative to a storage root) and the rendition
+ * number for the chunk cache, and returns the rendition's kbps, or 0
+ * for the original.
+ */
+int rendition_select(SOCKET client, int user_id, Video* video, int* pin, char* filename,
+                     size_t filename_size, int* rendition) {
+    int pinned = *pin;
+    *pin = -1;
+    snprintf(filename, filename_size, "%s", video->filename);
+    *rendition = 0;
+
+    char base[256];
+    snprintf(base, sizeof(base), "%s", video->filename);
+    char* ext = strrchr(base, '.');
+    if (ext) *ext = '\0';
+
+    time_t now = time(NULL);
+
+    pthread_mutex_lock(&g_rendition_mutex);
+
+    RenditionSet* set = NULL;
+    for (int i = 0; i < g_set_count; i++) {
+        if (strcmp(g_sets[i].base, base) == 0) set = &g_sets[i];
+    }
+    if (!set) {
+        pthread_mutex_unlock(&g_rendition_mutex);
+        return 0;
+    }
+
+    int choice = pinned >= 0 ? pinned_choice(set, pinned) : -1;
+    RenditionSession* session = find_session(user_id, video->id, now);
+    if (choice >= 0) {
+        /* The player's pin outlives the session table */
+        if (session) session->choice = choice;
+        else session = claim_session(user_id, video->id, choice);
+    } else if (!session) {
+        /* New session: measure the link outside the lock */
+        pthread_mutex_unlock(&g_rendition_mutex);
+
+        double throughput = stream_user_rate(user_id) * 8;
+        if (throughput <= 0) throughput = tcp_throughput(client);
+        int original = original_kbps(video);
+
+        pthread_mutex_lock(&g_rendition_mutex);
+        session = find_session(user_id, video->id, now);
+        if (!session) {
+            session = claim_session(user_id, video->id, best_fit(set, original, throughput));
+            g_selections[session->choice]++;
+
+            log_message(LOG_DEBUG, "User %d video %d: %.0f kbps link, rendition %d",
+                        user_id, video->id, throughput / 1000, session->choice);
+        }
+    }
+
+    session->last_used = now;
+    choice = session->choice;
+    int kbps = 0;
+    if (choice > 0 && choice <= set->count) {
+        snprintf(filename, filename_size, "%s", set->renditions[choice - 1].filename);
+        kbps = set->renditions[choice - 1].kbps;
+        *rendition = choice;
+    }
+    *pin = kbps;
+    pthread_mutex_unlock(&g_rendition_mutex);
+
+    return kbps;
+}
+
+/* Write rendition selection counts as a JSON object */
+int rendition_stats_json(char* buf, size_t size) {
+    pthread_mutex_lock(&g_rendition_mutex);
+    size_t used = snprintf(buf, size, "{\"videos\":%d,\"selections\":[", g_set_count);
+    for (int i = 0; i <= MAX_RENDITIONS && used < size; i++) {
+        used += snprintf(buf + used, size - used, "%s%lld", i > 0 ? "," : "", g_selections[i]);
+    }
+    pthread_mutex_unlock(&g_rendition_mutex);
+
+    if (used >= size) used = size - 1;
+    if (used + 2 < size) used += snprintf(buf + used, size - used, "]}");
+    return (int)used;
+}
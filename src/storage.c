@@ -0,0 +1,418 @@
+/*
+ * OTT Video Streaming Server - Multi-Volume Storage
+ * Video files may live under several storage roots, typically one per
+ * disk. Reads go to the least-loaded copy of a title, new titles are
+ * placed by free space and load, and popular titles are copied to more
+ * roots in the background, rate-limited so copies don't starve playback.
+ */
+
+#include "common.h"
+
+#if defined(_WIN32)
+    #include <io.h>
+    #include <sys/stat.h>
+#else
+    #include <sys/statvfs.h>
+#endif
+
+#define MAX_STORAGE_ROOTS 8
+#define MAX_PENDING_REPLICAS 16
+
+/* Space left free on a root when placing or copying titles */
+#define STORAGE_RESERVE_BYTES (1024LL * 1024 * 1024)
+
+#define COPY_BUFFER_SIZE (1024 * 1024)
+
+typedef struct {
+    char path[MAX_PATH_LEN];
+    long long dev;
+    int online;
+} StorageRoot;
+
+static StorageRoot g_roots[MAX_STORAGE_ROOTS];
+static int g_root_count = 0;
+
+static char g_pending[MAX_PENDING_REPLICAS][256];
+static int g_pending_count = 0;
+static pthread_mutex_t g_storage_mutex;
+static pthread_cond_t g_replica_cond;
+static long long g_replicas_made = 0;
+
+extern double disk_io_load(long long dev);
+
+/* Device of a path, -1 if it doesn't exist */
+static long long path_device(const char* path) {
+#if defined(_WIN32)
+    struct _stat64 st;
+    if (_stat64(path, &st) != 0) return -1;
+#else
+    struct stat st;
+    if (stat(path, &st) != 0) return -1;
+#endif
+    return (long long)st.st_dev;
+}
+
+/* Free bytes on the volume holding a root */
+static long long root_free_bytes(const StorageRoot* root) {
+#if defined(_WIN32)
+    ULARGE_INTEGER avail;
+    if (!GetDiskFreeSpaceExA(root->path, &avail, NULL, NULL)) return 0;
+    return (long long)avail.QuadPart;
+#else
+    struct statvfs vfs;
+    if (statvfs(root->path, &vfs) != 0) return 0;
+    return (long long)vfs.f_bavail * (long long)vfs.f_frsize;
+#endif
+}
+
+static void add_root(const char* path) {
+    if (g_root_count >= MAX_STORAGE_ROOTS || path[0] == '\0') return;
+
+    StorageRoot* root = &g_roots[g_root_count];
+    strncpy(root->path, path, sizeof(root->path) - 1);
+    root->path[sizeof(root->path) - 1] = '\0';
+    root->dev = path_device(path);
+    root->online = root->dev != -1;
+
+    if (!root->online) {
+        log_message(LOG_WARN, "Storage root not available: %s", path);
+    }
+    g_root_count++;
+}
+
+#if defined(_WIN32)
+static unsigned __stdcall replica_worker(void* arg);
+#else
+static void* replica_worker(void* arg);
+#endif
+
+/*
+ * Initialize storage roots from VIDEO_ROOTS, or from the OTT_VIDEO_ROOTS
+ * environment variable when set. Both are ';'-separated directory lists.
+ */
+void storage_init(void) {
+    pthread_mutex_init(&g_storage_mutex, NULL);
+    pthread_cond_init(&g_replica_cond, NULL);
+
+    const char* spec = getenv("OTT_VIDEO_ROOTS");
+    if (!spec || !spec[0]) spec = VIDEO_ROOTS;
+
+    char list[1024];
+    strncpy(list, spec, sizeof(list) - 1);
+    list[sizeof(list) - 1] = '\0';
+
+    g_root_count = 0;
+    char* start = list;
+    for (char* p = list; ; p++) {
+        if (*p == ';' || *p == '\0') {
+            int end = *p == '\0';
+            *p = '\0';
+            add_root(start);
+            if (end) break;
+            start = p + 1;
+        }
+    }
+
+    if (g_root_count == 0) add_root(VIDEO_DIR);
+
+    for (int i = 0; i < g_root_count; i++) {
+        log_message(LOG_INFO, "Storage root %d: %s (device %lld, %lld MB free)", i,
+                    g_roots[i].path, g_roots[i].dev, root_free_bytes(&g_roots[i]) / (1024 * 1024));
+    }
+
+    if (g_root_count > 1 && STORAGE_REPLICAS > 1) {
+#if defined(_WIN32)
+        HANDLE h = (HANDLE)_beginthreadex(NULL, 0, replica_worker, NULL, 0, NULL);
+        if (h) CloseHandle(h);
+#else
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, replica_worker, NULL) == 0) {
+            pthread_detach(thread);
+        }
+#endif
+    }
+}
+
+int storage_root_count(void) {
+    return g_root_count;
+}
+
+const char* storage_root_path(int index) {
+    return index >= 0 && index < g_root_count ? g_roots[index].path : NULL;
+}
+
+/* Roots holding a copy of filename, written to roots[]; returns the count */
+static int find_replicas(const char* filename, int* roots) {
+    int count = 0;
+    char path[MAX_PATH_LEN];
+
+    for (int i = 0; i < g_root_count; i++) {
+        if (snprintf(path, sizeof(path), "%s/%s", g_roots[i].path, filename) >= (int)sizeof(path)) {
+            continue;
+        }
+        if (path_device(path) != -1) roots[count++] = i;
+    }
+    return count;
+}
+
+/*
+ * Resolve the copy of a title to read from: the replica whose device has
+ * the lowest live load (queue depth times read latency). Writes its path
+ * and returns the root index, or -1 if no root holds the file.
+ */
+int storage_resolve(const char* filename, char* path, size_t path_size) {
+    int roots[MAX_STORAGE_ROOTS];
+    int count = find_replicas(filename, roots);
+    if (count == 0) return -1;
+
+    int best = roots[0];
+    double best_load = disk_io_load(g_roots[best].dev);
+    for (int i = 1; i < count; i++) {
+        double load = disk_io_load(g_roots[roots[i]].dev);
+        if (load < best_load) {
+            best = roots[i];
+            best_load = load;
+        }
+    }
+
+    snprintf(path, path_size, "%s/%s", g_roots[best].path, filename);
+    return best;
+}
+
+/*
+ * Pick the root for a new file of the given size: the one with the most
+ * free space after the reserve, discounted by how busy its device is.
+ * Roots listed in exclude[] (exclude_count entries) are skipped.
+ * Returns the root index, or -1 if nothing has room.
+ */
+static int place_file(long long size, const int* exclude, int exclude_count) {
+    int best = -1;
+    double best_score = 0;
+
+    for (int i = 0; i < g_root_count; i++) {
+        int skip = !g_roots[i].online;
+        for (int j = 0; j < exclude_count && !skip; j++) {
+            if (exclude[j] == i) skip = 1;
+        }
+        if (skip) continue;
+
+        long long room = root_free_bytes(&g_roots[i]) - STORAGE_RESERVE_BYTES - size;
+        if (room <= 0) continue;
+
+        double score = (double)room / (1.0 + disk_io_load(g_roots[i].dev));
+        if (best < 0 || score > best_score) {
+            best = i;
+            best_score = score;
+        }
+    }
+    return best;
+}
+
+/* Choose where to store a new title; writes the directory and returns its index */
+int storage_place(long long size, char* dir, size_t dir_size) {
+    int root = place_file(size, NULL, 0);
+    if (root < 0) return -1;
+
+    snprintf(dir, dir_size, "%s", g_roots[root].path);
+    return root;
+}
+
+/* Flush a file to stable storage before it is renamed into place */
+static int sync_file(FILE* fp) {
+    if (fflush(fp) != 0) return -1;
+#if defined(_WIN32)
+    return _commit(_fileno(fp));
+#else
+    return fsync(fileno(fp));
+#endif
+}
+
+/* Make a rename in the directory holding path durable */
+static void sync_parent_dir(const char* path) {
+#if defined(_WIN32)
+    (void)path;   /* MoveFileEx with MOVEFILE_WRITE_THROUGH covers it */
+#else
+    char dir[MAX_PATH_LEN];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char* slash = strrchr(dir, '/');
+    if (!slash) return;
+    *slash = '\0';
+
+    int fd = open(dir, O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+#endif
+}
+
+/*
+ * Copy src to dst at no more than STORAGE_COPY_MBPS through a temporary
+ * file, synced before it is renamed, so readers and crashes never leave a
+ * partial copy in place.
+ */
+static int copy_file(const char* src, const char* dst) {
+    char tmp[MAX_PATH_LEN];
+    if (snprintf(tmp, sizeof(tmp), "%s.part", dst) >= (int)sizeof(tmp)) return -1;
+
+    FILE* in = fopen(src, "rb");
+    if (!in) return -1;
+
+    FILE* out = fopen(tmp, "wb");
+    if (!out) {
+        fclose(in);
+        return -1;
+    }
+
+    char* buffer = malloc(COPY_BUFFER_SIZE);
+    int ok = buffer != NULL;
+    double rate = STORAGE_COPY_MBPS * 1024.0 * 1024.0;
+    double started = monotonic_seconds();
+    long long copied = 0;
+    size_t n;
+    while (ok && (n = fread(buffer, 1, COPY_BUFFER_SIZE, in)) > 0) {
+        if (fwrite(buffer, 1, n, out) != n) ok = 0;
+        copied += (long long)n;
+
+        /* Stay under the copy budget so replication doesn't compete with playback */
+        double ahead = copied / rate - (monotonic_seconds() - started);
+        if (ahead > 0) usleep((unsigned int)(ahead * 1000000));
+    }
+    if (ferror(in)) ok = 0;
+
+    free(buffer);
+    fclose(in);
+    if (ok && sync_file(out) != 0) ok = 0;
+    if (fclose(out) != 0) ok = 0;
+
+#if defined(_WIN32)
+    if (ok && !MoveFileExA(tmp, dst, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) ok = 0;
+#else
+    if (ok && rename(tmp, dst) != 0) ok = 0;
+#endif
+    if (ok) sync_parent_dir(dst);
+
+    if (!ok) remove(tmp);
+    return ok ? 0 : -1;
+}
+
+/* Add one replica of filename on the best root that lacks it */
+static void make_replica(const char* filename) {
+    int roots[MAX_STORAGE_ROOTS];
+    int count = find_replicas(filename, roots);
+    if (count == 0 || count >= STORAGE_REPLICAS) return;
+
+    char src[MAX_PATH_LEN];
+    snprintf(src, sizeof(src), "%s/%s", g_roots[roots[0]].path, filename);
+
+#if defined(_WIN32)
+    struct _stat64 st;
+    if (_stat64(src, &st) != 0) return;
+#else
+    struct stat st;
+    if (stat(src, &st) != 0) return;
+#endif
+
+    int target = place_file((long long)st.st_size, roots, count);
+    if (target < 0) {
+        log_message(LOG_WARN, "No storage root has room to replicate %s", filename);
+        return;
+    }
+
+    char dst[MAX_PATH_LEN];
+    snprintf(dst, sizeof(dst), "%s/%s", g_roots[target].path, filename);
+
+    double started = monotonic_seconds();
+    if (copy_file(src, dst) != 0) {
+        log_message(LOG_ERROR, "Failed to replicate %s to %s", filename, g_roots[target].path);
+        return;
+    }
+
+    pthread_mutex_lock(&g_storage_mutex);
+    g_replicas_made++;
+    pthread_mutex_unlock(&g_storage_mutex);
+
+    log_message(LOG_INFO, "Replicated %s to %s in %.1f s", filename, g_roots[target].path,
+                monotonic_seconds() - started);
+}
+
+/* Background thread copying popular titles to additional roots */
+#if defined(_WIN32)
+static unsigned __stdcall replica_worker(void* arg) {
+#else
+static void* replica_worker(void* arg) {
+#endif
+    (void)arg;
+    char filename[256];
+
+    for (;;) {
+        pthread_mutex_lock(&g_storage_mutex);
+        while (g_pending_count == 0) {
+            pthread_cond_wait(&g_replica_cond, &g_storage_mutex);
+        }
+        strcpy(filename, g_pending[0]);
+        pthread_mutex_unlock(&g_storage_mutex);
+
+        make_replica(filename);
+
+        /* Leave the entry queued while copying so it isn't requested twice */
+        pthread_mutex_lock(&g_storage_mutex);
+        g_pending_count--;
+        memmove(g_pending[0], g_pending[1], sizeof(g_pending[0]) * g_pending_count);
+        pthread_mutex_unlock(&g_storage_mutex);
+    }
+
+#if defined(_WIN32)
+    return 0;
+#else
+    return NULL;
+#endif
+}
+
+/*
+ * Note that a title is popular. If it has fewer than STORAGE_REPLICAS
+ * copies it is queued for replication; the copy happens in the background.
+ */
+void storage_title_popular(const char* filename) {
+    if (g_root_count < 2 || STORAGE_REPLICAS < 2) return;
+
+    int roots[MAX_STORAGE_ROOTS];
+    if (find_replicas(filename, roots) >= STORAGE_REPLICAS) return;
+
+    pthread_mutex_lock(&g_storage_mutex);
+    int queued = 0;
+    for (int i = 0; i < g_pending_count; i++) {
+        if (strcmp(g_pending[i], filename) == 0) queued = 1;
+    }
+    if (!queued && g_pending_count < MAX_PENDING_REPLICAS) {
+        strncpy(g_pending[g_pending_count], filename, sizeof(g_pending[0]) - 1);
+        g_pending[g_pending_count][sizeof(g_pending[0]) - 1] = '\0';
+        g_pending_count++;
+        pthread_cond_signal(&g_replica_cond);
+    }
+    pthread_mutex_unlock(&g_storage_mutex);
+}
+
+/* Write storage roots and their load as a JSON object */
+int storage_stats_json(char* buf, size_t size) {
+    size_t used = 0;
+
+    pthread_mutex_lock(&g_storage_mutex);
+    used += snprintf(buf + used, size - used,
+        "{\"replicas_made\":%lld,\"replicas_pending\":%d,\"roots\":[",
+        g_replicas_made, g_pending_count);
+    pthread_mutex_unlock(&g_storage_mutex);
+
+    for (int i = 0; i < g_root_count && used < size; i++) {
+        used += snprintf(buf + used, size - used,
+            "%s{\"path\":\"%s\",\"online\":%s,\"free_mb\":%lld,\"load\":%.2f}",
+            i > 0 ? "," : "", g_roots[i].path, g_roots[i].online ? "true" : "false",
+            root_free_bytes(&g_roots[i]) / (1024 * 1024), disk_io_load(g_roots[i].dev));
+    }
+
+    if (used >= size) used = size - 1;
+    if (used + 2 < size) {
+        used += snprintf(buf + used, size - used, "]}");
+    }
+    return (int)used;
+}
@@ -0,0 +1,266 @@
+/*
+ * OTT Video Streaming Server - Storage Benchmark
+ * Runs the same workload against each compiled-in storage backend, or the
+ * ones named on the command line, and prints operations per second for
+ * each phase. The file backend works in ./data, so run it from a scratch
+ * directory; the postgres backend uses the database configured in db.c.
+ * The rows it adds are left behind, so a store that already holds users
+ * or videos is refused.
+ * Session lookups are also timed as the live session count grows from
+ * 100 to the -s limit, tenfold each step.
+ *
+ * Usage: store_bench [-u users] [-v videos] [-h history_updates] [-s sessions] [backend...]
+ */
+
+#include "common.h"
+
+#define BENCH_BATCH 256   /* rows per history_update_batch call */
+#define BENCH_SWEEP_LOOKUPS 100000   /* session_find calls timed at each session count */
+
+extern const StorageBackend* const data_backends[];
+extern const StorageBackend* data_backend_find(const char* name);
+extern int password_hash(const char* password, char* out, size_t size);
+
+static int g_users = 2000;
+static int g_videos = 200;
+static int g_updates = 100000;
+static int g_sessions = 1000000;
+
+static void report(const char* backend, const char* phase, int ops, double started) {
+    double elapsed = monotonic_seconds() - started;
+    printf("%-10s %-26s %8d ops %10.0f ops/s\n", backend, phase, ops,
+           elapsed > 0 ? ops / elapsed : 0);
+}
+
+/* Cheap deterministic generator so every backend sees the same workload */
+static unsigned int next_rand(unsigned int* state) {
+    *state = *state * 1103515245u + 12345u;
+    return *state >> 8;
+}
+
+/* Time session_find at 100, 1000, ... live sessions, up to g_sessions */
+static int sweep_sessions(const StorageBackend* b, const int* user_ids) {
+    char (*tokens)[sizeof(((Session*)0)->token)] = malloc(sizeof(*tokens) * g_sessions);
+    if (!tokens) return -1;
+
+    Session session;
+    unsigned int seed = 7;
+    int live = 0;
+    for (int target = 100; live < g_sessions; target *= 10) {
+        if (target > g_sessions) target = g_sessions;
+        while (live < target && b->session_create(user_ids[live % g_users], &session) == 0) {
+            strcpy(tokens[live++], session.token);
+        }
+        if (live < target) {
+            fprintf(stderr, "%s: session_create failed after %d sessions\n", b->name, live);
+            break;
+        }
+
+        int found = 0;
+        double t = monotonic_seconds();
+        for (int i = 0; i < BENCH_SWEEP_LOOKUPS; i++) {
+            if (b->session_find(tokens[next_rand(&seed) % live], &session) == 0) found++;
+        }
+        char phase[32];
+        snprintf(phase, sizeof(phase), "session_find @%d", live);
+        report(b->name, phase, BENCH_SWEEP_LOOKUPS, t);
+        if (found != BENCH_SWEEP_LOOKUPS) fprintf(stderr, "%s: %d of %d session lookups missed\n",
+                                                  b->name, BENCH_SWEEP_LOOKUPS - found, BENCH_SWEEP_LOOKUPS);
+    }
+
+    for (int i = 0; i < live; i++) {
+        b->session_destroy(tokens[i]);
+    }
+    free(tokens);
+    return 0;
+}
+
+static int run_backend(const StorageBackend* b) {
+    if (b->init() < 0) {
+        fprintf(stderr, "%s: init failed\n", b->name);
+        return -1;
+    }
+    b->load();
+
+    User user;
+    if (b->video_count() > 0 || b->user_find_by_id(1, &user) == 0) {
+        fprintf(stderr, "%s: store is not empty; use a scratch data directory or database\n", b->name);
+        return -1;
+    }
+
+    char prefix[32];
+    snprintf(prefix, sizeof(prefix), "bench%lx_", (unsigned long)time(NULL));
+
+    char hash[256];
+    if (password_hash("benchmark", hash, sizeof(hash)) < 0) return -1;
+
+    int* user_ids = malloc(sizeof(int) * g_users);
+    int* video_ids = malloc(sizeof(int) * g_videos);
+    Video* videos = malloc(sizeof(Video) * BENCH_BATCH);
+    WatchHistory* rows = malloc(sizeof(WatchHistory) * BENCH_BATCH);
+    WatchHistory* history = malloc(sizeof(WatchHistory) * g_videos);
+    if (!user_ids || !video_ids || !videos || !rows || !history) {
+        free(user_ids); free(video_ids); free(videos); free(rows); free(history);
+        return -1;
+    }
+
+    char name[sizeof(((User*)0)->username)];
+    double t = monotonic_seconds();
+    for (int i = 0; i < g_users; i++) {
+        snprintf(name, sizeof(name), "%s%d", prefix, i);
+        b->user_create(name, hash);
+    }
+    report(b->name, "user_create", g_users, t);
+
+    /* user_create doesn't return the id; the lookup by name supplies it */
+    int found = 0;
+    t = monotonic_seconds();
+    for (int i = 0; i < g_users; i++) {
+        snprintf(name, sizeof(name), "%s%d", prefix, i);
+        user_ids[i] = 0;
+        if (b->user_find_by_username(name, &user) == 0) {
+            user_ids[i] = user.id;
+            found++;
+        }
+    }
+    report(b->name, "user_find_by_username", g_users, t);
+
+    t = monotonic_seconds();
+    for (int i = 0; i < g_users; i++) {
+        if (b->user_find_by_id(user_ids[i], &user) == 0) found++;
+    }
+    report(b->name, "user_find_by_id", g_users, t);
+    if (found != g_users * 2) fprintf(stderr, "%s: %d of %d user lookups missed\n",
+                                      b->name, g_users * 2 - found, g_users * 2);
+
+    Session session;
+    t = monotonic_seconds();
+    for (int i = 0; i < g_users; i++) {
+        if (b->session_create(user_ids[i], &session) < 0) continue;
+        b->session_find(session.token, &session);
+        b->session_destroy(session.token);
+    }
+    report(b->name, "session create/find/end", g_users, t);
+
+    if (sweep_sessions(b, user_ids) < 0) fprintf(stderr, "%s: session sweep skipped\n", b->name);
+
+    char title[sizeof(((Video*)0)->title)];
+    char filename[256];
+    t = monotonic_seconds();
+    for (int i = 0; i < g_videos; i++) {
+        snprintf(title, sizeof(title), "%s%d", prefix, i);
+        snprintf(filename, sizeof(filename), "%s%d.mp4", prefix, i);
+        video_ids[i] = b->video_add(title, filename, "", 600, "benchmark video");
+    }
+    report(b->name, "video_add", g_videos, t);
+
+    /* Half the updates one at a time, half in batches, same access pattern */
+    unsigned int seed = 1;
+    int singles = g_updates / 2;
+    t = monotonic_seconds();
+    for (int i = 0; i < singles; i++) {
+        unsigned int r = next_rand(&seed);
+        b->history_update(user_ids[r % g_users], video_ids[(r / g_users) % g_videos], i % 600);
+    }
+    report(b->name, "history_update", singles, t);
+
+    int batched = g_updates - singles;
+    t = monotonic_seconds();
+    for (int done = 0; done < batched; done += BENCH_BATCH) {
+        int count = batched - done < BENCH_BATCH ? batched - done : BENCH_BATCH;
+        for (int i = 0; i < count; i++) {
+            unsigned int r = next_rand(&seed);
+            rows[i].user_id = user_ids[r % g_users];
+            rows[i].video_id = video_ids[(r / g_users) % g_videos];
+            rows[i].last_pos_sec = (done + i) % 600;
+            rows[i].updated_at = 0;
+        }
+        b->history_update_batch(rows, count);
+    }
+    report(b->name, "history_update_batch", batched, t);
+
+    t = monotonic_seconds();
+    for (int i = 0; i < g_users; i++) {
+        b->history_get_user_history(user_ids[i], history, g_videos);
+    }
+    report(b->name, "history_get_user_history", g_users, t);
+
+    WatchHistory h;
+    t = monotonic_seconds();
+    for (int i = 0; i < g_users; i++) {
+        b->history_find(user_ids[i], video_ids[i % g_videos], &h);
+    }
+    report(b->name, "history_find", g_users, t);
+
+    int ids[BENCH_BATCH];
+    int per_user = g_videos < BENCH_BATCH ? g_videos : BENCH_BATCH;
+    int lookups = 0;
+    t = monotonic_seconds();
+    for (int i = 0; i < g_users; i++) {
+        int count = b->history_get_user_history(user_ids[i], history, per_user);
+        for (int j = 0; j < count; j++) {
+            ids[j] = history[j].video_id;
+        }
+        if (count > 0) b->videos_find(ids, count, videos);
+        lookups += count;
+    }
+    report(b->name, "history + videos_find", lookups, t);
+
+    t = monotonic_seconds();
+    for (int i = 0; i < 20; i++) {
+        b->history_top_videos(7, ids, 20);
+    }
+    report(b->name, "history_top_videos", 20, t);
+
+    t = monotonic_seconds();
+    b->save();
+    report(b->name, "save", 1, t);
+
+    free(user_ids);
+    free(video_ids);
+    free(videos);
+    free(rows);
+    free(history);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    const char* names[16];
+    int name_count = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-u") == 0 && i + 1 < argc) g_users = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-v") == 0 && i + 1 < argc) g_videos = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-h") == 0 && i + 1 < argc) g_updates = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) g_sessions = atoi(argv[++i]);
+        else if (name_count < 16) names[name_count++] = argv[i];
+    }
+    if (g_users <= 0 || g_videos <= 0 || g_updates <= 0 || g_sessions <= 0) {
+        fprintf(stderr, "Usage: %s [-u users] [-v videos] [-h history_updates] [-s sessions] [backend...]\n",
+                argv[0]);
+        return 1;
+    }
+
+#if defined(_WIN32)
+    CreateDirectoryA(DATA_DIR, NULL);
+#else
+    mkdir(DATA_DIR, 0755);
+#endif
+
+    int failed = 0;
+    if (name_count == 0) {
+        for (int i = 0; data_backends[i]; i++) {
+            if (run_backend(data_backends[i]) < 0) failed = 1;
+        }
+    }
+    for (int i = 0; i < name_count; i++) {
+        const StorageBackend* b = data_backend_find(names[i]);
+        if (!b) {
+            fprintf(stderr, "Unknown backend: %s\n", names[i]);
+            failed = 1;
+        } else if (run_backend(b) < 0) {
+            failed = 1;
+        }
+    }
+    return failed;
+}
@@ -0,0 +1,258 @@
+/*
+ * OTT Video Streaming Server - Stream Tuning
+ * Per-stream adaptive range sizing and kernel read-ahead hints
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+    #define _GNU_SOURCE
+#endif
+
+#include "common.h"
+
+/* Range window limits */
+#define STREAM_WINDOW_MIN (256 * 1024)
+#define STREAM_WINDOW_INITIAL (1024 * 1024)
+#define STREAM_WINDOW_MAX (8 * 1024 * 1024)
+
+/* Aim for ranges that take this long to deliver at the observed rate */
+#define STREAM_TARGET_SECONDS 4.0
+
+/* Weight of the newest throughput sample */
+#define STREAM_RATE_ALPHA 0.3
+
+/* Tracked streams and titles */
+#define MAX_STREAMS 256
+#define MAX_TITLES 1024   /* the coldest is replaced when full */
+
+/* Title heat decays by half every hour; below this it counts as cold */
+#define TITLE_HEAT_HALF_LIFE 3600.0
+#define TITLE_COLD_THRESHOLD 3.0
+
+/* Pages kept cached behind the playhead of a cold title */
+#define STREAM_KEEP_BEHIND (4 * 1024 * 1024)
+
+typedef struct {
+    int user_id;
+    int video_id;
+    long next_offset;     /* first byte after the last served range */
+    double rate;          /* smoothed client throughput, bytes/sec */
+    long window;          /* current range size */
+    time_t last_seen;
+    int active;
+} StreamState;
+
+typedef struct {
+    int video_id;
+    double heat;          /* decayed count of viewing sessions */
+    time_t updated_at;
+} TitleHeat;
+
+static StreamState g_streams[MAX_STREAMS];
+static TitleHeat g_titles[MAX_TITLES];
+static int g_title_count = 0;
+
+static pthread_mutex_t g_tune_mutex;
+static int g_tune_initialized = 0;
+
+/* Initialize stream tuning state */
+void stream_tune_init(void) {
+    if (!g_tune_initialized) {
+        pthread_mutex_init(&g_tune_mutex, NULL);
+        g_tune_initialized = 1;
+    }
+    memset(g_streams, 0, sizeof(g_streams));
+    g_title_count = 0;
+}
+
+/* Find stream state, or claim the least recently used slot (caller holds lock) */
+static StreamState* find_stream(int user_id, int video_id, int create) {
+    StreamState* victim = &g_streams[0];
+
+    for (int i = 0; i < MAX_STREAMS; i++) {
+        StreamState* s = &g_streams[i];
+        if (s->active && s->user_id == user_id && s->video_id == video_id) {
+            return s;
+        }
+        if (!s->active || (victim->active && s->last_seen < victim->last_seen)) {
+            victim = s;
+        }
+    }
+
+    if (!create) return NULL;
+
+    memset(victim, 0, sizeof(StreamState));
+    victim->user_id = user_id;
+    victim->video_id = video_id;
+    victim->next_offset = -1;
+    victim->window = STREAM_WINDOW_INITIAL;
+    victim->active = 1;
+    return victim;
+}
+
+/* Halve a title's heat for every elapsed half-life (caller holds lock) */
+static void decay_heat(TitleHeat* t, time_t now) {
+    while (difftime(now, t->updated_at) >= TITLE_HEAT_HALF_LIFE) {
+        t->heat *= 0.5;
+        t->updated_at += (time_t)TITLE_HEAT_HALF_LIFE;
+        if (t->heat < 0.01) {
+            t->heat = 0;
+            t->updated_at = now;
+        }
+    }
+}
+
+/* Find title heat entry, replacing the coldest one when full (caller holds lock) */
+static TitleHeat* find_title(int video_id, time_t now) {
+    for (int i = 0; i < g_title_count; i++) {
+        if (g_titles[i].video_id == video_id) {
+            decay_heat(&g_titles[i], now);
+            return &g_titles[i];
+        }
+    }
+
+    TitleHeat* t;
+    if (g_title_count < MAX_TITLES) {
+        t = &g_titles[g_title_count++];
+    } else {
+        t = &g_titles[0];
+        for (int i = 1; i < g_title_count; i++) {
+            decay_heat(&g_titles[i], now);
+            if (g_titles[i].heat < t->heat) t = &g_titles[i];
+        }
+    }
+
+    t->video_id = video_id;
+    t->heat = 0;
+    t->updated_at = now;
+    return t;
+}
+
+/* Current decayed heat of a title (viewing sessions per half-life) */
+double stream_title_heat(int video_id) {
+    pthread_mutex_lock(&g_tune_mutex);
+    TitleHeat* t = find_title(video_id, time(NULL));
+    double heat = t->heat;
+    pthread_mutex_unlock(&g_tune_mutex);
+    return heat;
+}
+
+int stream_title_is_cold(int video_id) {
+    return stream_title_heat(video_id) < TITLE_COLD_THRESHOLD;
+}
+
+/* Mark a title known to be popular (e.g. from watch history) as not cold */
+void stream_title_seed(int video_id) {
+    pthread_mutex_lock(&g_tune_mutex);
+    TitleHeat* t = find_title(video_id, time(NULL));
+    if (t->heat < TITLE_COLD_THRESHOLD) t->heat = TITLE_COLD_THRESHOLD;
+    pthread_mutex_unlock(&g_tune_mutex);
+}
+
+/*
+ * Pick the length of the next ranged response for this viewer.
+ * Sequential reads grow towards STREAM_TARGET_SECONDS of observed
+ * throughput; seeks fall back to a small window for fast restart.
+ */
+long stream_tune_range(int user_id, int video_id, long range_start) {
+    time_t now = time(NULL);
+
+    pthread_mutex_lock(&g_tune_mutex);
+
+    StreamState* s = find_stream(user_id, video_id, 0);
+    if (!s) {
+        /* A new viewing session warms the title */
+        s = find_stream(user_id, video_id, 1);
+        TitleHeat* t = find_title(video_id, now);
+        t->heat += 1.0;
+    } else if (range_start == s->next_offset) {
+        long target = s->rate > 0 ? (long)(s->rate * STREAM_TARGET_SECONDS) : s->window * 2;
+        if (target > s->window * 2) target = s->window * 2;
+        s->window = target;
+    } else {
+        s->window = STREAM_WINDOW_MIN;
+    }
+
+    if (s->window < STREAM_WINDOW_MIN) s->window = STREAM_WINDOW_MIN;
+    if (s->window > STREAM_WINDOW_MAX) s->window = STREAM_WINDOW_MAX;
+
+    s->last_seen = now;
+    long window = s->window;
+
+    pthread_mutex_unlock(&g_tune_mutex);
+    return window;
+}
+
+/* Most recent throughput estimate for any of a user's streams, 0 if none */
+double stream_user_rate(int user_id) {
+    double rate = 0;
+    time_t latest = 0;
+
+    pthread_mutex_lock(&g_tune_mutex);
+    for (int i = 0; i < MAX_STREAMS; i++) {
+        StreamState* s = &g_streams[i];
+        if (s->active && s->user_id == user_id && s->rate > 0 && s->last_seen >= latest) {
+            rate = s->rate;
+            latest = s->last_seen;
+        }
+    }
+    pthread_mutex_unlock(&g_tune_mutex);
+
+    return rate;
+}
+
+/* Record a completed range to refine the throughput estimate */
+void stream_tune_complete(int user_id, int video_id, long range_start, long bytes_sent,
+                          double elapsed_sec) {
+    pthread_mutex_lock(&g_tune_mutex);
+
+    StreamState* s = find_stream(user_id, video_id, 0);
+    if (s) {
+        s->next_offset = range_start + bytes_sent;
+        s->last_seen = time(NULL);
+
+        /* Tiny responses finish inside the socket buffer and say little about the link */
+        if (bytes_sent >= STREAM_WINDOW_MIN && elapsed_sec > 0.001) {
+            double sample = bytes_sent / elapsed_sec;
+            s->rate = s->rate > 0 ? s->rate + STREAM_RATE_ALPHA * (sample - s->rate) : sample;
+        }
+    }
+
+    pthread_mutex_unlock(&g_tune_mutex);
+}
+
+/* Hint the kernel before serving [offset, offset + length) */
+void stream_hint_before(int fd, long offset, long length) {
+#if defined(__linux__)
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(fd, offset, length, POSIX_FADV_WILLNEED);
+#else
+    (void)fd;
+    (void)offset;
+    (void)length;
+#endif
+}
+
+/*
+ * After serving a range, start reading the next window and, for cold
+ * titles, drop pages well behind the playhead so they don't evict the
+ * hot catalog.
+ */
+void stream_hint_after(int fd, int video_id, long next_offset, long next_length,
+                       long file_size) {
+#if defined(__linux__)
+    if (next_offset < file_size) {
+        if (next_offset + next_length > file_size) next_length = file_size - next_offset;
+        readahead(fd, next_offset, (size_t)next_length);
+    }
+
+    if (stream_title_is_cold(video_id) && next_offset > STREAM_KEEP_BEHIND) {
+        posix_fadvise(fd, 0, next_offset - STREAM_KEEP_BEHIND, POSIX_FADV_DONTNEED);
+    }
+#else
+    (void)fd;
+    (void)video_id;
+    (void)next_offset;
+    (void)next_length;
+    (void)file_size;
+#endif
+}
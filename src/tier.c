@@ -0,0 +1,451 @@
+/*
+ * OTT Video Streaming Server - Tiered Storage
+ * Hot titles are copied from the slow storage roots to a fast cache
+ * volume (SSD/NVMe) in the background and served from there. Copies are
+ * rate-limited and verified before serving switches to them; cold titles
+ * are demoted when the fast tier's capacity budget is needed.
+ */
+
+#include "common.h"
+
+#if defined(_WIN32)
+    #include <io.h>
+    #include <sys/stat.h>
+#endif
+
+#define MAX_TIER_TITLES 1024   /* titles tracked for the fast tier */
+#define TIER_COPY_CHUNK (1024 * 1024)
+
+#define TIER_NONE 0
+#define TIER_PENDING 1
+#define TIER_COPYING 2
+#define TIER_READY 3
+
+typedef struct {
+    char filename[256];
+    long long size;
+    int state;
+    double heat;          /* heat at the last request */
+    time_t last_access;
+} TierTitle;
+
+static TierTitle g_tier[MAX_TIER_TITLES];
+static int g_tier_count = 0;
+static char g_fast_dir[MAX_PATH_LEN];
+static long long g_capacity = 0;
+static long long g_used = 0;
+static long long g_promotions = 0;
+static long long g_demotions = 0;
+static long long g_fast_hits = 0;
+static pthread_mutex_t g_tier_mutex;
+static pthread_cond_t g_tier_cond;
+static int g_tier_enabled = 0;
+
+extern int storage_resolve(const char* filename, char* path, size_t path_size);
+
+/* Size of a file, -1 if missing */
+static long long file_size_of(const char* path) {
+#if defined(_WIN32)
+    struct _stat64 st;
+    if (_stat64(path, &st) != 0) return -1;
+#else
+    struct stat st;
+    if (stat(path, &st) != 0) return -1;
+#endif
+    return (long long)st.st_size;
+}
+
+/* Find a title's entry, adding one if asked (caller holds g_tier_mutex) */
+static TierTitle* find_title(const char* filename, int create) {
+    for (int i = 0; i < g_tier_count; i++) {
+        if (strcmp(g_tier[i].filename, filename) == 0) return &g_tier[i];
+    }
+    if (!create || g_tier_count >= MAX_TIER_TITLES) return NULL;
+
+    TierTitle* t = &g_tier[g_tier_count++];
+    memset(t, 0, sizeof(TierTitle));
+    strncpy(t->filename, filename, sizeof(t->filename) - 1);
+    return t;
+}
+
+/* Adopt a copy left in the fast directory by a previous run if it still matches */
+static void adopt_existing(const char* name) {
+    char fast[MAX_PATH_LEN];
+    char slow[MAX_PATH_LEN];
+    if (snprintf(fast, sizeof(fast), "%s/%s", g_fast_dir, name) >= (int)sizeof(fast)) return;
+
+    size_t len = strlen(name);
+    if (len > 5 && strcmp(name + len - 5, ".part") == 0) {
+        remove(fast);
+        return;
+    }
+
+    long long size = file_size_of(fast);
+    if (storage_resolve(name, slow, sizeof(slow)) < 0 || file_size_of(slow) != size) {
+        remove(fast);
+        return;
+    }
+
+    TierTitle* t = find_title(name, 1);
+    if (!t) return;
+    t->size = size;
+    t->state = TIER_READY;
+    t->last_access = time(NULL);
+    g_used += size;
+}
+
+static void load_existing(void) {
+#if defined(_WIN32)
+    WIN32_FIND_DATAA fd;
+    char search_path[MAX_PATH_LEN];
+    snprintf(search_path, sizeof(search_path), "%s\\*", g_fast_dir);
+
+    HANDLE hFind = FindFirstFileA(search_path, &fd);
+    if (hFind == INVALID_HANDLE_VALUE) return;
+    do {
+        if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) adopt_existing(fd.cFileName);
+    } while (FindNextFileA(hFind, &fd));
+    FindClose(hFind);
+#else
+    DIR* dir = opendir(g_fast_dir);
+    if (!dir) return;
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') adopt_existing(entry->d_name);
+    }
+    closedir(dir);
+#endif
+}
+
+/* FNV-1a over a buffer, continuing from hash */
+static unsigned long long fnv1a(unsigned long long hash, const char* data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*
+ * Checksum of a whole file as stored on disk, 0 on error. Its pages are
+ * dropped from the cache first so the bytes come from the device; the
+ * file must already be synced. Windows reads through the cache.
+ */
+static unsigned long long file_checksum(const char* path, char* buffer) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) return 0;
+#if defined(POSIX_FADV_DONTNEED)
+    posix_fadvise(fileno(fp), 0, 0, POSIX_FADV_DONTNEED);
+#endif
+
+    unsigned long long hash = 14695981039346656037ULL;
+    size_t n;
+    while ((n = fread(buffer, 1, TIER_COPY_CHUNK, fp)) > 0) {
+        hash = fnv1a(hash, buffer, n);
+    }
+    int failed = ferror(fp);
+    fclose(fp);
+    return failed ? 0 : hash;
+}
+
+/* Flush a file to stable storage */
+static int sync_file(FILE* fp) {
+    if (fflush(fp) != 0) return -1;
+#if defined(_WIN32)
+    return _commit(_fileno(fp));
+#else
+    return fsync(fileno(fp));
+#endif
+}
+
+/*
+ * Copy src to dst at no more than TIER_COPY_MBPS, sync it, then re-read
+ * the copy from disk and compare checksums before moving it into place.
+ */
+static int copy_verified(const char* src, const char* dst, char* buffer) {
+    char tmp[MAX_PATH_LEN];
+    if (snprintf(tmp, sizeof(tmp), "%s.part", dst) >= (int)sizeof(tmp)) return -1;
+
+    FILE* in = fopen(src, "rb");
+    if (!in) return -1;
+    FILE* out = fopen(tmp, "wb");
+    if (!out) {
+        fclose(in);
+        return -1;
+    }
+
+    unsigned long long hash = 14695981039346656037ULL;
+    double rate = TIER_COPY_MBPS * 1024.0 * 1024.0;
+    double started = monotonic_seconds();
+    long long copied = 0;
+    int ok = 1;
+    size_t n;
+
+    while (ok && (n = fread(buffer, 1, TIER_COPY_CHUNK, in)) > 0) {
+        hash = fnv1a(hash, buffer, n);
+        if (fwrite(buffer, 1, n, out) != n) ok = 0;
+        copied += (long long)n;
+
+        /* Stay under the copy budget so promotion doesn't starve playback */
+        double ahead = copied / rate - (monotonic_seconds() - started);
+        if (ahead > 0) usleep((unsigned int)(ahead * 1000000));
+    }
+    if (ferror(in)) ok = 0;
+    fclose(in);
+    if (ok && sync_file(out) != 0) ok = 0;
+    if (fclose(out) != 0) ok = 0;
+
+    if (ok && file_checksum(tmp, buffer) != hash) {
+        log_message(LOG_ERROR, "Fast tier copy of %s failed verification", src);
+        ok = 0;
+    }
+
+#if defined(_WIN32)
+    if (ok && !MoveFileExA(tmp, dst, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) ok = 0;
+#else
+    if (ok && rename(tmp, dst) != 0) ok = 0;
+
+    /* Make the rename itself durable */
+    int dir = ok ? open(g_fast_dir, O_RDONLY) : -1;
+    if (dir >= 0) {
+        fsync(dir);
+        close(dir);
+    }
+#endif
+
+    if (!ok) remove(tmp);
+    return ok ? 0 : -1;
+}
+
+/* Heat at the last request, halved for every idle hour since */
+static double idle_heat(const TierTitle* t, time_t now) {
+    double heat = t->heat;
+    for (double idle = difftime(now, t->last_access); idle >= 3600 && heat > 0.01; idle -= 3600) {
+        heat *= 0.5;
+    }
+    return heat;
+}
+
+/*
+ * Make room for size bytes by demoting ready titles colder than heat,
+ * coldest first. Returns 0 if the title now fits (caller holds g_tier_mutex).
+ */
+static int make_room(long long size, double heat) {
+    time_t now = time(NULL);
+
+    while (g_used + size > g_capacity) {
+        TierTitle* victim = NULL;
+        double victim_heat = 0;
+        for (int i = 0; i < g_tier_count; i++) {
+            TierTitle* t = &g_tier[i];
+            if (t->state != TIER_READY) continue;
+
+            double h = idle_heat(t, now);
+            if (h >= heat) continue;
+            if (!victim || h < victim_heat ||
+                (h == victim_heat && t->last_access < victim->last_access)) {
+                victim = t;
+                victim_heat = h;
+            }
+        }
+        if (!victim) return -1;
+
+        /* Requests already streaming keep their open descriptor */
+        char path[MAX_PATH_LEN];
+        int named = snprintf(path, sizeof(path), "%s/%s", g_fast_dir, victim->filename) < (int)sizeof(path);
+        victim->state = TIER_NONE;
+        g_used -= victim->size;
+        g_demotions++;
+
+        if (!named || remove(path) != 0) {
+            log_message(LOG_WARN, "Could not remove demoted fast tier copy %s", path);
+        }
+        log_message(LOG_INFO, "Demoted %s from fast tier", victim->filename);
+    }
+    return 0;
+}
+
+/* Background thread promoting pending titles one at a time */
+#if defined(_WIN32)
+static unsigned __stdcall tier_worker(void* arg) {
+#else
+static void* tier_worker(void* arg) {
+#endif
+    (void)arg;
+    char* buffer = malloc(TIER_COPY_CHUNK);
+    if (!buffer) {
+        log_message(LOG_ERROR, "Fast tier: out of memory");
+#if defined(_WIN32)
+        return 0;
+#else
+        return NULL;
+#endif
+    }
+
+    for (;;) {
+        pthread_mutex_lock(&g_tier_mutex);
+        TierTitle* t = NULL;
+        while (!t) {
+            /* Hottest pending title first */
+            for (int i = 0; i < g_tier_count; i++) {
+                if (g_tier[i].state == TIER_PENDING && (!t || g_tier[i].heat > t->heat)) {
+                    t = &g_tier[i];
+                }
+            }
+            if (!t) pthread_cond_wait(&g_tier_cond, &g_tier_mutex);
+        }
+
+        char src[MAX_PATH_LEN];
+        char dst[MAX_PATH_LEN];
+        char filename[256];
+        strcpy(filename, t->filename);
+        int named = snprintf(dst, sizeof(dst), "%s/%s", g_fast_dir, filename) < (int)sizeof(dst);
+
+        long long size = -1;
+        if (storage_resolve(filename, src, sizeof(src)) >= 0) size = file_size_of(src);
+
+        if (!named || size < 0 || make_room(size, t->heat) != 0) {
+            t->state = TIER_NONE;
+            pthread_mutex_unlock(&g_tier_mutex);
+            continue;
+        }
+
+        /* Reserve the space while copying */
+        t->state = TIER_COPYING;
+        t->size = size;
+        g_used += size;
+        pthread_mutex_unlock(&g_tier_mutex);
+
+        double started = monotonic_seconds();
+        int result = copy_verified(src, dst, buffer);
+
+        pthread_mutex_lock(&g_tier_mutex);
+        if (result == 0) {
+            t->state = TIER_READY;
+            t->last_access = time(NULL);
+            g_promotions++;
+        } else {
+            t->state = TIER_NONE;
+            g_used -= size;
+        }
+        pthread_mutex_unlock(&g_tier_mutex);
+
+        if (result == 0) {
+            log_message(LOG_INFO, "Promoted %s to fast tier in %.1f s", filename,
+                        monotonic_seconds() - started);
+        } else {
+            log_message(LOG_ERROR, "Failed to promote %s to fast tier", filename);
+        }
+    }
+
+#if defined(_WIN32)
+    return 0;
+#else
+    return NULL;
+#endif
+}
+
+/*
+ * Initialize the fast tier from FAST_TIER_DIR, or the OTT_FAST_TIER_DIR
+ * environment variable when set. An empty directory disables tiering.
+ */
+void tier_init(void) {
+    pthread_mutex_init(&g_tier_mutex, NULL);
+    pthread_cond_init(&g_tier_cond, NULL);
+
+    const char* dir = getenv("OTT_FAST_TIER_DIR");
+    if (!dir || !dir[0]) dir = FAST_TIER_DIR;
+    if (!dir[0]) return;
+
+    strncpy(g_fast_dir, dir, sizeof(g_fast_dir) - 1);
+    g_capacity = (long long)FAST_TIER_CAPACITY_MB * 1024 * 1024;
+
+#if defined(_WIN32)
+    CreateDirectoryA(g_fast_dir, NULL);
+#else
+    mkdir(g_fast_dir, 0755);
+#endif
+
+    load_existing();
+    g_tier_enabled = 1;
+
+#if defined(_WIN32)
+    HANDLE h = (HANDLE)_beginthreadex(NULL, 0, tier_worker, NULL, 0, NULL);
+    if (h) CloseHandle(h);
+#else
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, tier_worker, NULL) == 0) {
+        pthread_detach(thread);
+    }
+#endif
+
+    log_message(LOG_INFO, "Fast tier: %s, %d MB budget, %d titles present",
+                g_fast_dir, FAST_TIER_CAPACITY_MB, g_tier_count);
+}
+
+/*
+ * Route a request for a title. If a verified fast copy exists, its path
+ * replaces *path and 1 is returned. Titles at or above TIER_PROMOTE_HEAT
+ * are queued for promotion.
+ */
+int tier_resolve(const char* filename, double heat, char* path, size_t path_size) {
+    if (!g_tier_enabled) return 0;
+
+    int fast = 0;
+
+    pthread_mutex_lock(&g_tier_mutex);
+    TierTitle* t = find_title(filename, heat >= TIER_PROMOTE_HEAT);
+    if (t) {
+        t->heat = heat;
+        t->last_access = time(NULL);
+
+        if (t->state == TIER_READY) {
+            snprintf(path, path_size, "%s/%s", g_fast_dir, filename);
+            g_fast_hits++;
+            fast = 1;
+        } else if (t->state == TIER_NONE && heat >= TIER_PROMOTE_HEAT) {
+            t->state = TIER_PENDING;
+            pthread_cond_signal(&g_tier_cond);
+        }
+    }
+    pthread_mutex_unlock(&g_tier_mutex);
+
+    return fast;
+}
+
+/*
+ * Like tier_resolve, but only looks: heat, access time and hit counts are
+ * left alone, so background readers don't skew promotion or eviction.
+ */
+int tier_peek(const char* filename, char* path, size_t path_size) {
+    if (!g_tier_enabled) return 0;
+
+    pthread_mutex_lock(&g_tier_mutex);
+    TierTitle* t = find_title(filename, 0);
+    int fast = t && t->state == TIER_READY;
+    if (fast) snprintf(path, path_size, "%s/%s", g_fast_dir, filename);
+    pthread_mutex_unlock(&g_tier_mutex);
+
+    return fast;
+}
+
+/* Write fast tier metrics as a JSON object */
+int tier_stats_json(char* buf, size_t size) {
+    int ready = 0;
+    int pending = 0;
+
+    pthread_mutex_lock(&g_tier_mutex);
+    for (int i = 0; i < g_tier_count; i++) {
+        if (g_tier[i].state == TIER_READY) ready++;
+        if (g_tier[i].state == TIER_PENDING || g_tier[i].state == TIER_COPYING) pending++;
+    }
+    int written = snprintf(buf, size,
+        "{\"enabled\":%s,\"used_mb\":%lld,\"capacity_mb\":%lld,\"titles\":%d,\"pending\":%d,"
+        "\"promotions\":%lld,\"demotions\":%lld,\"fast_hits\":%lld}",
+        g_tier_enabled ? "true" : "false", g_used / (1024 * 1024), g_capacity / (1024 * 1024),
+        ready, pending, g_promotions, g_demotions, g_fast_hits);
+    pthread_mutex_unlock(&g_tier_mutex);
+
+    return written;
+}
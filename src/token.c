@@ -0,0 +1,529 @@
+/*
+ * OTT Video Streaming Server - Signed Session Tokens
+ * A session cookie carries the user id, expiry and signing key id, with
+ * an HMAC-SHA256 over them, so requests are authenticated without a
+ * session lookup. Signing keys rotate every SESSION_KEY_ROTATE_SECONDS
+ * and stay valid for verification until their last token expires.
+ * Logged-out tokens are kept in a small denylist until they expire.
+ * The SHA-256 code also provides PBKDF2 for password hashing.
+ */
+
+#include "common.h"
+#include <stdint.h>
+
+#define TOKEN_KEYS 4              /* signing keys kept, current one included */
+#define TOKEN_MAC_BYTES 16        /* HMAC-SHA256 truncated to 128 bits */
+#define TOKEN_NONCE_BYTES 8
+
+#define KEYS_FILE DATA_DIR "/session.keys"
+#define REVOKED_FILE DATA_DIR "/session.revoked"
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;              /* bytes hashed */
+    unsigned char block[64];
+    size_t used;
+} Sha256;
+
+/* A signing key as stored in KEYS_FILE */
+typedef struct {
+    uint32_t kid;                 /* 0 = unused */
+    uint32_t reserved;
+    int64_t created_at;
+    unsigned char secret[32];
+} KeyRecord;
+
+/* HMAC contexts with the key's inner and outer pads already absorbed */
+typedef struct {
+    KeyRecord record;
+    Sha256 inner;
+    Sha256 outer;
+} SigningKey;
+
+/* A revoked token, as stored in REVOKED_FILE */
+typedef struct {
+    unsigned char mac[TOKEN_MAC_BYTES];
+    int64_t expires_at;           /* 0 = empty bucket */
+} Revoked;
+
+static SigningKey g_keys[TOKEN_KEYS];   /* slot = kid % TOKEN_KEYS */
+static uint32_t g_current_kid = 0;
+static RWLOCK g_key_lock;
+
+/* Open-addressing set of revoked MACs; expired entries are dropped when it grows */
+static Revoked* g_revoked = NULL;
+static int g_revoked_size = 0;
+static int g_revoked_count = 0;
+static FILE* g_revoked_file = NULL;
+static RWLOCK g_revoked_lock;
+
+static const uint32_t k_sha256[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_compress(Sha256* ctx, const unsigned char* block) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 |
+               (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = ctx->state[0], b = ctx->state[1], c = ctx->state[2], d = ctx->state[3];
+    uint32_t e = ctx->state[4], f = ctx->state[5], g = ctx->state[6], h = ctx->state[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + k_sha256[i] + w[i];
+        uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    ctx->state[0] += a;
+    ctx->state[1] += b;
+    ctx->state[2] += c;
+    ctx->state[3] += d;
+    ctx->state[4] += e;
+    ctx->state[5] += f;
+    ctx->state[6] += g;
+    ctx->state[7] += h;
+}
+
+static void sha256_init(Sha256* ctx) {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(ctx->state, initial, sizeof(initial));
+    ctx->length = 0;
+    ctx->used = 0;
+}
+
+static void sha256_update(Sha256* ctx, const void* data, size_t len) {
+    const unsigned char* p = data;
+    ctx->length += len;
+    while (len > 0) {
+        size_t n = 64 - ctx->used < len ? 64 - ctx->used : len;
+        memcpy(ctx->block + ctx->used, p, n);
+        ctx->used += n;
+        p += n;
+        len -= n;
+        if (ctx->used == 64) {
+            sha256_compress(ctx, ctx->block);
+            ctx->used = 0;
+        }
+    }
+}
+
+static void sha256_final(Sha256* ctx, unsigned char* out) {
+    uint64_t bits = ctx->length * 8;
+    static const unsigned char pad[64] = { 0x80 };
+    sha256_update(ctx, pad, ctx->used < 56 ? 56 - ctx->used : 120 - ctx->used);
+
+    unsigned char length[8];
+    for (int i = 0; i < 8; i++) length[i] = (unsigned char)(bits >> (56 - i * 8));
+    sha256_update(ctx, length, 8);
+
+    for (int i = 0; i < 8; i++) {
+        out[i * 4] = (unsigned char)(ctx->state[i] >> 24);
+        out[i * 4 + 1] = (unsigned char)(ctx->state[i] >> 16);
+        out[i * 4 + 2] = (unsigned char)(ctx->state[i] >> 8);
+        out[i * 4 + 3] = (unsigned char)ctx->state[i];
+    }
+}
+
+/* Absorb a key's inner and outer pads; keys longer than a block are hashed first */
+static void hmac_pads(Sha256* inner, Sha256* outer, const void* key, size_t len) {
+    unsigned char block[64];
+    unsigned char pad[64];
+
+    memset(block, 0, sizeof(block));
+    if (len > sizeof(block)) {
+        Sha256 ctx;
+        sha256_init(&ctx);
+        sha256_update(&ctx, key, len);
+        sha256_final(&ctx, block);
+    } else if (len > 0) {
+        memcpy(block, key, len);
+    }
+
+    for (size_t i = 0; i < sizeof(pad); i++) pad[i] = block[i] ^ 0x36;
+    sha256_init(inner);
+    sha256_update(inner, pad, sizeof(pad));
+
+    for (size_t i = 0; i < sizeof(pad); i++) pad[i] = block[i] ^ 0x5c;
+    sha256_init(outer);
+    sha256_update(outer, pad, sizeof(pad));
+}
+
+/* Absorb the key's pads once, so each MAC costs two hash passes over the message */
+static void hmac_setup(SigningKey* key) {
+    hmac_pads(&key->inner, &key->outer, key->record.secret, sizeof(key->record.secret));
+}
+
+static void hmac(const SigningKey* key, const void* data, size_t len, unsigned char* mac) {
+    unsigned char digest[32];
+
+    Sha256 ctx = key->inner;
+    sha256_update(&ctx, data, len);
+    sha256_final(&ctx, digest);
+
+    ctx = key->outer;
+    sha256_update(&ctx, digest, sizeof(digest));
+    sha256_final(&ctx, digest);
+
+    memcpy(mac, digest, TOKEN_MAC_BYTES);
+}
+
+/*
+ * PBKDF2-HMAC-SHA256 (RFC 8018) with the given iteration count, writing
+ * out_len bytes of derived key. scrypt uses it with a single iteration.
+ */
+void pbkdf2_sha256(const void* password, size_t password_len, const void* salt, size_t salt_len,
+                   unsigned int iterations, unsigned char* out, size_t out_len) {
+    Sha256 inner, outer;
+    hmac_pads(&inner, &outer, password, password_len);
+
+    for (uint32_t block = 1; out_len > 0; block++) {
+        unsigned char counter[4] = {
+            (unsigned char)(block >> 24), (unsigned char)(block >> 16),
+            (unsigned char)(block >> 8), (unsigned char)block
+        };
+        unsigned char u[32], t[32];
+
+        Sha256 ctx = inner;
+        sha256_update(&ctx, salt, salt_len);
+        sha256_update(&ctx, counter, sizeof(counter));
+        sha256_final(&ctx, u);
+        ctx = outer;
+        sha256_update(&ctx, u, sizeof(u));
+        sha256_final(&ctx, u);
+        memcpy(t, u, sizeof(t));
+
+        for (unsigned int i = 1; i < iterations; i++) {
+            ctx = inner;
+            sha256_update(&ctx, u, sizeof(u));
+            sha256_final(&ctx, u);
+            ctx = outer;
+            sha256_update(&ctx, u, sizeof(u));
+            sha256_final(&ctx, u);
+            for (size_t j = 0; j < sizeof(t); j++) t[j] ^= u[j];
+        }
+
+        size_t n = out_len < sizeof(t) ? out_len : sizeof(t);
+        memcpy(out, t, n);
+        out += n;
+        out_len -= n;
+    }
+}
+
+/* Unpadded base64url, safe in cookies */
+static void base64url(const unsigned char* data, size_t len, char* out) {
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+    unsigned int bits = 0;
+    int held = 0;
+    for (size_t i = 0; i < len; i++) {
+        bits = (bits << 8) | data[i];
+        held += 8;
+        while (held >= 6) {
+            held -= 6;
+            *out++ = alphabet[(bits >> held) & 63];
+        }
+    }
+    if (held > 0) *out++ = alphabet[(bits << (6 - held)) & 63];
+    *out = '\0';
+}
+
+/* Write the key set through a temporary file readable only by the server */
+static void save_keys(void) {
+    char tmp[MAX_PATH_LEN];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", KEYS_FILE);
+
+#if defined(_WIN32)
+    FILE* fp = fopen(tmp, "wb");
+#else
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    FILE* fp = fd >= 0 ? fdopen(fd, "wb") : NULL;
+#endif
+    if (!fp) {
+        log_message(LOG_ERROR, "Failed to save session signing keys");
+        return;
+    }
+
+    int ok = 1;
+    for (int i = 0; i < TOKEN_KEYS; i++) {
+        if (g_keys[i].record.kid != 0) {
+            ok = ok && fwrite(&g_keys[i].record, sizeof(KeyRecord), 1, fp) == 1;
+        }
+    }
+    if (fclose(fp) != 0) ok = 0;
+
+#if defined(_WIN32)
+    if (ok && !MoveFileExA(tmp, KEYS_FILE, MOVEFILE_REPLACE_EXISTING)) ok = 0;
+#else
+    if (ok && rename(tmp, KEYS_FILE) != 0) ok = 0;
+#endif
+    if (!ok) {
+        remove(tmp);
+        log_message(LOG_ERROR, "Failed to save session signing keys");
+    }
+}
+
+/* Start signing with a fresh key (caller holds g_key_lock for writing) */
+static int rotate_key(time_t now) {
+    SigningKey key;
+    memset(&key, 0, sizeof(key));
+    key.record.kid = g_current_kid + 1;
+    key.record.created_at = (int64_t)now;
+    if (random_bytes(key.record.secret, sizeof(key.record.secret)) < 0) {
+        log_message(LOG_ERROR, "No random source for session signing keys");
+        return -1;
+    }
+    hmac_setup(&key);
+
+    g_keys[key.record.kid % TOKEN_KEYS] = key;
+    g_current_kid = key.record.kid;
+    save_keys();
+
+    log_message(LOG_INFO, "Session signing key %u in use", g_current_kid);
+    return 0;
+}
+
+/* Tokens of a key can be verified until the last one signed with it expires */
+static int key_usable(const SigningKey* key, uint32_t kid, time_t now) {
+    return key->record.kid == kid &&
+           (int64_t)now < key->record.created_at + SESSION_KEY_ROTATE_SECONDS + SESSION_TIMEOUT;
+}
+
+/* Find a revoked MAC's bucket, or the empty bucket where it would go (caller holds g_revoked_lock) */
+static Revoked* revoked_slot(Revoked* table, int size, const unsigned char* mac) {
+    unsigned int i;
+    memcpy(&i, mac, sizeof(i));   /* MACs are uniformly random */
+    for (;; i++) {
+        Revoked* r = &table[i & (size - 1)];
+        if (r->expires_at == 0 || memcmp(r->mac, mac, TOKEN_MAC_BYTES) == 0) return r;
+    }
+}
+
+/* Add a revoked MAC, growing the set without expired entries when half full */
+static int revoked_add(const unsigned char* mac, int64_t expires_at, time_t now) {
+    if ((g_revoked_count + 1) * 2 > g_revoked_size) {
+        int live = 0;
+        for (int i = 0; i < g_revoked_size; i++) {
+            if (g_revoked[i].expires_at > (int64_t)now) live++;
+        }
+        int size = 64;
+        while (size < (live + 1) * 4) size *= 2;
+
+        Revoked* table = calloc(size, sizeof(Revoked));
+        if (!table) return -1;
+        for (int i = 0; i < g_revoked_size; i++) {
+            if (g_revoked[i].expires_at > (int64_t)now) {
+                *revoked_slot(table, size, g_revoked[i].mac) = g_revoked[i];
+            }
+        }
+        free(g_revoked);
+        g_revoked = table;
+        g_revoked_size = size;
+        g_revoked_count = live;
+    }
+
+    Revoked* r = revoked_slot(g_revoked, g_revoked_size, mac);
+    if (r->expires_at == 0) g_revoked_count++;
+    memcpy(r->mac, mac, TOKEN_MAC_BYTES);
+    r->expires_at = expires_at;
+    return 0;
+}
+
+/* Load the denylist, rewrite it without expired entries, and keep it open for appends */
+static void load_revoked(time_t now) {
+    FILE* fp = fopen(REVOKED_FILE, "rb");
+    if (fp) {
+        Revoked r;
+        while (fread(&r, sizeof(r), 1, fp) == 1) {
+            if (r.expires_at > (int64_t)now) revoked_add(r.mac, r.expires_at, now);
+        }
+        fclose(fp);
+    }
+
+    char tmp[MAX_PATH_LEN];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", REVOKED_FILE);
+    fp = fopen(tmp, "wb");
+    if (!fp) return;
+
+    int ok = 1;
+    for (int i = 0; i < g_revoked_size; i++) {
+        if (g_revoked[i].expires_at > (int64_t)now) {
+            ok = ok && fwrite(&g_revoked[i], sizeof(Revoked), 1, fp) == 1;
+        }
+    }
+    if (fclose(fp) != 0) ok = 0;
+
+#if defined(_WIN32)
+    if (ok && !MoveFileExA(tmp, REVOKED_FILE, MOVEFILE_REPLACE_EXISTING)) ok = 0;
+#else
+    if (ok && rename(tmp, REVOKED_FILE) != 0) ok = 0;
+#endif
+    if (!ok) remove(tmp);
+
+    g_revoked_file = fopen(REVOKED_FILE, "ab");
+}
+
+/* Load the signing keys and the denylist */
+void token_init(void) {
+    if (!SESSION_SIGNED_TOKENS) return;
+
+    RWLOCK_INIT(&g_key_lock);
+    RWLOCK_INIT(&g_revoked_lock);
+    time_t now = time(NULL);
+
+    FILE* fp = fopen(KEYS_FILE, "rb");
+    if (fp) {
+        KeyRecord record;
+        while (fread(&record, sizeof(record), 1, fp) == 1) {
+            if (record.kid == 0) continue;
+            SigningKey* key = &g_keys[record.kid % TOKEN_KEYS];
+            if (record.kid < key->record.kid) continue;
+            key->record = record;
+            hmac_setup(key);
+            if (record.kid > g_current_kid) g_current_kid = record.kid;
+        }
+        fclose(fp);
+    }
+
+    SigningKey* current = &g_keys[g_current_kid % TOKEN_KEYS];
+    if (g_current_kid == 0 || now - (time_t)current->record.created_at >= SESSION_KEY_ROTATE_SECONDS) {
+        rotate_key(now);
+    }
+
+    load_revoked(now);
+    log_message(LOG_INFO, "Signed session tokens enabled (key %u, %d revoked)", g_current_kid, g_revoked_count);
+}
+
+/* Sign the text of a token and append ".<mac>"; returns 0, or -1 if it doesn't fit */
+static int sign_token(const SigningKey* key, char* token, size_t size, unsigned char* mac) {
+    size_t len = strlen(token);
+    char encoded[32];
+
+    hmac(key, token, len, mac);
+    base64url(mac, TOKEN_MAC_BYTES, encoded);
+    return snprintf(token + len, size - len, ".%s", encoded) < (int)(size - len) ? 0 : -1;
+}
+
+/*
+ * Issue a token for a user: "<kid>.<user_id>.<expires>.<nonce>.<mac>".
+ * The nonce keeps tokens from two logins in the same second distinct, so
+ * revoking one leaves the other.
+ */
+int token_create(int user_id, char* token, size_t size) {
+    time_t now = time(NULL);
+    SigningKey key;
+
+    READ_LOCK(&g_key_lock);
+    key = g_keys[g_current_kid % TOKEN_KEYS];
+    READ_UNLOCK(&g_key_lock);
+
+    if (key.record.kid == 0 || now - (time_t)key.record.created_at >= SESSION_KEY_ROTATE_SECONDS) {
+        WRITE_LOCK(&g_key_lock);
+        SigningKey* current = &g_keys[g_current_kid % TOKEN_KEYS];
+        if (g_current_kid == 0 || now - (time_t)current->record.created_at >= SESSION_KEY_ROTATE_SECONDS) {
+            rotate_key(now);
+        }
+        key = g_keys[g_current_kid % TOKEN_KEYS];
+        WRITE_UNLOCK(&g_key_lock);
+        if (key.record.kid == 0) return -1;
+    }
+
+    unsigned char nonce[TOKEN_NONCE_BYTES];
+    char encoded[16];
+    if (random_bytes(nonce, sizeof(nonce)) < 0) return -1;
+    base64url(nonce, sizeof(nonce), encoded);
+
+    unsigned char mac[TOKEN_MAC_BYTES];
+    snprintf(token, size, "%u.%d.%lld.%s", key.record.kid, user_id,
+             (long long)(now + SESSION_TIMEOUT), encoded);
+    return sign_token(&key, token, size, mac);
+}
+
+/* Check a token's MAC and expiry; returns its user id and fills the MAC, 0 if invalid */
+static int check_token(const char* token, unsigned char* mac, long long* expires) {
+    const char* sep = strrchr(token, '.');
+    if (!sep || sep - token >= 96 || strlen(sep + 1) != (TOKEN_MAC_BYTES * 4 + 2) / 3) return 0;
+
+    unsigned int kid;
+    int user_id;
+    if (sscanf(token, "%u.%d.%lld.", &kid, &user_id, expires) != 3 || user_id <= 0) return 0;
+
+    time_t now = time(NULL);
+    if (*expires <= (long long)now) return 0;
+
+    SigningKey key;
+    READ_LOCK(&g_key_lock);
+    key = g_keys[kid % TOKEN_KEYS];
+    READ_UNLOCK(&g_key_lock);
+    if (!key_usable(&key, kid, now)) return 0;
+
+    char expected[128];
+    memcpy(expected, token, sep - token);
+    expected[sep - token] = '\0';
+    if (sign_token(&key, expected, sizeof(expected), mac) < 0) return 0;
+
+    /* Compare in constant time */
+    unsigned char diff = 0;
+    const char* given = sep + 1;
+    const char* computed = expected + (sep - token) + 1;
+    for (int i = 0; computed[i]; i++) diff |= (unsigned char)(given[i] ^ computed[i]);
+    return diff == 0 ? user_id : 0;
+}
+
+/* Validate a token; returns its user id, 0 if invalid, expired or revoked */
+int token_verify(const char* token) {
+    if (!token || !*token) return 0;
+
+    unsigned char mac[TOKEN_MAC_BYTES];
+    long long expires;
+    int user_id = check_token(token, mac, &expires);
+    if (user_id <= 0) return 0;
+
+    READ_LOCK(&g_revoked_lock);
+    int revoked = g_revoked_size > 0 && revoked_slot(g_revoked, g_revoked_size, mac)->expires_at != 0;
+    READ_UNLOCK(&g_revoked_lock);
+
+    return revoked ? 0 : user_id;
+}
+
+/* Deny a token until it expires; only valid tokens are recorded */
+void token_revoke(const char* token) {
+    if (!token || !*token) return;
+
+    unsigned char mac[TOKEN_MAC_BYTES];
+    long long expires;
+    if (check_token(token, mac, &expires) <= 0) return;
+
+    WRITE_LOCK(&g_revoked_lock);
+    if (revoked_add(mac, (int64_t)expires, time(NULL)) == 0 && g_revoked_file) {
+        Revoked r;
+        memcpy(r.mac, mac, TOKEN_MAC_BYTES);
+        r.expires_at = (int64_t)expires;
+        fwrite(&r, sizeof(r), 1, g_revoked_file);
+        fflush(g_revoked_file);
+    }
+    WRITE_UNLOCK(&g_revoked_lock);
+}
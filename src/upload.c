@@ -0,0 +1,689 @@
+/*
+ * OTT Video Streaming Server - Resumable Uploads
+ * tus-style uploads for new titles. A client creates an upload with its
+ * total length, then sends the body with PATCH requests at chunk-aligned
+ * offsets, several in parallel if it likes. Bodies are written straight
+ * into a file preallocated on the chosen storage root. Progress is kept
+ * per UPLOAD_CHUNK_MB chunk in a sidecar file, so an interrupted upload
+ * resumes from the last whole chunk, even across restarts. When the last
+ * chunk lands the file moves into the library and a probe thread rewrites
+ * it for streaming, adds it to the catalog and makes its thumbnails.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+    #define _GNU_SOURCE
+#endif
+
+#include "common.h"
+
+#if defined(_WIN32)
+    #include <io.h>
+    #include <fcntl.h>
+    #include <sys/stat.h>
+    #define strcasecmp _stricmp
+#endif
+
+#define MAX_UPLOADS 16
+#define UPLOAD_ID_LEN 32
+#define UPLOAD_DIR ".uploads"
+#define UPLOAD_CHUNK_SIZE ((long long)UPLOAD_CHUNK_MB * 1024 * 1024)
+#define UPLOAD_BUFFER_SIZE (256 * 1024)
+#define MAX_PROBE_JOBS MAX_UPLOADS   /* a finishing upload keeps its slot until probed */
+
+/* Uploads untouched for this long are dropped to make room for new ones */
+#define UPLOAD_EXPIRE_SECONDS (24 * 3600)
+
+enum { CHUNK_EMPTY = 0, CHUNK_WRITING = 1, CHUNK_DONE = 2 };
+
+typedef struct {
+    char id[UPLOAD_ID_LEN + 1];
+    char filename[256];
+    char dir[MAX_PATH_LEN];   /* storage root receiving the file */
+    int user_id;
+    long long length;
+    int chunk_count;
+    unsigned char* chunks;
+    int writers;              /* PATCH requests in progress, or 1 while finishing */
+    int video_id;             /* catalog id once the title is added */
+    time_t last_active;
+    int in_use;
+} Upload;
+
+typedef struct {
+    Upload* upload;
+    char path[MAX_PATH_LEN];
+    char filename[256];
+    char basename[256];
+} ProbeJob;
+
+static Upload g_uploads[MAX_UPLOADS];
+static pthread_mutex_t g_upload_mutex;
+static ProbeJob g_probe_jobs[MAX_PROBE_JOBS];
+static int g_probe_head = 0;
+static int g_probe_count = 0;
+static pthread_cond_t g_probe_cond;
+static long long g_uploaded_bytes = 0;
+static int g_completed = 0;
+
+extern int storage_root_count(void);
+extern const char* storage_root_path(int index);
+extern int storage_place(long long size, char* dir, size_t dir_size);
+extern int storage_resolve(const char* filename, char* path, size_t path_size);
+extern int mp4_faststart_ingest(const char* video_path, const char* filename);
+extern int ffmpeg_check_available(void);
+extern int ffmpeg_get_duration(const char* video_path);
+extern int ffmpeg_extract_thumbnail(const char* video_path, const char* output_path, int timestamp_sec);
+extern int ffmpeg_generate_trickplay(const char* video_path, const char* basename, int duration_sec);
+extern int video_add(const char* title, const char* filename, const char* thumbnail, int duration,
+                     const char* description);
+extern int video_set_duration(int id, int duration);
+
+/* An empty path if it doesn't fit, which every open, rename and remove rejects */
+static void upload_path(const Upload* u, const char* ext, char* path, size_t size) {
+    if (snprintf(path, size, "%s/%s/%s.%s", u->dir, UPLOAD_DIR, u->id, ext) >= (int)size) {
+        path[0] = '\0';
+    }
+}
+
+static int open_for_write(const char* path, int create) {
+#if defined(_WIN32)
+    return _open(path, _O_WRONLY | _O_BINARY | (create ? _O_CREAT | _O_TRUNC : 0),
+                 _S_IREAD | _S_IWRITE);
+#else
+    return open(path, O_WRONLY | (create ? O_CREAT | O_TRUNC : 0), 0644);
+#endif
+}
+
+static void close_file(int fd) {
+#if defined(_WIN32)
+    _close(fd);
+#else
+    close(fd);
+#endif
+}
+
+/* Reserve the whole file up front so it is laid out contiguously and can't run out of space */
+static int preallocate(int fd, long long length) {
+#if defined(_WIN32)
+    LARGE_INTEGER size;
+    size.QuadPart = length;
+    HANDLE h = (HANDLE)_get_osfhandle(fd);
+    return SetFilePointerEx(h, size, NULL, FILE_BEGIN) && SetEndOfFile(h) ? 0 : -1;
+#else
+#if defined(__linux__)
+    if (fallocate(fd, 0, 0, (off_t)length) == 0) return 0;
+    if (errno != EOPNOTSUPP) return -1;
+#endif
+    return ftruncate(fd, (off_t)length);
+#endif
+}
+
+static int write_at(int fd, const char* buf, long length, long long offset) {
+#if defined(_WIN32)
+    HANDLE h = (HANDLE)_get_osfhandle(fd);
+    while (length > 0) {
+        OVERLAPPED ov;
+        DWORD n = 0;
+        memset(&ov, 0, sizeof(ov));
+        ov.Offset = (DWORD)(offset & 0xFFFFFFFF);
+        ov.OffsetHigh = (DWORD)(offset >> 32);
+        if (!WriteFile(h, buf, (DWORD)length, &n, &ov) || n == 0) return -1;
+        buf += n;
+        length -= n;
+        offset += n;
+    }
+#else
+    while (length > 0) {
+        ssize_t n = pwrite(fd, buf, (size_t)length, (off_t)offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        length -= (long)n;
+        offset += n;
+    }
+#endif
+    return 0;
+}
+
+/* Flush a descriptor's data to stable storage */
+static int sync_fd(int fd) {
+#if defined(_WIN32)
+    return _commit(fd);
+#elif defined(__linux__)
+    return fdatasync(fd);
+#else
+    return fsync(fd);
+#endif
+}
+
+/* Flush a file to stable storage */
+static int sync_file(FILE* fp) {
+    if (fflush(fp) != 0) return -1;
+#if defined(_WIN32)
+    return sync_fd(_fileno(fp));
+#else
+    return sync_fd(fileno(fp));
+#endif
+}
+
+/*
+ * Persist an upload's progress: "length user_id", the filename on a line
+ * of its own, then one digit per chunk. Written to a temporary file and
+ * renamed over the old one, so a crash leaves one or the other intact.
+ */
+static void save_info(const Upload* u) {
+    char path[MAX_PATH_LEN];
+    char tmp[MAX_PATH_LEN];
+    upload_path(u, "info", path, sizeof(path));
+    upload_path(u, "info.tmp", tmp, sizeof(tmp));
+
+    FILE* fp = fopen(tmp, "w");
+    if (!fp) return;
+
+    fprintf(fp, "%lld %d\n%s\n", u->length, u->user_id, u->filename);
+    for (int i = 0; i < u->chunk_count; i++) {
+        fputc(u->chunks[i] == CHUNK_DONE ? '1' : '0', fp);
+    }
+    fputc('\n', fp);
+    int ok = !ferror(fp) && sync_file(fp) == 0;
+    if (fclose(fp) != 0) ok = 0;
+
+#if defined(_WIN32)
+    if (ok && !MoveFileExA(tmp, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) ok = 0;
+#else
+    if (ok && rename(tmp, path) != 0) ok = 0;
+#endif
+    if (!ok) {
+        log_message(LOG_WARN, "Cannot save progress of upload %s", u->id);
+        remove(tmp);
+    }
+}
+
+static void remove_files(const Upload* u) {
+    char path[MAX_PATH_LEN];
+    upload_path(u, "part", path, sizeof(path));
+    remove(path);
+    upload_path(u, "info", path, sizeof(path));
+    remove(path);
+    upload_path(u, "info.tmp", path, sizeof(path));
+    remove(path);
+}
+
+static void free_upload(Upload* u) {
+    free(u->chunks);
+    memset(u, 0, sizeof(Upload));
+}
+
+/* Claim a free slot, dropping an expired upload if needed (caller holds lock) */
+static Upload* claim_slot(void) {
+    time_t now = time(NULL);
+    for (int i = 0; i < MAX_UPLOADS; i++) {
+        if (!g_uploads[i].in_use) return &g_uploads[i];
+    }
+    for (int i = 0; i < MAX_UPLOADS; i++) {
+        Upload* u = &g_uploads[i];
+        if (u->writers == 0 && (u->video_id > 0 || difftime(now, u->last_active) > UPLOAD_EXPIRE_SECONDS)) {
+            log_message(LOG_INFO, "Upload %s expired", u->id);
+            remove_files(u);
+            free_upload(u);
+            return u;
+        }
+    }
+    return NULL;
+}
+
+static Upload* find_upload(const char* id, int user_id) {
+    for (int i = 0; i < MAX_UPLOADS; i++) {
+        Upload* u = &g_uploads[i];
+        if (u->in_use && strcmp(u->id, id) == 0 && u->user_id == user_id) return u;
+    }
+    return NULL;
+}
+
+/* Bytes received contiguously from the start (caller holds lock) */
+static long long contiguous_offset(const Upload* u) {
+    int done = 0;
+    while (done < u->chunk_count && u->chunks[done] == CHUNK_DONE) done++;
+
+    long long offset = done * UPLOAD_CHUNK_SIZE;
+    return offset < u->length ? offset : u->length;
+}
+
+/* Reload unfinished uploads left under one storage root */
+static void load_root(const char* root) {
+    char dir_path[MAX_PATH_LEN];
+    snprintf(dir_path, sizeof(dir_path), "%s/%s", root, UPLOAD_DIR);
+
+#if defined(_WIN32)
+    CreateDirectoryA(dir_path, NULL);
+
+    WIN32_FIND_DATAA fd;
+    char search_path[MAX_PATH_LEN];
+    snprintf(search_path, sizeof(search_path), "%s\\*.info", dir_path);
+    HANDLE hFind = FindFirstFileA(search_path, &fd);
+    if (hFind == INVALID_HANDLE_VALUE) return;
+    do {
+        const char* name = fd.cFileName;
+#else
+    mkdir(dir_path, 0755);
+
+    DIR* dir = opendir(dir_path);
+    if (!dir) return;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char* name = entry->d_name;
+#endif
+        const char* ext = strrchr(name, '.');
+        if (!ext || strcmp(ext, ".info") != 0 || ext - name != UPLOAD_ID_LEN) continue;
+
+        char path[MAX_PATH_LEN];
+        if (snprintf(path, sizeof(path), "%s/%s", dir_path, name) >= (int)sizeof(path)) continue;
+        FILE* fp = fopen(path, "r");
+        if (!fp) continue;
+
+        /* The filename may contain spaces, so it has a line to itself */
+        Upload* u = claim_slot();
+        if (u && fscanf(fp, "%lld %d", &u->length, &u->user_id) == 2 && u->length > 0 &&
+            fgetc(fp) == '\n' && fgets(u->filename, sizeof(u->filename), fp) &&
+            u->filename[0] != '\n' && strchr(u->filename, '\n')) {
+            *strchr(u->filename, '\n') = '\0';
+            memcpy(u->id, name, UPLOAD_ID_LEN);
+            snprintf(u->dir, sizeof(u->dir), "%s", root);
+            u->chunk_count = (int)((u->length + UPLOAD_CHUNK_SIZE - 1) / UPLOAD_CHUNK_SIZE);
+            u->chunks = calloc(u->chunk_count, 1);
+
+            for (int i = 0; u->chunks && i < u->chunk_count; i++) {
+                if (fgetc(fp) == '1') u->chunks[i] = CHUNK_DONE;
+            }
+            u->last_active = time(NULL);
+            u->in_use = u->chunks != NULL;
+        } else if (u) {
+            memset(u, 0, sizeof(Upload));
+        }
+        fclose(fp);
+#if defined(_WIN32)
+    } while (FindNextFileA(hFind, &fd));
+    FindClose(hFind);
+#else
+    }
+    closedir(dir);
+#endif
+}
+
+/*
+ * Register uploaded titles one at a time: rewrite the file to faststart
+ * layout, add it to the catalog, then probe its duration and generate
+ * thumbnails.
+ */
+#if defined(_WIN32)
+static unsigned __stdcall probe_worker(void* arg) {
+#else
+static void* probe_worker(void* arg) {
+#endif
+    (void)arg;
+
+    for (;;) {
+        pthread_mutex_lock(&g_upload_mutex);
+        while (g_probe_count == 0) {
+            pthread_cond_wait(&g_probe_cond, &g_upload_mutex);
+        }
+        ProbeJob job = g_probe_jobs[g_probe_head];
+        g_probe_head = (g_probe_head + 1) % MAX_PROBE_JOBS;
+        g_probe_count--;
+        pthread_mutex_unlock(&g_upload_mutex);
+
+        /* Rewrite before anyone can stream it, so cached offsets stay valid */
+        mp4_faststart_ingest(job.path, job.filename);
+
+        char title[256];
+        strcpy(title, job.basename);
+        for (char* p = title; *p; p++) {
+            if (*p == '_') *p = ' ';
+        }
+
+        char thumb_relative[300];
+        snprintf(thumb_relative, sizeof(thumb_relative), "thumbnails/%s.jpg", job.basename);
+
+        int video_id = video_add(title, job.filename, thumb_relative, 0, "");
+
+        pthread_mutex_lock(&g_upload_mutex);
+        Upload* u = job.upload;
+        remove_files(u);
+        if (video_id > 0) {
+            log_message(LOG_INFO, "Upload %s complete: added video %d (%s)", u->id, video_id, title);
+            u->video_id = video_id;
+            u->writers = 0;
+            u->last_active = time(NULL);
+            g_completed++;
+        } else {
+            /* Every chunk is in, so nothing would finish it again */
+            log_message(LOG_ERROR, "Upload %s could not be added to the library", u->id);
+            remove(job.path);
+            free_upload(u);
+        }
+        pthread_mutex_unlock(&g_upload_mutex);
+
+        if (video_id <= 0 || !ffmpeg_check_available()) continue;
+
+        int duration = ffmpeg_get_duration(job.path);
+        if (duration > 0) video_set_duration(video_id, duration);
+
+        char thumb_path[MAX_PATH_LEN];
+        snprintf(thumb_path, sizeof(thumb_path), "%s/%s.jpg", THUMBNAIL_DIR, job.basename);
+        ffmpeg_extract_thumbnail(job.path, thumb_path, 10);
+        ffmpeg_generate_trickplay(job.path, job.basename, duration);
+    }
+
+#if defined(_WIN32)
+    return 0;
+#else
+    return NULL;
+#endif
+}
+
+/* Reload unfinished uploads and start the probe thread */
+void upload_init(void) {
+    pthread_mutex_init(&g_upload_mutex, NULL);
+    pthread_cond_init(&g_probe_cond, NULL);
+    memset(g_uploads, 0, sizeof(g_uploads));
+
+    for (int i = 0; i < storage_root_count(); i++) {
+        load_root(storage_root_path(i));
+    }
+
+#if defined(_WIN32)
+    HANDLE h = (HANDLE)_beginthreadex(NULL, 0, probe_worker, NULL, 0, NULL);
+    if (h) CloseHandle(h);
+#else
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, probe_worker, NULL) == 0) {
+        pthread_detach(thread);
+    }
+#endif
+
+    int pending = 0;
+    for (int i = 0; i < MAX_UPLOADS; i++) pending += g_uploads[i].in_use;
+    if (pending > 0) {
+        log_message(LOG_INFO, "Resuming %d unfinished uploads", pending);
+    }
+}
+
+/*
+ * Is a name acceptable for a new title: a .mp4 filename of letters,
+ * digits, '.', '_', '-' and spaces, not starting with '.' or '-' and
+ * not already taken.
+ */
+static int valid_new_name(const char* filename) {
+    size_t len = strlen(filename);
+    if (len < 5 || len >= 256 || strcasecmp(filename + len - 4, ".mp4") != 0) return 0;
+    if (filename[0] == '.' || filename[0] == '-') return 0;
+    if (strspn(filename, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789._ -") != len) {
+        return 0;
+    }
+
+    char path[MAX_PATH_LEN];
+    if (storage_resolve(filename, path, sizeof(path)) >= 0) return 0;
+
+    for (int i = 0; i < MAX_UPLOADS; i++) {
+        if (g_uploads[i].in_use && strcmp(g_uploads[i].filename, filename) == 0) return 0;
+    }
+    return 1;
+}
+
+/*
+ * Start an upload of length bytes for a new title. Writes the upload id
+ * (UPLOAD_ID_LEN + 1 bytes). Returns 0, -1 on failure, or -2 if the name
+ * is invalid or already taken.
+ */
+int upload_create(int user_id, const char* filename, long long length, char* id) {
+    if (length <= 0) return -1;
+
+    char dir[MAX_PATH_LEN];
+    if (storage_place(length, dir, sizeof(dir)) < 0) return -1;
+
+    pthread_mutex_lock(&g_upload_mutex);
+
+    if (!valid_new_name(filename)) {
+        pthread_mutex_unlock(&g_upload_mutex);
+        return -2;
+    }
+
+    Upload* u = claim_slot();
+    int chunk_count = (int)((length + UPLOAD_CHUNK_SIZE - 1) / UPLOAD_CHUNK_SIZE);
+    unsigned char* chunks = u ? calloc(chunk_count, 1) : NULL;
+    if (!chunks) {
+        pthread_mutex_unlock(&g_upload_mutex);
+        return -1;
+    }
+
+    generate_session_token(u->id, sizeof(u->id));
+    snprintf(u->filename, sizeof(u->filename), "%s", filename);
+    snprintf(u->dir, sizeof(u->dir), "%s", dir);
+    u->user_id = user_id;
+    u->length = length;
+    u->chunk_count = chunk_count;
+    u->chunks = chunks;
+    u->last_active = time(NULL);
+    u->writers = 1;   /* keep the slot while the file is created */
+    u->in_use = 1;
+    strcpy(id, u->id);
+    pthread_mutex_unlock(&g_upload_mutex);
+
+    char path[MAX_PATH_LEN];
+    upload_path(u, "part", path, sizeof(path));
+    int fd = open_for_write(path, 1);
+    int ok = fd >= 0 && preallocate(fd, length) == 0;
+    if (fd >= 0) close_file(fd);
+
+    pthread_mutex_lock(&g_upload_mutex);
+    u->writers = 0;
+    if (ok) {
+        save_info(u);
+    } else {
+        log_message(LOG_WARN, "Cannot preallocate %lld bytes for upload %s", length, path);
+        remove_files(u);
+        free_upload(u);
+    }
+    pthread_mutex_unlock(&g_upload_mutex);
+
+    if (!ok) return -1;
+
+    log_message(LOG_INFO, "Upload %s started: %s (%lld bytes) on %s", id, filename, length, dir);
+    return 0;
+}
+
+/*
+ * Report an upload's resume offset and total length, and the catalog id
+ * once the finished title has been added (0 until then); -1 if unknown.
+ */
+int upload_offset(const char* id, int user_id, long long* offset, long long* length, int* video_id) {
+    pthread_mutex_lock(&g_upload_mutex);
+    Upload* u = find_upload(id, user_id);
+    if (u) {
+        *offset = contiguous_offset(u);
+        *length = u->length;
+        *video_id = u->video_id;
+    }
+    pthread_mutex_unlock(&g_upload_mutex);
+    return u ? 0 : -1;
+}
+
+/* Abandon an upload; -1 if unknown or still receiving data */
+int upload_cancel(const char* id, int user_id) {
+    pthread_mutex_lock(&g_upload_mutex);
+    Upload* u = find_upload(id, user_id);
+    int ok = u && u->writers == 0;
+    if (ok) {
+        remove_files(u);
+        free_upload(u);
+    }
+    pthread_mutex_unlock(&g_upload_mutex);
+    return ok ? 0 : -1;
+}
+
+/*
+ * Move a finished file into the library and queue it for the probe thread,
+ * which adds it to the catalog. The caller keeps the upload claimed until
+ * then. Returns 0, or -1 if the file could not be moved.
+ */
+static int finish_upload(Upload* u) {
+    char part_path[MAX_PATH_LEN];
+    char video_path[MAX_PATH_LEN];
+    upload_path(u, "part", part_path, sizeof(part_path));
+    if (snprintf(video_path, sizeof(video_path), "%s/%s", u->dir, u->filename) >= (int)sizeof(video_path)) {
+        return -1;
+    }
+
+#if defined(_WIN32)
+    if (!MoveFileExA(part_path, video_path, 0)) return -1;
+#else
+    if (rename(part_path, video_path) != 0) return -1;
+#endif
+
+    pthread_mutex_lock(&g_upload_mutex);
+    ProbeJob* job = &g_probe_jobs[(g_probe_head + g_probe_count) % MAX_PROBE_JOBS];
+    job->upload = u;
+    strcpy(job->path, video_path);
+    strcpy(job->filename, u->filename);
+    strcpy(job->basename, u->filename);
+    char* ext = strrchr(job->basename, '.');
+    if (ext) *ext = '\0';
+    g_probe_count++;
+    pthread_cond_signal(&g_probe_cond);
+    pthread_mutex_unlock(&g_upload_mutex);
+
+    return 0;
+}
+
+/*
+ * Receive a PATCH body of content_length bytes at offset, streaming it from
+ * the socket into the upload's file. The offset must start a chunk and the
+ * body must end on a chunk boundary or at the end of the file; chunks being
+ * written by another request are refused. prefix holds body bytes that came
+ * with the headers. On return *new_offset is the resume offset.
+ * Returns 0, -1 for an unknown upload, -2 for a bad or overlapping range,
+ * or -3 if the body was cut short or could not be written.
+ */
+int upload_write(SOCKET client, const char* id, int user_id, long long offset,
+                 long long content_length, const char* prefix, int prefix_len,
+                 long long* new_offset) {
+    pthread_mutex_lock(&g_upload_mutex);
+    Upload* u = find_upload(id, user_id);
+    if (!u) {
+        pthread_mutex_unlock(&g_upload_mutex);
+        return -1;
+    }
+
+    long long end = offset + content_length;
+    int first = (int)(offset / UPLOAD_CHUNK_SIZE);
+    int last = (int)((end - 1) / UPLOAD_CHUNK_SIZE);
+    int valid = content_length > 0 && offset % UPLOAD_CHUNK_SIZE == 0 && end <= u->length &&
+                (end == u->length || end % UPLOAD_CHUNK_SIZE == 0);
+    for (int i = first; valid && i <= last; i++) {
+        if (u->chunks[i] != CHUNK_EMPTY) valid = 0;
+    }
+    if (!valid) {
+        *new_offset = contiguous_offset(u);
+        pthread_mutex_unlock(&g_upload_mutex);
+        return -2;
+    }
+
+    for (int i = first; i <= last; i++) u->chunks[i] = CHUNK_WRITING;
+    u->writers++;
+    u->last_active = time(NULL);
+    pthread_mutex_unlock(&g_upload_mutex);
+
+    char path[MAX_PATH_LEN];
+    upload_path(u, "part", path, sizeof(path));
+    int fd = open_for_write(path, 0);
+    char* buffer = malloc(UPLOAD_BUFFER_SIZE);
+
+    long long pos = offset;
+    int chunk = first;
+    int ok = fd >= 0 && buffer != NULL;
+
+    if (ok && prefix_len > 0) {
+        long n = prefix_len < content_length ? prefix_len : (long)content_length;
+        ok = write_at(fd, prefix, n, pos) == 0;
+        pos += n;
+        ATOMIC_ADD64(&g_uploaded_bytes, n);
+    }
+
+    while (ok && pos < end) {
+        long want = end - pos < UPLOAD_BUFFER_SIZE ? (long)(end - pos) : UPLOAD_BUFFER_SIZE;
+        int n = recv(client, buffer, want, 0);
+        if (n <= 0 || write_at(fd, buffer, n, pos) != 0) {
+            ok = 0;
+            break;
+        }
+        pos += n;
+        ATOMIC_ADD64(&g_uploaded_bytes, n);
+
+        /* Record each chunk as soon as it is whole and on disk, so a later failure keeps it */
+        if (pos == end || pos >= (chunk + 1) * UPLOAD_CHUNK_SIZE) {
+            if (sync_fd(fd) != 0) {
+                ok = 0;
+                break;
+            }
+            pthread_mutex_lock(&g_upload_mutex);
+            while (chunk <= last && (pos == end || pos >= (chunk + 1) * UPLOAD_CHUNK_SIZE)) {
+                u->chunks[chunk++] = CHUNK_DONE;
+            }
+            save_info(u);
+            pthread_mutex_unlock(&g_upload_mutex);
+        }
+    }
+    if (ok && chunk <= last) {
+        /* The whole body arrived with the headers */
+        ok = sync_fd(fd) == 0;
+        if (ok) {
+            pthread_mutex_lock(&g_upload_mutex);
+            while (chunk <= last) u->chunks[chunk++] = CHUNK_DONE;
+            save_info(u);
+            pthread_mutex_unlock(&g_upload_mutex);
+        }
+    }
+
+    free(buffer);
+    if (fd >= 0) close_file(fd);
+
+    pthread_mutex_lock(&g_upload_mutex);
+    for (int i = chunk; i <= last; i++) u->chunks[i] = CHUNK_EMPTY;
+    u->writers--;
+    u->last_active = time(NULL);
+
+    int complete = u->writers == 0;
+    for (int i = 0; complete && i < u->chunk_count; i++) {
+        if (u->chunks[i] != CHUNK_DONE) complete = 0;
+    }
+    if (complete) u->writers = 1;   /* no one else finishes or cancels it */
+    *new_offset = contiguous_offset(u);
+    pthread_mutex_unlock(&g_upload_mutex);
+
+    if (complete && finish_upload(u) < 0) {
+        log_message(LOG_ERROR, "Upload %s could not be moved into the library", u->id);
+        pthread_mutex_lock(&g_upload_mutex);
+        u->writers = 0;
+        pthread_mutex_unlock(&g_upload_mutex);
+    }
+
+    return ok ? 0 : -3;
+}
+
+/* Write upload metrics as a JSON object */
+int upload_stats_json(char* buf, size_t size) {
+    int active = 0;
+    int probes;
+
+    pthread_mutex_lock(&g_upload_mutex);
+    for (int i = 0; i < MAX_UPLOADS; i++) active += g_uploads[i].in_use;
+    probes = g_probe_count;
+    int completed = g_completed;
+    pthread_mutex_unlock(&g_upload_mutex);
+
+    return snprintf(buf, size,
+        "{\"active\":%d,\"completed\":%d,\"bytes\":%lld,\"probes_queued\":%d}",
+        active, completed, (long long)ATOMIC_LOAD64(&g_uploaded_bytes), probes);
+}
@@ -4,6 +4,11 @@
 
 #include "common.h"
 
+#if defined(_WIN32)
+    #include <ntsecapi.h>
+    #pragma comment(lib, "advapi32.lib")
+#endif
+
 /* Global log level */
 static LogLevel g_log_level = LOG_INFO;
 
@@ -30,6 +35,17 @@ void log_message(LogLevel level, const char* format, ...) {
     fflush(stderr);
 }
 
+/* Monotonic clock in seconds, for measuring elapsed time */
+double monotonic_seconds(void) {
+#if defined(_WIN32)
+    return GetTickCount64() / 1000.0;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
 /* Get content type from file extension */
 const char* get_content_type(const char* path) {
     const char* last_dot = strrchr(path, '.');
@@ -50,6 +66,10 @@ const char* get_content_type(const char* path) {
         if (strcmp(last_dot, ".mp3") == 0) return "audio/mpeg";
         if (strcmp(last_dot, ".wav") == 0) return "audio/wav";
         if (strcmp(last_dot, ".txt") == 0) return "text/plain";
+        if (strcmp(last_dot, ".vtt") == 0) return "text/vtt";
+        if (strcmp(last_dot, ".m3u8") == 0) return "application/vnd.apple.mpegurl";
+        if (strcmp(last_dot, ".m4s") == 0) return "video/iso.segment";
+        if (strcmp(last_dot, ".ts") == 0) return "video/mp2t";
     }
     return "application/octet-stream";
 }
@@ -107,20 +127,53 @@ char* get_query_param(const char* query, const char* name, char* value, size_t v
     return value;
 }
 
-/* Generate random session token */
-void generate_session_token(char* token, size_t len) {
-    static const char charset[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
-    static int seeded = 0;
-    
-    if (!seeded) {
-        srand((unsigned int)time(NULL) ^ (unsigned int)clock());
-        seeded = 1;
+/* Fill a buffer from the operating system's CSPRNG; safe from any thread */
+int random_bytes(void* buf, size_t len) {
+#if defined(_WIN32)
+    return RtlGenRandom(buf, (ULONG)len) ? 0 : -1;
+#else
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd < 0) return -1;
+
+    unsigned char* p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            close(fd);
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
     }
-    
-    for (size_t i = 0; i < len - 1; i++) {
-        token[i] = charset[rand() % (sizeof(charset) - 1)];
+    close(fd);
+    return 0;
+#endif
+}
+
+/* Generate random session token; returns -1 (and an empty token) without a random source */
+int generate_session_token(char* token, size_t len) {
+    static const char charset[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    unsigned char random[64];
+    size_t used = sizeof(random);
+    
+    for (size_t i = 0; i < len - 1; ) {
+        if (used == sizeof(random)) {
+            if (random_bytes(random, sizeof(random)) < 0) {
+                token[0] = '\0';
+                return -1;
+            }
+            used = 0;
+        }
+        
+        /* Reject bytes past the largest multiple of the charset size to avoid bias */
+        unsigned char r = random[used++];
+        if (r < 256 - 256 % (sizeof(charset) - 1)) {
+            token[i++] = charset[r % (sizeof(charset) - 1)];
+        }
     }
     token[len - 1] = '\0';
+    return 0;
 }
 
 /* Simple hash function for passwords (DJB2) */
@@ -140,6 +193,8 @@ int parse_http_request(const char* raw, HttpRequest* req) {
     memset(req, 0, sizeof(HttpRequest));
     req->range_start = -1;
     req->range_end = -1;
+    req->upload_length = -1;
+    req->upload_offset = -1;
     
     /* Parse request line */
     char* line_end = strstr(raw, "\r\n");
@@ -208,7 +263,18 @@ int parse_http_request(const char* raw, HttpRequest* req) {
             strncpy(req->content_type, value, sizeof(req->content_type) - 1);
         }
         else if (strncasecmp(header_line, "Content-Length:", 15) == 0) {
-            req->content_length = atoi(header_line + 15);
+            char* end;
+            req->content_length = strtoll(header_line + 15, &end, 10);
+            if (req->content_length < 0 || end == header_line + 15) return -1;
+        }
+        else if (strncasecmp(header_line, "Upload-Length:", 14) == 0) {
+            req->upload_length = atoll(header_line + 14);
+        }
+        else if (strncasecmp(header_line, "Upload-Offset:", 14) == 0) {
+            req->upload_offset = atoll(header_line + 14);
+        }
+        else if (strncasecmp(header_line, "Transfer-Encoding:", 18) == 0) {
+            req->chunked = strstr(header_line + 18, "chunked") != NULL;
         }
         else if (strncasecmp(header_line, "Range:", 6) == 0) {
             /* Parse Range: bytes=start-end */
@@ -238,9 +304,9 @@ int parse_http_request(const char* raw, HttpRequest* req) {
     /* Copy body if present */
     if (body_start && req->content_length > 0) {
         body_start += 4;
-        size_t body_len = req->content_length;
-        if (body_len >= sizeof(req->body)) {
-            body_len = sizeof(req->body) - 1;
+        size_t body_len = sizeof(req->body) - 1;
+        if (req->content_length < (long long)body_len) {
+            body_len = (size_t)req->content_length;
         }
         strncpy(req->body, body_start, body_len);
         req->body[body_len] = '\0';
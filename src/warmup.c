@@ -0,0 +1,189 @@
+/*
+ * OTT Video Streaming Server - Startup Warmup
+ * After a restart the first viewers of popular titles would hit cold
+ * disks. A background thread ranks titles by recent watch history and
+ * reads the moov box and first minutes of each into memory, within an
+ * I/O budget, while the server is already accepting connections.
+ */
+
+#include "common.h"
+
+#define WARMUP_READ_SIZE (1024 * 1024)
+
+/* Used when a title's duration (and so its bitrate) is unknown */
+#define WARMUP_DEFAULT_HEAD (8L * 1024 * 1024)
+
+static long long g_warmed_bytes = 0;
+static int g_warmed_titles = 0;
+static int g_warmup_done = 0;
+static pthread_mutex_t g_warmup_mutex;
+
+extern int history_top_videos(int days, int* video_ids, int max_count);
+extern int videos_find(const int* ids, int count, Video* videos);
+extern int tier_peek(const char* filename, char* path, size_t path_size);
+extern int storage_resolve(const char* filename, char* path, size_t path_size);
+extern int mp4_find_moov(const char* path, long long* moov_offset, long long* moov_size,
+                         long long* mdat_offset);
+extern int disk_open(const char* path, long* size, long long* dev);
+extern void disk_close(int fd);
+extern long disk_io_read(int fd, long long dev, char* buf, long length, long long offset);
+extern int disk_io_saturated(long long dev);
+extern void disk_io_background(void);
+extern int chunk_cache_get(int video_id, int rendition, int fd, long long dev, long file_size,
+                           long offset, long max_len, const char** data, long* len);
+extern void chunk_cache_release(int handle);
+extern void stream_title_seed(int video_id);
+
+/* Load [offset, offset + length) into the chunk cache; returns bytes loaded */
+static long warm_cached(int video_id, int fd, long long dev, long file_size, long offset,
+                        long length) {
+    long loaded = 0;
+    while (loaded < length) {
+        const char* data;
+        long len;
+        int handle = chunk_cache_get(video_id, 0, fd, dev, file_size, offset + loaded,
+                                     length - loaded, &data, &len);
+        if (handle < 0) break;
+        chunk_cache_release(handle);
+        loaded += len;
+    }
+    return loaded;
+}
+
+/* Read [offset, offset + length) through the page cache; returns bytes read */
+static long warm_page_cache(int fd, long long dev, char* buffer, long offset, long length) {
+    long done = 0;
+    while (done < length) {
+        /* Never compete with viewers for a busy disk */
+        while (disk_io_saturated(dev)) usleep(50000);
+
+        long want = length - done;
+        if (want > WARMUP_READ_SIZE) want = WARMUP_READ_SIZE;
+
+        long n = disk_io_read(fd, dev, buffer, want, offset + done);
+        if (n <= 0) break;
+        done += n;
+    }
+    return done;
+}
+
+/*
+ * Warm one title: the moov box goes into the chunk cache, the first
+ * WARMUP_SECONDS of playback into the page cache. Returns bytes read.
+ */
+static long long warm_title(Video* video, long long budget, char* buffer) {
+    char path[MAX_PATH_LEN];
+    if (!tier_peek(video->filename, path, sizeof(path)) &&
+        storage_resolve(video->filename, path, sizeof(path)) < 0) {
+        return 0;
+    }
+
+    long file_size;
+    long long dev;
+    int fd = disk_open(path, &file_size, &dev);
+    if (fd < 0) return 0;
+
+    long long total = 0;
+
+    long long moov_offset, moov_size, mdat_offset;
+    if (mp4_find_moov(path, &moov_offset, &moov_size, &mdat_offset) == 0 &&
+        moov_size <= budget) {
+        total += warm_cached(video->id, fd, dev, file_size, (long)moov_offset, (long)moov_size);
+    }
+
+    long head = video->duration_sec > 0
+        ? (long)((double)file_size * WARMUP_SECONDS / video->duration_sec)
+        : WARMUP_DEFAULT_HEAD;
+    if (head > file_size) head = file_size;
+    if (head > budget - total) head = (long)(budget - total);
+
+    if (head > 0) {
+        total += warm_page_cache(fd, dev, buffer, 0, head);
+    }
+
+    disk_close(fd);
+    return total;
+}
+
+#if defined(_WIN32)
+static unsigned __stdcall warmup_worker(void* arg) {
+#else
+static void* warmup_worker(void* arg) {
+#endif
+    (void)arg;
+    disk_io_background();
+    double started = monotonic_seconds();
+    long long budget = (long long)WARMUP_BUDGET_MB * 1024 * 1024;
+
+    int* ids = malloc(sizeof(int) * WARMUP_TITLES);
+    Video* videos = malloc(sizeof(Video) * WARMUP_TITLES);
+    int count = ids && videos ? history_top_videos(WARMUP_HISTORY_DAYS, ids, WARMUP_TITLES) : 0;
+    videos_find(ids, count, videos);
+    char* buffer = malloc(WARMUP_READ_SIZE);
+
+    for (int i = 0; i < count && buffer && budget > 0; i++) {
+        Video* video = &videos[i];
+        if (video->id == 0) continue;
+
+        /* Popular titles are hot from the start, so they don't go to direct I/O */
+        stream_title_seed(video->id);
+
+        long long loaded = warm_title(video, budget, buffer);
+        budget -= loaded;
+
+        pthread_mutex_lock(&g_warmup_mutex);
+        g_warmed_bytes += loaded;
+        g_warmed_titles++;
+        pthread_mutex_unlock(&g_warmup_mutex);
+    }
+
+    free(buffer);
+    free(videos);
+    free(ids);
+
+    pthread_mutex_lock(&g_warmup_mutex);
+    g_warmup_done = 1;
+    int titles = g_warmed_titles;
+    long long bytes = g_warmed_bytes;
+    pthread_mutex_unlock(&g_warmup_mutex);
+
+    log_message(LOG_INFO, "Warmup complete: %d titles, %lld MB in %.1f s", titles,
+                bytes / (1024 * 1024), monotonic_seconds() - started);
+
+#if defined(_WIN32)
+    return 0;
+#else
+    return NULL;
+#endif
+}
+
+/* Start warming popular titles in the background */
+void warmup_start(void) {
+    pthread_mutex_init(&g_warmup_mutex, NULL);
+
+    if (WARMUP_TITLES <= 0 || WARMUP_BUDGET_MB <= 0) {
+        g_warmup_done = 1;
+        return;
+    }
+
+#if defined(_WIN32)
+    HANDLE h = (HANDLE)_beginthreadex(NULL, 0, warmup_worker, NULL, 0, NULL);
+    if (h) CloseHandle(h);
+#else
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, warmup_worker, NULL) == 0) {
+        pthread_detach(thread);
+    }
+#endif
+}
+
+/* Write warmup progress as a JSON object */
+int warmup_stats_json(char* buf, size_t size) {
+    pthread_mutex_lock(&g_warmup_mutex);
+    int written = snprintf(buf, size,
+        "{\"done\":%s,\"titles\":%d,\"bytes\":%lld,\"budget_bytes\":%lld}",
+        g_warmup_done ? "true" : "false", g_warmed_titles, g_warmed_bytes,
+        (long long)WARMUP_BUDGET_MB * 1024 * 1024);
+    pthread_mutex_unlock(&g_warmup_mutex);
+    return written;
+}